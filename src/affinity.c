@@ -0,0 +1,369 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* CPU affinity and scheduling policy for each class of thread.
+ *
+ * The settings are process wide and are set once from the command line.
+ * Threads call affinity_apply() as they start. A class with no settings
+ * is reset to the process defaults, so threads started by a thread of
+ * another class don't inherit its settings.
+ *
+ * Failing to apply a setting, usually because real-time scheduling or a
+ * negative nice value needs privileges the process doesn't have, is
+ * reported once per class and the thread continues with the defaults.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "affinity.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef __linux__
+
+static const char *_class_names[AFFINITY_CLASSES] = {
+	"render",
+	"input",
+	"sink",
+};
+
+typedef struct {
+	
+	/* CPU set, if set_cpus is non-zero */
+	int set_cpus;
+	cpu_set_t cpus;
+	
+	/* Scheduling policy and real-time priority */
+	int policy;
+	int priority;
+	
+	/* Nice level, if set_nice is non-zero */
+	int set_nice;
+	int nice;
+	
+	/* Failures already reported */
+	int warned;
+	
+} _affinity_t;
+
+static _affinity_t _classes[AFFINITY_CLASSES];
+static int _enabled = 0;
+
+/* Process defaults, captured before the first change */
+static cpu_set_t _default_cpus;
+static int _default_nice;
+
+#define _WARN_CPUS  1
+#define _WARN_SCHED 2
+#define _WARN_NICE  4
+
+static void _init(void)
+{
+	int i;
+	
+	if(_enabled)
+	{
+		return;
+	}
+	
+	if(sched_getaffinity(0, sizeof(cpu_set_t), &_default_cpus) != 0)
+	{
+		CPU_ZERO(&_default_cpus);
+	}
+	
+	errno = 0;
+	_default_nice = getpriority(PRIO_PROCESS, 0);
+	if(errno != 0) _default_nice = 0;
+	
+	for(i = 0; i < AFFINITY_CLASSES; i++)
+	{
+		_classes[i].policy = SCHED_OTHER;
+	}
+	
+	_enabled = 1;
+}
+
+/* Split "<class>=<value>", returning the first class and the number of
+ * classes the setting applies to. "all" selects every class */
+static const char *_parse_class(const char *arg, int *c, int *n)
+{
+	const char *v = strchr(arg, '=');
+	size_t l;
+	int i;
+	
+	if(v == NULL)
+	{
+		return(NULL);
+	}
+	
+	l = v - arg;
+	
+	if(l == 3 && strncmp(arg, "all", 3) == 0)
+	{
+		*c = 0;
+		*n = AFFINITY_CLASSES;
+		return(v + 1);
+	}
+	
+	for(i = 0; i < AFFINITY_CLASSES; i++)
+	{
+		if(strlen(_class_names[i]) == l && strncmp(arg, _class_names[i], l) == 0)
+		{
+			*c = i;
+			*n = 1;
+			return(v + 1);
+		}
+	}
+	
+	return(NULL);
+}
+
+int affinity_set_cpus(const char *arg)
+{
+	cpu_set_t cpus;
+	const char *v;
+	char *p;
+	long a, b;
+	int c, n;
+	
+	v = _parse_class(arg, &c, &n);
+	if(v == NULL)
+	{
+		return(-1);
+	}
+	
+	/* Parse a CPU list, such as "0-3,6" */
+	CPU_ZERO(&cpus);
+	
+	for(p = (char *) v; *p; p++)
+	{
+		a = b = strtol(p, &p, 10);
+		
+		if(*p == '-')
+		{
+			b = strtol(p + 1, &p, 10);
+		}
+		
+		if(a < 0 || b < a || b >= CPU_SETSIZE)
+		{
+			return(-1);
+		}
+		
+		for(; a <= b; a++)
+		{
+			CPU_SET(a, &cpus);
+		}
+		
+		if(*p != ',') break;
+	}
+	
+	if(*p != '\0' || CPU_COUNT(&cpus) == 0)
+	{
+		return(-1);
+	}
+	
+	_init();
+	
+	for(; n > 0; n--, c++)
+	{
+		_classes[c].set_cpus = 1;
+		_classes[c].cpus = cpus;
+	}
+	
+	return(0);
+}
+
+int affinity_set_sched(const char *arg)
+{
+	const char *v;
+	char *p;
+	int c, n;
+	int policy, priority = 0;
+	
+	v = _parse_class(arg, &c, &n);
+	if(v == NULL)
+	{
+		return(-1);
+	}
+	
+	if(strncmp(v, "fifo", 4) == 0)
+	{
+		policy = SCHED_FIFO;
+		v += 4;
+	}
+	else if(strncmp(v, "rr", 2) == 0)
+	{
+		policy = SCHED_RR;
+		v += 2;
+	}
+	else if(strncmp(v, "other", 5) == 0)
+	{
+		policy = SCHED_OTHER;
+		v += 5;
+	}
+	else
+	{
+		return(-1);
+	}
+	
+	if(policy != SCHED_OTHER)
+	{
+		/* Default to the lowest real-time priority */
+		priority = sched_get_priority_min(policy);
+		
+		if(*v == ':')
+		{
+			priority = strtol(v + 1, &p, 10);
+			v = p;
+		}
+		
+		if(priority < sched_get_priority_min(policy) ||
+		   priority > sched_get_priority_max(policy))
+		{
+			return(-1);
+		}
+	}
+	
+	if(*v != '\0')
+	{
+		return(-1);
+	}
+	
+	_init();
+	
+	for(; n > 0; n--, c++)
+	{
+		_classes[c].policy = policy;
+		_classes[c].priority = priority;
+	}
+	
+	return(0);
+}
+
+int affinity_set_nice(const char *arg)
+{
+	const char *v;
+	char *p;
+	int c, n;
+	long nice;
+	
+	v = _parse_class(arg, &c, &n);
+	if(v == NULL)
+	{
+		return(-1);
+	}
+	
+	nice = strtol(v, &p, 10);
+	
+	if(p == v || *p != '\0' || nice < -20 || nice > 19)
+	{
+		return(-1);
+	}
+	
+	_init();
+	
+	for(; n > 0; n--, c++)
+	{
+		_classes[c].set_nice = 1;
+		_classes[c].nice = nice;
+	}
+	
+	return(0);
+}
+
+void affinity_apply(affinity_class_t c)
+{
+	_affinity_t *a = &_classes[c];
+	struct sched_param sp;
+	int r;
+	
+	if(!_enabled)
+	{
+		/* Nothing has been configured */
+		return;
+	}
+	
+	r = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), a->set_cpus ? &a->cpus : &_default_cpus);
+	if(r != 0 && !(a->warned & _WARN_CPUS))
+	{
+		fprintf(stderr, "Warning: Unable to set the CPU affinity of %s threads: %s\n", _class_names[c], strerror(r));
+		a->warned |= _WARN_CPUS;
+	}
+	
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = a->policy == SCHED_OTHER ? 0 : a->priority;
+	
+	r = pthread_setschedparam(pthread_self(), a->policy, &sp);
+	if(r != 0 && !(a->warned & _WARN_SCHED))
+	{
+		fprintf(stderr, "Warning: Unable to set the %s scheduling policy for %s threads: %s. Using the default policy.\n",
+			a->policy == SCHED_FIFO ? "FIFO" : (a->policy == SCHED_RR ? "RR" : "default"),
+			_class_names[c], strerror(r)
+		);
+		a->warned |= _WARN_SCHED;
+	}
+	
+	/* On Linux the nice level is a per-thread attribute */
+	r = setpriority(PRIO_PROCESS, syscall(SYS_gettid), a->set_nice ? a->nice : _default_nice);
+	if(r != 0 && !(a->warned & _WARN_NICE))
+	{
+		fprintf(stderr, "Warning: Unable to set the nice level of %s threads: %s\n", _class_names[c], strerror(errno));
+		a->warned |= _WARN_NICE;
+	}
+}
+
+#else
+
+static int _unsupported(void)
+{
+	fprintf(stderr, "Thread affinity and scheduling options are only supported on Linux.\n");
+	return(-1);
+}
+
+int affinity_set_cpus(const char *arg)
+{
+	return(_unsupported());
+}
+
+int affinity_set_sched(const char *arg)
+{
+	return(_unsupported());
+}
+
+int affinity_set_nice(const char *arg)
+{
+	return(_unsupported());
+}
+
+void affinity_apply(affinity_class_t c)
+{
+}
+
+#endif
+
@@ -0,0 +1,36 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _AFFINITY_H
+#define _AFFINITY_H
+
+/* Thread classes. Each thread applies the settings for its class
+ * when it starts */
+typedef enum {
+	AFFINITY_RENDER,	/* The main render loop */
+	AFFINITY_INPUT,		/* ffmpeg input, decoder and scaler threads, file writers, control */
+	AFFINITY_SINK,		/* SDR driver callback threads */
+	AFFINITY_CLASSES,
+} affinity_class_t;
+
+extern int affinity_set_cpus(const char *arg);
+extern int affinity_set_sched(const char *arg);
+extern int affinity_set_nice(const char *arg);
+extern void affinity_apply(affinity_class_t c);
+
+#endif
+
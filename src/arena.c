@@ -0,0 +1,227 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* A simple bump allocator for tables which live as long as the encoder.
+ * Memory is taken from large blocks, optionally backed by huge pages,
+ * and is only released all at once by arena_free(). Allocations are
+ * zeroed and aligned to a cache line.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#else
+#include <malloc.h>
+#endif
+#include "arena.h"
+
+static int _map_block(_arena_block_t *b, size_t size, int hugepages)
+{
+#ifndef WIN32
+	void *p = MAP_FAILED;
+	
+	b->huge = 0;
+	
+#ifdef MAP_HUGETLB
+	if(hugepages)
+	{
+		/* Explicit huge pages, if any have been reserved */
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(p != MAP_FAILED) b->huge = 1;
+	}
+#endif
+	
+	if(p == MAP_FAILED)
+	{
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(p == MAP_FAILED)
+		{
+			return(-1);
+		}
+		
+#ifdef MADV_HUGEPAGE
+		/* Otherwise ask for transparent huge pages */
+		if(hugepages && madvise(p, size, MADV_HUGEPAGE) == 0)
+		{
+			b->huge = 2;
+		}
+#endif
+	}
+	
+	b->data = p;
+#else
+	b->huge = 0;
+	b->data = _aligned_malloc(size, ARENA_ALIGN);
+	if(!b->data)
+	{
+		return(-1);
+	}
+	
+	memset(b->data, 0, size);
+#endif
+	
+	b->size = size;
+	b->used = 0;
+	
+	return(0);
+}
+
+static void _unmap_block(_arena_block_t *b)
+{
+#ifndef WIN32
+	munmap(b->data, b->size);
+#else
+	_aligned_free(b->data);
+#endif
+}
+
+static arena_stat_t *_stat(arena_t *a, const char *name)
+{
+	int i;
+	
+	for(i = 0; i < a->nstats; i++)
+	{
+		if(strcmp(a->stats[i].name, name) == 0)
+		{
+			return(&a->stats[i]);
+		}
+	}
+	
+	if(a->nstats == ARENA_MAX_STATS)
+	{
+		/* Everything else is grouped together */
+		return(&a->stats[ARENA_MAX_STATS - 1]);
+	}
+	
+	a->stats[a->nstats].name = name;
+	
+	return(&a->stats[a->nstats++]);
+}
+
+void arena_init(arena_t *a, int hugepages)
+{
+	memset(a, 0, sizeof(arena_t));
+	a->hugepages = hugepages;
+}
+
+void arena_free(arena_t *a)
+{
+	_arena_block_t *b;
+	
+	while((b = a->blocks) != NULL)
+	{
+		a->blocks = b->next;
+		_unmap_block(b);
+		free(b);
+	}
+	
+	memset(a, 0, sizeof(arena_t));
+}
+
+void *arena_alloc(arena_t *a, const char *name, size_t size)
+{
+	_arena_block_t *b;
+	void *p;
+	
+	size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+	
+	/* Only the newest block is used for new allocations. A
+	 * large allocation gets a block of its own, leaving the
+	 * remainder of the current block for small tables */
+	b = a->blocks;
+	
+	if(b == NULL || b->size - b->used < size)
+	{
+		size_t bsize = (size + ARENA_BLOCK_SIZE - 1) & ~((size_t) ARENA_BLOCK_SIZE - 1);
+		
+		b = malloc(sizeof(_arena_block_t));
+		if(!b)
+		{
+			return(NULL);
+		}
+		
+		if(_map_block(b, bsize, a->hugepages) != 0)
+		{
+			free(b);
+			return(NULL);
+		}
+		
+		if(a->blocks && size >= ARENA_BLOCK_SIZE)
+		{
+			b->next = a->blocks->next;
+			a->blocks->next = b;
+		}
+		else
+		{
+			b->next = a->blocks;
+			a->blocks = b;
+		}
+	}
+	
+	p = b->data + b->used;
+	b->used += size;
+	
+	arena_account(a, name, size);
+	
+	return(p);
+}
+
+void arena_account(arena_t *a, const char *name, size_t size)
+{
+	arena_stat_t *st = _stat(a, name);
+	
+	st->bytes += size;
+	st->allocs++;
+}
+
+void arena_print_stats(arena_t *a, FILE *f)
+{
+	_arena_block_t *b;
+	size_t total = 0, mapped = 0, huge = 0;
+	int i, n = 0;
+	
+	fprintf(f, "Memory usage by subsystem:\n");
+	
+	for(i = 0; i < a->nstats; i++)
+	{
+		fprintf(f, "  %-12s %10.1f KiB  %d allocation%s\n",
+			a->stats[i].name,
+			a->stats[i].bytes / 1024.0,
+			a->stats[i].allocs,
+			a->stats[i].allocs == 1 ? "" : "s"
+		);
+		
+		total += a->stats[i].bytes;
+	}
+	
+	for(b = a->blocks; b; b = b->next, n++)
+	{
+		mapped += b->size;
+		if(b->huge) huge += b->size;
+	}
+	
+	fprintf(f, "  %-12s %10.1f KiB\n", "Total", total / 1024.0);
+	fprintf(f, "Arena: %d block%s, %.1f KiB mapped, %.1f KiB huge page backed\n",
+		n, n == 1 ? "" : "s",
+		mapped / 1024.0,
+		huge / 1024.0
+	);
+}
+
@@ -0,0 +1,68 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* All allocations are aligned to a cache line */
+#define ARENA_ALIGN 64
+
+/* Minimum block size, one 2MB huge page */
+#define ARENA_BLOCK_SIZE (2 * 1024 * 1024)
+
+#define ARENA_MAX_STATS 32
+
+typedef struct _arena_block_t _arena_block_t;
+
+struct _arena_block_t {
+	_arena_block_t *next;
+	uint8_t *data;
+	size_t size;
+	size_t used;
+	int huge;
+};
+
+typedef struct {
+	const char *name;
+	size_t bytes;
+	int allocs;
+} arena_stat_t;
+
+typedef struct {
+	
+	/* Request huge page backed blocks */
+	int hugepages;
+	
+	_arena_block_t *blocks;
+	
+	/* Usage by subsystem */
+	int nstats;
+	arena_stat_t stats[ARENA_MAX_STATS];
+	
+} arena_t;
+
+extern void arena_init(arena_t *a, int hugepages);
+extern void arena_free(arena_t *a);
+extern void *arena_alloc(arena_t *a, const char *name, size_t size);
+extern void arena_account(arena_t *a, const char *name, size_t size);
+extern void arena_print_stats(arena_t *a, FILE *f);
+
+#endif
+
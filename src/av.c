@@ -31,6 +31,29 @@ void av_frame_init(av_frame_t *frame, int width, int height, uint32_t *framebuff
 	};
 }
 
+void av_frame_init_yuv(av_frame_t *frame, int width, int height, uint8_t * const planes[3], const int linesize[3], int shift_x, int shift_y)
+{
+	int i;
+	
+	*frame = (av_frame_t) {
+		.width = width,
+		.height = height,
+		.format = AV_FRAME_YUV,
+		.chroma_shift_x = shift_x,
+		.chroma_shift_y = shift_y,
+		.matrix = AV_MATRIX_BT601,
+		.pixel_aspect_ratio = { 1, 1 },
+		.interlaced = 0,
+	};
+	
+	for(i = 0; i < 3; i++)
+	{
+		frame->planes[i] = planes[i];
+		frame->plane_pixel_stride[i] = 1;
+		frame->plane_line_stride[i] = linesize[i];
+	}
+}
+
 int av_read_video(av_t *s, av_frame_t *frame)
 {
 	int r;
@@ -69,6 +92,13 @@ int av_eof(av_t *s)
 	return(s->eof ? s->eof(s->av_source_ctx) : 0);
 }
 
+int av_seek(av_t *s, double seconds, int relative)
+{
+	/* Seek to a position in seconds, from the start
+	 * of the source or from the current position */
+	return(s->seek ? s->seek(s->av_source_ctx, seconds, relative) : AV_ERROR);
+}
+
 int av_close(av_t *s)
 {
 	int r;
@@ -79,11 +109,62 @@ int av_close(av_t *s)
 	s->read_video = NULL;
 	s->read_audio = NULL;
 	s->eof = NULL;
+	s->seek = NULL;
 	s->close = NULL;
 	
 	return(r);
 }
 
+void av_set_source(av_t *s, void *ctx, av_read_video_t read_video, av_read_audio_t read_audio, av_eof_t eof, av_seek_t seek, av_close_t close)
+{
+	if(s->prefetch)
+	{
+		/* Hold the source until av_next() */
+		s->next = (av_source_t) { ctx, read_video, read_audio, eof, seek, close };
+		return;
+	}
+	
+	s->av_source_ctx = ctx;
+	s->read_video = read_video;
+	s->read_audio = read_audio;
+	s->eof = eof;
+	s->seek = seek;
+	s->close = close;
+}
+
+int av_next(av_t *s)
+{
+	if(s->next.ctx == NULL)
+	{
+		return(AV_ERROR);
+	}
+	
+	/* Close the current source and switch to the next */
+	av_close(s);
+	
+	s->av_source_ctx = s->next.ctx;
+	s->read_video = s->next.read_video;
+	s->read_audio = s->next.read_audio;
+	s->eof = s->next.eof;
+	s->seek = s->next.seek;
+	s->close = s->next.close;
+	
+	s->next = (av_source_t) { NULL };
+	
+	return(AV_OK);
+}
+
+int av_close_next(av_t *s)
+{
+	int r;
+	
+	r = s->next.close ? s->next.close(s->next.ctx) : AV_ERROR;
+	
+	s->next = (av_source_t) { NULL };
+	
+	return(r);
+}
+
 rational_t av_calculate_frame_size(av_t *av, rational_t resolution, rational_t aspect)
 {
 	rational_t r = { av->width, av->height };
@@ -187,21 +268,56 @@ void av_set_display_aspect_ratio(av_frame_t *frame, rational_t display_aspect_ra
 	);
 }
 
+static void _plane_size(av_frame_t *frame, int p, int *width, int *height)
+{
+	/* Dimensions of plane p of a Y'CbCr frame */
+	*width = p > 0 ? frame->width >> frame->chroma_shift_x : frame->width;
+	*height = p > 0 ? frame->height >> frame->chroma_shift_y : frame->height;
+}
+
 void av_hflip_frame(av_frame_t *frame)
 {
+	int p, w, h;
+	
+	if(frame->format == AV_FRAME_YUV)
+	{
+		for(p = 0; p < 3; p++)
+		{
+			_plane_size(frame, p, &w, &h);
+			frame->planes[p] += (w - 1) * frame->plane_pixel_stride[p];
+			frame->plane_pixel_stride[p] = -frame->plane_pixel_stride[p];
+		}
+		
+		return;
+	}
+	
 	frame->framebuffer += (frame->width - 1) * frame->pixel_stride;
 	frame->pixel_stride = -frame->pixel_stride;
 }
 
 void av_vflip_frame(av_frame_t *frame)
 {
+	int p, w, h;
+	
+	if(frame->format == AV_FRAME_YUV)
+	{
+		for(p = 0; p < 3; p++)
+		{
+			_plane_size(frame, p, &w, &h);
+			frame->planes[p] += (h - 1) * frame->plane_line_stride[p];
+			frame->plane_line_stride[p] = -frame->plane_line_stride[p];
+		}
+		
+		return;
+	}
+	
 	frame->framebuffer += (frame->height - 1) * frame->line_stride;
 	frame->line_stride = -frame->line_stride;
 }
 
 void av_rotate_frame(av_frame_t *frame, int a)
 {
-	int i;
+	int i, p, w, h;
 	
 	/* a == degrees / 90 */
 	a = a % 4;
@@ -210,19 +326,42 @@ void av_rotate_frame(av_frame_t *frame, int a)
 	{
 		/* Rotate the frame 90 degrees clockwise */
 		
-		/* Move the origin to the bottom left of the image */
-		frame->framebuffer += (frame->height - 1) * frame->line_stride;
+		if(frame->format == AV_FRAME_YUV)
+		{
+			for(p = 0; p < 3; p++)
+			{
+				_plane_size(frame, p, &w, &h);
+				
+				/* Move the origin to the bottom left of the plane */
+				frame->planes[p] += (h - 1) * frame->plane_line_stride[p];
+				
+				/* Reverse the line and pixel strides */
+				i = frame->plane_pixel_stride[p];
+				frame->plane_pixel_stride[p] = -frame->plane_line_stride[p];
+				frame->plane_line_stride[p] = i;
+			}
+			
+			/* The chroma subsampling rotates with the image */
+			i = frame->chroma_shift_x;
+			frame->chroma_shift_x = frame->chroma_shift_y;
+			frame->chroma_shift_y = i;
+		}
+		else
+		{
+			/* Move the origin to the bottom left of the image */
+			frame->framebuffer += (frame->height - 1) * frame->line_stride;
+			
+			/* Reverse the line and pixel strides */
+			i = frame->pixel_stride;
+			frame->pixel_stride = -frame->line_stride;
+			frame->line_stride = i;
+		}
 		
 		/* Reverse the image dimensions */
 		i = frame->width;
 		frame->width = frame->height;
 		frame->height = i;
 		
-		/* Reverse the line and pixel strides */
-		i = frame->pixel_stride;
-		frame->pixel_stride = -frame->line_stride;
-		frame->line_stride = i;
-		
 		/* Reverse the pixel aspect ratio (r = 1 / r) */
 		frame->pixel_aspect_ratio = (rational_t) {
 			frame->pixel_aspect_ratio.den,
@@ -245,7 +384,22 @@ void av_crop_frame(av_frame_t *frame, int x, int y, int width, int height)
 	if(x + width > frame->width) width = frame->width - x;
 	if(y + height > frame->height) height = frame->height - y;
 	
-	frame->framebuffer += y * frame->line_stride + x * frame->pixel_stride;
+	if(frame->format == AV_FRAME_YUV)
+	{
+		int p, sx, sy;
+		
+		for(p = 0; p < 3; p++)
+		{
+			sx = p > 0 ? frame->chroma_shift_x : 0;
+			sy = p > 0 ? frame->chroma_shift_y : 0;
+			frame->planes[p] += (y >> sy) * frame->plane_line_stride[p] + (x >> sx) * frame->plane_pixel_stride[p];
+		}
+	}
+	else
+	{
+		frame->framebuffer += y * frame->line_stride + x * frame->pixel_stride;
+	}
+	
 	frame->width = width;
 	frame->height = height;
 }
@@ -26,30 +26,71 @@
 #define AV_ERROR         -1
 #define AV_OUT_OF_MEMORY -2
 
+/* Frame formats */
+typedef enum {
+	AV_FRAME_RGB32,
+	AV_FRAME_YUV,
+} av_frame_format_t;
+
+/* Y'CbCr colour matrices */
+typedef enum {
+	AV_MATRIX_BT601,
+	AV_MATRIX_BT709,
+	AV_MATRIX_BT2020,
+} av_matrix_t;
+
 typedef struct {
 	
 	/* Dimensions */
 	int width;
 	int height;
 	
+	/* Format of the image data */
+	av_frame_format_t format;
+	
 	/* 32-bit RGBx framebuffer */
 	uint32_t *framebuffer;
 	int pixel_stride;
 	int line_stride;
 	
+	/* 8-bit planar Y'CbCr, for AV_FRAME_YUV. The Cb and Cr
+	 * planes are subsampled by 1 << chroma_shift_x/y */
+	uint8_t *planes[3];
+	int plane_pixel_stride[3];
+	int plane_line_stride[3];
+	int chroma_shift_x;
+	int chroma_shift_y;
+	av_matrix_t matrix;
+	int full_range;
+	
 	/* The pixel aspect ratio */
 	rational_t pixel_aspect_ratio;
 	
 	/* Interlace flag */
 	int interlaced;
 	
+	/* Set by the source when the image is the same as
+	 * the last frame it returned */
+	int unchanged;
+	
 } av_frame_t;
 
 typedef int (*av_read_video_t)(void *ctx, av_frame_t *frame);
 typedef int16_t *(*av_read_audio_t)(void *ctx, size_t *samples);
 typedef int (*av_eof_t)(void *ctx);
+typedef int (*av_seek_t)(void *ctx, double seconds, int relative);
 typedef int (*av_close_t)(void *ctx);
 
+/* A source context and its callbacks */
+typedef struct {
+	void *ctx;
+	av_read_video_t read_video;
+	av_read_audio_t read_audio;
+	av_eof_t eof;
+	av_seek_t seek;
+	av_close_t close;
+} av_source_t;
+
 /* Frame fit/crop modes */
 typedef enum {
 	AV_FIT_STRETCH,
@@ -59,8 +100,6 @@ typedef enum {
 } av_fit_mode_t;
 
 typedef struct {
-	/* Source interfaces */
-	void *av_font;
 	
 	/* Video settings */
 	int width;
@@ -75,6 +114,30 @@ typedef struct {
 	/* Video state */
 	unsigned int frames;
 	
+	/* Set while playback is paused. Sources that can pause
+	 * hold their current frame and return no audio */
+	int paused;
+	
+	/* Skip burning in the timestamp, logo and subtitles. Written
+	 * by the render thread and read by the source's threads, so
+	 * it is only accessed with __atomic builtins */
+	int skip_overlays;
+	
+	/* The source may return AV_FRAME_YUV frames */
+	int yuv;
+	
+	/* Frames the source repeated, and times it had no frame
+	 * ready when asked, if it keeps count */
+	unsigned int video_repeated;
+	unsigned int video_starved;
+	unsigned int audio_starved;
+	
+	/* Total and longest time from the source reading each new video
+	 * frame to returning it, and the frames timed, if it measures them */
+	uint64_t latency_ns;
+	uint64_t latency_max_ns;
+	unsigned int latency_frames;
+	
 	/* Audio settings */
 	rational_t sample_rate;
 	
@@ -86,17 +149,29 @@ typedef struct {
 	av_read_video_t read_video;
 	av_read_audio_t read_audio;
 	av_eof_t eof;
+	av_seek_t seek;
 	av_close_t close;
 	
+	/* Set while the next source is opened ahead of time. It's
+	 * held in next until av_next() switches over to it */
+	int prefetch;
+	av_source_t next;
+	
 } av_t;
 
 extern void av_frame_init(av_frame_t *frame, int width, int height, uint32_t *framebuffer, int pstride, int lstride);
+extern void av_frame_init_yuv(av_frame_t *frame, int width, int height, uint8_t * const planes[3], const int linesize[3], int shift_x, int shift_y);
 
 extern int av_read_video(av_t *s, av_frame_t *frame);
 extern int16_t *av_read_audio(av_t *s, size_t *samples);
 extern int av_eof(av_t *s);
+extern int av_seek(av_t *s, double seconds, int relative);
 extern int av_close(av_t *s);
 
+extern void av_set_source(av_t *s, void *ctx, av_read_video_t read_video, av_read_audio_t read_audio, av_eof_t eof, av_seek_t seek, av_close_t close);
+extern int av_next(av_t *s);
+extern int av_close_next(av_t *s);
+
 extern rational_t av_display_aspect_ratio(av_frame_t *frame);
 extern void av_set_display_aspect_ratio(av_frame_t *frame, rational_t display_aspect_ratio);
 
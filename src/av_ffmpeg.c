@@ -42,6 +42,12 @@
 #endif
 #include <pthread.h>
 #include <ctype.h>
+#include <limits.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavdevice/avdevice.h>
@@ -50,57 +56,127 @@
 #include <libavutil/opt.h>
 #include <libavutil/time.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <libavfilter/avfilter.h>
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include <libavutil/cpu.h>
 #include "hacktv.h"
-#include "keyboard.h"
-#ifdef WIN32
-#include <conio.h>
-#endif
+#include "affinity.h"
+#include "pool.h"
 
 /* Maximum length of the packet queue */
 /* Taken from ffplay.c */
 #define MAX_QUEUE_SIZE (15 * 1024 * 1024)
-#define AVSEEK_FWD 60
-#define AVSEEK_RWD -60
-#define AVSEEK_SEEKING 1
 
-typedef struct __packet_queue_item_t {
+/* Packets each queue can hold, a power of two */
+#define _PACKET_QUEUE_SLOTS 2048
+
+/* Seeks that can be in flight, a power of two */
+#define _SEEK_SERIALS 4
+
+/* Most slices a video frame is scaled in */
+#define _SCALE_SLICES_MAX 16
+
+/* Default number of frames in each ring between the threads */
+#define _FRAME_RING_SIZE 4
+
+/* Packet queue size and longest audio frame with --low-latency */
+#define _LOW_LATENCY_QUEUE_SIZE (1024 * 1024)
+#define _LOW_LATENCY_AUDIO_MS 10
+
+/* Video packet arrival times kept for measuring latency, a power of two */
+#define _ARRIVALS 64
+
+/* Something a thread can wait for. Waiting threads sleep on the
+ * sequence number, which is bumped to wake them */
+typedef struct {
 	
-	AVPacket pkt;
-	struct __packet_queue_item_t *next;
+	unsigned int seq;
+	int waiters;
+	
+#ifndef __linux__
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
 	
-} _packet_queue_item_t;
+} _event_t;
+
+/* A queued packet and the serial number of the seek it follows */
+typedef struct {
+	AVPacket pkt;
+	int serial;
+} _packet_t;
 
+/* A packet queue with one writer (the input thread) and one reader
+ * (a decoder thread). The writer only moves the tail and the reader
+ * only moves the head, so neither takes a lock */
 typedef struct {
 	
-	int length;	/* Number of packets */
+	_packet_t *pkts;	/* Ring of packets */
+	unsigned int head;	/* Next packet to read */
+	unsigned int tail;	/* Next free slot */
+	
 	int size;       /* Number of bytes used */
 	int eof;        /* End of stream / file flag */
 	int abort;      /* Abort flag */
 	
-	/* Pointers to the first and last packets in the queue */
-	_packet_queue_item_t *first;
-	_packet_queue_item_t *last;
+	/* Signalled when a packet is added or the queue aborted */
+	_event_t readable;
 	
 } _packet_queue_t;
 
+/* A ring of frames passed from one thread to the next. The consumer
+ * holds on to the frame it last took until it takes the next one, the
+ * producer can fill the others before it has to wait */
 typedef struct {
 	
-	int ready;	/* Frame ready flag */
-	int repeat;	/* Repeat the previous frame */
+	int size;	/* Number of frames in the ring */
+	int head;	/* The frame held by the consumer */
+	int count;	/* Frames ready after the head */
+	int started;	/* The consumer has taken a frame */
+	int eof;	/* The producer has finished */
 	int abort;	/* Abort flag */
 	
-	/* The AVFrame buffers */
-	AVFrame *frame[2];
+	/* The AVFrame buffers, and the number of extra
+	 * times each is to be returned to the consumer */
+	AVFrame **frame;
+	int *repeat;
+	
+	/* The serial number of the seek each frame follows */
+	int *serial;
+	
+	/* Counters for frames returned again and times the consumer
+	 * had to wait for a frame, or NULL. Updated by the consumer */
+	unsigned int *repeated;
+	unsigned int *starved;
 	
 	/* Thread locking and signaling */
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	
-} _frame_dbuffer_t;
+} _frame_ring_t;
+
+/* A keyframe in the video stream */
+typedef struct {
+	int64_t ts;	/* Timestamp, in the stream time base */
+	int next;	/* The next entry is the next keyframe in the stream */
+} _keyframe_t;
+
+/* The keyframes seen so far, sorted by timestamp. Loaded from the
+ * demuxer's own index if it has one, and added to while reading */
+typedef struct {
+	_keyframe_t *keys;
+	int count;
+	int size;
+	int64_t last;	/* The last keyframe read, AV_NOPTS_VALUE after a seek */
+} _keyframe_index_t;
+
+/* When a video packet was read from the input */
+typedef struct {
+	int64_t pts;
+	uint64_t ns;
+} _arrival_t;
 
 typedef struct {
 	
@@ -109,7 +185,6 @@ typedef struct {
 	int height;
 	int sample_rate;
 	uint32_t *video;
-	uint8_t paused;
 	time_t last_paused;
 	av_t *av;
 	
@@ -121,12 +196,13 @@ typedef struct {
 	_packet_queue_t video_queue;
 	AVStream *video_stream;
 	AVCodecContext *video_codec_ctx;
-	_frame_dbuffer_t in_video_buffer;
+	_frame_ring_t in_video_buffer;
 	int video_eof;
 	
-	/* Video scaling */
-	struct SwsContext *sws_ctx;
-	_frame_dbuffer_t out_video_buffer;
+	/* Video scaling, one context per slice */
+	struct SwsContext *sws_ctx[_SCALE_SLICES_MAX];
+	int scale_slices;
+	_frame_ring_t out_video_buffer;
 	
 	/* Audio decoder */
 	AVRational audio_time_base;
@@ -134,12 +210,12 @@ typedef struct {
 	_packet_queue_t audio_queue;
 	AVStream *audio_stream;
 	AVCodecContext *audio_codec_ctx;
-	_frame_dbuffer_t in_audio_buffer;
+	_frame_ring_t in_audio_buffer;
 	int audio_eof;
 	
 	/* Audio resampler */
 	struct SwrContext *swr_ctx;
-	_frame_dbuffer_t out_audio_buffer;
+	_frame_ring_t out_audio_buffer;
 	int out_frame_size;
 	int allowed_error;
 	
@@ -155,11 +231,33 @@ typedef struct {
 	pthread_t audio_decode_thread;
 	pthread_t audio_scaler_thread;
 	volatile int thread_abort;
-	int input_stall;
 	
-	/* Thread locking and signaling for input queues */
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
+	/* Signalled when the input thread may be able to write again */
+	_event_t writable;
+	
+	/* Seeking. The input thread bumps the serial number each time
+	 * it seeks, and the threads after it drop anything older */
+	_keyframe_index_t keyframes;
+	int serial;
+	int seek_request;
+	int64_t seek_target;
+	int seek_wait_key;
+	int input_eof;
+	
+	/* The timestamp each seek landed on, by serial number,
+	 * and the timestamp of the frame on display */
+	int64_t seek_pts[_SEEK_SERIALS];
+	int64_t position;
+	
+	/* Packet queue limit, in bytes */
+	size_t queue_size;
+	
+	/* Latency measurement. The input thread notes when each video
+	 * packet arrived, which is looked up as its frame is displayed */
+	int measure_latency;
+	_arrival_t arrivals[_ARRIVALS];
+	unsigned int arrival_next;
+	int64_t latency_pts;
 	
 	/* Video filter buffers */
 	AVFilterContext *vbuffersink_ctx;
@@ -170,8 +268,9 @@ typedef struct {
 	AVFilterContext *abuffersrc_ctx;
 	AVRational sar, dar;
 
-	/* Callbacks */
-	vid_config_t *vid_conf;
+	/* A copy of the settings this source was opened with,
+	 * it may have been opened ahead on another thread */
+	vid_config_t conf;
 	tt_t *vid_tt;
 
 	/* Subtitles */
@@ -213,256 +312,435 @@ void _audio_offset(uint8_t const **dst, uint8_t const * const *src, int offset,
 	}
 }
 
-static int _packet_queue_init(av_ffmpeg_t *s, _packet_queue_t *q)
+static void _event_init(_event_t *e)
 {
-	q->length = 0;
-	q->size = 0;
-	q->eof = 0;
-	q->abort = 0;
+	e->seq = 0;
+	e->waiters = 0;
 	
-	return(0);
+#ifndef __linux__
+	pthread_mutex_init(&e->mutex, NULL);
+	pthread_cond_init(&e->cond, NULL);
+#endif
+}
+
+static void _event_free(_event_t *e)
+{
+#ifndef __linux__
+	pthread_cond_destroy(&e->cond);
+	pthread_mutex_destroy(&e->mutex);
+#endif
+}
+
+/* To wait, call _event_prepare(), check the condition again and
+ * then either _event_wait() or _event_cancel(). A signal between
+ * the prepare and the wait isn't lost */
+static unsigned int _event_prepare(_event_t *e)
+{
+	__atomic_add_fetch(&e->waiters, 1, __ATOMIC_SEQ_CST);
+	return(__atomic_load_n(&e->seq, __ATOMIC_SEQ_CST));
 }
 
-static int _packet_queue_flush(av_ffmpeg_t *s, _packet_queue_t *q)
+static void _event_cancel(_event_t *e)
 {
-	_packet_queue_item_t *p;
+	__atomic_sub_fetch(&e->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+static void _event_wait(_event_t *e, unsigned int seq)
+{
+#ifdef __linux__
+	/* Sleeps only if seq hasn't changed */
+	syscall(SYS_futex, &e->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&e->mutex);
 	
-	pthread_mutex_lock(&s->mutex);
+	while(__atomic_load_n(&e->seq, __ATOMIC_SEQ_CST) == seq)
+	{
+		pthread_cond_wait(&e->cond, &e->mutex);
+	}
 	
-	while(q->length--)
+	pthread_mutex_unlock(&e->mutex);
+#endif
+	
+	_event_cancel(e);
+}
+
+static void _event_signal(_event_t *e)
+{
+	/* Nothing to do unless someone is waiting */
+	if(__atomic_load_n(&e->waiters, __ATOMIC_SEQ_CST) == 0)
 	{
-		/* Pop the first item off the list */
-		p = q->first;
-		q->first = p->next;
-		
-		av_packet_unref(&p->pkt);
-		free(p);
+		return;
+	}
+	
+#ifdef __linux__
+	__atomic_add_fetch(&e->seq, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, &e->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&e->mutex);
+	__atomic_add_fetch(&e->seq, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->mutex);
+#endif
+}
+
+static int _packet_queue_init(av_ffmpeg_t *s, _packet_queue_t *q)
+{
+	q->pkts = calloc(_PACKET_QUEUE_SLOTS, sizeof(_packet_t));
+	if(!q->pkts)
+	{
+		return(-1);
 	}
 	
-	pthread_cond_signal(&s->cond);
-	pthread_mutex_unlock(&s->mutex);
+	q->head = 0;
+	q->tail = 0;
+	q->size = 0;
+	q->eof = 0;
+	q->abort = 0;
+	
+	_event_init(&q->readable);
 	
 	return(0);
 }
 
 static void _packet_queue_free(av_ffmpeg_t *s, _packet_queue_t *q)
 {
-	_packet_queue_flush(s, q);
+	/* The reader and writer must have stopped */
+	for(; q->head != q->tail; q->head++)
+	{
+		av_packet_unref(&q->pkts[q->head % _PACKET_QUEUE_SLOTS].pkt);
+	}
+	
+	_event_free(&q->readable);
+	free(q->pkts);
 }
 
 static void _packet_queue_abort(av_ffmpeg_t *s, _packet_queue_t *q)
 {
-	pthread_mutex_lock(&s->mutex);
+	__atomic_store_n(&q->abort, 1, __ATOMIC_SEQ_CST);
 	
-	q->abort = 1;
+	_event_signal(&q->readable);
+	_event_signal(&s->writable);
+}
+
+static int _packet_queue_room(av_ffmpeg_t *s, _packet_queue_t *q, AVPacket *pkt)
+{
+	_packet_queue_t *other = (q == &s->video_queue ? &s->audio_queue : &s->video_queue);
+	
+	if(q->tail - __atomic_load_n(&q->head, __ATOMIC_SEQ_CST) >= _PACKET_QUEUE_SLOTS)
+	{
+		/* Every slot is in use */
+		return(0);
+	}
 	
-	pthread_cond_signal(&s->cond);
-	pthread_mutex_unlock(&s->mutex);
+	if(__atomic_load_n(&q->size, __ATOMIC_SEQ_CST) + pkt->size + sizeof(AVPacket) <= s->queue_size)
+	{
+		return(1);
+	}
+	
+	/* The queue is full, but if the other queue has run dry its
+	 * decoder can't move on until this one is allowed to grow */
+	return(__atomic_load_n(&other->readable.waiters, __ATOMIC_SEQ_CST) > 0);
 }
 
 static int _packet_queue_write(av_ffmpeg_t *s, _packet_queue_t *q, AVPacket *pkt)
 {
-	_packet_queue_item_t *p;
-	
-	pthread_mutex_lock(&s->mutex);
+	unsigned int seq;
 	
 	/* A NULL packet signals the end of the stream / file */
 	if(pkt == NULL)
 	{
-		q->eof = 1;
+		__atomic_store_n(&q->eof, 1, __ATOMIC_SEQ_CST);
+		_event_signal(&q->readable);
+		return(0);
 	}
-	else
+	
+	/* Limit the size of the queue */
+	for(;;)
 	{
-		/* Limit the size of the queue */
-		while(q->abort == 0 && q->size + pkt->size + sizeof(_packet_queue_item_t) > MAX_QUEUE_SIZE)
-		{
-			s->input_stall = 1;
-			pthread_cond_signal(&s->cond);
-			pthread_cond_wait(&s->cond, &s->mutex);
-		}
-		
-		s->input_stall = 0;
-		
-		if(q->abort == 1)
+		if(__atomic_load_n(&q->abort, __ATOMIC_SEQ_CST))
 		{
 			/* Abort was called while waiting for the queue size to drop */
 			av_packet_unref(pkt);
-			
-			pthread_cond_signal(&s->cond);
-			pthread_mutex_unlock(&s->mutex);
-			
 			return(-2);
 		}
 		
-		/* Allocate memory for queue item and copy packet */
-		p = malloc(sizeof(_packet_queue_item_t));
-		p->pkt = *pkt;
-		p->next = NULL;
+		if(__atomic_load_n(&s->seek_request, __ATOMIC_SEQ_CST))
+		{
+			/* A seek is waiting, the packet won't be needed */
+			av_packet_unref(pkt);
+			return(-3);
+		}
 		
-		/* Add the item to the end of the queue */
-		if(q->length == 0)
+		if(_packet_queue_room(s, q, pkt))
 		{
-			q->first = p;
+			break;
 		}
-		else
+		
+		seq = _event_prepare(&s->writable);
+		
+		if(__atomic_load_n(&q->abort, __ATOMIC_SEQ_CST) ||
+		   __atomic_load_n(&s->seek_request, __ATOMIC_SEQ_CST) ||
+		   _packet_queue_room(s, q, pkt))
 		{
-			q->last->next = p;
+			_event_cancel(&s->writable);
+			continue;
 		}
 		
-		q->last = p;
-		q->length++;
-		q->size += pkt->size + sizeof(_packet_queue_item_t);
+		_event_wait(&s->writable, seq);
 	}
 	
-	pthread_cond_signal(&s->cond);
-	pthread_mutex_unlock(&s->mutex);
+	/* Copy the packet into the ring and make it visible to the reader */
+	q->pkts[q->tail % _PACKET_QUEUE_SLOTS].pkt = *pkt;
+	q->pkts[q->tail % _PACKET_QUEUE_SLOTS].serial = s->serial;
+	__atomic_add_fetch(&q->size, pkt->size + sizeof(AVPacket), __ATOMIC_SEQ_CST);
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_SEQ_CST);
+	
+	_event_signal(&q->readable);
 	
 	return(0);
 }
 
-static int _packet_queue_read(av_ffmpeg_t *s, _packet_queue_t *q, AVPacket *pkt)
+static int _packet_queue_ready(_packet_queue_t *q)
 {
-	_packet_queue_item_t *p;
+	/* Returns 1 if a packet is waiting, -1 at the end
+	 * of the stream, -2 if aborted, or 0 otherwise */
+	if(__atomic_load_n(&q->abort, __ATOMIC_SEQ_CST))
+	{
+		return(-2);
+	}
 	
-	pthread_mutex_lock(&s->mutex);
+	if(q->head != __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST))
+	{
+		return(1);
+	}
 	
-	while(q->length == 0)
+	/* The tail is final once the EOF flag is set */
+	if(__atomic_load_n(&q->eof, __ATOMIC_SEQ_CST))
 	{
-		if(s->input_stall)
-		{
-			pthread_mutex_unlock(&s->mutex);
-			return(0);
-		}
+		return(q->head != __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST) ? 1 : -1);
+	}
+	
+	return(0);
+}
+
+static int _packet_queue_read(av_ffmpeg_t *s, _packet_queue_t *q, AVPacket *pkt, int *serial)
+{
+	unsigned int seq;
+	int r;
+	
+	while((r = _packet_queue_ready(q)) == 0)
+	{
+		seq = _event_prepare(&q->readable);
 		
-		if(q->abort == 1 || q->eof == 1)
+		if(_packet_queue_ready(q) != 0)
 		{
-			pthread_mutex_unlock(&s->mutex);
-			return(q->abort == 1 ? -2 : -1);
+			_event_cancel(&q->readable);
+			continue;
 		}
 		
-		pthread_cond_wait(&s->cond, &s->mutex);
+		/* Let the input thread know this queue has run dry,
+		 * in case it's waiting on the other one */
+		_event_signal(&s->writable);
+		_event_wait(&q->readable, seq);
 	}
 	
-	p = q->first;
-	
-	*pkt = p->pkt;
-	q->first = p->next;
-	q->length--;
-	q->size -= pkt->size + sizeof(_packet_queue_item_t);
+	if(r < 0)
+	{
+		return(r);
+	}
 	
-	free(p);
+	*pkt = q->pkts[q->head % _PACKET_QUEUE_SLOTS].pkt;
+	*serial = q->pkts[q->head % _PACKET_QUEUE_SLOTS].serial;
+	__atomic_sub_fetch(&q->size, pkt->size + sizeof(AVPacket), __ATOMIC_SEQ_CST);
+	__atomic_store_n(&q->head, q->head + 1, __ATOMIC_SEQ_CST);
 	
-	pthread_cond_signal(&s->cond);
-	pthread_mutex_unlock(&s->mutex);
+	_event_signal(&s->writable);
 	
 	return(0);
 }
 
-static int _frame_dbuffer_init(_frame_dbuffer_t *d)
+static int _frame_ring_init(_frame_ring_t *d, int size, unsigned int *repeated, unsigned int *starved)
 {
-	d->ready = 0;
-	d->repeat = 0;
+	int i;
+	
+	d->size = size;
+	d->head = size - 1;
+	d->count = 0;
+	d->started = 0;
+	d->eof = 0;
 	d->abort = 0;
+	d->repeated = repeated;
+	d->starved = starved;
 	
-	d->frame[0] = av_frame_alloc();
-	d->frame[1] = av_frame_alloc();
+	d->frame = calloc(size, sizeof(AVFrame *));
+	d->repeat = calloc(size, sizeof(int));
+	d->serial = calloc(size, sizeof(int));
 	
-	if(!d->frame[0] || !d->frame[1])
+	if(!d->frame || !d->repeat || !d->serial)
 	{
-		av_frame_free(&d->frame[0]);
-		av_frame_free(&d->frame[1]);
+		free(d->frame);
+		free(d->repeat);
+		free(d->serial);
 		return(-1);
 	}
 	
+	for(i = 0; i < size; i++)
+	{
+		d->frame[i] = av_frame_alloc();
+		
+		if(!d->frame[i])
+		{
+			while(i--) av_frame_free(&d->frame[i]);
+			free(d->frame);
+			free(d->repeat);
+			free(d->serial);
+			return(-1);
+		}
+	}
+	
 	pthread_mutex_init(&d->mutex, NULL);
 	pthread_cond_init(&d->cond, NULL);
 	
 	return(0);
 }
 
-static void _frame_dbuffer_free(_frame_dbuffer_t *d)
+static void _frame_ring_free(_frame_ring_t *d)
 {
+	int i;
+	
 	pthread_cond_destroy(&d->cond);
 	pthread_mutex_destroy(&d->mutex);
 	
-	av_frame_free(&d->frame[0]);
-	av_frame_free(&d->frame[1]);
+	for(i = 0; i < d->size; i++)
+	{
+		av_frame_free(&d->frame[i]);
+	}
+	
+	free(d->frame);
+	free(d->repeat);
+	free(d->serial);
 }
 
-static void _frame_dbuffer_abort(_frame_dbuffer_t *d)
+static void _frame_ring_abort(_frame_ring_t *d)
 {
 	pthread_mutex_lock(&d->mutex);
 	
 	d->abort = 1;
 	
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+static void _frame_ring_eof(_frame_ring_t *d)
+{
+	pthread_mutex_lock(&d->mutex);
+	
+	/* The consumer takes any frames left before seeing the end */
+	d->eof = 1;
+	
 	pthread_cond_signal(&d->cond);
 	pthread_mutex_unlock(&d->mutex);
 }
 
-static AVFrame *_frame_dbuffer_back_buffer(_frame_dbuffer_t *d)
+static AVFrame *_frame_ring_back_buffer(_frame_ring_t *d)
 {
-	AVFrame *frame;
+	AVFrame *frame = NULL;
+	
 	pthread_mutex_lock(&d->mutex);
 	
-	/* Wait for the ready flag to be unset */
-	while(d->ready != 0 && d->abort == 0)
+	/* Wait for a free frame */
+	while(d->count >= d->size - 1 && d->abort == 0)
 	{
 		pthread_cond_wait(&d->cond, &d->mutex);
 	}
 	
-	frame = d->frame[1];
+	/* Return NULL if aborted, the frames may still be in use */
+	if(d->abort == 0)
+	{
+		frame = d->frame[(d->head + d->count + 1) % d->size];
+	}
 	
 	pthread_mutex_unlock(&d->mutex);
 	
 	return(frame);
 }
 
-static void _frame_dbuffer_ready(_frame_dbuffer_t *d, int repeat)
+static void _frame_ring_ready(_frame_ring_t *d, int serial)
 {
 	pthread_mutex_lock(&d->mutex);
 	
-	/* Wait for the ready flag to be unset */
-	while(d->ready != 0 && d->abort == 0)
+	/* Wait for a free frame */
+	while(d->count >= d->size - 1 && d->abort == 0)
 	{
 		pthread_cond_wait(&d->cond, &d->mutex);
 	}
 	
-	d->ready = 1;
-	d->repeat = repeat;
+	if(d->abort == 0)
+	{
+		d->count++;
+		d->repeat[(d->head + d->count) % d->size] = 0;
+		d->serial[(d->head + d->count) % d->size] = serial;
+	}
+	
+	pthread_cond_signal(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+static void _frame_ring_repeat(_frame_ring_t *d, int n)
+{
+	pthread_mutex_lock(&d->mutex);
+	
+	/* Repeat the last frame made ready, which is
+	 * the head if the consumer has caught up */
+	d->repeat[(d->head + d->count) % d->size] += n;
 	
 	pthread_cond_signal(&d->cond);
 	pthread_mutex_unlock(&d->mutex);
 }
 
-static AVFrame *_frame_dbuffer_flip(_frame_dbuffer_t *d)
+static AVFrame *_frame_ring_flip(_frame_ring_t *d)
 {
 	AVFrame *frame;
 	
 	pthread_mutex_lock(&d->mutex);
 	
-	/* Wait for a flag to be set */
-	while(d->ready == 0 && d->abort == 0)
+	if(d->started && d->starved &&
+	   d->count == 0 && d->repeat[d->head] == 0 &&
+	   d->eof == 0 && d->abort == 0)
+	{
+		/* The producer has fallen behind */
+		(*d->starved)++;
+	}
+	
+	/* Wait for a frame */
+	while(d->count == 0 && d->repeat[d->head] == 0 &&
+	      d->eof == 0 && d->abort == 0)
 	{
 		pthread_cond_wait(&d->cond, &d->mutex);
 	}
 	
-	/* Die if it was the abort flag */
-	if(d->abort != 0)
+	/* Die if it was the abort flag, or the end with no frames left */
+	if(d->abort != 0 || (d->count == 0 && d->repeat[d->head] == 0))
 	{
 		pthread_mutex_unlock(&d->mutex);
 		return(NULL);
 	}
 	
-	/* Swap the frames if we're not repeating */
-	if(d->repeat == 0)
+	if(d->repeat[d->head] > 0)
+	{
+		/* Return the head again */
+		d->repeat[d->head]--;
+		if(d->repeated) (*d->repeated)++;
+	}
+	else
 	{
-		frame       = d->frame[1];
-		d->frame[1] = d->frame[0];
-		d->frame[0] = frame;
+		/* Move on to the next frame, freeing the old head */
+		d->head = (d->head + 1) % d->size;
+		d->count--;
 	}
 	
-	frame = d->frame[0];
-	d->ready = 0;
+	d->started = 1;
+	frame = d->frame[d->head];
 	
 	/* Signal we're finished and release the mutex */
 	pthread_cond_signal(&d->cond);
@@ -471,17 +749,192 @@ static AVFrame *_frame_dbuffer_flip(_frame_dbuffer_t *d)
 	return(frame);
 }
 
+static AVFrame *_frame_ring_current(_frame_ring_t *d)
+{
+	/* The frame held by the consumer, or NULL if it hasn't
+	 * taken one yet. Only call from the consumer */
+	return(d->started ? d->frame[d->head] : NULL);
+}
+
+static int _frame_ring_serial(_frame_ring_t *d)
+{
+	/* The serial number of the frame held by the consumer */
+	return(d->serial[d->head]);
+}
+
+static int _frame_ring_poll(_frame_ring_t *d)
+{
+	int r;
+	
+	/* Returns non-zero if _frame_ring_flip() won't have to wait */
+	pthread_mutex_lock(&d->mutex);
+	r = d->count > 0 || d->repeat[d->head] > 0 || d->eof || d->abort;
+	pthread_mutex_unlock(&d->mutex);
+	
+	return(r);
+}
+
+static void _keyframe_index_free(_keyframe_index_t *x)
+{
+	free(x->keys);
+	x->keys = NULL;
+	x->count = 0;
+	x->size = 0;
+}
+
+static int _keyframe_index_find(_keyframe_index_t *x, int64_t ts)
+{
+	int a = 0, b = x->count, m;
+	
+	/* Find the last keyframe at or before ts, or -1 if there isn't one */
+	while(a < b)
+	{
+		m = (a + b) / 2;
+		
+		if(x->keys[m].ts <= ts) a = m + 1;
+		else b = m;
+	}
+	
+	return(a - 1);
+}
+
+static int _keyframe_index_add(_keyframe_index_t *x, int64_t ts)
+{
+	_keyframe_t *keys;
+	int i;
+	
+	i = _keyframe_index_find(x, ts);
+	
+	if(i < 0 || x->keys[i].ts != ts)
+	{
+		if(x->count == x->size)
+		{
+			keys = realloc(x->keys, sizeof(_keyframe_t) * (x->size ? x->size * 2 : 256));
+			if(!keys)
+			{
+				return(-1);
+			}
+			
+			x->keys = keys;
+			x->size = x->size ? x->size * 2 : 256;
+		}
+		
+		/* Insert it after the last keyframe before it, which
+		 * can no longer be linked to the one that followed */
+		i++;
+		memmove(&x->keys[i + 1], &x->keys[i], sizeof(_keyframe_t) * (x->count - i));
+		x->keys[i].ts = ts;
+		x->keys[i].next = 0;
+		x->count++;
+		
+		if(i > 0) x->keys[i - 1].next = 0;
+	}
+	
+	/* Link it to the keyframe read before it, unless there was a seek
+	 * in between. Keyframes could have been skipped over */
+	if(i > 0 && x->keys[i - 1].ts == x->last)
+	{
+		x->keys[i - 1].next = 1;
+	}
+	
+	x->last = ts;
+	
+	return(0);
+}
+
+static void _keyframe_index_load(_keyframe_index_t *x, AVStream *st)
+{
+	x->last = AV_NOPTS_VALUE;
+	
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+	const AVIndexEntry *e;
+	int i, n;
+	
+	/* Start with the keyframes the demuxer already knows about. Its
+	 * index is taken to be complete, so each is linked to the next */
+	n = avformat_index_get_entries_count(st);
+	
+	for(i = 0; i < n; i++)
+	{
+		e = avformat_index_get_entry(st, i);
+		
+		if(e != NULL && (e->flags & AVINDEX_KEYFRAME))
+		{
+			if(_keyframe_index_add(x, e->timestamp) != 0) break;
+		}
+	}
+	
+	x->last = AV_NOPTS_VALUE;
+#endif
+}
+
+static void _arrival_add(av_ffmpeg_t *s, int64_t pts)
+{
+	_arrival_t *a = &s->arrivals[s->arrival_next++ & (_ARRIVALS - 1)];
+	
+	/* Invalidate the slot while it's rewritten */
+	__atomic_store_n(&a->pts, AV_NOPTS_VALUE, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&a->ns, monotonic_ns(), __ATOMIC_SEQ_CST);
+	__atomic_store_n(&a->pts, pts, __ATOMIC_SEQ_CST);
+}
+
+static void _input_seek(av_ffmpeg_t *s)
+{
+	int64_t target, ts;
+	int i, r = -1;
+	
+	target = __atomic_load_n(&s->seek_target, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&s->seek_request, 0, __ATOMIC_SEQ_CST);
+	
+	/* Seek straight to the keyframe if it's known to be the last one
+	 * before the target, so the first packet read can be decoded */
+	i = _keyframe_index_find(&s->keyframes, target);
+	
+	if(i >= 0 && s->keyframes.keys[i].next)
+	{
+		ts = s->keyframes.keys[i].ts;
+		r = avformat_seek_file(s->format_ctx, s->video_stream->index, ts, ts, ts, 0);
+	}
+	
+	if(r < 0)
+	{
+		/* Let the demuxer find a keyframe at or before the target */
+		r = avformat_seek_file(s->format_ctx, s->video_stream->index, INT64_MIN, target, target, 0);
+	}
+	
+	if(r < 0)
+	{
+		fprintf(stderr, "\nSeek failed\n");
+		_print_ffmpeg_error(r);
+		return;
+	}
+	
+	/* Everything queued from here on follows the new serial number.
+	 * Packets are dropped until the next video keyframe */
+	s->seek_wait_key = 1;
+	s->keyframes.last = AV_NOPTS_VALUE;
+	__atomic_store_n(&s->serial, s->serial + 1, __ATOMIC_SEQ_CST);
+}
+
 static void *_input_thread(void *arg)
 {
 	av_ffmpeg_t *s = (av_ffmpeg_t *) arg;
 	AVPacket pkt;
+	int64_t ts;
 	int r;
 	
 	//fprintf(stderr, "_input_thread(): Starting\n");
 	
+	affinity_apply(AFFINITY_INPUT);
+	
 	/* Fetch packets from the source */
 	while(s->thread_abort == 0)
 	{
+		if(__atomic_load_n(&s->seek_request, __ATOMIC_SEQ_CST))
+		{
+			_input_seek(s);
+		}
+		
 		r = av_read_frame(s->format_ctx, &pkt);
 		
 		if(r == AVERROR(EAGAIN))
@@ -497,11 +950,44 @@ static void *_input_thread(void *arg)
 		
 		if(s->video_stream && pkt.stream_index == s->video_stream->index)
 		{
-			_packet_queue_write(s, &s->video_queue, &pkt);
+			if(s->measure_latency && pkt.pts != AV_NOPTS_VALUE)
+			{
+				_arrival_add(s, pkt.pts);
+			}
+			
+			if(pkt.flags & AV_PKT_FLAG_KEY)
+			{
+				ts = pkt.dts != AV_NOPTS_VALUE ? pkt.dts : pkt.pts;
+				if(ts != AV_NOPTS_VALUE) _keyframe_index_add(&s->keyframes, ts);
+				
+				if(s->seek_wait_key)
+				{
+					/* Playback restarts from this frame */
+					ts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : ts;
+					s->seek_pts[s->serial & (_SEEK_SERIALS - 1)] = ts != AV_NOPTS_VALUE ? ts : s->seek_target;
+					s->seek_wait_key = 0;
+				}
+			}
+			
+			if(s->seek_wait_key)
+			{
+				av_packet_unref(&pkt);
+			}
+			else
+			{
+				_packet_queue_write(s, &s->video_queue, &pkt);
+			}
 		}
 		else if(s->audio_stream && pkt.stream_index == s->audio_stream->index)
 		{
-			_packet_queue_write(s, &s->audio_queue, &pkt);
+			if(s->seek_wait_key)
+			{
+				av_packet_unref(&pkt);
+			}
+			else
+			{
+				_packet_queue_write(s, &s->audio_queue, &pkt);
+			}
 		}
 		/* Keep it in the input thread rather than moving to a separate one */
 		else if(s->subtitle_stream && pkt.stream_index == s->subtitle_stream->index && s->av_sub)
@@ -541,7 +1027,7 @@ static void *_input_thread(void *arg)
 					}
 
 					/* Set correct ratio based on supplied parameters */
-					bitmap_ratio = s->vid_conf->pillarbox || s->vid_conf->letterbox ? 4.0/3.0 : 16.0/9.0;
+					bitmap_ratio = s->conf.pillarbox || s->conf.letterbox ? 4.0/3.0 : 16.0/9.0;
 					bitmap_width = (float) (s->width / (float) s->height) / bitmap_ratio * max_bitmap_width;
 					load_bitmap_subtitle(&sub, s->av_sub, bitmap_width, max_bitmap_width, max_bitmap_height, pkt.pts, bitmap_scale);
 				}
@@ -562,6 +1048,9 @@ static void *_input_thread(void *arg)
 		}
 	}
 	
+	/* No more seeking once the input has ended */
+	__atomic_store_n(&s->input_eof, 1, __ATOMIC_SEQ_CST);
+	
 	/* Set the EOF flag in the queues */
 	_packet_queue_write(s, &s->video_queue, NULL);
 	_packet_queue_write(s, &s->audio_queue, NULL);
@@ -575,11 +1064,13 @@ static void *_video_decode_thread(void *arg)
 {
 	av_ffmpeg_t *s = (av_ffmpeg_t *) arg;
 	AVPacket pkt, *ppkt = NULL;
-	AVFrame *frame;
-	int r;
+	AVFrame *frame, *oframe;
+	int r, serial = 0, pkt_serial;
 	
 	//fprintf(stderr, "_video_decode_thread(): Starting\n");
 	
+	affinity_apply(AFFINITY_INPUT);
+	
 	frame = av_frame_alloc();
 	
 	/* Fetch video packets from the queue and decode */
@@ -587,13 +1078,28 @@ static void *_video_decode_thread(void *arg)
 	{
 		if(ppkt == NULL)
 		{
-			r = _packet_queue_read(s, &s->video_queue, &pkt);
+			r = _packet_queue_read(s, &s->video_queue, &pkt, &pkt_serial);
 			if(r == -2)
 			{
 				/* Thread is aborting */
 				break;
 			}
 			
+			if(r >= 0 && pkt_serial != __atomic_load_n(&s->serial, __ATOMIC_SEQ_CST))
+			{
+				/* Queued before a seek, drop it */
+				av_packet_unref(&pkt);
+				continue;
+			}
+			
+			if(r >= 0 && pkt_serial != serial)
+			{
+				/* The first packet after a seek. Drop
+				 * anything still in the decoder */
+				avcodec_flush_buffers(s->video_codec_ctx);
+				serial = pkt_serial;
+			}
+			
 			ppkt = (r >= 0 ? &pkt : NULL);
 		}
 		
@@ -605,46 +1111,219 @@ static void *_video_decode_thread(void *arg)
 			ppkt = NULL;
 		}
 		
-		if(r < 0 && r != AVERROR(EAGAIN))
-		{
-			/* avcodec_send_packet() has failed, abort thread */
-			break;
-		}
+		if(r < 0 && r != AVERROR(EAGAIN))
+		{
+			/* avcodec_send_packet() has failed, abort thread */
+			break;
+		}
+		
+		r = avcodec_receive_frame(s->video_codec_ctx, frame);
+		
+		if(r == 0)
+		{
+			/* Push the decoded frame into the filtergraph */
+			if (av_buffersrc_add_frame(s->vbuffersrc_ctx, frame) < 0) 
+			{
+				printf( "Error while feeding the video filtergraph\n");
+			}
+
+			/* Pull filtered frame from the filtergraph */ 
+			if(av_buffersink_get_frame(s->vbuffersink_ctx, frame) < 0) 
+			{
+				printf( "Error while sourcing the video filtergraph\n");
+			}
+			
+			/* We have received a frame! */
+			oframe = _frame_ring_back_buffer(&s->in_video_buffer);
+			if(!oframe) break;
+			
+			av_frame_ref(oframe, frame);
+			_frame_ring_ready(&s->in_video_buffer, serial);
+		}
+		else if(r != AVERROR(EAGAIN))
+		{
+			/* avcodec_receive_frame returned an EOF or error, abort thread */
+			break;
+		}
+	}
+	
+	_frame_ring_eof(&s->in_video_buffer);
+	
+	av_frame_free(&frame);
+	
+	//fprintf(stderr, "_video_decode_thread(): Ending\n");
+	
+	return(NULL);
+}
+
+static enum AVPixelFormat _yuv_format(const AVFrame *frame)
+{
+	const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(frame->format);
+	
+	/* Return the 8-bit planar Y'CbCr format nearest to the
+	 * source, or AV_PIX_FMT_NONE if the source isn't Y'CbCr */
+	if(d == NULL || d->nb_components < 3 ||
+	   (d->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL)))
+	{
+		return(AV_PIX_FMT_NONE);
+	}
+	
+	if(d->log2_chroma_w == 0) return(AV_PIX_FMT_YUV444P);
+	if(d->log2_chroma_h == 0) return(AV_PIX_FMT_YUV422P);
+	
+	return(AV_PIX_FMT_YUV420P);
+}
+
+static int _draws_overlays(av_ffmpeg_t *s, int skip)
+{
+	/* Will the timestamp, logo or subtitles be drawn onto the next frame? */
+	if(skip)
+	{
+		return(0);
+	}
+	
+	if(s->font[TEXT_SUBTITLE] &&
+	   (s->conf.subtitles || get_subtitle_type(s->av_sub) != SUB_TEXT))
+	{
+		return(1);
+	}
+	
+	return(s->font[TEXT_TIMESTAMP] != NULL || s->av_logo != NULL);
+}
+
+typedef struct {
+	av_ffmpeg_t *s;
+	AVFrame *frame;
+	AVFrame *oframe;
+	image_t *logo;
+	int slices;
+	int align;
+	int error[_SCALE_SLICES_MAX];
+} _scale_job_t;
+
+static int _scale_slice_row(const _scale_job_t *j, int i)
+{
+	int y;
+	
+	if(i >= j->slices)
+	{
+		return(j->oframe->height);
+	}
+	
+	/* Slices start on a multiple of the scaler's alignment,
+	 * which keeps whole chroma rows in each slice */
+	y = (int64_t) j->oframe->height * i / j->slices;
+	
+	return(y - y % j->align);
+}
+
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT(6, 1, 100)
+static void _scale_slice_task(void *arg, int start, int end)
+{
+	_scale_job_t *j = arg;
+	struct SwsContext *ctx;
+	int i, y0, y1, r;
+	
+	for(i = start; i < end; i++)
+	{
+		ctx = j->s->sws_ctx[i];
+		y0 = _scale_slice_row(j, i);
+		y1 = _scale_slice_row(j, i + 1);
+		
+		if(y1 <= y0) continue;
+		
+		/* Each context scales the whole source into its own rows */
+		r = sws_frame_start(ctx, j->oframe, j->frame);
+		if(r >= 0) r = sws_send_slice(ctx, 0, j->frame->height);
+		if(r >= 0) r = sws_receive_slice(ctx, y0, y1 - y0);
+		sws_frame_end(ctx);
+		
+		if(r < 0)
+		{
+			j->error[i] = r;
+			continue;
+		}
+		
+		/* Draw the part of the logo that falls in this slice */
+		if(j->logo)
+		{
+			overlay_image_rows((uint32_t *) j->oframe->data[0], j->logo, j->oframe->width, j->oframe->linesize[0] / sizeof(uint32_t), j->oframe->height, j->logo->position, y0, y1);
+		}
+	}
+}
+#endif
+
+static int _scale_frame(av_ffmpeg_t *s, AVFrame *frame, AVFrame *oframe, image_t *logo)
+{
+	int i;
+	
+	/* Initialise / re-initialise software scaler */
+	for(i = 0; i < s->scale_slices; i++)
+	{
+		s->sws_ctx[i] = sws_getCachedContext(
+			s->sws_ctx[i],
+			frame->width,
+			frame->height,
+			frame->format,
+			oframe->width,
+			oframe->height,
+			oframe->format,
+			SWS_BICUBIC,
+			NULL,
+			NULL,
+			NULL
+		);
+		
+		if(!s->sws_ctx[i]) return(-1);
+	}
+	
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT(6, 1, 100)
+	if(s->scale_slices > 1)
+	{
+		_scale_job_t j;
+		
+		memset(&j, 0, sizeof(j));
+		j.s = s;
+		j.frame = frame;
+		j.oframe = oframe;
+		j.logo = logo;
+		j.slices = s->scale_slices;
+		j.align = sws_receive_slice_alignment(s->sws_ctx[0]);
+		if(j.align < 1) j.align = 1;
+		
+		/* Scale and compose the slices on the task pool */
+		pool_parallel_for(j.slices, 1, _scale_slice_task, &j);
 		
-		r = avcodec_receive_frame(s->video_codec_ctx, frame);
+		for(i = 0; i < j.slices && j.error[i] == 0; i++);
 		
-		if(r == 0)
-		{
-			/* Push the decoded frame into the filtergraph */
-			if (av_buffersrc_add_frame(s->vbuffersrc_ctx, frame) < 0) 
-			{
-				printf( "Error while feeding the video filtergraph\n");
-			}
-
-			/* Pull filtered frame from the filtergraph */ 
-			if(av_buffersink_get_frame(s->vbuffersink_ctx, frame) < 0) 
-			{
-				printf( "Error while sourcing the video filtergraph\n");
-			}
-			
-			/* We have received a frame! */
-			av_frame_ref(_frame_dbuffer_back_buffer(&s->in_video_buffer), frame);
-			_frame_dbuffer_ready(&s->in_video_buffer, 0);
-		}
-		else if(r != AVERROR(EAGAIN))
+		if(i == j.slices)
 		{
-			/* avcodec_receive_frame returned an EOF or error, abort thread */
-			break;
+			return(0);
 		}
+		
+		/* This conversion can't be split, scale
+		 * whole frames from now on */
+		fprintf(stderr, "Warning: Unable to scale the video in slices (%s). Using one slice.\n", av_err2str(j.error[i]));
+		s->scale_slices = 1;
 	}
+#endif
 	
-	_frame_dbuffer_abort(&s->in_video_buffer);
-	
-	av_frame_free(&frame);
-	
-	//fprintf(stderr, "_video_decode_thread(): Ending\n");
+	sws_scale(
+		s->sws_ctx[0],
+		(uint8_t const * const *) frame->data,
+		frame->linesize,
+		0,
+		s->video_codec_ctx->height,
+		oframe->data,
+		oframe->linesize
+	);
+	
+	if(logo)
+	{
+		overlay_image((uint32_t *) oframe->data[0], logo, oframe->width, oframe->linesize[0] / sizeof(uint32_t), oframe->height, logo->position);
+	}
 	
-	return(NULL);
+	return(0);
 }
 
 static void *_video_scaler_thread(void *arg)
@@ -652,12 +1331,32 @@ static void *_video_scaler_thread(void *arg)
 	av_ffmpeg_t *s = (av_ffmpeg_t *) arg;
 	AVFrame *frame, *oframe;
 	AVRational ratio;
+	enum AVPixelFormat fmt;
+	const AVPixFmtDescriptor *d;
 	rational_t r;
 	int64_t pts;
+	int rgb, skip, serial = 0;
+	
+	affinity_apply(AFFINITY_INPUT);
 	
 	/* Fetch video frames and pass them through the scaler */
-	while((frame = _frame_dbuffer_flip(&s->in_video_buffer)) != NULL)
+	while((frame = _frame_ring_flip(&s->in_video_buffer)) != NULL)
 	{
+		if(_frame_ring_serial(&s->in_video_buffer) != __atomic_load_n(&s->serial, __ATOMIC_SEQ_CST))
+		{
+			/* Decoded before a seek, drop it */
+			av_frame_unref(frame);
+			continue;
+		}
+		
+		if(_frame_ring_serial(&s->in_video_buffer) != serial)
+		{
+			/* The first frame after a seek, restart the clock from
+			 * the keyframe the input thread landed on */
+			serial = _frame_ring_serial(&s->in_video_buffer);
+			s->video_start_time = av_rescale_q(s->seek_pts[serial & (_SEEK_SERIALS - 1)], s->video_stream->time_base, s->video_time_base);
+		}
+		
 		pts = frame->best_effort_timestamp;
 		
 		if(pts != AV_NOPTS_VALUE)
@@ -672,16 +1371,16 @@ static void *_video_scaler_thread(void *arg)
 				continue;
 			}
 			
-			while(pts > 0)
+			if(pts > 0)
 			{
 				/* This frame is in the future. Repeat the previous one */
-				_frame_dbuffer_ready(&s->out_video_buffer, 1);
-				s->video_start_time++;
-				pts--;
+				_frame_ring_repeat(&s->out_video_buffer, pts);
+				s->video_start_time += pts;
 			}
 		}
 		
-		oframe = _frame_dbuffer_back_buffer(&s->out_video_buffer);
+		oframe = _frame_ring_back_buffer(&s->out_video_buffer);
+		if(!oframe) break;
 		
 		ratio = av_guess_sample_aspect_ratio(s->format_ctx, s->video_stream, frame);
 		
@@ -700,50 +1399,72 @@ static void *_video_scaler_thread(void *arg)
 			)
 		);
 		
+		/* Keep Y'CbCr sources in Y'CbCr if the encoder can take it
+		 * and nothing is drawn onto the frame. This saves converting
+		 * to RGB here and back again in the encoder. The overlays
+		 * are only drawn in RGB */
+		fmt = AV_PIX_FMT_NONE;
+		
+		/* Set by the render thread, the same value is used for the whole frame */
+		skip = __atomic_load_n(&s->av->skip_overlays, __ATOMIC_RELAXED);
+		
+		if(s->av->yuv && !_draws_overlays(s, skip))
+		{
+			fmt = _yuv_format(frame);
+		}
+		
+		rgb = (fmt == AV_PIX_FMT_NONE);
+		
+		if(rgb)
+		{
+			fmt = AV_PIX_FMT_RGB32;
+		}
+		else
+		{
+			/* Round down to a whole number of chroma samples */
+			d = av_pix_fmt_desc_get(fmt);
+			r.num &= ~((1 << d->log2_chroma_w) - 1);
+			r.den &= ~((1 << d->log2_chroma_h) - 1);
+		}
+		
 		if(r.num != oframe->width ||
-		   r.den != oframe->height)
+		   r.den != oframe->height ||
+		   fmt != oframe->format)
 		{
-			av_freep(&oframe->data[0]);
+			av_frame_unref(oframe);
 			
-			oframe->format = AV_PIX_FMT_RGB32;
+			oframe->format = fmt;
 			oframe->width = r.num;
 			oframe->height = r.den;
 			
-			int i = av_image_alloc(
-				oframe->data,
-				oframe->linesize,
-				oframe->width, oframe->height,
-				AV_PIX_FMT_RGB32, av_cpu_max_align()
-			);
-			memset(oframe->data[0], 0, i);
+			if(av_frame_get_buffer(oframe, 0) < 0) break;
 		}
 		
-		/* Initialise / re-initialise software scaler */
-		s->sws_ctx = sws_getCachedContext(
-			s->sws_ctx,
-			frame->width,
-			frame->height,
-			frame->format,
-			oframe->width,
-			oframe->height,
-			AV_PIX_FMT_RGB32,
-			SWS_BICUBIC,
-			NULL,
-			NULL,
-			NULL
-		);
-		
-		if(!s->sws_ctx) break;
+		if(!rgb)
+		{
+			/* Pass on the colour matrix and range. sws converts
+			 * the range of the yuvj formats, but not the others */
+			oframe->color_range = AVCOL_RANGE_MPEG;
+			
+			if(frame->color_range == AVCOL_RANGE_JPEG &&
+			   frame->format != AV_PIX_FMT_YUVJ420P &&
+			   frame->format != AV_PIX_FMT_YUVJ422P &&
+			   frame->format != AV_PIX_FMT_YUVJ444P)
+			{
+				oframe->color_range = AVCOL_RANGE_JPEG;
+			}
+			
+			oframe->colorspace = frame->colorspace;
+			
+			if(oframe->colorspace == AVCOL_SPC_UNSPECIFIED)
+			{
+				/* Guess from the source resolution */
+				oframe->colorspace = frame->height >= 720 ? AVCOL_SPC_BT709 : AVCOL_SPC_BT470BG;
+			}
+		}
 		
-		sws_scale(
-			s->sws_ctx,
-			(uint8_t const * const *) frame->data,
-			frame->linesize,
-			0,
-			s->video_codec_ctx->height,
-			oframe->data,
-			oframe->linesize
-		);
+		/* Scale the frame and draw the logo, if enabled */
+		if(_scale_frame(s, frame, oframe, rgb && !skip ? s->av_logo : NULL) != 0) break;
 		
 		/* Adjust the pixel ratio for the scaled image */
 		av_reduce(
@@ -764,8 +1485,9 @@ static void *_video_scaler_thread(void *arg)
 
 		fprintf(stderr,"\r%02d:%02d:%02d", hr, min, sec);
 
-		/* Overlay timestamp to video frame, if enabled */
-		if(s->font[TEXT_TIMESTAMP])
+		/* Overlay timestamp to video frame, if enabled. Overlays
+		 * are skipped while the encoder is short of time */
+		if(s->font[TEXT_TIMESTAMP] && rgb && !skip)
 		{
 			asprintf(&s->font[TEXT_TIMESTAMP]->text, "%02d:%02d:%02d", hr, min, sec);
 			print_generic_text(s->font[TEXT_TIMESTAMP], (uint32_t *) oframe->data[0], s->font[TEXT_TIMESTAMP]->text, 10, 90, TEXT_SHADOW, NO_TEXT_BOX, 0, 0);
@@ -773,12 +1495,6 @@ static void *_video_scaler_thread(void *arg)
 			/* Free memory */
 			free(s->font[TEXT_TIMESTAMP]->text);
 		}
-
-		/* Print logo, if enabled */
-		if(s->av_logo)
-		{
-			overlay_image((uint32_t *) oframe->data[0], s->av_logo, oframe->width, oframe->linesize[0] / sizeof(uint32_t), oframe->height, s->av_logo->position);
-		}
 	
 		/* Print subtitles to video frame, if enabled */
 		if(s->font[TEXT_SUBTITLE])
@@ -789,13 +1505,13 @@ static void *_video_scaler_thread(void *arg)
 				asprintf(&s->font[TEXT_SUBTITLE]->text,"%s", get_text_subtitle(s->av_sub, frame->best_effort_timestamp / (s->video_stream->time_base.den / 1000)));
 
 				/* Do not refresh teletext unless subtitle text has changed */
-				if(s->vid_conf->txsubtitles && strcmp(s->font[TEXT_SUBTITLE]->text, s->vid_tt->text) != 0)
+				if(s->conf.txsubtitles && strcmp(s->font[TEXT_SUBTITLE]->text, s->vid_tt->text) != 0)
 				{
 					strcpy(s->vid_tt->text, s->font[TEXT_SUBTITLE]->text);
 					update_teletext_subtitle(s->vid_tt->text, &s->vid_tt->service);
 				}
 
-				if(s->vid_conf->subtitles)
+				if(s->conf.subtitles && rgb && !skip)
 				{
 					print_subtitle(s->font[TEXT_SUBTITLE], (uint32_t *) oframe->data[0], s->font[TEXT_SUBTITLE]->text);
 				}
@@ -807,11 +1523,13 @@ static void *_video_scaler_thread(void *arg)
 			{
 				int w, h, sindex;
 				sindex = get_bitmap_subtitle(s->av_sub, frame->best_effort_timestamp, &w, &h);				
-				if(w > 0) display_bitmap_subtitle(s->font[TEXT_SUBTITLE], (uint32_t *) oframe->data[0], w, h, s->av_sub[sindex].bitmap);
+				if(w > 0 && rgb && !skip) display_bitmap_subtitle(s->font[TEXT_SUBTITLE], (uint32_t *) oframe->data[0], w, h, s->av_sub[sindex].bitmap);
 			}
 		}
 
 		/* Copy some data to the scaled image */
+		oframe->pts = frame->best_effort_timestamp;
+		
 #if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(58, 29, 100)
 		oframe->interlaced_frame = frame->flags & AV_FRAME_FLAG_INTERLACED ? 1 : 0;
 		oframe->top_field_first = frame->flags & AV_FRAME_FLAG_TOP_FIELD_FIRST ? 1 : 0;
@@ -823,24 +1541,152 @@ static void *_video_scaler_thread(void *arg)
 		/* Done with the frame */
 		av_frame_unref(frame);
 		
-		_frame_dbuffer_ready(&s->out_video_buffer, 0);
+		_frame_ring_ready(&s->out_video_buffer, serial);
 		s->video_start_time++;
 	}
 	
-	_frame_dbuffer_abort(&s->out_video_buffer);
+	_frame_ring_eof(&s->out_video_buffer);
 	
 	// fprintf(stderr, "_video_scaler_thread(): Ending\n");
 	
 	return(NULL);
 }
 
+static av_matrix_t _av_matrix(const AVFrame *avframe)
+{
+	switch(avframe->colorspace)
+	{
+	case AVCOL_SPC_BT709:      return(AV_MATRIX_BT709);
+	case AVCOL_SPC_BT2020_NCL:
+	case AVCOL_SPC_BT2020_CL:  return(AV_MATRIX_BT2020);
+	default:                   return(AV_MATRIX_BT601);
+	}
+}
+
+static void _overlay_media_icon(AVFrame *avframe, image_t *icon)
+{
+	const AVPixFmtDescriptor *d;
+	
+	if(avframe->format != AV_PIX_FMT_RGB32 &&
+	   (d = av_pix_fmt_desc_get(avframe->format)) != NULL)
+	{
+		overlay_image_yuv(avframe->data, avframe->linesize, d->log2_chroma_w, d->log2_chroma_h,
+			_av_matrix(avframe), avframe->color_range == AVCOL_RANGE_JPEG,
+			icon, avframe->width, avframe->height, IMG_POS_MIDDLE);
+	}
+	else
+	{
+		overlay_image((uint32_t *) avframe->data[0], icon, avframe->width, avframe->linesize[0] / sizeof(uint32_t), avframe->height, IMG_POS_MIDDLE);
+	}
+}
+
+static void _measure_latency(av_ffmpeg_t *s, int64_t pts)
+{
+	_arrival_t *a;
+	uint64_t ns, t;
+	int i;
+	
+	if(pts == AV_NOPTS_VALUE || pts == s->latency_pts)
+	{
+		/* Repeated frame, already counted */
+		return;
+	}
+	
+	s->latency_pts = pts;
+	t = monotonic_ns();
+	
+	for(i = 0; i < _ARRIVALS; i++)
+	{
+		a = &s->arrivals[i];
+		
+		if(__atomic_load_n(&a->pts, __ATOMIC_SEQ_CST) != pts) continue;
+		ns = __atomic_load_n(&a->ns, __ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&a->pts, __ATOMIC_SEQ_CST) != pts || ns > t) continue;
+		
+		s->av->latency_ns += t - ns;
+		s->av->latency_frames++;
+		
+		if(t - ns > s->av->latency_max_ns)
+		{
+			s->av->latency_max_ns = t - ns;
+		}
+		
+		break;
+	}
+}
+
+static AVFrame *_next_video_frame(av_ffmpeg_t *s)
+{
+	_frame_ring_t *d = &s->out_video_buffer;
+	AVFrame *avframe;
+	int serial;
+	
+	serial = __atomic_load_n(&s->serial, __ATOMIC_SEQ_CST);
+	
+	/* Skip any frames from before a seek */
+	do
+	{
+		if(_frame_ring_serial(d) != serial && !_frame_ring_poll(d) &&
+		   _frame_ring_current(d) != NULL)
+		{
+			/* Nothing new yet. Hold the current
+			 * frame rather than stall the output */
+			return(_frame_ring_current(d));
+		}
+		
+		avframe = _frame_ring_flip(d);
+	}
+	while(avframe && _frame_ring_serial(d) != serial);
+	
+	return(avframe);
+}
+
+static int _ffmpeg_seek(void *ctx, double seconds, int relative)
+{
+	av_ffmpeg_t *s = ctx;
+	AVStream *st = s->video_stream;
+	int64_t start, ts;
+	
+	/* Seeks follow the video stream, and stop
+	 * once the input thread has reached the end */
+	if(st == NULL || __atomic_load_n(&s->input_eof, __ATOMIC_SEQ_CST))
+	{
+		return(AV_ERROR);
+	}
+	
+	start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+	
+	if(!relative)
+	{
+		ts = start;
+	}
+	else if(__atomic_load_n(&s->seek_request, __ATOMIC_SEQ_CST))
+	{
+		/* Add to a seek that hasn't started yet */
+		ts = __atomic_load_n(&s->seek_target, __ATOMIC_SEQ_CST);
+	}
+	else
+	{
+		ts = __atomic_load_n(&s->position, __ATOMIC_SEQ_CST);
+	}
+	
+	ts += seconds / av_q2d(st->time_base);
+	if(ts < start) ts = start;
+	
+	__atomic_store_n(&s->seek_target, ts, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&s->seek_request, 1, __ATOMIC_SEQ_CST);
+	
+	/* Wake the input thread if it's waiting to queue a packet */
+	_event_signal(&s->writable);
+	
+	return(AV_OK);
+}
+
 static int _ffmpeg_read_video(void *ctx, av_frame_t *frame)
 {
 	av_ffmpeg_t *s = ctx;
+	const AVPixFmtDescriptor *d;
 	AVFrame *avframe;
-		
-	// int nav;
-	// nav = 0;
 
 	av_frame_init(frame, 0, 0, NULL, 0, 0);
 
@@ -849,80 +1695,61 @@ static int _ffmpeg_read_video(void *ctx, av_frame_t *frame)
 		return(AV_OK);
 	}
 
-	kb_enable();
-	if(kbhit())
+	if(s->av->paused)
 	{
-		#ifndef WIN32
-		char c = getchar();
-		#else
-		char c = getch();
-		#endif
-		switch(c)
+		avframe = _frame_ring_current(&s->out_video_buffer);
+		
+		if(avframe)
 		{
-			case ' ':
-				s->paused ^= 1;
-				fprintf(stderr,"\nVideo state: %s", s->paused ? "PAUSE" : "PLAY");	
-				break;
-/*			case '\033':
-				#ifndef WIN32
-				getchar();
-				c = getchar();
-				#else
-				c = getch();
-				#endif
-				switch(c)
-				{
-					case 'C':
-						fprintf(stderr,"\nVideo state: FF");
-						nav = AVSEEK_FWD;
-						break;
-					case 'D':
-						fprintf(stderr,"\nVideo state: RW");
-						nav = AVSEEK_RWD;
-						break;
-					default:
-						break;
-				}
-				break;
-*/
-			default: 
-				break;
+			_overlay_media_icon(avframe, s->media_icons[1]);
 		}
-	}
-	kb_disable();
-
-/*
-	if(nav == AVSEEK_FWD || nav == AVSEEK_RWD)
-	{
-		s->video_start_time += nav;
-		s->audio_start_time += nav;
-		nav = 0;
-	}
-*/	
-	if(s->paused) 
-	{
-		avframe = s->out_video_buffer.frame[0];
 		
-		overlay_image((uint32_t *) avframe->data[0], s->media_icons[1], avframe->width, avframe->linesize[0] / sizeof(uint32_t), avframe->height, IMG_POS_MIDDLE);
 		s->last_paused = time(0);
 	}
 	else
 	{
-		avframe = _frame_dbuffer_flip(&s->out_video_buffer);
+		avframe = _next_video_frame(s);
 		/* Show 'play' icon for 5 seconds after resuming play */
-		if(time(0) - s->last_paused < 5)
+		if(avframe && time(0) - s->last_paused < 5)
 		{
-			overlay_image((uint32_t *) avframe->data[0], s->media_icons[0], avframe->width, avframe->linesize[0] / sizeof(uint32_t), avframe->height, IMG_POS_MIDDLE);
+			_overlay_media_icon(avframe, s->media_icons[0]);
 		}
 	}
 
 	if(!avframe)
 	{
-		/* EOF or abort */
+		/* At the end of the video, hold the last
+		 * frame until the audio has finished too */
 		s->video_eof = 1;
+		avframe = _frame_ring_current(&s->out_video_buffer);
+	}
+	
+	if(!avframe)
+	{
+		/* No frame has been decoded, leave the frame empty */
 		return(AV_OK);
 	}
 	
+	if(avframe->pts != AV_NOPTS_VALUE)
+	{
+		/* Relative seeks start from here */
+		__atomic_store_n(&s->position, avframe->pts, __ATOMIC_SEQ_CST);
+	}
+	
+	if(s->measure_latency && !s->av->paused && !s->video_eof)
+	{
+		_measure_latency(s, avframe->pts);
+	}
+	
+	if(avframe->format != AV_PIX_FMT_RGB32 &&
+	   (d = av_pix_fmt_desc_get(avframe->format)) != NULL)
+	{
+		/* Planar Y'CbCr */
+		av_frame_init_yuv(frame, avframe->width, avframe->height, avframe->data, avframe->linesize, d->log2_chroma_w, d->log2_chroma_h);
+		frame->full_range = avframe->color_range == AVCOL_RANGE_JPEG;
+		frame->matrix = _av_matrix(avframe);
+	}
+	
 	/* Return image ratio */
 	if(avframe->sample_aspect_ratio.num > 0 &&
 	   avframe->sample_aspect_ratio.den > 0)
@@ -939,12 +1766,15 @@ static int _ffmpeg_read_video(void *ctx, av_frame_t *frame)
 		frame->interlaced = avframe->top_field_first ? 1 : 2;
 	}
 	
-	/* Set the pointer to the framebuffer */
-	frame->width = avframe->width;
-	frame->height = avframe->height;
-	frame->framebuffer = (uint32_t *) avframe->data[0];
-	frame->pixel_stride = 1;
-	frame->line_stride = avframe->linesize[0] / sizeof(uint32_t);
+	if(frame->format == AV_FRAME_RGB32)
+	{
+		/* Set the pointer to the framebuffer */
+		frame->width = avframe->width;
+		frame->height = avframe->height;
+		frame->framebuffer = (uint32_t *) avframe->data[0];
+		frame->pixel_stride = 1;
+		frame->line_stride = avframe->linesize[0] / sizeof(uint32_t);
+	}
 
 	return(AV_OK);
 }
@@ -955,11 +1785,13 @@ static void *_audio_decode_thread(void *arg)
 	 *       they should probably be combined */
 	av_ffmpeg_t *s = (av_ffmpeg_t *) arg;
 	AVPacket pkt, *ppkt = NULL;
-	AVFrame *frame;
-	int r;
+	AVFrame *frame, *oframe;
+	int r, serial = 0, pkt_serial;
 	
 	//fprintf(stderr, "_audio_decode_thread(): Starting\n");
 	
+	affinity_apply(AFFINITY_INPUT);
+	
 	frame = av_frame_alloc();
 	
 	/* Fetch audio packets from the queue and decode */
@@ -967,13 +1799,28 @@ static void *_audio_decode_thread(void *arg)
 	{
 		if(ppkt == NULL)
 		{
-			r = _packet_queue_read(s, &s->audio_queue, &pkt);
+			r = _packet_queue_read(s, &s->audio_queue, &pkt, &pkt_serial);
 			if(r == -2)
 			{
 				/* Thread is aborting */
 				break;
 			}
 			
+			if(r >= 0 && pkt_serial != __atomic_load_n(&s->serial, __ATOMIC_SEQ_CST))
+			{
+				/* Queued before a seek, drop it */
+				av_packet_unref(&pkt);
+				continue;
+			}
+			
+			if(r >= 0 && pkt_serial != serial)
+			{
+				/* The first packet after a seek. Drop
+				 * anything still in the decoder */
+				avcodec_flush_buffers(s->audio_codec_ctx);
+				serial = pkt_serial;
+			}
+			
 			ppkt = (r >= 0 ? &pkt : NULL);
 		}
 		
@@ -1002,8 +1849,11 @@ static void *_audio_decode_thread(void *arg)
 			}
 			
 			/* We have received a frame! */
-			av_frame_ref(_frame_dbuffer_back_buffer(&s->in_audio_buffer), frame);
-			_frame_dbuffer_ready(&s->in_audio_buffer, 0);
+			oframe = _frame_ring_back_buffer(&s->in_audio_buffer);
+			if(!oframe) break;
+			
+			av_frame_ref(oframe, frame);
+			_frame_ring_ready(&s->in_audio_buffer, serial);
 		}
 		else if(r != AVERROR(EAGAIN))
 		{
@@ -1012,7 +1862,7 @@ static void *_audio_decode_thread(void *arg)
 		}
 	}
 	
-	_frame_dbuffer_abort(&s->in_audio_buffer);
+	_frame_ring_eof(&s->in_audio_buffer);
 	
 	av_frame_free(&frame);
 	
@@ -1027,13 +1877,31 @@ static void *_audio_scaler_thread(void *arg)
 	AVFrame *frame, *oframe;
 	int64_t pts, next_pts;
 	uint8_t const *data[AV_NUM_DATA_POINTERS];
-	int r, count, drop;
+	int r, count, drop, serial = 0;
 	
 	//fprintf(stderr, "_audio_scaler_thread(): Starting\n");
 	
+	affinity_apply(AFFINITY_INPUT);
+	
 	/* Fetch audio frames and pass them through the resampler */
-	while((frame = _frame_dbuffer_flip(&s->in_audio_buffer)) != NULL)
+	while((frame = _frame_ring_flip(&s->in_audio_buffer)) != NULL)
 	{
+		if(_frame_ring_serial(&s->in_audio_buffer) != __atomic_load_n(&s->serial, __ATOMIC_SEQ_CST))
+		{
+			/* Decoded before a seek, drop it */
+			av_frame_unref(frame);
+			continue;
+		}
+		
+		if(_frame_ring_serial(&s->in_audio_buffer) != serial)
+		{
+			/* The first frame after a seek. Drop the samples
+			 * held by the resampler and restart the clock */
+			serial = _frame_ring_serial(&s->in_audio_buffer);
+			s->audio_start_time = av_rescale_q(s->seek_pts[serial & (_SEEK_SERIALS - 1)], s->video_stream->time_base, s->audio_time_base);
+			swr_init(s->swr_ctx);
+		}
+		
 		pts = frame->best_effort_timestamp;
 		drop = 0;
 		
@@ -1087,7 +1955,9 @@ static void *_audio_scaler_thread(void *arg)
 		
 		do
 		{
-			oframe = _frame_dbuffer_back_buffer(&s->out_audio_buffer);
+			oframe = _frame_ring_back_buffer(&s->out_audio_buffer);
+			if(!oframe) break;
+			
 			r = swr_convert(
 				s->swr_ctx,
 				oframe->data,
@@ -1099,7 +1969,7 @@ static void *_audio_scaler_thread(void *arg)
 			
 			oframe->nb_samples = r;
 			
-			_frame_dbuffer_ready(&s->out_audio_buffer, 0);
+			_frame_ring_ready(&s->out_audio_buffer, serial);
 			
 			s->audio_start_time += count;
 			count = 0;
@@ -1109,7 +1979,7 @@ static void *_audio_scaler_thread(void *arg)
 		av_frame_unref(frame);
 	}
 	
-	_frame_dbuffer_abort(&s->out_audio_buffer);
+	_frame_ring_eof(&s->out_audio_buffer);
 	
 	//fprintf(stderr, "_audio_scaler_thread(): Ending\n");
 	
@@ -1120,19 +1990,34 @@ static int16_t *_ffmpeg_read_audio(void *ctx, size_t *samples)
 {
 	av_ffmpeg_t *s = ctx;
 	AVFrame *frame;
+	int serial;
 	
-	if(s->audio_stream == NULL || s->paused)
+	if(s->audio_stream == NULL || s->av->paused)
 	{
 		return(NULL);
 	}
 	
-	frame = _frame_dbuffer_flip(&s->out_audio_buffer);
-	if(!frame)
+	serial = __atomic_load_n(&s->serial, __ATOMIC_SEQ_CST);
+	
+	/* Skip any audio from before a seek */
+	do
 	{
-		/* EOF or abort */
-		s->audio_eof = 1;
-		return(NULL);
+		if(_frame_ring_serial(&s->out_audio_buffer) != serial &&
+		   !_frame_ring_poll(&s->out_audio_buffer))
+		{
+			/* Silence until the new audio is ready */
+			return(NULL);
+		}
+		
+		frame = _frame_ring_flip(&s->out_audio_buffer);
+		if(!frame)
+		{
+			/* EOF or abort */
+			s->audio_eof = 1;
+			return(NULL);
+		}
 	}
+	while(_frame_ring_serial(&s->out_audio_buffer) != serial);
 	
 	*samples = frame->nb_samples;
 	
@@ -1155,6 +2040,7 @@ static int _ffmpeg_eof(void *ctx)
 static int _ffmpeg_close(void *ctx)
 {
 	av_ffmpeg_t *s = ctx;
+	int i;
 	
 	s->thread_abort = 1;
 	_packet_queue_abort(s, &s->video_queue);
@@ -1164,37 +2050,36 @@ static int _ffmpeg_close(void *ctx)
 	
 	if(s->video_stream != NULL)
 	{
-		_frame_dbuffer_abort(&s->in_video_buffer);
-		_frame_dbuffer_abort(&s->out_video_buffer);
+		_frame_ring_abort(&s->in_video_buffer);
+		_frame_ring_abort(&s->out_video_buffer);
 		
 		pthread_join(s->video_decode_thread, NULL);
 		pthread_join(s->video_scaler_thread, NULL);
 		
-		_packet_queue_free(s, &s->video_queue);
-		_frame_dbuffer_free(&s->in_video_buffer);
-		
-		av_freep(&s->out_video_buffer.frame[0]->data[0]);
-		av_freep(&s->out_video_buffer.frame[1]->data[0]);
-		_frame_dbuffer_free(&s->out_video_buffer);
+		_frame_ring_free(&s->in_video_buffer);
+		_frame_ring_free(&s->out_video_buffer);
 		
 		avcodec_free_context(&s->video_codec_ctx);
-		sws_freeContext(s->sws_ctx);
+		
+		for(i = 0; i < _SCALE_SLICES_MAX; i++)
+		{
+			sws_freeContext(s->sws_ctx[i]);
+		}
 	}
 	
 	if(s->audio_stream != NULL)
 	{
-		_frame_dbuffer_abort(&s->in_audio_buffer);
-		_frame_dbuffer_abort(&s->out_audio_buffer);
+		_frame_ring_abort(&s->in_audio_buffer);
+		_frame_ring_abort(&s->out_audio_buffer);
 		
 		pthread_join(s->audio_decode_thread, NULL);
 		pthread_join(s->audio_scaler_thread, NULL);
 		
-		_packet_queue_free(s, &s->audio_queue);
-		_frame_dbuffer_free(&s->in_audio_buffer);
+		_frame_ring_free(&s->in_audio_buffer);
 		
 		//av_freep(&s->out_audio_buffer.frame[0]->data[0]);
 		//av_freep(&s->out_audio_buffer.frame[1]->data[0]);
-		_frame_dbuffer_free(&s->out_audio_buffer);
+		_frame_ring_free(&s->out_audio_buffer);
 		
 		avcodec_free_context(&s->audio_codec_ctx);
 		swr_free(&s->swr_ctx);
@@ -1202,8 +2087,15 @@ static int _ffmpeg_close(void *ctx)
 	
 	avformat_close_input(&s->format_ctx);
 	
-	pthread_cond_destroy(&s->cond);
-	pthread_mutex_destroy(&s->mutex);
+	_packet_queue_free(s, &s->video_queue);
+	_packet_queue_free(s, &s->audio_queue);
+	_event_free(&s->writable);
+	_keyframe_index_free(&s->keyframes);
+	
+	for(i = 0; i < 3; i++)
+	{
+		font_free(s->font[i]);
+	}
 	
 	free(s);
 	
@@ -1224,7 +2116,7 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 	AVChannelLayout dst_ch_layout = AV_CHANNEL_LAYOUT_STEREO;
 #endif
 	int64_t start_time = 0;
-	int r, i, ws;
+	int r, i, ws, ring;
 
 	/* Default ratio */
 	float source_ratio;
@@ -1239,8 +2131,6 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 		return(HACKTV_OUT_OF_MEMORY);
 	}
 
-	s->paused = 0;
-	
 	s->av = av;
 	
 	s->av = av;
@@ -1261,6 +2151,18 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 		av_dict_parse_string(&opts, options, "=", ":", 0);
 	}
 	
+	s->queue_size = MAX_QUEUE_SIZE;
+	s->measure_latency = conf->low_latency || conf->stats;
+	s->latency_pts = AV_NOPTS_VALUE;
+	
+	if(conf->low_latency)
+	{
+		/* Don't hold on to the packets read while probing
+		 * the input, and keep the packet queues short */
+		av_dict_set(&opts, "fflags", "+nobuffer", AV_DICT_DONT_OVERWRITE);
+		s->queue_size = _LOW_LATENCY_QUEUE_SIZE;
+	}
+	
 	/* Open the video */
 	if((r = avformat_open_input(&s->format_ctx, input_url, fmt, &opts)) < 0)
 	{
@@ -1344,6 +2246,14 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 		
 		s->video_codec_ctx->thread_count = 0; /* Let ffmpeg decide number of threads */
 		
+		if(conf->low_latency)
+		{
+			/* Frame threading delays output by a frame per thread */
+			s->video_codec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+			s->video_codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+			s->video_codec_ctx->thread_type = FF_THREAD_SLICE;
+		}
+		
 		/* Find the decoder for the video stream */
 		codec = avcodec_find_decoder(s->video_codec_ctx->codec_id);
 		if(codec == NULL)
@@ -1455,7 +2365,7 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 		/* Video filter ends here */
 		
 		/* Initialise SWS context for software scaling */
-		s->sws_ctx = sws_getContext(
+		s->sws_ctx[0] = sws_getContext(
 			s->video_codec_ctx->width,
 			s->video_codec_ctx->height,
 			s->video_codec_ctx->pix_fmt,
@@ -1468,11 +2378,19 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 			NULL
 		);
 		
-		if(!s->sws_ctx)
+		if(!s->sws_ctx[0])
 		{
 			return(HACKTV_OUT_OF_MEMORY);
 		}
 		
+		/* Scale in one slice per pool thread unless set */
+		s->scale_slices = conf->scale_slices > 0 ? conf->scale_slices : pool_threads();
+		
+		if(s->scale_slices > _SCALE_SLICES_MAX)
+		{
+			s->scale_slices = _SCALE_SLICES_MAX;
+		}
+		
 		s->video_eof = 0;
 	}
 	else
@@ -1665,12 +2583,11 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 			subs_init_ffmpeg(&s->av_sub);
 			
 			/* Initialise fonts here */
-			if(font_init(av, 38, source_ratio, conf) !=0)
+			if(font_init(&s->font[TEXT_SUBTITLE], av, 38, source_ratio, conf) !=0)
 			{
 				return(HACKTV_ERROR);
 			};
 			
-			s->font[TEXT_SUBTITLE] = av->av_font;
 			s->font[TEXT_SUBTITLE]->video_width += 2;
 
 			fprintf(stderr, "Using subtitle stream %d.\n", s->subtitle_stream->index);
@@ -1723,14 +2640,13 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 				}
 				
 				/* Initialise fonts here */
-				if(font_init(av, 38, source_ratio, conf) < 0)
+				if(font_init(&s->font[TEXT_SUBTITLE], av, 38, source_ratio, conf) < 0)
 				{
 					conf->subtitles = 0;
 					conf->txsubtitles = 0;
 					return(HACKTV_ERROR);
 				}
 				
-				s->font[TEXT_SUBTITLE] = av->av_font;
 				s->font[TEXT_SUBTITLE]->video_width += 2;
 			}
 		}
@@ -1763,17 +2679,26 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 		s->audio_start_time = av_rescale_q(conf->position ? request_timestamp : start_time, time_base, s->audio_time_base);
 	}
 	
+	if(s->video_stream != NULL)
+	{
+		/* Seeks use the demuxer's index to begin with */
+		_keyframe_index_load(&s->keyframes, s->video_stream);
+		s->position = conf->position > 0 ? request_timestamp : start_time;
+	}
+	
 	if(conf->timestamp)
 	{
-		conf->timestamp = time(0);
+		conf->timestamp = wall_time();
 		
-		if(font_init(av, 40, source_ratio, conf) != VID_OK)
+		if(font_init(&s->font[TEXT_TIMESTAMP], av, 40, source_ratio, conf) != VID_OK)
 		{
 			conf->timestamp = 0;
-		};
-		
-		s->font[TEXT_TIMESTAMP] = av->av_font;
-		s->font[TEXT_TIMESTAMP]->video_width += 2;
+			s->font[TEXT_TIMESTAMP] = NULL;
+		}
+		else
+		{
+			s->font[TEXT_TIMESTAMP]->video_width += 2;
+		}
 	}
 	
 	/* Calculate ratio */
@@ -1801,41 +2726,46 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 	}
 		
 	/* Register the callback functions */
-	s->vid_conf = &vid->conf;
+	s->conf = *conf;
 	s->vid_tt = &vid->tt;
 	s->width = av->width;
 	s->height = av->height;
 
-	av->av_source_ctx = s;
-	av->read_video = _ffmpeg_read_video;
-	av->read_audio = _ffmpeg_read_audio;
-	av->eof = _ffmpeg_eof;
-	av->close = _ffmpeg_close;
+	av_set_source(av, s, _ffmpeg_read_video, _ffmpeg_read_audio, _ffmpeg_eof, _ffmpeg_seek, _ffmpeg_close);
+	
+	/* Frames buffered between each thread */
+	ring = conf->buffer_frames > 0 ? conf->buffer_frames : (conf->low_latency ? 2 : _FRAME_RING_SIZE);
 	
 	/* Start the threads */
 	s->thread_abort = 0;
-	pthread_mutex_init(&s->mutex, NULL);
-	pthread_cond_init(&s->cond, NULL);
-	_packet_queue_init(s, &s->video_queue);
-	_packet_queue_init(s, &s->audio_queue);
+	_event_init(&s->writable);
+	
+	if(_packet_queue_init(s, &s->video_queue) != 0 ||
+	   _packet_queue_init(s, &s->audio_queue) != 0)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
 	
 	if(s->video_stream != NULL)
 	{
-		_frame_dbuffer_init(&s->in_video_buffer);
-		_frame_dbuffer_init(&s->out_video_buffer);
+		if(_frame_ring_init(&s->in_video_buffer, ring, NULL, NULL) != 0 ||
+		   _frame_ring_init(&s->out_video_buffer, ring, &av->video_repeated, &av->video_starved) != 0)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
 		
 		/* Allocate memory for the output frame buffers */
-		for(i = 0; i < 2; i++)
+		for(i = 0; i < ring; i++)
 		{
+			s->out_video_buffer.frame[i]->format = AV_PIX_FMT_RGB32;
 			s->out_video_buffer.frame[i]->width = av->width;
 			s->out_video_buffer.frame[i]->height = av->height;
 			
-			r = av_image_alloc(
-				s->out_video_buffer.frame[i]->data,
-				s->out_video_buffer.frame[i]->linesize,
-				av->width, av->height,
-				AV_PIX_FMT_RGB32, av_cpu_max_align()
-			);
+			r = av_frame_get_buffer(s->out_video_buffer.frame[i], 0);
+			if(r < 0)
+			{
+				return(HACKTV_OUT_OF_MEMORY);
+			}
 		}
 		
 		r = pthread_create(&s->video_decode_thread, NULL, &_video_decode_thread, (void *) s);
@@ -1855,8 +2785,11 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 	
 	if(s->audio_stream != NULL)
 	{
-		_frame_dbuffer_init(&s->in_audio_buffer);
-		_frame_dbuffer_init(&s->out_audio_buffer);
+		if(_frame_ring_init(&s->in_audio_buffer, ring, NULL, NULL) != 0 ||
+		   _frame_ring_init(&s->out_audio_buffer, ring, NULL, &av->audio_starved) != 0)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
 		
 		/* Calculate the number of samples needed for output */
 		s->out_frame_size = av_rescale_q_rnd(
@@ -1871,10 +2804,16 @@ int av_ffmpeg_open(vid_t *vid, void *ctx, char *input_url, char *format, char *o
 			s->out_frame_size = av->sample_rate.num / av->sample_rate.den;
 		}
 		
+		if(conf->low_latency && s->out_frame_size > av->sample_rate.num / av->sample_rate.den * _LOW_LATENCY_AUDIO_MS / 1000)
+		{
+			/* Audio is held until a whole frame is ready */
+			s->out_frame_size = av->sample_rate.num / av->sample_rate.den * _LOW_LATENCY_AUDIO_MS / 1000;
+		}
+		
 		/* Calculate the allowed error in input samples, +/- 20ms */
 		s->allowed_error = av_rescale_q(AV_TIME_BASE * 0.020, AV_TIME_BASE_Q, s->audio_time_base);
 		
-		for(i = 0; i < 2; i++)
+		for(i = 0; i < ring; i++)
 		{
 			s->out_audio_buffer.frame[i]->format = AV_SAMPLE_FMT_S16;
 #if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(59, 24, 100)
@@ -0,0 +1,426 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Still image source. A file or a directory of PNG images is decoded
+ * and scaled once when opened, then each image is shown in turn for
+ * --dwell seconds with an optional --crossfade into the next. While
+ * an image is held the same frame is returned and marked unchanged,
+ * so reading a frame costs nothing */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "hacktv.h"
+#include "graphics.h"
+
+typedef struct {
+	av_t *av;
+	int width;
+	int height;
+	rational_t ratio;
+	
+	/* The scaled images, top row first */
+	uint32_t **images;
+	int count;
+	
+	/* The frame being crossfaded */
+	uint32_t *fade;
+	
+	/* A block of silence, returned as the audio */
+	int16_t *audio;
+	size_t audio_samples;
+	
+	/* Frames read per image, and in the crossfade at the end of it */
+	unsigned int dwell;
+	unsigned int fade_frames;
+	
+	/* The image showing and the frames read since it started.
+	 * shown is the image last returned whole, or -1 after a fade */
+	int current;
+	unsigned int frame;
+	int shown;
+} av_image_t;
+
+static int _is_png(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	return(ext && strcasecmp(ext, ".png") == 0);
+}
+
+static int _is_jpeg(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	return(ext && (strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0));
+}
+
+static int _compare_names(const void *a, const void *b)
+{
+	return(strcmp(*(char * const *) a, *(char * const *) b));
+}
+
+/* Decode a PNG and scale it to fit the frame, keeping its shape.
+ * Transparent areas are drawn over black */
+static uint32_t *_load_image(av_image_t *s, char *filename)
+{
+	image_t image = { .name = filename };
+	uint32_t *src, *scaled, *frame;
+	double par;
+	int x, y, w, h, x0, y0;
+	png_bytep px;
+	
+	if(read_png_file(&image) != HACKTV_OK)
+	{
+		return(NULL);
+	}
+	
+	/* The shape of a frame pixel, the images have square pixels */
+	par = ((double) s->ratio.num / s->ratio.den) / ((double) s->width / s->height);
+	
+	h = s->height;
+	w = (double) image.width / image.height * h / par + 0.5;
+	
+	if(w > s->width)
+	{
+		w = s->width;
+		h = (double) image.height / image.width * w * par + 0.5;
+	}
+	
+	if(w < 1) w = 1;
+	if(h < 1) h = 1;
+	
+	src = malloc(sizeof(uint32_t) * image.width * image.height);
+	scaled = malloc(sizeof(uint32_t) * w * h);
+	frame = calloc(s->width * s->height, sizeof(uint32_t));
+	
+	if(src && scaled && frame)
+	{
+		for(y = 0; y < image.height; y++)
+		{
+			for(x = 0; x < image.width; x++)
+			{
+				px = &image.row_pointers[y][x * 4];
+				src[y * image.width + x] =
+					(px[0] * px[3] / 255) << 16 |
+					(px[1] * px[3] / 255) << 8 |
+					(px[2] * px[3] / 255);
+			}
+		}
+	}
+	
+	for(y = 0; y < image.height; y++)
+	{
+		free(image.row_pointers[y]);
+	}
+	
+	free(image.row_pointers);
+	
+	if(!src || !scaled || !frame ||
+	   resize_bitmap(src, scaled, image.width, image.height, w, h) != HACKTV_OK)
+	{
+		free(src);
+		free(scaled);
+		free(frame);
+		return(NULL);
+	}
+	
+	/* Centre the image in the frame */
+	x0 = (s->width - w) / 2;
+	y0 = (s->height - h) / 2;
+	
+	for(y = 0; y < h; y++)
+	{
+		memcpy(&frame[(y0 + y) * s->width + x0], &scaled[y * w], sizeof(uint32_t) * w);
+	}
+	
+	free(src);
+	free(scaled);
+	
+	return(frame);
+}
+
+static int _add_image(av_image_t *s, char *filename)
+{
+	uint32_t *frame;
+	void *p;
+	
+	if(_is_jpeg(filename))
+	{
+		fprintf(stderr, "%s: Only PNG images are supported, skipping\n", filename);
+		return(HACKTV_OK);
+	}
+	
+	frame = _load_image(s, filename);
+	if(!frame)
+	{
+		/* Skip images that can't be read */
+		return(HACKTV_OK);
+	}
+	
+	p = realloc(s->images, sizeof(uint32_t *) * (s->count + 1));
+	if(!p)
+	{
+		free(frame);
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	s->images = p;
+	s->images[s->count++] = frame;
+	
+	return(HACKTV_OK);
+}
+
+/* Load the PNG files in a directory, in name order */
+static int _add_directory(av_image_t *s, char *path)
+{
+	DIR *dir;
+	struct dirent *ent;
+	char filename[PATH_MAX];
+	char **names = NULL;
+	int i, n = 0;
+	int r = HACKTV_OK;
+	void *p;
+	
+	dir = opendir(path);
+	if(!dir)
+	{
+		fprintf(stderr, "%s: ", path);
+		perror("opendir");
+		return(HACKTV_ERROR);
+	}
+	
+	while((ent = readdir(dir)))
+	{
+		/* Skip hidden dot files */
+		if(ent->d_name[0] == '.' || !(_is_png(ent->d_name) || _is_jpeg(ent->d_name)))
+		{
+			continue;
+		}
+		
+		p = realloc(names, sizeof(char *) * (n + 1));
+		if(!p)
+		{
+			r = HACKTV_OUT_OF_MEMORY;
+			break;
+		}
+		
+		names = p;
+		names[n] = strdup(ent->d_name);
+		
+		if(!names[n])
+		{
+			r = HACKTV_OUT_OF_MEMORY;
+			break;
+		}
+		
+		n++;
+	}
+	
+	closedir(dir);
+	
+	qsort(names, n, sizeof(char *), _compare_names);
+	
+	for(i = 0; i < n; i++)
+	{
+		if(r == HACKTV_OK)
+		{
+			snprintf(filename, PATH_MAX, "%s/%s", path, names[i]);
+			r = _add_image(s, filename);
+		}
+		
+		free(names[i]);
+	}
+	
+	free(names);
+	
+	return(r);
+}
+
+/* Blend two frames, b weighted by w out of 256 */
+static void _crossfade(uint32_t *dst, const uint32_t *a, const uint32_t *b, uint32_t w, int length)
+{
+	uint32_t rb, g;
+	int x;
+	
+	for(x = 0; x < length; x++)
+	{
+		rb = ((a[x] & 0xFF00FF) * (256 - w) + (b[x] & 0xFF00FF) * w) >> 8;
+		g = ((a[x] & 0x00FF00) * (256 - w) + (b[x] & 0x00FF00) * w) >> 8;
+		dst[x] = (rb & 0xFF00FF) | (g & 0x00FF00);
+	}
+}
+
+static int _image_read_video(void *ctx, av_frame_t *frame)
+{
+	av_image_t *s = ctx;
+	uint32_t *fb;
+	unsigned int t;
+	int next;
+	
+	if(s->count > 1 && s->frame >= s->dwell)
+	{
+		s->current = (s->current + 1) % s->count;
+		s->frame = 0;
+	}
+	
+	next = (s->current + 1) % s->count;
+	t = s->dwell - s->fade_frames;
+	
+	if(s->count > 1 && s->frame >= t)
+	{
+		/* Crossfade into the next image */
+		_crossfade(s->fade, s->images[s->current], s->images[next],
+			(s->frame - t + 1) * 256 / (s->fade_frames + 1), s->width * s->height);
+		
+		fb = s->fade;
+		s->shown = -1;
+		
+		av_frame_init(frame, s->width, s->height, fb, 1, s->width);
+	}
+	else
+	{
+		fb = s->images[s->current];
+		
+		av_frame_init(frame, s->width, s->height, fb, 1, s->width);
+		frame->unchanged = (s->shown == s->current);
+		
+		s->shown = s->current;
+	}
+	
+	av_set_display_aspect_ratio(frame, s->ratio);
+	
+	/* Hold the image while paused */
+	if(!s->av->paused)
+	{
+		s->frame++;
+	}
+	
+	return(AV_OK);
+}
+
+static int16_t *_image_read_audio(void *ctx, size_t *samples)
+{
+	av_image_t *s = ctx;
+	*samples = s->audio_samples;
+	return(s->audio);
+}
+
+static int _image_close(void *ctx)
+{
+	av_image_t *s = ctx;
+	int i;
+	
+	for(i = 0; i < s->count; i++)
+	{
+		free(s->images[i]);
+	}
+	
+	free(s->images);
+	free(s->fade);
+	free(s->audio);
+	free(s);
+	
+	return(HACKTV_OK);
+}
+
+int av_image_open(av_t *av, char *path, void *ctx)
+{
+	vid_config_t *conf = ctx;
+	av_image_t *s;
+	struct stat fs;
+	double rate;
+	int r;
+	
+	if(path == NULL || *path == '\0')
+	{
+		fprintf(stderr, "No image file or directory given\n");
+		return(HACKTV_ERROR);
+	}
+	
+	if(stat(path, &fs) != 0)
+	{
+		fprintf(stderr, "%s: ", path);
+		perror("stat");
+		return(HACKTV_ERROR);
+	}
+	
+	s = calloc(1, sizeof(av_image_t));
+	if(!s)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	s->av = av;
+	s->width = av->width;
+	s->height = av->height;
+	s->ratio = av->display_aspect_ratios[0];
+	
+	if(s->ratio.num <= 0 || s->ratio.den <= 0)
+	{
+		/* The mode has no aspect ratio set, assume 4:3 */
+		s->ratio = (rational_t) { 4, 3 };
+	}
+	s->shown = -1;
+	
+	if(S_ISDIR(fs.st_mode))
+	{
+		r = _add_directory(s, path);
+	}
+	else
+	{
+		r = _add_image(s, path);
+	}
+	
+	if(r == HACKTV_OK && s->count == 0)
+	{
+		fprintf(stderr, "%s: No images could be loaded\n", path);
+		r = HACKTV_ERROR;
+	}
+	
+	s->fade = malloc(sizeof(uint32_t) * s->width * s->height);
+	
+	/* 100ms of silence */
+	s->audio_samples = av->sample_rate.num / av->sample_rate.den / 10;
+	s->audio = calloc(s->audio_samples * 2 + 2, sizeof(int16_t));
+	
+	if(r == HACKTV_OK && (!s->fade || !s->audio))
+	{
+		r = HACKTV_OUT_OF_MEMORY;
+	}
+	
+	if(r != HACKTV_OK)
+	{
+		_image_close(s);
+		return(r);
+	}
+	
+	/* Images are read at the frame rate, which counts fields when interlaced */
+	rate = (double) av->frame_rate.num / av->frame_rate.den;
+	
+	s->dwell = conf->image_dwell * rate + 0.5;
+	s->fade_frames = conf->image_crossfade * rate + 0.5;
+	
+	if(s->dwell < 1) s->dwell = 1;
+	if(s->fade_frames >= s->dwell) s->fade_frames = s->dwell - 1;
+	
+	av_set_source(av, s, _image_read_video, _image_read_audio, NULL, NULL, _image_close);
+	
+	return(HACKTV_OK);
+}
+
@@ -42,22 +42,23 @@ static int _test_read_video(void *ctx, av_frame_t *frame)
 	av_set_display_aspect_ratio(frame, (rational_t) { 4, 3 });
 
 	/* Get current time */
-	time_t secs = time(0);
-	struct tm *time = localtime(&secs);
-	asprintf(&s->font[TEXT_TIMESTAMP]->text, "%02d:%02d:%02d", time->tm_hour, time->tm_min, time->tm_sec);
+	time_t secs = wall_time();
+	struct tm time;
+	wall_tm(secs, &time);
 
 	/* Print clock */
 	if(s->font[TEXT_TIMESTAMP])
 	{
+		asprintf(&s->font[TEXT_TIMESTAMP]->text, "%02d:%02d:%02d", time.tm_hour, time.tm_min, time.tm_sec);
 		print_generic_text(	s->font[TEXT_TIMESTAMP],
 							s->video,
 							s->font[TEXT_TIMESTAMP]->text,
 							s->font[TEXT_TIMESTAMP]->x_loc, s->font[TEXT_TIMESTAMP]->y_loc, NO_TEXT_SHADOW, TEXT_BOX, 0, 1);
+		
+		/* Free memory */
+		free(s->font[TEXT_TIMESTAMP]->text);
 	}
 	
-	/* Free memory */
-	free(s->font[TEXT_TIMESTAMP]->text);
-	
 	return(AV_OK);
 }
 
@@ -73,6 +74,8 @@ static int _test_close(void *ctx)
 	av_test_t *s = ctx;
 	if(s->video) free(s->video);
 	if(s->audio) free(s->audio);
+	font_free(s->font[TEXT_TIMESTAMP]);
+	font_free(s->font[TEXT_GENERIC]);
 	free(s);
 	return(HACKTV_OK);
 }
@@ -171,14 +174,12 @@ int av_test_open(av_t *av, char *test_screen, void *ctx)
 	/* Initialise default fonts */
 	
 	/* Clock */
-	font_init(av, 56, img_ratio, conf);
-	t->font[TEXT_TIMESTAMP] = av->av_font;
+	font_init(&t->font[TEXT_TIMESTAMP], av, 56, img_ratio, conf);
 	t->font[TEXT_TIMESTAMP]->x_loc = 50;
 	t->font[TEXT_TIMESTAMP]->y_loc = 50;
 	
 	/* HACKTV text*/
-	font_init(av, 72, img_ratio, conf);
-	t->font[TEXT_GENERIC] = av->av_font;
+	font_init(&t->font[TEXT_GENERIC], av, 72, img_ratio, conf);
 	t->font[TEXT_GENERIC]->x_loc = 50;
 	t->font[TEXT_GENERIC]->y_loc = 25;
 	
@@ -276,14 +277,15 @@ int av_test_open(av_t *av, char *test_screen, void *ctx)
 			else if(strcmp(test_screen, "fubk") == 0)
 			{
 				/* Reinit font with new size */
-				font_init(av, 44, img_ratio, conf);
-				t->font[TEXT_TIMESTAMP] = av->av_font;
+				font_free(t->font[TEXT_TIMESTAMP]);
+				font_init(&t->font[TEXT_TIMESTAMP], av, 44, img_ratio, conf);
 				t->font[TEXT_TIMESTAMP]->x_loc = 52;
 				t->font[TEXT_TIMESTAMP]->y_loc = 55.5;
 			}
 			else if(strcmp(test_screen, "ueitm") == 0)
 			{
 				/* Don't display clock */
+				font_free(t->font[TEXT_TIMESTAMP]);
 				t->font[TEXT_TIMESTAMP] = NULL;
 			}
 			
@@ -354,10 +356,7 @@ int av_test_open(av_t *av, char *test_screen, void *ctx)
 	}
 	
 	/* Register the callback functions */
-	av->av_source_ctx = t;
-	av->read_video = _test_read_video;
-	av->read_audio = _test_read_audio;
-	av->close = _test_close;
+	av_set_source(av, t, _test_read_video, _test_read_audio, NULL, NULL, _test_close);
 	
 	return(HACKTV_OK);
 }
\ No newline at end of file
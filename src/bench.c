@@ -0,0 +1,608 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* hacktv-bench - Encoder throughput benchmark
+ *
+ * Renders the built-in test card through every mode in vid_configs[],
+ * at each of a list of sample rates and with each applicable feature,
+ * discarding the output. The throughput, real-time factor and time
+ * spent in each line process are reported for every combination.
+ * 
+ * With --hash the encoder is run with a fixed seed and clock, and a
+ * SHA-256 hash of the output is reported instead. The hashes from a
+ * known good build can be compared against with --check, to confirm
+ * that a change to the encoder has not altered its output. "make check"
+ * compares against tests/golden.txt, and "make golden" rewrites it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <libavutil/sha.h>
+#include "video.h"
+#include "av_test.h"
+#include "rf.h"
+#include "pool.h"
+
+/* Seed and clock used with --hash */
+#define BENCH_SEED 1
+#define BENCH_TIME 946684800 /* 2000-01-01 00:00:00 UTC */
+
+typedef struct {
+	const char *id;
+	int (*apply)(vid_config_t *conf);
+} _feature_t;
+
+typedef struct {
+	int frames;
+	int json;
+	int hash;
+	FILE *check;
+	int failed;
+	const char *mode;
+	const char *features;
+	char *teletext;
+	int nrates;
+	unsigned int rates[16];
+} _bench_t;
+
+static _bench_t _bench;
+
+static int _base(vid_config_t *conf)
+{
+	return(1);
+}
+
+static int _vfilter(vid_config_t *conf)
+{
+	conf->vfilter = 1;
+	return(1);
+}
+
+static int _nonicam(vid_config_t *conf)
+{
+	if(conf->nicam_level <= 0 || conf->nicam_carrier == 0) return(0);
+	
+	conf->nicam_level = 0;
+	conf->nicam_carrier = 0;
+	
+	return(1);
+}
+
+static int _a2stereo(vid_config_t *conf)
+{
+	if(conf->fm_mono_level <= 0 || conf->fm_mono_carrier == 0) return(0);
+	
+	conf->a2stereo = 1;
+	
+	return(1);
+}
+
+static int _teletext(vid_config_t *conf)
+{
+	if(conf->lines != 625 || _bench.teletext == NULL) return(0);
+	
+	conf->teletext = _bench.teletext;
+	
+	return(1);
+}
+
+static int _videocrypt(vid_config_t *conf)
+{
+	if(conf->type != VID_RASTER_625 || conf->colour_mode != VID_PAL) return(0);
+	
+	conf->videocrypt = "free";
+	
+	return(1);
+}
+
+static int _syster(vid_config_t *conf)
+{
+	if(conf->type != VID_RASTER_625 || conf->colour_mode != VID_PAL) return(0);
+	
+	conf->syster = "premiere-fa";
+	
+	return(1);
+}
+
+static int _videocrypt2(vid_config_t *conf)
+{
+	if(conf->type != VID_RASTER_625 || conf->colour_mode != VID_PAL) return(0);
+	
+	conf->videocrypt2 = "free";
+	
+	return(1);
+}
+
+static int _videocrypts(vid_config_t *conf)
+{
+	if(conf->type != VID_RASTER_625 || conf->colour_mode != VID_PAL) return(0);
+	
+	conf->videocrypts = "free";
+	
+	return(1);
+}
+
+static int _eurocrypt(vid_config_t *conf)
+{
+	if(conf->type != VID_MAC) return(0);
+	
+	conf->eurocrypt = "filmnet";
+	
+	if(conf->scramble_video == 0)
+	{
+		conf->scramble_video = 1;
+	}
+	
+	return(1);
+}
+
+static int _wss(vid_config_t *conf)
+{
+	if(conf->lines != 625) return(0);
+	
+	conf->wss = "16:9";
+	
+	return(1);
+}
+
+static int _acp(vid_config_t *conf)
+{
+	if(conf->lines != 625 && conf->lines != 525) return(0);
+	
+	conf->acp = 1;
+	
+	return(1);
+}
+
+static int _vits(vid_config_t *conf)
+{
+	if(conf->type != VID_RASTER_625 && conf->type != VID_RASTER_525) return(0);
+	
+	conf->vits = 1;
+	
+	return(1);
+}
+
+static int _vitc(vid_config_t *conf)
+{
+	if(conf->type != VID_RASTER_625 && conf->type != VID_RASTER_525) return(0);
+	
+	conf->vitc = 1;
+	
+	return(1);
+}
+
+static int _interlace(vid_config_t *conf)
+{
+	if(conf->type != VID_RASTER_625 && conf->type != VID_RASTER_525) return(0);
+	
+	conf->interlace = 1;
+	
+	return(1);
+}
+
+static const _feature_t _features[] = {
+	{ "base",        _base },
+	{ "vfilter",     _vfilter },
+	{ "nonicam",     _nonicam },
+	{ "a2stereo",    _a2stereo },
+	{ "teletext",    _teletext },
+	{ "videocrypt",  _videocrypt },
+	{ "syster",      _syster },
+	{ "videocrypt2", _videocrypt2 },
+	{ "videocrypts", _videocrypts },
+	{ "eurocrypt",   _eurocrypt },
+	{ "wss",         _wss },
+	{ "acp",         _acp },
+	{ "vits",        _vits },
+	{ "vitc",        _vitc },
+	{ "interlace",   _interlace },
+	{ NULL, NULL },
+};
+
+static int _in_list(const char *list, const char *id)
+{
+	size_t l = strlen(id);
+	const char *p;
+	
+	if(list == NULL)
+	{
+		return(1);
+	}
+	
+	for(p = list; (p = strstr(p, id)) != NULL; p += l)
+	{
+		if((p == list || p[-1] == ',') && (p[l] == '\0' || p[l] == ','))
+		{
+			return(1);
+		}
+	}
+	
+	return(0);
+}
+
+static void _print_result(vid_t *s, const char *mode, unsigned int rate, const char *feature, uint64_t samples, uint64_t elapsed)
+{
+	double sps = elapsed ? samples * 1e9 / elapsed : 0;
+	double rtf = sps / rate;
+	int i, n;
+	
+	if(_bench.json)
+	{
+		printf("{\"mode\":\"%s\",\"sample_rate\":%u,\"feature\":\"%s\",\"samples\":%llu,\"elapsed_ns\":%llu,\"samples_per_second\":%.0f,\"realtime_factor\":%.3f,\"stages\":[",
+			mode, rate, feature,
+			(unsigned long long) samples,
+			(unsigned long long) elapsed,
+			sps, rtf
+		);
+		
+		for(n = i = 0; i < s->nprocesses; i++)
+		{
+			if(s->processes[i].process == NULL) continue;
+			
+			printf("%s{\"name\":\"%s\",\"calls\":%llu,\"ns\":%llu}",
+				n++ ? "," : "",
+				s->processes[i].name,
+				(unsigned long long) s->processes[i].stat.calls,
+				(unsigned long long) s->processes[i].stat.ns
+			);
+		}
+		
+		printf(",{\"name\":\"av_read_video\",\"calls\":%llu,\"ns\":%llu}",
+			(unsigned long long) s->av_video_stat.calls,
+			(unsigned long long) s->av_video_stat.ns
+		);
+		
+		printf("]}\n");
+	}
+	else
+	{
+		printf("%-14s %9u %-11s %8.2f %7.2fx ",
+			mode, rate, feature,
+			sps / 1e6, rtf
+		);
+		
+		for(i = 0; i < s->nprocesses; i++)
+		{
+			if(s->processes[i].process == NULL) continue;
+			
+			printf(" %s:%.0f%%",
+				s->processes[i].name,
+				elapsed ? 100.0 * s->processes[i].stat.ns / elapsed : 0.0
+			);
+		}
+		
+		printf("\n");
+	}
+	
+	fflush(stdout);
+}
+
+static void _print_hash(const char *mode, unsigned int rate, const char *feature, const char *hash)
+{
+	char line[256], m[64], f[64], h[80];
+	unsigned int r;
+	const char *result = "";
+	
+	if(_bench.check)
+	{
+		/* Find the expected hash for this test */
+		result = "missing";
+		rewind(_bench.check);
+		
+		while(fgets(line, sizeof(line), _bench.check))
+		{
+			if(sscanf(line, "%63s %u %63s %79s", m, &r, f, h) == 4 &&
+			   strcmp(m, mode) == 0 && r == rate && strcmp(f, feature) == 0)
+			{
+				result = strcmp(h, hash) == 0 ? "ok" : "FAILED";
+				break;
+			}
+		}
+		
+		if(strcmp(result, "ok") != 0)
+		{
+			_bench.failed++;
+		}
+	}
+	
+	if(_bench.json)
+	{
+		printf("{\"mode\":\"%s\",\"sample_rate\":%u,\"feature\":\"%s\",\"sha256\":\"%s\"%s%s%s}\n",
+			mode, rate, feature, hash,
+			*result ? ",\"check\":\"" : "", result, *result ? "\"" : ""
+		);
+	}
+	else
+	{
+		printf("%-14s %9u %-11s %s%s%s\n", mode, rate, feature, hash, *result ? " " : "", result);
+	}
+	
+	fflush(stdout);
+}
+
+static void _print_skipped(const char *mode, unsigned int rate, const char *feature)
+{
+	if(_bench.json)
+	{
+		printf("{\"mode\":\"%s\",\"sample_rate\":%u,\"feature\":\"%s\",\"error\":\"init failed\"}\n",
+			mode, rate, feature
+		);
+	}
+	else
+	{
+		printf("%-14s %9u %-11s  (init failed)\n", mode, rate, feature);
+	}
+	
+	fflush(stdout);
+}
+
+static void _run(const vid_configs_t *vc, unsigned int rate, const _feature_t *f)
+{
+	static vid_t s;
+	vid_config_t conf = *vc->conf;
+	uint64_t start, elapsed, samples = 0;
+	struct AVSHA *sha = NULL;
+	uint8_t digest[32];
+	char hash[65];
+	int16_t *data;
+	size_t n;
+	int lines, i;
+	
+	if(!f->apply(&conf))
+	{
+		/* Feature doesn't apply to this mode */
+		return;
+	}
+	
+	conf.stats = 1;
+	
+	if(_bench.hash)
+	{
+		conf.seed = BENCH_SEED;
+		conf.fixed_time = BENCH_TIME;
+		
+		sha = av_sha_alloc();
+		if(!sha)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(-1);
+		}
+		
+		av_sha_init(sha, 256);
+	}
+	
+	if(vid_init(&s, rate, 0, &conf) != VID_OK)
+	{
+		av_free(sha);
+		_print_skipped(vc->id, rate, f->id);
+		return;
+	}
+	
+	vid_av_init(&s, AV_FIT_STRETCH, (rational_t) { 0, 0 }, (rational_t) { 0, 0 });
+	
+	if(av_test_open(&s.av, "colourbars", &s.conf) != AV_OK)
+	{
+		vid_free(&s);
+		av_free(sha);
+		_print_skipped(vc->id, rate, f->id);
+		return;
+	}
+	
+	start = monotonic_ns();
+	
+	for(lines = _bench.frames * s.conf.lines; lines > 0; lines--)
+	{
+		data = vid_next_line(&s, &n);
+		if(data == NULL) break;
+		samples += n;
+		
+		if(sha)
+		{
+			/* The output buffer is always I/Q pairs,
+			 * Q is only valid for complex modes */
+			if(s.conf.output_type == RF_INT16_COMPLEX)
+			{
+				av_sha_update(sha, (const uint8_t *) data, n * sizeof(int16_t) * 2);
+			}
+			else
+			{
+				for(i = 0; i < n; i++)
+				{
+					av_sha_update(sha, (const uint8_t *) &data[i * 2], sizeof(int16_t));
+				}
+			}
+		}
+	}
+	
+	elapsed = monotonic_ns() - start;
+	
+	if(sha)
+	{
+		av_sha_final(sha, digest);
+		av_free(sha);
+		
+		for(i = 0; i < 32; i++)
+		{
+			sprintf(&hash[i * 2], "%02x", digest[i]);
+		}
+		
+		_print_hash(vc->id, rate, f->id, hash);
+	}
+	else
+	{
+		_print_result(&s, vc->id, rate, f->id, samples, elapsed);
+	}
+	
+	vid_free(&s);
+}
+
+static void _print_usage(void)
+{
+	printf(
+		"\n"
+		"Usage: hacktv-bench [options]\n"
+		"\n"
+		"  -m, --mode <id[,id...]>        Only benchmark these modes. Default: all\n"
+		"  -s, --samplerate <hz[,hz...]>  Sample rates to test. Default: 13500000,16000000,20250000\n"
+		"  -f, --frames <n>               Frames rendered for each test. Default: 25\n"
+		"  -F, --features <list>          Features to test. Default: all\n"
+		"  -t, --threads <n>              Number of threads sharing the parallel work.\n"
+		"                                 Default: 1. 0 uses one per CPU.\n"
+		"      --teletext <path>          Teletext source for the teletext tests.\n"
+		"      --json                     Output one JSON object per test.\n"
+		"      --hash                     Report a SHA-256 hash of the output of each test,\n"
+		"                                 using a fixed seed and clock.\n"
+		"      --check <file>             Compare the hashes against those in a file\n"
+		"                                 previously saved from --hash. Implies --hash.\n"
+		"\n"
+		"Features: base, vfilter, nonicam, a2stereo, teletext, videocrypt, syster,\n"
+		"          videocrypt2, videocrypts, eurocrypt, wss, acp, vits, vitc, interlace\n"
+		"\n"
+		"Features are only tested with the modes that support them. The teletext\n"
+		"tests are skipped if no --teletext source is given.\n"
+		"\n"
+	);
+}
+
+int main(int argc, char *argv[])
+{
+	const vid_configs_t *vc;
+	const _feature_t *f;
+	char *p;
+	int c, r;
+	static struct option long_options[] = {
+		{ "mode",       required_argument, 0, 'm' },
+		{ "samplerate", required_argument, 0, 's' },
+		{ "frames",     required_argument, 0, 'f' },
+		{ "features",   required_argument, 0, 'F' },
+		{ "threads",    required_argument, 0, 't' },
+		{ "teletext",   required_argument, 0, 'T' },
+		{ "json",       no_argument,       0, 'j' },
+		{ "hash",       no_argument,       0, 'H' },
+		{ "check",      required_argument, 0, 'C' },
+		{ "help",       no_argument,       0, 'h' },
+		{ 0,            0,                 0,  0  }
+	};
+	
+	_bench.frames = 25;
+	_bench.nrates = 3;
+	_bench.rates[0] = 13500000;
+	_bench.rates[1] = 16000000;
+	_bench.rates[2] = 20250000;
+	
+	while((c = getopt_long(argc, argv, "m:s:f:F:t:h", long_options, NULL)) != -1)
+	{
+		switch(c)
+		{
+		case 'm': /* -m, --mode <id[,id...]> */
+			_bench.mode = optarg;
+			break;
+		
+		case 's': /* -s, --samplerate <hz[,hz...]> */
+			_bench.nrates = 0;
+			for(p = optarg; *p && _bench.nrates < 16; p++)
+			{
+				_bench.rates[_bench.nrates++] = strtol(p, &p, 10);
+				if(*p != ',') break;
+			}
+			break;
+		
+		case 'f': /* -f, --frames <n> */
+			_bench.frames = atoi(optarg);
+			break;
+		
+		case 'F': /* -F, --features <list> */
+			_bench.features = optarg;
+			break;
+		
+		case 't': /* -t, --threads <n> */
+			if(pool_set_threads(atoi(optarg)) != 0)
+			{
+				fprintf(stderr, "Invalid number of threads '%s'\n", optarg);
+				return(-1);
+			}
+			break;
+		
+		case 'T': /* --teletext <path> */
+			_bench.teletext = optarg;
+			break;
+		
+		case 'j': /* --json */
+			_bench.json = 1;
+			break;
+		
+		case 'H': /* --hash */
+			_bench.hash = 1;
+			break;
+		
+		case 'C': /* --check <file> */
+			_bench.check = fopen(optarg, "r");
+			if(!_bench.check)
+			{
+				perror(optarg);
+				return(-1);
+			}
+			_bench.hash = 1;
+			break;
+		
+		case 'h': /* -h, --help */
+			_print_usage();
+			return(0);
+		
+		case '?':
+			_print_usage();
+			return(-1);
+		}
+	}
+	
+	if(!_bench.json && !_bench.hash)
+	{
+		printf("%-14s %9s %-11s %8s %8s  %s\n", "mode", "rate", "feature", "Msps", "realtime", "stages");
+	}
+	
+	for(vc = vid_configs; vc->id != NULL; vc++)
+	{
+		if(!_in_list(_bench.mode, vc->id)) continue;
+		
+		for(r = 0; r < _bench.nrates; r++)
+		{
+			for(f = _features; f->id != NULL; f++)
+			{
+				if(!_in_list(_bench.features, f->id)) continue;
+				
+				_run(vc, _bench.rates[r], f);
+			}
+		}
+	}
+	
+	if(_bench.check)
+	{
+		fclose(_bench.check);
+		
+		if(_bench.failed)
+		{
+			fprintf(stderr, "%d test%s did not match\n", _bench.failed, _bench.failed == 1 ? "" : "s");
+			return(1);
+		}
+	}
+	
+	return(0);
+}
+
@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
 #include "common.h"
 
 int64_t gcd(int64_t a, int64_t b)
@@ -33,6 +34,58 @@ int64_t gcd(int64_t a, int64_t b)
 	return(b);
 }
 
+uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* When set, wall_time() returns this instead of the system clock */
+static time_t _fixed_time = 0;
+
+void set_fixed_time(time_t t)
+{
+	_fixed_time = t;
+}
+
+time_t wall_time(void)
+{
+	return(_fixed_time ? _fixed_time : time(NULL));
+}
+
+struct tm *wall_tm(time_t t, struct tm *tm)
+{
+	/* Local time, or UTC with a fixed clock so the
+	 * output doesn't depend on the TZ setting */
+#ifndef WIN32
+	return(_fixed_time ? gmtime_r(&t, tm) : localtime_r(&t, tm));
+#else
+	return((_fixed_time ? gmtime_s(tm, &t) : localtime_s(tm, &t)) == 0 ? tm : NULL);
+#endif
+}
+
+long wall_gmtoff(time_t t)
+{
+	struct tm tm;
+	
+	/* Seconds east of UTC for the local time at t */
+	if(_fixed_time)
+	{
+		return(0);
+	}
+	
+#ifndef WIN32
+	localtime_r(&t, &tm);
+	return(tm.tm_gmtoff);
+#else
+	localtime_s(&tm, &t);
+	return(-_timezone);
+#endif
+}
+
 rational_t rational_mul(rational_t a, rational_t b)
 {
 	int64_t c, d, e;
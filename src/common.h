@@ -19,6 +19,7 @@
 #define _COMMON_H
 
 #include <stdint.h>
+#include <time.h>
 
 /* These factors where calculated with: f = M_PI / 2.0 / asin(0.9 - 0.1); */
 #define RT1090 1.6939549523182869 /* Factor to convert 10-90% rise time to 0-100% */
@@ -40,6 +41,11 @@ typedef struct {
 } cint32_t;
 
 extern int64_t gcd(int64_t a, int64_t b);
+extern uint64_t monotonic_ns(void);
+extern void set_fixed_time(time_t t);
+extern time_t wall_time(void);
+extern struct tm *wall_tm(time_t t, struct tm *tm);
+extern long wall_gmtoff(time_t t);
 extern rational_t rational_mul(rational_t a, rational_t b);
 extern rational_t rational_div(rational_t a, rational_t b);
 extern int rational_cmp(rational_t a, rational_t b);
@@ -0,0 +1,633 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Control of a running hacktv from a UNIX domain socket and the terminal.
+ *
+ * A thread reads commands, one per line, and replies "OK" once a command
+ * is queued or "ERROR <reason>" if it can't be. The render thread takes
+ * the queued commands with control_next() between lines, so nothing here
+ * touches the encoder or the source. Any slow preparation is done by the
+ * caller's prepare function, on this thread. The commands are:
+ *
+ *   pause, resume, toggle
+ *   next, previous
+ *   seek <seconds>, seek +<seconds>, seek -<seconds>
+ *   level <value>
+ *   volume <value>
+ *   teletext <file>
+ *   enable <feature> [<argument>], disable <feature>
+ *
+ * On the terminal the space bar toggles pause, the left and right arrow
+ * keys seek 10 seconds and the up and down arrow keys 60 seconds.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "control.h"
+#include "keyboard.h"
+#include "affinity.h"
+
+#ifndef WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#else
+#include <conio.h>
+#include <windows.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Seek steps for the arrow keys, in seconds */
+#define _SEEK_SHORT 10
+#define _SEEK_LONG  60
+
+static const char *_parse_value(double *v, const char *arg)
+{
+	char *e;
+	
+	*v = strtod(arg, &e);
+	
+	return(e == arg || *e != '\0' ? "Invalid value" : NULL);
+}
+
+static const char *_parse(control_msg_t *m, char *line)
+{
+	char *cmd, *arg, *e;
+	
+	/* Split the command from its argument, trimming white space */
+	cmd = line + strspn(line, " \t");
+	arg = cmd + strcspn(cmd, " \t\r");
+	
+	if(*arg != '\0')
+	{
+		*arg++ = '\0';
+		arg += strspn(arg, " \t");
+	}
+	
+	for(e = arg + strlen(arg); e > arg && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r'); e--);
+	*e = '\0';
+	
+	m->value = 0;
+	m->relative = 0;
+	m->arg[0] = '\0';
+	m->data = NULL;
+	m->release = NULL;
+	
+	if(strcmp(cmd, "pause") == 0 || strcmp(cmd, "resume") == 0 || strcmp(cmd, "toggle") == 0)
+	{
+		m->command = CONTROL_PAUSE;
+		m->value = cmd[0] == 'p' ? 1 : (cmd[0] == 'r' ? 0 : -1);
+	}
+	else if(strcmp(cmd, "next") == 0)
+	{
+		m->command = CONTROL_NEXT;
+	}
+	else if(strcmp(cmd, "previous") == 0)
+	{
+		m->command = CONTROL_PREVIOUS;
+	}
+	else if(strcmp(cmd, "seek") == 0)
+	{
+		/* A sign makes the seek relative to the current position */
+		m->command = CONTROL_SEEK;
+		m->relative = (*arg == '+' || *arg == '-');
+		return(_parse_value(&m->value, arg));
+	}
+	else if(strcmp(cmd, "level") == 0 || strcmp(cmd, "volume") == 0)
+	{
+		m->command = cmd[0] == 'l' ? CONTROL_LEVEL : CONTROL_VOLUME;
+		
+		if(_parse_value(&m->value, arg) != NULL || m->value < 0)
+		{
+			return("Invalid value");
+		}
+	}
+	else if(strcmp(cmd, "teletext") == 0)
+	{
+		if(*arg == '\0')
+		{
+			return("Missing file name");
+		}
+		
+		m->command = CONTROL_TELETEXT;
+		strcpy(m->arg, arg);
+	}
+	else if(strcmp(cmd, "enable") == 0 || strcmp(cmd, "disable") == 0)
+	{
+		if(*arg == '\0')
+		{
+			return("Missing feature name");
+		}
+		
+		m->command = cmd[0] == 'e' ? CONTROL_ENABLE : CONTROL_DISABLE;
+		strcpy(m->arg, arg);
+	}
+	else
+	{
+		return("Unknown command");
+	}
+	
+	return(NULL);
+}
+
+static int _push(control_t *s, const control_msg_t *m)
+{
+	int r = CONTROL_ERROR;
+	
+	pthread_mutex_lock(&s->mutex);
+	
+	if(s->count < CONTROL_QUEUE)
+	{
+		s->queue[(s->head + s->count) % CONTROL_QUEUE] = *m;
+		__atomic_store_n(&s->count, s->count + 1, __ATOMIC_RELEASE);
+		r = CONTROL_OK;
+	}
+	
+	pthread_mutex_unlock(&s->mutex);
+	
+	return(r);
+}
+
+static void _key(control_t *s, int c)
+{
+	control_msg_t m;
+	
+	/* Arrow keys arrive as ESC [ A to D */
+	if(s->esc == 1)
+	{
+		s->esc = (c == '[') ? 2 : 0;
+		return;
+	}
+	
+	m.relative = 1;
+	m.arg[0] = '\0';
+	m.data = NULL;
+	m.release = NULL;
+	
+	if(s->esc == 2)
+	{
+		s->esc = 0;
+		m.command = CONTROL_SEEK;
+		
+		switch(c)
+		{
+		case 'A': m.value = _SEEK_LONG; break;
+		case 'B': m.value = -_SEEK_LONG; break;
+		case 'C': m.value = _SEEK_SHORT; break;
+		case 'D': m.value = -_SEEK_SHORT; break;
+		default: return;
+		}
+	}
+	else if(c == 0x1B)
+	{
+		s->esc = 1;
+		return;
+	}
+	else if(c == ' ')
+	{
+		m.command = CONTROL_PAUSE;
+		m.value = -1;
+	}
+	else
+	{
+		return;
+	}
+	
+	_push(s, &m);
+}
+
+#ifndef WIN32
+
+static void _reply(control_client_t *c, const char *error)
+{
+	char buf[64];
+	int n;
+	
+	n = snprintf(buf, sizeof(buf), error ? "ERROR %s\n" : "OK\n", error);
+	
+	/* Replies are short. A client not reading them may lose some */
+	send(c->fd, buf, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+static void _command(control_t *s, control_client_t *c, char *line)
+{
+	control_msg_t m;
+	const char *error;
+	
+	if(line[strspn(line, " \t\r")] == '\0')
+	{
+		/* Ignore blank lines */
+		return;
+	}
+	
+	error = _parse(&m, line);
+	
+	if(error == NULL && s->prepare)
+	{
+		error = s->prepare(s->user, &m);
+	}
+	
+	if(error != NULL || m.command == CONTROL_ENABLE || m.command == CONTROL_DISABLE)
+	{
+		/* Features are changed by the prepare function,
+		 * there is nothing left for the render thread */
+		_reply(c, error);
+		return;
+	}
+	
+	if(_push(s, &m) != CONTROL_OK)
+	{
+		error = "Too many commands waiting";
+		
+		if(m.release)
+		{
+			m.release(m.data);
+		}
+	}
+	
+	_reply(c, error);
+}
+
+static int _client_read(control_t *s, control_client_t *c)
+{
+	ssize_t n;
+	char *nl;
+	
+	n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+	
+	if(n <= 0)
+	{
+		/* Closed by the client, or failed */
+		return(n < 0 && errno == EINTR ? 0 : -1);
+	}
+	
+	c->len += n;
+	
+	while((nl = memchr(c->buf, '\n', c->len)) != NULL)
+	{
+		*nl = '\0';
+		_command(s, c, c->buf);
+		
+		c->len -= nl + 1 - c->buf;
+		memmove(c->buf, nl + 1, c->len);
+	}
+	
+	if(c->len == sizeof(c->buf))
+	{
+		_reply(c, "Line too long");
+		c->len = 0;
+	}
+	
+	return(0);
+}
+
+static void _accept(control_t *s)
+{
+	int i, fd;
+	
+	fd = accept(s->fd, NULL, NULL);
+	if(fd < 0)
+	{
+		return;
+	}
+	
+	for(i = 0; i < CONTROL_CLIENTS; i++)
+	{
+		if(s->clients[i].fd < 0)
+		{
+			s->clients[i].fd = fd;
+			s->clients[i].len = 0;
+			return;
+		}
+	}
+	
+	send(fd, "ERROR Too many connections\n", 27, MSG_NOSIGNAL | MSG_DONTWAIT);
+	close(fd);
+}
+
+static void *_control_thread(void *arg)
+{
+	control_t *s = arg;
+	struct pollfd fds[3 + CONTROL_CLIENTS];
+	int client[3 + CONTROL_CLIENTS];
+	unsigned char keys[16];
+	int keyboard = s->keyboard;
+	int i, j, n, r;
+	
+	affinity_apply(AFFINITY_INPUT);
+	
+	for(;;)
+	{
+		n = 0;
+		
+		fds[n] = (struct pollfd) { s->wake[0], POLLIN, 0 };
+		client[n++] = -1;
+		
+		if(s->fd >= 0)
+		{
+			fds[n] = (struct pollfd) { s->fd, POLLIN, 0 };
+			client[n++] = -1;
+		}
+		
+		if(keyboard)
+		{
+			fds[n] = (struct pollfd) { STDIN_FILENO, POLLIN, 0 };
+			client[n++] = -1;
+		}
+		
+		for(i = 0; i < CONTROL_CLIENTS; i++)
+		{
+			if(s->clients[i].fd >= 0)
+			{
+				fds[n] = (struct pollfd) { s->clients[i].fd, POLLIN, 0 };
+				client[n++] = i;
+			}
+		}
+		
+		if(poll(fds, n, -1) < 0)
+		{
+			if(errno == EINTR) continue;
+			break;
+		}
+		
+		for(i = 0; i < n; i++)
+		{
+			if(fds[i].revents == 0)
+			{
+				continue;
+			}
+			
+			if(client[i] >= 0)
+			{
+				if(_client_read(s, &s->clients[client[i]]) != 0)
+				{
+					close(s->clients[client[i]].fd);
+					s->clients[client[i]].fd = -1;
+				}
+			}
+			else if(fds[i].fd == s->wake[0])
+			{
+				/* control_close() has been called */
+				return(NULL);
+			}
+			else if(fds[i].fd == s->fd)
+			{
+				_accept(s);
+			}
+			else
+			{
+				r = read(STDIN_FILENO, keys, sizeof(keys));
+				
+				if(r <= 0 && !(r < 0 && errno == EINTR))
+				{
+					/* The terminal has gone away */
+					keyboard = 0;
+				}
+				
+				for(j = 0; j < r; j++)
+				{
+					_key(s, keys[j]);
+				}
+			}
+		}
+	}
+	
+	return(NULL);
+}
+
+static int _listen(control_t *s, const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "%s: Control socket path is too long\n", path);
+		return(CONTROL_ERROR);
+	}
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	
+	/* Remove a socket left behind by an earlier run,
+	 * but nothing else that might be at the path */
+	if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+	{
+		unlink(path);
+	}
+	
+	s->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	
+	if(s->fd < 0 ||
+	   bind(s->fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+	   listen(s->fd, CONTROL_CLIENTS) != 0)
+	{
+		fprintf(stderr, "%s: ", path);
+		perror("Control socket");
+		return(CONTROL_ERROR);
+	}
+	
+	s->path = strdup(path);
+	
+	return(s->path ? CONTROL_OK : CONTROL_OUT_OF_MEMORY);
+}
+
+#else
+
+static void *_control_thread(void *arg)
+{
+	control_t *s = arg;
+	int c;
+	
+	affinity_apply(AFFINITY_INPUT);
+	
+	/* Only the terminal is available here, it's polled */
+	while(!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE))
+	{
+		while(_kbhit())
+		{
+			c = getch();
+			
+			if(c == 0 || c == 0xE0)
+			{
+				/* Arrow keys arrive as a prefix and H, P, M or K */
+				c = getch();
+				c = c == 'H' ? 'A' : c == 'P' ? 'B' : c == 'M' ? 'C' : c == 'K' ? 'D' : 0;
+				
+				_key(s, 0x1B);
+				_key(s, '[');
+			}
+			
+			_key(s, c);
+		}
+		
+		Sleep(20);
+	}
+	
+	return(NULL);
+}
+
+static int _listen(control_t *s, const char *path)
+{
+	fprintf(stderr, "The control socket is not supported on this platform.\n");
+	return(CONTROL_ERROR);
+}
+
+#endif
+
+int control_open(control_t *s, const char *path, int keyboard, control_prepare_t prepare, void *user)
+{
+	int i, r;
+	
+	memset(s, 0, sizeof(control_t));
+	
+	s->prepare = prepare;
+	s->user = user;
+	s->fd = -1;
+	s->wake[0] = s->wake[1] = -1;
+	
+	for(i = 0; i < CONTROL_CLIENTS; i++)
+	{
+		s->clients[i].fd = -1;
+	}
+	
+	pthread_mutex_init(&s->mutex, NULL);
+
+#ifndef WIN32
+	if(pipe(s->wake) != 0)
+	{
+		perror("pipe");
+		control_close(s);
+		return(CONTROL_ERROR);
+	}
+#endif
+	
+	if(path != NULL && (r = _listen(s, path)) != CONTROL_OK)
+	{
+		control_close(s);
+		return(r);
+	}
+	
+	if(keyboard)
+	{
+		/* Unbuffered keys without echo, until control_close() */
+		kb_enable();
+		s->keyboard = 1;
+	}
+	
+	s->started = pthread_create(&s->thread, NULL, &_control_thread, s) == 0;
+	
+	if(!s->started)
+	{
+		fprintf(stderr, "Error starting the control thread.\n");
+		control_close(s);
+		return(CONTROL_ERROR);
+	}
+	
+	return(CONTROL_OK);
+}
+
+int control_next(control_t *s, control_msg_t *msg)
+{
+	/* Cheap enough to call for every line */
+	if(__atomic_load_n(&s->count, __ATOMIC_ACQUIRE) == 0)
+	{
+		return(0);
+	}
+	
+	pthread_mutex_lock(&s->mutex);
+	
+	*msg = s->queue[s->head];
+	s->head = (s->head + 1) % CONTROL_QUEUE;
+	__atomic_store_n(&s->count, s->count - 1, __ATOMIC_RELEASE);
+	
+	pthread_mutex_unlock(&s->mutex);
+	
+	return(1);
+}
+
+void control_close(control_t *s)
+{
+	int i;
+	
+	if(s->started)
+	{
+		/* Wake the thread and wait for it to finish */
+		__atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+		
+		if(s->wake[1] >= 0)
+		{
+			write(s->wake[1], "", 1);
+		}
+		
+		pthread_join(s->thread, NULL);
+		s->started = 0;
+	}
+	
+	if(s->keyboard)
+	{
+		kb_disable();
+		s->keyboard = 0;
+	}
+	
+	for(i = 0; i < CONTROL_CLIENTS; i++)
+	{
+		if(s->clients[i].fd >= 0) close(s->clients[i].fd);
+		s->clients[i].fd = -1;
+	}
+	
+	if(s->fd >= 0)
+	{
+		close(s->fd);
+		s->fd = -1;
+	}
+	
+	if(s->path)
+	{
+		unlink(s->path);
+		free(s->path);
+		s->path = NULL;
+	}
+	
+	if(s->wake[0] >= 0) close(s->wake[0]);
+	if(s->wake[1] >= 0) close(s->wake[1]);
+	s->wake[0] = s->wake[1] = -1;
+	
+	/* Release anything prepared for commands never taken */
+	for(; s->count > 0; s->count--)
+	{
+		control_msg_t *m = &s->queue[s->head];
+		
+		if(m->release)
+		{
+			m->release(m->data);
+		}
+		
+		s->head = (s->head + 1) % CONTROL_QUEUE;
+	}
+	
+	pthread_mutex_destroy(&s->mutex);
+}
+
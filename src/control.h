@@ -0,0 +1,106 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+#include <pthread.h>
+
+/* Return codes */
+#define CONTROL_OK             0
+#define CONTROL_ERROR         -1
+#define CONTROL_OUT_OF_MEMORY -2
+
+/* Limits */
+#define CONTROL_CLIENTS 8	/* Connections to the socket at once */
+#define CONTROL_QUEUE   64	/* Commands waiting for the render thread */
+#define CONTROL_LINE    1024	/* Longest command line, with the newline */
+
+/* Commands */
+typedef enum {
+	CONTROL_PAUSE,		/* value: 1 to pause, 0 to resume, -1 to toggle */
+	CONTROL_NEXT,		/* Skip to the next source */
+	CONTROL_PREVIOUS,	/* Go back to the previous source */
+	CONTROL_SEEK,		/* value: seconds, from the current position if relative */
+	CONTROL_LEVEL,		/* value: output level, as --level */
+	CONTROL_VOLUME,		/* value: audio volume, as --volume */
+	CONTROL_TELETEXT,	/* arg: a TTI file of pages to add or replace */
+	CONTROL_ENABLE,		/* arg: a feature name and its argument, if any */
+	CONTROL_DISABLE,	/* arg: a feature name */
+} control_command_t;
+
+typedef struct {
+	control_command_t command;
+	double value;
+	int relative;
+	char arg[CONTROL_LINE];
+	
+	/* Anything made for the command by the prepare function. It's
+	 * passed to release() if the command is dropped before it's
+	 * taken by control_next(), after that it belongs to the caller */
+	void *data;
+	void (*release)(void *data);
+} control_msg_t;
+
+/* Called on the control thread for each command from the socket, before
+ * it is queued. Work that would stall the render thread is done here.
+ * Returns NULL, or the reason the command failed */
+typedef const char *(*control_prepare_t)(void *user, control_msg_t *m);
+
+typedef struct {
+	int fd;
+	size_t len;
+	char buf[CONTROL_LINE];
+} control_client_t;
+
+typedef struct {
+	
+	/* The listening socket and its path, or -1 and NULL */
+	int fd;
+	char *path;
+	
+	/* Called for each command before it is queued */
+	control_prepare_t prepare;
+	void *user;
+	
+	/* Keys are read from the terminal if non-zero */
+	int keyboard;
+	int esc;
+	
+	/* Connected clients, fd -1 for unused slots */
+	control_client_t clients[CONTROL_CLIENTS];
+	
+	/* The control thread, and a pipe written to stop it */
+	pthread_t thread;
+	int started;
+	int stop;
+	int wake[2];
+	
+	/* Commands waiting for the render thread */
+	pthread_mutex_t mutex;
+	control_msg_t queue[CONTROL_QUEUE];
+	int head;
+	int count;
+	
+} control_t;
+
+extern int control_open(control_t *s, const char *path, int keyboard, control_prepare_t prepare, void *user);
+extern int control_next(control_t *s, control_msg_t *msg);
+extern void control_close(control_t *s);
+
+#endif
+
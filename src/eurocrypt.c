@@ -783,8 +783,10 @@ char *_get_sub_date(int b, const char *date)
 	
 	dtm = malloc(sizeof(char) * 24);
 	
-	time_t t = time(NULL);
-	struct tm tm = *localtime(&t);
+	time_t t = wall_time();
+	struct tm tm;
+	
+	wall_tm(t, &tm);
 	
 	m = tm.tm_mon + 1;
 	y = tm.tm_year + 1900;
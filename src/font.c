@@ -23,7 +23,7 @@
 
 static FT_Library _freetype = NULL;
 
-int font_init(av_t *av, int size, float ratio, void *ctx)
+int font_init(av_font_t **s, av_t *av, int size, float ratio, void *ctx)
 {	
 	int r;
 	int x_res;
@@ -49,12 +49,17 @@ int font_init(av_t *av, int size, float ratio, void *ctx)
 	/* Hack to deal with different sampling rates */
 	x_res = 96.0 * ((float) font->video_width / font->video_height / font->video_ratio);
 	
-	/* Initialise the freetype library */
-	r = FT_Init_FreeType(&_freetype);
-	if(r)
+	/* Initialise the freetype library, shared by all fonts */
+	if(!_freetype)
 	{
-		fprintf(stderr, "There was an error initialising the freetype library.\n");
-		return(HACKTV_ERROR);
+		r = FT_Init_FreeType(&_freetype);
+		if(r)
+		{
+			_freetype = NULL;
+			fprintf(stderr, "There was an error initialising the freetype library.\n");
+			font_free(font);
+			return(HACKTV_ERROR);
+		}
 	}
 	
 	// r = FT_New_Face(_freetype, fontfile, 0, &font->fontface);
@@ -67,11 +72,13 @@ int font_init(av_t *av, int size, float ratio, void *ctx)
 	if(r == FT_Err_Unknown_File_Format)
 	{
 		fprintf(stderr, "Unknown font file format.");
+		font_free(font);
 		return(HACKTV_ERROR);
 	}
 	else if(r)
 	{
 		fprintf(stderr, "Error loading font.");
+		font_free(font);
 		return(HACKTV_ERROR);
 	}
 	
@@ -79,15 +86,48 @@ int font_init(av_t *av, int size, float ratio, void *ctx)
 	if(r)
 	{
 		fprintf(stderr, "Error setting font size %d.", 32);
+		font_free(font);
 		return(HACKTV_ERROR);
 	}
 	
-	/* Callback */
-	av->av_font = font;
+	*s = font;
 	
 	return(HACKTV_OK);
 }
 
+void font_free(av_font_t *font)
+{
+	int i;
+	
+	if(font == NULL)
+	{
+		return;
+	}
+	
+	for(i = 0; i < _FONT_LAYOUTS; i++)
+	{
+		free(font->layouts[i].text);
+		free(font->layouts[i].places);
+	}
+	
+	free(font->glyphs);
+	free(font->hash);
+	free(font->atlas);
+	
+	free(font->cue_text);
+	free(font->cue.rgb);
+	free(font->cue.yuv[0][0]);
+	free(font->cue.spans);
+	free(font->cue.row_spans);
+	
+	if(font->fontface)
+	{
+		FT_Done_Face(font->fontface);
+	}
+	
+	free(font);
+}
+
 static uint32_t _make_transparent(uint32_t a, uint32_t b, float t)
 {
 	int vr, vg, vb;
@@ -104,6 +144,12 @@ static int draw_box(av_font_t *font, int x_start, int y_start, int x_end, int y_
 	int i, j;
 	uint32_t *dp;
 	
+	/* Clip the box to the frame */
+	if(x_start < 0) x_start = 0;
+	if(y_start < 0) y_start = 0;
+	if(x_end > font->video_width) x_end = font->video_width;
+	if(y_end > font->video_height) y_end = font->video_height;
+	
 	for(i = x_start; i < x_end; i++)
 	{
 		for(j = y_start; j < y_end; j++)
@@ -116,55 +162,33 @@ static int draw_box(av_font_t *font, int x_start, int y_start, int x_end, int y_
 	return(0);
 }
 
-int display_bitmap_subtitle(av_font_t *font, uint32_t *vid, int w, int h, uint32_t *bitmap)
+static int _printchar(av_font_t *font, _font_glyph_t *glyph, int x, int y, uint32_t colour)
 {
-	font->video = vid;
-		
-	uint32_t c, *dp;
-	int i, j, x_start, y_start, x, y;
-	
-	x_start = (font->video_width / 2) - (w / 2);
-	y_start = (font->video_height) * 0.8;
-	
-	for (y = 0, i = y_start; y < h; y++, i++) 
-	{
-		for(x = 0, j = x_start; x < w; x++, j++)
-		{
-			dp = &font->video[i * font->video_width + j];
-			c = bitmap[y * w + x];
-			*dp = c > 0 ? c : *dp;
-		}
-	}
+	const uint8_t *src;
+	uint32_t *dp;
+	int i, j, x0, x1, y0, y1;
 	
-	return (0);
-}
-
-static int _printchar(av_font_t *font, FT_Bitmap *bitmap, FT_Int x, FT_Int y, uint32_t colour)
-{
-	FT_Int i, j, p, q;
-	FT_Int x_max = x + bitmap->width;
-	FT_Int y_max = y + bitmap->rows;
-
+	/* Clip the glyph to the frame */
+	x0 = x < 0 ? -x : 0;
+	y0 = y < 0 ? -y : 0;
+	x1 = x + glyph->width > font->video_width ? font->video_width - x : glyph->width;
+	y1 = y + glyph->rows > font->video_height ? font->video_height - y : glyph->rows;
 	
-	for(i = x, p = 0; i < x_max; i++, p++)
+	for(j = y0; j < y1; j++)
 	{
-		for(j = y, q = 0; j < y_max; j++, q++)
+		src = font->atlas + glyph->offset + j * glyph->width;
+		dp = &font->video[(y + j) * font->video_width + x];
+		
+		for(i = x0; i < x1; i++)
 		{
-			uint32_t *dp;
 			uint8_t r, g, b;
-			int c;
-			
-			if(i < 0 || j < 0) continue;
-			if(i >= font->video_width || j >= font->video_height) continue;
-			
-			dp = &font->video[j * font->video_width +i];
-			c = bitmap->buffer[q * bitmap->width + p];
+			int c = src[i];
 			
-			r = (((*dp >> 16) & 0xFF) * (255 - c) + ((colour >> 16) & 0xFF) * c) / 256;
-			g = (((*dp >>  8) & 0xFF) * (255 - c) + ((colour >>  8) & 0xFF) * c) / 256;
-			b = (((*dp >>  0) & 0xFF) * (255 - c) + ((colour >>  0) & 0xFF) * c) / 256;
+			r = (((dp[i] >> 16) & 0xFF) * (255 - c) + ((colour >> 16) & 0xFF) * c) / 256;
+			g = (((dp[i] >>  8) & 0xFF) * (255 - c) + ((colour >>  8) & 0xFF) * c) / 256;
+			b = (((dp[i] >>  0) & 0xFF) * (255 - c) + ((colour >>  0) & 0xFF) * c) / 256;
 			
-			*dp = (r << 16) | (g << 8) | (b << 0);
+			dp[i] = (r << 16) | (g << 8) | (b << 0);
 		}
 	}
 	
@@ -203,27 +227,154 @@ const uint32_t _utf8_to_utf32(char *str, char **next)
 	return(u);
 }
 
-int _printf(av_font_t *font, int32_t x, int32_t y, uint32_t colour, char *fmt)
+static int _grow_hash(av_font_t *font)
+{
+	int *hash;
+	int i, h, size;
+	
+	size = font->hash_size ? font->hash_size * 2 : 256;
+	
+	hash = malloc(sizeof(int) * size);
+	if(!hash)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < size; i++)
+	{
+		hash[i] = -1;
+	}
+	
+	for(i = 0; i < font->glyphs_count; i++)
+	{
+		for(h = (font->glyphs[i].code * 2654435761U) >> 8 & (size - 1); hash[h] >= 0; h = (h + 1) & (size - 1));
+		hash[h] = i;
+	}
+	
+	free(font->hash);
+	font->hash = hash;
+	font->hash_size = size;
+	
+	return(HACKTV_OK);
+}
+
+/* Returns the glyph for character u, rendering it the first time
+ * it's used. Glyphs FreeType can't load are remembered as such */
+static _font_glyph_t *_get_glyph(av_font_t *font, uint32_t u)
+{
+	FT_GlyphSlot slot = font->fontface->glyph;
+	_font_glyph_t *g;
+	void *p;
+	size_t len;
+	int i, h;
+	
+	if(font->glyphs_count * 2 >= font->hash_size && _grow_hash(font) != HACKTV_OK)
+	{
+		return(NULL);
+	}
+	
+	for(h = (u * 2654435761U) >> 8 & (font->hash_size - 1); font->hash[h] >= 0; h = (h + 1) & (font->hash_size - 1))
+	{
+		g = &font->glyphs[font->hash[h]];
+		if(g->code == u) return(g);
+	}
+	
+	if(font->glyphs_count == font->glyphs_size)
+	{
+		p = realloc(font->glyphs, sizeof(_font_glyph_t) * (font->glyphs_size ? font->glyphs_size * 2 : 128));
+		if(!p) return(NULL);
+		
+		font->glyphs = p;
+		font->glyphs_size = font->glyphs_size ? font->glyphs_size * 2 : 128;
+	}
+	
+	g = &font->glyphs[font->glyphs_count];
+	memset(g, 0, sizeof(_font_glyph_t));
+	
+	g->code = u;
+	g->index = FT_Get_Char_Index(font->fontface, u);
+	
+	if(FT_Load_Glyph(font->fontface, g->index, FT_LOAD_RENDER) == 0)
+	{
+		len = (size_t) slot->bitmap.width * slot->bitmap.rows;
+		
+		if(font->atlas_len + len > font->atlas_size)
+		{
+			p = realloc(font->atlas, (font->atlas_len + len) * 2);
+			if(!p) return(NULL);
+			
+			font->atlas = p;
+			font->atlas_size = (font->atlas_len + len) * 2;
+		}
+		
+		g->loaded = 1;
+		g->left = slot->bitmap_left;
+		g->top = slot->bitmap_top;
+		g->width = slot->bitmap.width;
+		g->rows = slot->bitmap.rows;
+		g->height = slot->metrics.height >> 6;
+		g->advance_x = slot->advance.x;
+		g->advance_y = slot->advance.y;
+		g->offset = font->atlas_len;
+		
+		/* Copy the coverage into the atlas, without any row padding */
+		for(i = 0; i < g->rows; i++)
+		{
+			memcpy(font->atlas + g->offset + i * g->width, slot->bitmap.buffer + i * slot->bitmap.pitch, g->width);
+		}
+		
+		font->atlas_len += len;
+	}
+	
+	font->hash[h] = font->glyphs_count++;
+	
+	return(g);
+}
+
+/* Returns the layout of a string, reusing it if it was drawn recently */
+static _font_layout_t *_get_layout(av_font_t *font, char *fmt)
 {
-	FT_GlyphSlot slot;
+	_font_layout_t *l;
+	_font_glyph_t *g;
 	FT_F26Dot6 pen_x, pen_y;
 	FT_Bool use_kerning;
 	FT_UInt previous;
-	int i;
 	char *s;
 	uint32_t u;
+	int i;
 	
-	if(!_freetype || !font->fontface)
+	for(i = 0; i < _FONT_LAYOUTS; i++)
 	{
-		fprintf(stderr, "Freetype library not initialised or no font set.\n");
-		return(HACKTV_ERROR);
+		l = &font->layouts[i];
+		
+		if(l->text && strcmp(l->text, fmt) == 0)
+		{
+			return(l);
+		}
 	}
 	
-	/* Todo: Process formatted text */
+	/* Replace the oldest layout */
+	l = &font->layouts[font->layout_next];
+	font->layout_next = (font->layout_next + 1) % _FONT_LAYOUTS;
+	
+	free(l->text);
+	free(l->places);
+	memset(l, 0, sizeof(_font_layout_t));
 	
-	slot = font->fontface->glyph;
-	pen_x = x << 6;
-	pen_y = y << 6;
+	/* There can't be more glyphs than bytes */
+	l->text = strdup(fmt);
+	l->places = malloc(sizeof(_font_place_t) * (strlen(fmt) + 1));
+	
+	if(!l->text || !l->places)
+	{
+		free(l->text);
+		free(l->places);
+		memset(l, 0, sizeof(_font_layout_t));
+		return(NULL);
+	}
+	
+	pen_x = 0;
+	pen_y = 0;
 	
 	use_kerning = FT_HAS_KERNING(font->fontface);
 	previous = 0;
@@ -232,31 +383,70 @@ int _printf(av_font_t *font, int32_t x, int32_t y, uint32_t colour, char *fmt)
 	while((u = _utf8_to_utf32(s, &s)))
 	{
 		/* Ignore CR in Windows files */
-		if(u != '\r')
+		if(u == '\r') continue;
+		
+		g = _get_glyph(font, u);
+		if(g == NULL)
 		{
-			FT_UInt glyph_index;
-			glyph_index = FT_Get_Char_Index(font->fontface, u);
-			
-			if(use_kerning && previous && glyph_index)
-			{
-				FT_Vector delta;
-				FT_Get_Kerning(font->fontface, previous, glyph_index, ft_kerning_default, &delta);
-				pen_x += delta.x;
-			}
-			
-			i = FT_Load_Glyph(font->fontface, glyph_index, FT_LOAD_RENDER);
-			if(i) continue;
-			
-			_printchar(font, &slot->bitmap,
-				(pen_x >> 6) + slot->bitmap_left,
-				(pen_y >> 6) - slot->bitmap_top,
-				colour);
-			
-			pen_x += slot->advance.x;
-			pen_y += slot->advance.y;
-			
-			previous = glyph_index;
+			/* Don't remember a truncated layout */
+			free(l->text);
+			free(l->places);
+			memset(l, 0, sizeof(_font_layout_t));
+			return(NULL);
+		}
+		
+		if(use_kerning && previous && g->index)
+		{
+			FT_Vector delta;
+			FT_Get_Kerning(font->fontface, previous, g->index, ft_kerning_default, &delta);
+			pen_x += delta.x;
 		}
+		
+		if(!g->loaded) continue;
+		
+		l->places[l->count].glyph = g - font->glyphs;
+		l->places[l->count].x = (pen_x >> 6) + g->left;
+		l->places[l->count].y = (pen_y >> 6) - g->top;
+		l->count++;
+		
+		pen_x += g->advance_x;
+		pen_y += g->advance_y;
+		
+		previous = g->index;
+		
+		if(g->height > l->height)
+		{
+			l->height = g->height;
+		}
+	}
+	
+	l->width = pen_x >> 6;
+	
+	return(l);
+}
+
+int _printf(av_font_t *font, int32_t x, int32_t y, uint32_t colour, char *fmt)
+{
+	_font_layout_t *l;
+	int i;
+	
+	if(!_freetype || !font->fontface)
+	{
+		fprintf(stderr, "Freetype library not initialised or no font set.\n");
+		return(HACKTV_ERROR);
+	}
+	
+	/* Todo: Process formatted text */
+	
+	l = _get_layout(font, fmt);
+	if(!l)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < l->count; i++)
+	{
+		_printchar(font, &font->glyphs[l->places[i].glyph], x + l->places[i].x, y + l->places[i].y, colour);
 	}
 	
 	return(0);
@@ -264,14 +454,7 @@ int _printf(av_font_t *font, int32_t x, int32_t y, uint32_t colour, char *fmt)
 
 static int _get_line_size(av_font_t *font, char *fmt, int *line_width, int *line_height)
 {
-	FT_GlyphSlot slot;
-	FT_F26Dot6 pen_x;
-	FT_Bool use_kerning;
-	FT_UInt previous;
-	int i;
-	int32_t x = 0;
-	char *s;
-	uint32_t u;
+	_font_layout_t *l;
 	
 	*line_width = 0;
 	*line_height = 0;
@@ -282,40 +465,15 @@ static int _get_line_size(av_font_t *font, char *fmt, int *line_width, int *line
 		return(HACKTV_ERROR);
 	}
 	
-	slot = font->fontface->glyph;
-	pen_x = x << 6;
-	
-	use_kerning = FT_HAS_KERNING(font->fontface);
-	previous = 0;
-
-	s = fmt;
-		
-	while((u = _utf8_to_utf32(s, &s)))
+	l = _get_layout(font, fmt);
+	if(!l)
 	{
-		/* Ignore CR in Windows files */
-		if(u != '\r')
-		{
-			FT_UInt glyph_index;
-			glyph_index = FT_Get_Char_Index(font->fontface, u);
-			
-			if(use_kerning && previous && glyph_index)
-			{
-				FT_Vector delta;
-				FT_Get_Kerning(font->fontface, previous, glyph_index, ft_kerning_default, &delta);
-				pen_x += delta.x;
-			}
-			
-			i = FT_Load_Glyph(font->fontface, glyph_index, FT_LOAD_RENDER);
-			if(i) continue;
-			
-			pen_x += slot->advance.x;
-			previous = glyph_index;
-			
-			*line_height = slot->metrics.height >> 6 > *line_height ? slot->metrics.height >> 6 : *line_height;
-		}
+		return(HACKTV_OUT_OF_MEMORY);
 	}
 	
-	*line_width = pen_x >> 6;
+	*line_width = l->width;
+	*line_height = l->height;
+	
 	return(HACKTV_OK);
 }
 
@@ -334,15 +492,13 @@ static void _print_line(av_font_t *font, int line_width, int line_height, int po
 		_printf(font, pos_x, pos_y, 0xFFFFFF, fmt);
 }
 
-void print_subtitle(av_font_t *font, uint32_t *vid, char *fmt)
+static void _draw_subtitle(av_font_t *font, char *fmt)
 {
 	if(strcmp(fmt, "") != 0) 
 	{
 		int i, p, x, y;
 		int spacing = 32;
 		
-		font->video = vid;
-		
 		int lines = 1;
 		char text[128];
 		
@@ -397,6 +553,96 @@ void print_subtitle(av_font_t *font, uint32_t *vid, char *fmt)
 	}
 }
 
+/* Render a subtitle once over black and once over white. Everything
+ * drawn blends linearly with the frame, so the two together give the
+ * colour and coverage of each pixel */
+static int _render_cue(av_font_t *font, char *fmt)
+{
+	uint32_t *white, b, w, inv, d;
+	int i, c, size;
+	
+	size = font->video_width * font->video_height;
+	
+	free(font->cue_text);
+	font->cue_text = NULL;
+	
+	if(!font->cue.rgb)
+	{
+		font->cue.rgb = malloc(sizeof(uint32_t) * size);
+		font->cue.img_width = font->video_width;
+		font->cue.img_height = font->video_height;
+	}
+	
+	white = malloc(sizeof(uint32_t) * size);
+	
+	if(!font->cue.rgb || !white)
+	{
+		free(white);
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < size; i++)
+	{
+		font->cue.rgb[i] = 0x000000;
+		white[i] = 0xFFFFFF;
+	}
+	
+	font->video = font->cue.rgb;
+	_draw_subtitle(font, fmt);
+	
+	font->video = white;
+	_draw_subtitle(font, fmt);
+	
+	for(i = 0; i < size; i++)
+	{
+		b = font->cue.rgb[i];
+		w = white[i];
+		
+		/* Use the least coverage of the three channels,
+		 * so the blend can't overflow */
+		for(c = 0, inv = 0xFF; c < 24; c += 8)
+		{
+			d = ((w >> c) & 0xFF) - ((b >> c) & 0xFF);
+			d = (int32_t) d < 0 ? 0 : d;
+			inv = d < inv ? d : inv;
+		}
+		
+		font->cue.rgb[i] = inv << 24 | (b & 0xFFFFFF);
+	}
+	
+	free(white);
+	
+	if(image_spans(&font->cue) != HACKTV_OK)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	font->cue_text = strdup(fmt);
+	
+	return(font->cue_text ? HACKTV_OK : HACKTV_OUT_OF_MEMORY);
+}
+
+void print_subtitle(av_font_t *font, uint32_t *vid, char *fmt)
+{
+	if(strcmp(fmt, "") == 0)
+	{
+		return;
+	}
+	
+	/* Each subtitle is rendered once, and overlaid on every frame it shows in */
+	if(!font->cue_text || strcmp(font->cue_text, fmt) != 0)
+	{
+		if(_render_cue(font, fmt) != HACKTV_OK)
+		{
+			font->video = vid;
+			_draw_subtitle(font, fmt);
+			return;
+		}
+	}
+	
+	overlay_image(vid, &font->cue, font->video_width, font->video_width, font->video_height, IMG_POS_FULL);
+}
+
 void print_generic_text(av_font_t *font, uint32_t *vid, char *fmt, float pos_x, float pos_y, int shadow, int box, int colour, float transparency)
 {
 	if(strcmp(fmt, "") != 0)
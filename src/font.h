@@ -22,6 +22,7 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include "video.h"
+#include "graphics.h"
 
 #define TEXT_POS_CENTRE 0
 #define TEXT_POS_LEFT 1
@@ -34,6 +35,40 @@
 #define TEXT_SUBTITLE 1
 #define TEXT_GENERIC 1
 
+/* Laid out strings remembered by each font */
+#define _FONT_LAYOUTS 8
+
+/* A rendered glyph. Its coverage bitmap is width * rows
+ * bytes in the font's atlas, starting at offset */
+typedef struct {
+	uint32_t code;
+	FT_UInt index;
+	int loaded;
+	int left;
+	int top;
+	int width;
+	int rows;
+	int height;
+	FT_Pos advance_x;
+	FT_Pos advance_y;
+	size_t offset;
+} _font_glyph_t;
+
+/* A glyph placed in a string, relative to the pen's starting point */
+typedef struct {
+	int glyph;
+	int x;
+	int y;
+} _font_place_t;
+
+typedef struct {
+	char *text;
+	int width;
+	int height;
+	int count;
+	_font_place_t *places;
+} _font_layout_t;
+
 typedef struct {
 	uint32_t *video;
 	int video_width;
@@ -45,11 +80,31 @@ typedef struct {
 	float x_loc;
 	float y_loc;
 	char *text;
+	
+	/* Glyphs rendered so far, found by character through a hash
+	 * table of indices. Their bitmaps are packed into the atlas */
+	_font_glyph_t *glyphs;
+	int glyphs_count;
+	int glyphs_size;
+	int *hash;
+	int hash_size;
+	uint8_t *atlas;
+	size_t atlas_len;
+	size_t atlas_size;
+	
+	/* The most recently drawn strings, laid out */
+	_font_layout_t layouts[_FONT_LAYOUTS];
+	int layout_next;
+	
+	/* The last subtitle drawn and its rendered overlay */
+	char *cue_text;
+	image_t cue;
+	
 } av_font_t;
 
 
-extern int font_init(av_t *av, int size, float ratio, void *conf);
+extern int font_init(av_font_t **s, av_t *av, int size, float ratio, void *conf);
+extern void font_free(av_font_t *font);
 extern void print_subtitle(av_font_t *av, uint32_t *vid, char *fmt);
 extern void print_generic_text(av_font_t *font, uint32_t *vid, char *fmt, float pos_x, float pos_y, int shadow, int box, int colour, float transparency);
-extern int display_bitmap_subtitle(av_font_t *av, uint32_t *vid, int w, int h, uint32_t *bitmap_data);
 #endif
@@ -21,6 +21,8 @@
  * Modified by Yoshimasa Niwa to support all possible colour types.
  */
 
+#include <math.h>
+#include <pthread.h>
 #include "video.h"
 #include "hacktv.h"
 #include "resources.h"
@@ -81,22 +83,17 @@ static void _read_png_memory_callback(png_struct *png_str, png_byte *data, png_s
 	if (bytesread != length) png_error(png_str, "Read Error!");
 }
 
-static int _read_png_data(image_t *image, const pngs_t *pngs) 
+static void _read_png_file_callback(png_struct *png_str, png_byte *data, png_size_t length)
+{
+	FILE *f = (FILE *) png_get_io_ptr(png_str);
+	if(fread(data, 1, length, f) != length) png_error(png_str, "Read Error!");
+}
+
+/* Decode a PNG into 8-bit RGBA rows, after its signature has been checked */
+static int _read_png(image_t *image, png_voidp io, png_rw_ptr read_fn)
 {
 	int y;
 	
-	uint8_t buf[8];
-	png_mem_t reader;
-	_open_png_memory(&reader, pngs->png->data, pngs->size);
-	_read_png_memory(&reader, buf, 8);
-	
-	/* Ensure that it is, in fact, valid PNG data */
-	if(png_sig_cmp((png_const_bytep) buf, (png_size_t) 0, 8))
-	{
-		fprintf(stderr,"Warning: %s is not a valid PNG data.\n", image->name);
-		return(HACKTV_ERROR);
-	}
-	
 	/* Define png structure */
 	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	
@@ -121,7 +118,7 @@ static int _read_png_data(image_t *image, const pngs_t *pngs)
 		return (HACKTV_ERROR);
 	};
 	
-	png_set_read_fn(png_ptr, (png_voidp) &reader, _read_png_memory_callback);
+	png_set_read_fn(png_ptr, io, read_fn);
 	
 	/* Skip signature bytes */
 	png_set_sig_bytes(png_ptr, 8);
@@ -186,6 +183,266 @@ static int _read_png_data(image_t *image, const pngs_t *pngs)
 	return (HACKTV_OK);
 }
 
+static int _read_png_data(image_t *image, const pngs_t *pngs) 
+{
+	uint8_t buf[8];
+	png_mem_t reader;
+	_open_png_memory(&reader, pngs->png->data, pngs->size);
+	_read_png_memory(&reader, buf, 8);
+	
+	/* Ensure that it is, in fact, valid PNG data */
+	if(png_sig_cmp((png_const_bytep) buf, (png_size_t) 0, 8))
+	{
+		fprintf(stderr,"Warning: %s is not a valid PNG data.\n", image->name);
+		return(HACKTV_ERROR);
+	}
+	
+	return(_read_png(image, (png_voidp) &reader, _read_png_memory_callback));
+}
+
+/* Read the PNG file named by image->name */
+int read_png_file(image_t *image)
+{
+	uint8_t buf[8];
+	FILE *f;
+	int r;
+	
+	f = fopen(image->name, "rb");
+	if(!f)
+	{
+		fprintf(stderr, "%s: ", image->name);
+		perror("fopen");
+		return(HACKTV_ERROR);
+	}
+	
+	if(fread(buf, 1, 8, f) != 8 || png_sig_cmp((png_const_bytep) buf, (png_size_t) 0, 8))
+	{
+		fprintf(stderr, "Warning: %s is not a valid PNG file.\n", image->name);
+		fclose(f);
+		return(HACKTV_ERROR);
+	}
+	
+	r = _read_png(image, (png_voidp) f, _read_png_file_callback);
+	fclose(f);
+	
+	return(r);
+}
+
+/* Split each row of a prepared image into spans of transparent, opaque
+ * and blended pixels. Only the opaque and blended spans are kept, so
+ * transparent pixels cost nothing */
+int image_spans(image_t *image)
+{
+	int w = image->img_width;
+	int h = image->img_height;
+	int x, y, n, size, type;
+	uint32_t inv;
+	void *p;
+	
+	free(image->spans);
+	free(image->row_spans);
+	
+	image->row_spans = malloc(sizeof(int) * (h + 1));
+	image->spans = NULL;
+	
+	if(!image->row_spans)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	n = size = 0;
+	
+	for(y = 0; y < h; y++)
+	{
+		image->row_spans[y] = n;
+		
+		for(x = 0; x < w; x++)
+		{
+			inv = image->rgb[y * w + x] >> 24;
+			
+			if(inv == 0xFF)
+			{
+				continue;
+			}
+			
+			type = inv == 0 ? IMG_SPAN_OPAQUE : IMG_SPAN_BLEND;
+			
+			if(n > image->row_spans[y] &&
+			   image->spans[n - 1].type == type &&
+			   image->spans[n - 1].x + image->spans[n - 1].length == x)
+			{
+				/* Extend the current span */
+				image->spans[n - 1].length++;
+				continue;
+			}
+			
+			if(n == size)
+			{
+				size = size ? size * 2 : 256;
+				
+				p = realloc(image->spans, sizeof(image_span_t) * size);
+				if(!p)
+				{
+					return(HACKTV_OUT_OF_MEMORY);
+				}
+				
+				image->spans = p;
+			}
+			
+			image->spans[n].x = x;
+			image->spans[n].length = 1;
+			image->spans[n].type = type;
+			n++;
+		}
+	}
+	
+	image->row_spans[h] = n;
+	
+	return(HACKTV_OK);
+}
+
+/* Convert a colour to 8-bit Y'CbCr with the given matrix and range */
+static uint32_t _rgb_to_yuv(uint32_t r, uint32_t g, uint32_t b, av_matrix_t matrix, int full_range)
+{
+	double kr, kb, y, cb, cr;
+	
+	switch(matrix)
+	{
+	case AV_MATRIX_BT709:  kr = 0.2126; kb = 0.0722; break;
+	case AV_MATRIX_BT2020: kr = 0.2627; kb = 0.0593; break;
+	default:               kr = 0.299;  kb = 0.114;  break;
+	}
+	
+	/* Y' 0..1 and Cb, Cr -0.5..0.5 */
+	y = (kr * r + (1 - kr - kb) * g + kb * b) / 255;
+	cb = ((double) b / 255 - y) / (2 * (1 - kb));
+	cr = ((double) r / 255 - y) / (2 * (1 - kr));
+	
+	if(full_range)
+	{
+		y = y * 255;
+		cb = 128 + cb * 255;
+		cr = 128 + cr * 255;
+	}
+	else
+	{
+		y = 16 + y * 219;
+		cb = 128 + cb * 224;
+		cr = 128 + cr * 224;
+	}
+	
+	return(
+		(uint32_t) lround(y < 0 ? 0 : (y > 255 ? 255 : y)) << 16 |
+		(uint32_t) lround(cb < 0 ? 0 : (cb > 255 ? 255 : cb)) << 8 |
+		(uint32_t) lround(cr < 0 ? 0 : (cr > 255 ? 255 : cr))
+	);
+}
+
+/* Prepare the scaled image for overlaying */
+static int _prepare_image(image_t *image)
+{
+	int w = image->img_width;
+	int h = image->img_height;
+	int x, y, k, m, f;
+	uint32_t c, a, r, g, b;
+	
+	image->rgb = malloc(sizeof(uint32_t) * w * h);
+	image->yuv[0][0] = malloc(sizeof(uint32_t) * w * h * 6);
+	
+	if(!image->rgb || !image->yuv[0][0])
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	for(m = 0; m < 3; m++)
+	{
+		for(f = 0; f < 2; f++)
+		{
+			image->yuv[m][f] = image->yuv[0][0] + (m * 2 + f) * w * h;
+		}
+	}
+	
+	for(y = 0; y < h; y++)
+	{
+		for(x = 0; x < w; x++)
+		{
+			/* The scaled logo is stored bottom row first */
+			c = image->logo[x + (h - y - 1) * w];
+			k = y * w + x;
+			
+			a = c >> 24;
+			r = (c >> 16) & 0xFF;
+			g = (c >> 8) & 0xFF;
+			b = (c >> 0) & 0xFF;
+			
+			image->rgb[k] = (255 - a) << 24 | (r * a / 255) << 16 | (g * a / 255) << 8 | (b * a / 255);
+			
+			/* The image is shared between sources, so every
+			 * matrix and range a frame might use is ready */
+			for(m = 0; m < 3; m++)
+			{
+				for(f = 0; f < 2; f++)
+				{
+					image->yuv[m][f][k] = (255 - a) << 24 | _rgb_to_yuv(r, g, b, m, f);
+				}
+			}
+		}
+	}
+	
+	return(image_spans(image));
+}
+
+/* Images already loaded, by source image and scaled size */
+typedef struct {
+	const pngs_t *pngs;
+	int width;
+	int height;
+	float scale;
+	float ratio;
+	image_t *image;
+} _image_cache_t;
+
+static _image_cache_t _image_cache[IMG_CACHE_SIZE];
+static int _image_cache_len = 0;
+static pthread_mutex_t _image_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static image_t *_image_cache_find(const pngs_t *pngs, int width, int height, float scale, float ratio)
+{
+	image_t *image = NULL;
+	int i;
+	
+	pthread_mutex_lock(&_image_cache_mutex);
+	
+	for(i = 0; i < _image_cache_len; i++)
+	{
+		_image_cache_t *c = &_image_cache[i];
+		
+		if(c->pngs == pngs && c->width == width && c->height == height &&
+		   c->scale == scale && c->ratio == ratio)
+		{
+			image = c->image;
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&_image_cache_mutex);
+	
+	return(image);
+}
+
+static void _image_cache_add(const pngs_t *pngs, int width, int height, float scale, float ratio, image_t *image)
+{
+	pthread_mutex_lock(&_image_cache_mutex);
+	
+	/* Images are never freed, so a full cache just stops growing */
+	if(_image_cache_len < IMG_CACHE_SIZE)
+	{
+		_image_cache[_image_cache_len++] = (_image_cache_t) { pngs, width, height, scale, ratio, image };
+	}
+	
+	pthread_mutex_unlock(&_image_cache_mutex);
+}
+
 int load_png(image_t **s, int width, int height, char *image_name, float scale, float ratio, int type)
 {
 	const pngs_t *pngs;
@@ -258,6 +515,14 @@ int load_png(image_t **s, int width, int height, char *image_name, float scale,
 		}
 	}
 	
+	/* Each source reopens its logo and icons, reuse them if
+	 * they have been scaled to this size before */
+	if((*s = _image_cache_find(pngs, width, height, scale, ratio)) != NULL)
+	{
+		free(image);
+		return(HACKTV_OK);
+	}
+	
 	if(_read_png_data(image, pngs) == HACKTV_OK)
 	{
 		image->position = pngs->position;
@@ -269,6 +534,14 @@ int load_png(image_t **s, int width, int height, char *image_name, float scale,
 		logo = malloc(image->width * image->height * sizeof(uint32_t));
 		image->logo = malloc(image->img_width * image->img_height * sizeof(uint32_t));
 		
+		if(!logo || !image->logo)
+		{
+			free(logo);
+			free(image->logo);
+			image->logo = NULL;
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+		
 		for(i = image->height - 1, k = 0; i > -1 ; i--)
 		{	
 			png_bytep row = image->row_pointers[i];
@@ -279,7 +552,21 @@ int load_png(image_t **s, int width, int height, char *image_name, float scale,
 			}
 		}
 		
-		resize_bitmap(logo, image->logo, image->width, image->height, image->img_width, image->img_height);
+		if(resize_bitmap(logo, image->logo, image->width, image->height, image->img_width, image->img_height) != HACKTV_OK)
+		{
+			free(logo);
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+		
+		free(logo);
+		
+		if(_prepare_image(image) != HACKTV_OK)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+		
+		_image_cache_add(pngs, width, height, scale, ratio, image);
+		
 		*s = image;
 		return(HACKTV_OK);
 	}
@@ -288,11 +575,8 @@ int load_png(image_t **s, int width, int height, char *image_name, float scale,
 }
 
 
-void overlay_image(uint32_t *framebuffer, image_t *l, int vid_width, int line_stride, int vid_height, int pos)
+static void _image_origin(image_t *l, int vid_width, int vid_height, int pos, int *x, int *y)
 {
-	int i, j, x, y, r, g, b, vi;
-	float t;
-	uint32_t c;
 	int x_start = 0;
 	int y_start = 0;
 
@@ -342,79 +626,291 @@ void overlay_image(uint32_t *framebuffer, image_t *l, int vid_width, int line_st
 		y_start = (float) (vid_height) * 0.5- ((float) l->img_height * 0.5);
 	}
 	
-	/* Overlay image */
-	for (y = 0, i = y_start; y < l->img_height; y++, i++) 
+	*x = x_start;
+	*y = y_start;
+}
+
+void overlay_image(uint32_t *framebuffer, image_t *l, int vid_width, int line_stride, int vid_height, int pos)
+{
+	overlay_image_rows(framebuffer, l, vid_width, line_stride, vid_height, pos, 0, vid_height);
+}
+
+/* Blend a premultiplied pixel over a frame pixel, two channels at a
+ * time. Written without branches so the compiler can vectorise it */
+static inline uint32_t _blend_pixel(uint32_t d, uint32_t c)
+{
+	uint32_t inv, rb, g;
+	
+	inv = c >> 24;
+	
+	/* d * (255 - alpha) / 255, rounded */
+	rb = (d & 0xFF00FF) * inv + 0x800080;
+	rb = ((rb + ((rb >> 8) & 0xFF00FF)) >> 8) & 0xFF00FF;
+	g = (d & 0x00FF00) * inv + 0x008000;
+	g = ((g + ((g >> 8) & 0x00FF00)) >> 8) & 0x00FF00;
+	
+	return((rb | g) + (c & 0xFFFFFF));
+}
+
+static void _blend_span(uint32_t *dst, const uint32_t *src, int length)
+{
+	int x;
+	
+	for(x = 0; x < length; x++)
+	{
+		dst[x] = _blend_pixel(dst[x], src[x]);
+	}
+}
+
+/* Blend one premultiplied colour over a run of pixels */
+void blend_fill(uint32_t *dst, uint32_t c, int length)
+{
+	int x;
+	
+	if((c >> 24) == 0)
 	{
-		for(x = 0, j = x_start; x < l->img_width; x++, j++)
+		for(x = 0; x < length; x++)
 		{
+			dst[x] = c & 0xFFFFFF;
+		}
+		
+		return;
+	}
+	
+	for(x = 0; x < length; x++)
+	{
+		dst[x] = _blend_pixel(dst[x], c);
+	}
+}
+
+void overlay_image_rows(uint32_t *framebuffer, image_t *l, int vid_width, int line_stride, int vid_height, int pos, int row_start, int row_end)
+{
+	const image_span_t *sp;
+	const uint32_t *src;
+	uint32_t *dst;
+	int i, j, n, x, x0, x1, y, y0, y1;
+	int x_start;
+	int y_start;
+	
+	_image_origin(l, vid_width, vid_height, pos, &x_start, &y_start);
+	
+	/* Overlay the part of the image between frame
+	 * rows row_start and row_end - 1 */
+	y0 = row_start > y_start ? row_start : y_start;
+	y1 = row_end < y_start + l->img_height ? row_end : y_start + l->img_height;
+	
+	for(i = y0; i < y1; i++)
+	{
+		y = i - y_start;
+		
+		for(j = l->row_spans[y]; j < l->row_spans[y + 1]; j++)
+		{
+			sp = &l->spans[j];
+			
 			/* Only render image inside active video areas */
-			if(j >= 0 && j < vid_width)
+			x0 = x_start + sp->x;
+			x1 = x0 + sp->length;
+			if(x0 < 0) x0 = 0;
+			if(x1 > vid_width) x1 = vid_width;
+			if(x0 >= x1) continue;
+			
+			src = &l->rgb[y * l->img_width + x0 - x_start];
+			dst = &framebuffer[i * line_stride + x0];
+			n = x1 - x0;
+			
+			if(sp->type == IMG_SPAN_OPAQUE)
 			{
-				/* Get pixel */
-				c = l->logo[x + ((l->img_height - y - 1) * l->img_width)];
-				
-				/* Calculate transparency level */
-				t = 1.0 - (float) (c >> 24) / 0xFF;
-				
-				/* Set logo position */
-				vi = i * line_stride + j;
-				
-				/* Apply transparency  */
-				r = ((framebuffer[vi] >> 16) & 0xFF) * t + ((c >> 16) & 0xFF) * (1 - t);
-				g = ((framebuffer[vi] >> 8)  & 0xFF) * t + ((c >> 8)  & 0xFF) * (1 - t);
-				b = ((framebuffer[vi] >> 0)  & 0xFF) * t + ((c >> 0)  & 0xFF) * (1 - t);
-				
-				framebuffer[vi] = (r << 16 | g << 8 | b << 0);
+				for(x = 0; x < n; x++)
+				{
+					dst[x] = src[x] & 0xFFFFFF;
+				}
+			}
+			else
+			{
+				_blend_span(dst, src, n);
 			}
 		}
 	}
 }
 
-/* Inspiration from http://tech-algorithm.com/articles/bilinear-image-scaling/ */
+static inline uint8_t _blend_yuv(uint8_t d, uint32_t c, int shift)
+{
+	uint32_t inv = c >> 24;
+	uint32_t v = d * inv + ((c >> shift) & 0xFF) * (255 - inv) + 128;
+	
+	return((v + (v >> 8)) >> 8);
+}
 
-void resize_bitmap(uint32_t *input, uint32_t *output, int old_width, int old_height, int new_width, int new_height) 
+void overlay_image_yuv(uint8_t * const planes[3], const int linesize[3], int shift_x, int shift_y, av_matrix_t matrix, int full_range, image_t *l, int vid_width, int vid_height, int pos)
 {
-	int a, b, c, d, x, y, index;
-	float x_ratio = ((float)(old_width - 1)) / new_width;
-	float y_ratio = ((float)(old_height - 1)) / new_height;
-	float x_diff, y_diff, blue, red, green, alpha;
-	int offset = 0 ;
+	const uint32_t *yuv = l->yuv[matrix][full_range ? 1 : 0];
+	const image_span_t *sp;
+	uint32_t c;
+	int i, j, k, x, y, x0, x1, vi;
+	int x_start;
+	int y_start;
 	
-	for (int i = 0; i < new_height; i++) 
+	_image_origin(l, vid_width, vid_height, pos, &x_start, &y_start);
+	
+	/* Overlay image onto 8-bit planar Y'CbCr */
+	for(y = 0, i = y_start; y < l->img_height; y++, i++)
 	{
-		for (int j = 0; j < new_width; j++) 
+		if(i < 0 || i >= vid_height) continue;
+		
+		for(k = l->row_spans[y]; k < l->row_spans[y + 1]; k++)
 		{
-			x = (int)(x_ratio * j);
-			y = (int)(y_ratio * i);
-			x_diff = (x_ratio * j) - x;
-			y_diff = (y_ratio * i) - y;
-			index = (y * old_width + x);
-			a = input[index];
-			b = input[index + 1];
-			c = input[index + old_width];
-			d = input[index + old_width + 1];
-			
-			/* Blue */
-			blue = (a & 0xFF) * ( 1- x_diff) * (1 - y_diff) + (b & 0xFF) * (x_diff) * (1 - y_diff) +
-				   (c & 0xFF) * (y_diff) * (1 - x_diff)   + (d & 0xFF) * (x_diff * y_diff);
-			
-			/* Green */
-			green = ((a >> 8) & 0xFF) * (1-x_diff) * (1 - y_diff) + ((b >> 8) & 0xFF) * (x_diff) * (1 - y_diff) +
-					((c >> 8) & 0xFF) * (y_diff) * (1 - x_diff)   + ((d >> 8) & 0xFF) * (x_diff * y_diff);
+			sp = &l->spans[k];
 			
-			/* Reg */
-			red = ((a >> 16) & 0xFF) * (1 - x_diff) * (1 - y_diff) + ((b >> 16) & 0xFF) * (x_diff) * (1-y_diff) +
-				  ((c >> 16) & 0xFF) * (y_diff) * (1 - x_diff)   + ((d >> 16) & 0xFF) * (x_diff * y_diff);
-			
-			// /* Alpha */
-			alpha = ((a >> 24) & 0xFF) * (1-x_diff) * (1 - y_diff) + ((b >> 24) & 0xFF) * (x_diff) * (1 - y_diff) +
-					((c >> 24) & 0xFF) * (y_diff) * (1 - x_diff)   + ((d >> 24) & 0xFF) * (x_diff * y_diff);
+			/* Only render image inside active video areas */
+			x0 = x_start + sp->x;
+			x1 = x0 + sp->length;
+			if(x0 < 0) x0 = 0;
+			if(x1 > vid_width) x1 = vid_width;
 			
-			output[offset++] = 
-					((((int) alpha) << 24) & 0xFF000000) |
-					((((int) red)   << 16) & 0xFF0000)   |
-					((((int) green) << 8)  & 0xFF00)     |
-					((((int) blue)  << 0)  & 0xFF);
+			for(j = x0; j < x1; j++)
+			{
+				x = j - x_start;
+				c = yuv[y * l->img_width + x];
+				
+				vi = i * linesize[0] + j;
+				planes[0][vi] = sp->type == IMG_SPAN_OPAQUE ? (c >> 16) & 0xFF : _blend_yuv(planes[0][vi], c, 16);
+				
+				/* Blend each chroma sample once, from its top left pixel */
+				if((i & ((1 << shift_y) - 1)) == 0 &&
+				   (j & ((1 << shift_x) - 1)) == 0)
+				{
+					vi = (i >> shift_y) * linesize[1] + (j >> shift_x);
+					planes[1][vi] = sp->type == IMG_SPAN_OPAQUE ? (c >> 8) & 0xFF : _blend_yuv(planes[1][vi], c, 8);
+					
+					vi = (i >> shift_y) * linesize[2] + (j >> shift_x);
+					planes[2][vi] = sp->type == IMG_SPAN_OPAQUE ? c & 0xFF : _blend_yuv(planes[2][vi], c, 0);
+				}
+			}
+		}
+	}
+}
+
+/* Blend two packed pixels, w is the weight of b out of 256 */
+static inline uint32_t _lerp_pixel(uint32_t a, uint32_t b, uint32_t w)
+{
+	uint32_t rb, ag;
+	
+	rb = ((a & 0x00FF00FF) * (256 - w) + (b & 0x00FF00FF) * w + 0x00800080) >> 8;
+	ag = (((a >> 8) & 0x00FF00FF) * (256 - w) + ((b >> 8) & 0x00FF00FF) * w + 0x00800080) >> 8;
+	
+	return((rb & 0x00FF00FF) | ((ag & 0x00FF00FF) << 8));
+}
+
+/* Scale one source row horizontally into a row of the new width */
+static void _resize_row(uint32_t *dst, const uint32_t *src, const int *xi, const uint32_t *xw, int new_width)
+{
+	int x;
+	
+	for(x = 0; x < new_width; x++)
+	{
+		dst[x] = _lerp_pixel(src[xi[x * 2 + 0]], src[xi[x * 2 + 1]], xw[x]);
+	}
+}
+
+/* Precompute the source samples and weights along one axis. This keeps
+ * the sample positions of the original float scaler, (old - 1) / new */
+static void _resize_weights(int *idx, uint32_t *w, int old_size, int new_size)
+{
+	uint64_t step, p;
+	int i;
+	
+	step = ((uint64_t) (old_size - 1) << 16) / new_size;
+	
+	for(i = 0, p = 0; i < new_size; i++, p += step)
+	{
+		idx[i * 2 + 0] = p >> 16;
+		idx[i * 2 + 1] = (p >> 16) + 1 < old_size ? (p >> 16) + 1 : old_size - 1;
+		w[i] = (p >> 8) & 0xFF;
+	}
+}
+
+/* Bilinear scaler in 8-bit fixed point. The image is scaled across each
+ * source row once and the rows are then blended together, so each output
+ * pixel costs one vertical blend. The loops are written to vectorise */
+
+int resize_bitmap(uint32_t *input, uint32_t *output, int old_width, int old_height, int new_width, int new_height) 
+{
+	int *xi, *yi;
+	uint32_t *xw, *yw;
+	uint32_t *rows[2], *t, *dst;
+	int row[2];
+	int x, y;
+	
+	if(new_width <= 0 || new_height <= 0)
+	{
+		return(HACKTV_OK);
+	}
+	
+	xi = malloc(sizeof(int) * new_width * 2);
+	yi = malloc(sizeof(int) * new_height * 2);
+	xw = malloc(sizeof(uint32_t) * new_width);
+	yw = malloc(sizeof(uint32_t) * new_height);
+	rows[0] = malloc(sizeof(uint32_t) * new_width);
+	rows[1] = malloc(sizeof(uint32_t) * new_width);
+	
+	if(!xi || !yi || !xw || !yw || !rows[0] || !rows[1])
+	{
+		free(xi);
+		free(yi);
+		free(xw);
+		free(yw);
+		free(rows[0]);
+		free(rows[1]);
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	_resize_weights(xi, xw, old_width, new_width);
+	_resize_weights(yi, yw, old_height, new_height);
+	
+	/* The source rows held in rows[0] and rows[1] */
+	row[0] = row[1] = -1;
+	
+	for(y = 0; y < new_height; y++)
+	{
+		/* Output rows only move down the source, so at most
+		 * two new source rows are needed for each one */
+		if(row[0] != yi[y * 2 + 0])
+		{
+			if(row[1] == yi[y * 2 + 0])
+			{
+				t = rows[0];
+				rows[0] = rows[1];
+				rows[1] = t;
+				row[0] = row[1];
+				row[1] = -1;
+			}
+			else
+			{
+				row[0] = yi[y * 2 + 0];
+				_resize_row(rows[0], &input[row[0] * old_width], xi, xw, new_width);
+			}
+		}
+		
+		if(row[1] != yi[y * 2 + 1])
+		{
+			row[1] = yi[y * 2 + 1];
+			_resize_row(rows[1], &input[row[1] * old_width], xi, xw, new_width);
+		}
+		
+		dst = &output[y * new_width];
+		
+		for(x = 0; x < new_width; x++)
+		{
+			dst[x] = _lerp_pixel(rows[0][x], rows[1][x], yw[y]);
 		}
 	}
+	
+	free(xi);
+	free(yi);
+	free(xw);
+	free(yw);
+	free(rows[0]);
+	free(rows[1]);
+	
+	return(HACKTV_OK);
 }
@@ -35,6 +35,19 @@
 
 #define MAX_PNG_SIZE 128
 
+/* Scaled images kept for reuse by load_png() */
+#define IMG_CACHE_SIZE 16
+
+#define IMG_SPAN_OPAQUE 0
+#define IMG_SPAN_BLEND  1
+
+/* A run of visible pixels in a row of an image */
+typedef struct {
+	int x;
+	int length;
+	int type;
+} image_span_t;
+
 typedef struct {
 	char *name;
 	int width;
@@ -44,6 +57,18 @@ typedef struct {
 	uint32_t *logo;
 	png_bytep *row_pointers;
 	int position;
+	
+	/* The scaled image prepared for blending, top row first, with
+	 * 255 - alpha in the top byte. The RGB colours are premultiplied
+	 * by alpha, the Y'CbCr ones are not. There is a Y'CbCr copy
+	 * for each matrix (av_matrix_t) and range (limited, full) */
+	uint32_t *rgb;
+	uint32_t *yuv[3][2];
+	
+	/* The visible spans of each row, row y has spans
+	 * row_spans[y] to row_spans[y + 1] - 1 */
+	image_span_t *spans;
+	int *row_spans;
 } image_t;
 
 typedef struct {
@@ -65,6 +90,10 @@ typedef struct {
 
 extern int read_png_file(image_t *image);
 extern void overlay_image(uint32_t *framebuffer, image_t *l, int vid_width, int line_stride, int vid_height, int pos);
+extern void overlay_image_rows(uint32_t *framebuffer, image_t *l, int vid_width, int line_stride, int vid_height, int pos, int row_start, int row_end);
+extern void overlay_image_yuv(uint8_t * const planes[3], const int linesize[3], int shift_x, int shift_y, av_matrix_t matrix, int full_range, image_t *l, int vid_width, int vid_height, int pos);
+extern int image_spans(image_t *image);
+extern void blend_fill(uint32_t *dst, uint32_t c, int length);
 extern int load_png(image_t **s, int width, int height, char *filename, float scale, float ratio, int type);
-extern void resize_bitmap(uint32_t *input, uint32_t *output, int old_width, int old_height, int new_width, int new_height);
+extern int resize_bitmap(uint32_t *input, uint32_t *output, int old_width, int old_height, int new_width, int new_height);
 #endif
@@ -16,14 +16,18 @@
 /* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 #define _GNU_SOURCE 1
 #include <stdio.h>
+#include <math.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <getopt.h>
 #include <signal.h>
+#include <pthread.h>
 #include "hacktv.h"
 #include "av.h"
 #include "rf.h"
+#include "affinity.h"
+#include "pool.h"
 
 #ifdef WIN32
 #define OS_SEP '\\'
@@ -39,6 +43,9 @@
 #include "rf_fl2k.h"
 #endif
 
+/* Interval between --stats reports */
+#define STATS_INTERVAL 10000000000ULL
+
 static volatile sig_atomic_t _abort = 0;
 static volatile sig_atomic_t _signal = 0;
 
@@ -145,7 +152,39 @@ static void print_usage(void)
 		"      --invert-video             Invert the composite video signal sync and\n"
 		"                                 white levels.\n"
 		"      --secam-field-id           Enable SECAM field identification.\n"
-		"      --json                     Output a JSON array when used with --list-modes.\n"
+		"      --raw-bb-file <file>       Replace the generated video with raw baseband lines\n"
+		"                                 read from a file (int16, at the pixel rate).\n"
+		"                                 Use - for stdin. The file is looped at the end.\n"
+		"      --raw-bb-blanking <value>  Set the blanking level of the raw baseband. Default: 0\n"
+		"      --raw-bb-white <value>     Set the white level of the raw baseband. Default: 32767\n"
+		"      --tbc <file>               Write the baseband video to a 16-bit TBC file,\n"
+		"                                 before any filtering or modulation.\n"
+		"      --memstats                 Print the memory used by each subsystem.\n"
+		"      --stats                    Print the time spent in each processing stage,\n"
+		"                                 every 10 seconds and on exit.\n"
+		"      --hugepages                Use huge pages for large tables if available.\n"
+		"      --degrade                  Temporarily disable --filter, then any overlays\n"
+		"                                 and subtitles, when close to falling behind real-time.\n"
+		"      --affinity <class>=<cpus>  Run a class of threads on a list of CPUs, e.g. 0-3,6\n"
+		"      --sched <class>=<policy>[:<priority>]\n"
+		"                                 Set the scheduling policy of a class of threads.\n"
+		"                                 The policy can be other, fifo or rr.\n"
+		"      --nice <class>=<value>     Set the nice level of a class of threads.\n"
+		"      --threads <value>          Number of threads sharing the parallel work.\n"
+		"                                 Default: 1. 0 uses one per CPU.\n"
+		"      --seed <value>             Seed the random number generator with a fixed,\n"
+		"                                 non-zero value.\n"
+		"      --fixed-time <value>       Use a fixed date and time, in seconds since\n"
+		"                                 1970 UTC, instead of the system clock.\n"
+		"      --json                     Output a JSON array when used with --list-modes,\n"
+		"                                 or JSON formatted stats with --stats.\n"
+		"      --control <path>           Accept commands on a UNIX socket at path.\n"
+		"                                 See the man page for the commands.\n"
+		"\n"
+		"Thread classes for --affinity, --sched and --nice are render (the main\n"
+		"encoder loop and task pool), input (ffmpeg and file writer threads), sink (HackRF and\n"
+		"fl2k callbacks) or all. Real-time policies and negative nice levels may\n"
+		"need extra privileges, if not available the defaults are used.\n"
 		"\n"
 		"Input options\n"
 		"\n"
@@ -154,6 +193,8 @@ static void print_usage(void)
 		"  test:ueitm         Transmit a UEITM test pattern.\n"
 		"  test:fubk          Transmit a FUBK test pattern.\n"
 		"  ffmpeg:<file|url>  Decode and transmit a video file with ffmpeg.\n"
+		"  image:<file|dir>   Transmit a PNG image, or each PNG image in a directory\n"
+		"                     in turn. The images are loaded once and shown in a loop.\n"
 		"\n"
 		"  If no valid input prefix is provided, ffmpeg: is assumed.\n"
 		"\n"
@@ -162,6 +203,19 @@ static void print_usage(void)
 		"      --ffmt <format>            Force input file format.\n"
 		"      --fopts <option=value[:option2=value]>\n"
 		"                                 Pass option(s) to ffmpeg.\n"
+		"      --scale-slices <value>     Scale the video in this many slices in parallel.\n"
+		"                                 Default: 0, one per thread.\n"
+		"      --buffer-frames <value>    Number of video and audio frames buffered between\n"
+		"                                 the decoder, scaler and encoder. Default: 4\n"
+		"      --low-latency              Keep the delay through hacktv short, for live\n"
+		"                                 inputs. Buffers as little as possible at each\n"
+		"                                 stage and reports the latency.\n"
+		"\n"
+		"image input options\n"
+		"\n"
+		"      --dwell <seconds>          Show each image for this long. Default: 10\n"
+		"      --crossfade <seconds>      Fade into the next image over the end of\n"
+		"                                 the dwell time. Default: 0\n"
 		"\n"
 		"HackRF output options\n"
 		"\n"
@@ -169,6 +223,9 @@ static void print_usage(void)
 		"  -f, --frequency <value>        Set the RF frequency in Hz, 0MHz to 7250MHz.\n"
 		"  -a, --amp                      Enable the TX RF amplifier.\n"
 		"  -g, --gain <value>             Set the TX VGA (IF) gain, 0-47dB. Default: 0dB\n"
+		"      --latency <value>          Size the output buffers to hold this many\n"
+		"                                 milliseconds. Default: 400, or 50 with\n"
+		"                                 --low-latency.\n"
 		"\n"
 		"  Only modes with a complex output are supported by the HackRF.\n"
 		"\n"
@@ -392,6 +449,125 @@ static int _fputs_json(const char *str, FILE *stream)
 	return(c);
 }
 
+static void _print_stat_json(const char *name, const vid_stat_t *st, int last)
+{
+	fprintf(stderr, "{\"name\":\"");
+	_fputs_json(name, stderr);
+	fprintf(stderr, "\",\"calls\":%llu,\"ns\":%llu}%s",
+		(unsigned long long) st->calls,
+		(unsigned long long) st->ns,
+		last ? "" : ","
+	);
+}
+
+static void _print_stat(const char *name, const vid_stat_t *st, uint64_t elapsed)
+{
+	fprintf(stderr, "  %-16s %12llu %12.1f %10.0f %7.2f%%\n",
+		name,
+		(unsigned long long) st->calls,
+		st->ns / 1e6,
+		st->calls ? (double) st->ns / st->calls : 0.0,
+		elapsed ? 100.0 * st->ns / elapsed : 0.0
+	);
+}
+
+/* Print the measured latency, from a video frame being read by
+ * the source to it leaving the sink. The time spent in the sink's
+ * buffers is the most they can hold, as they stay full while the
+ * encoder is waiting to write */
+static void _print_latency(hacktv_t *s)
+{
+	av_t *av = &s->vid.av;
+	
+	if(av->latency_frames == 0)
+	{
+		fprintf(stderr, "  Latency: not measured\n");
+		return;
+	}
+	
+	fprintf(stderr, "  Latency: %.1f ms average, %.1f ms maximum (source %.1f ms, sink %.1f ms)\n",
+		(av->latency_ns / av->latency_frames + s->rf.latency_ns) / 1e6,
+		(av->latency_max_ns + s->rf.latency_ns) / 1e6,
+		av->latency_ns / av->latency_frames / 1e6,
+		s->rf.latency_ns / 1e6
+	);
+}
+
+/* Print the timing counters, as a table or a single line of JSON */
+static void _print_stats(hacktv_t *s, int json)
+{
+	uint64_t elapsed = monotonic_ns() - s->stats_start;
+	int i;
+	
+	if(json)
+	{
+		fprintf(stderr, "{\"elapsed_ns\":%llu,\"stages\":[", (unsigned long long) elapsed);
+		
+		for(i = 0; i < s->vid.nprocesses; i++)
+		{
+			if(s->vid.processes[i].process == NULL) continue;
+			_print_stat_json(s->vid.processes[i].name, &s->vid.processes[i].stat, 0);
+		}
+		
+		_print_stat_json("av_read_video", &s->vid.av_video_stat, 0);
+		_print_stat_json("av_read_audio", &s->vid.av_audio_stat, 0);
+		_print_stat_json("rf_write", &s->rf_stat, 1);
+		
+		fprintf(stderr, "],\"video_repeated\":%u,\"video_starved\":%u,\"audio_starved\":%u,"
+			"\"latency_ns\":%llu,\"latency_max_ns\":%llu,\"sink_latency_ns\":%llu}\n",
+			s->vid.av.video_repeated,
+			s->vid.av.video_starved,
+			s->vid.av.audio_starved,
+			(unsigned long long) (s->vid.av.latency_frames ? s->vid.av.latency_ns / s->vid.av.latency_frames : 0),
+			(unsigned long long) s->vid.av.latency_max_ns,
+			(unsigned long long) s->rf.latency_ns
+		);
+		
+		return;
+	}
+	
+	fprintf(stderr, "\nStats after %.1f seconds:\n", elapsed / 1e9);
+	fprintf(stderr, "  %-16s %12s %12s %10s %8s\n", "stage", "calls", "total ms", "ns/call", "time");
+	
+	for(i = 0; i < s->vid.nprocesses; i++)
+	{
+		if(s->vid.processes[i].process == NULL) continue;
+		_print_stat(s->vid.processes[i].name, &s->vid.processes[i].stat, elapsed);
+	}
+	
+	_print_stat("av_read_video", &s->vid.av_video_stat, elapsed);
+	_print_stat("av_read_audio", &s->vid.av_audio_stat, elapsed);
+	_print_stat("rf_write", &s->rf_stat, elapsed);
+	
+	fprintf(stderr, "  Video frames repeated: %u, starved: %u. Audio frames starved: %u\n",
+		s->vid.av.video_repeated,
+		s->vid.av.video_starved,
+		s->vid.av.audio_starved
+	);
+	
+	_print_latency(s);
+}
+
+static int _rf_write_timed(hacktv_t *s, int16_t *data, size_t samples)
+{
+	uint64_t t = monotonic_ns();
+	int r;
+	
+	r = rf_write(&s->rf, data, samples);
+	
+	s->rf_stat.ns += monotonic_ns() - t;
+	s->rf_stat.calls++;
+	
+	/* Periodic report */
+	if(t - s->stats_last >= STATS_INTERVAL)
+	{
+		_print_stats(s, s->json);
+		s->stats_last = t;
+	}
+	
+	return(r);
+}
+
 /* List all avaliable modes, optionally formatted as a JSON array */
 static void _list_modes(int json)
 {
@@ -479,15 +655,300 @@ enum {
 	_OPT_SECAM_FIELD_ID,
 	_OPT_FFMT,
 	_OPT_FOPTS,
+	_OPT_SCALE_SLICES,
+	_OPT_BUFFER_FRAMES,
 	_OPT_PIXELRATE,
 	_OPT_LIST_MODES,
 	_OPT_JSON,
 	_OPT_SHUFFLE,
 	_OPT_FIT,
 	_OPT_MIN_ASPECT,
-	_OPT_MAX_ASPECT
+	_OPT_MAX_ASPECT,
+	_OPT_TBC,
+	_OPT_MEMSTATS,
+	_OPT_STATS,
+	_OPT_HUGEPAGES,
+	_OPT_DEGRADE,
+	_OPT_AFFINITY,
+	_OPT_SCHED,
+	_OPT_NICE,
+	_OPT_THREADS,
+	_OPT_SEED,
+	_OPT_FIXED_TIME,
+	_OPT_CONTROL,
+	_OPT_LOW_LATENCY,
+	_OPT_LATENCY,
+	_OPT_DWELL,
+	_OPT_CROSSFADE,
 };
 
+static int _open_input(hacktv_t *s, char *input, vid_config_t *conf)
+{
+	char *sub;
+	int l;
+	
+	/* Get a pointer to the input prefix and target */
+	sub = strchr(input, ':');
+	
+	if(sub != NULL)
+	{
+		l = sub - input;
+		sub++;
+	}
+	else
+	{
+		l = strlen(input);
+	}
+	
+	if(strncmp(input, "test", l) == 0)
+	{
+		return(av_test_open(&s->vid.av, sub, conf));
+	}
+	else if(strncmp(input, "ffmpeg", l) == 0)
+	{
+		return(av_ffmpeg_open(&s->vid, conf, sub, s->ffmt, s->fopts));
+	}
+	else if(strncmp(input, "image", l) == 0)
+	{
+		return(av_image_open(&s->vid.av, sub, conf));
+	}
+	
+	return(av_ffmpeg_open(&s->vid, conf, input, s->ffmt, s->fopts));
+}
+
+static void _shuffle_inputs(char *argv[], int first, int argc)
+{
+	char *t;
+	int c, l;
+	
+	/* Avoids moving the last entry to the start
+	 * to prevent it repeating immediately */
+	for(c = first; c < argc - 1; c++)
+	{
+		l = c + (rand() % (argc - c - (c == first ? 1 : 0)));
+		t = argv[c];
+		argv[c] = argv[l];
+		argv[l] = t;
+	}
+}
+
+/* Returns the index of the input after c, or -1 at the end of the
+ * list. With --repeat the list starts again, reshuffled with --shuffle */
+static int _next_input(hacktv_t *s, char *argv[], int c, int argc)
+{
+	if(c + 1 < argc)
+	{
+		return(c + 1);
+	}
+	
+	if(!s->repeat)
+	{
+		return(-1);
+	}
+	
+	if(s->shuffle)
+	{
+		_shuffle_inputs(argv, optind, argc);
+	}
+	
+	return(optind);
+}
+
+/* The next input is opened on another thread while the current one
+ * plays, so the ffmpeg threads have already started decoding it by
+ * the time it's needed. It's opened with a copy of the settings, as
+ * opening can change some of them, and they're only applied once it
+ * becomes the current input */
+typedef struct {
+	hacktv_t *s;
+	char *input;
+	vid_config_t conf;
+	pthread_t thread;
+	int started;
+	int r;
+} _prefetch_t;
+
+static void *_prefetch_thread(void *arg)
+{
+	_prefetch_t *p = arg;
+	
+	affinity_apply(AFFINITY_INPUT);
+	
+	p->r = _open_input(p->s, p->input, &p->conf);
+	
+	return(NULL);
+}
+
+static void _prefetch_start(_prefetch_t *p, hacktv_t *s, char *input)
+{
+	p->s = s;
+	p->input = input;
+	p->conf = s->vid.conf;
+	p->r = HACKTV_ERROR;
+	
+	/* Sources opened now are held until av_next() */
+	s->vid.av.prefetch = 1;
+	
+	p->started = pthread_create(&p->thread, NULL, &_prefetch_thread, p) == 0;
+	
+	if(!p->started)
+	{
+		/* Open it when it's needed instead */
+		s->vid.av.prefetch = 0;
+	}
+}
+
+/* Returns the index of the input before c. The first input
+ * goes back to the last with --repeat, or restarts without */
+static int _previous_input(hacktv_t *s, int c, int argc)
+{
+	if(c > optind)
+	{
+		return(c - 1);
+	}
+	
+	return(s->repeat ? argc - 1 : c);
+}
+
+/* Apply a command from the control socket or terminal. Returns
+ * 1 to skip to the next input, -1 for the previous one or 0 */
+static int _control_apply(hacktv_t *s, control_msg_t *m)
+{
+	switch(m->command)
+	{
+	case CONTROL_PAUSE:
+		s->vid.av.paused = m->value < 0 ? !s->vid.av.paused : m->value != 0;
+		fprintf(stderr, "\nVideo state: %s", s->vid.av.paused ? "PAUSE" : "PLAY");
+		break;
+	
+	case CONTROL_NEXT:
+		return(1);
+	
+	case CONTROL_PREVIOUS:
+		return(-1);
+	
+	case CONTROL_SEEK:
+		if(av_seek(&s->vid.av, m->value, m->relative) == AV_OK)
+		{
+			if(m->relative)
+			{
+				fprintf(stderr, "\nVideo state: %s %gs", m->value > 0 ? "FF" : "RW", fabs(m->value));
+			}
+			else
+			{
+				fprintf(stderr, "\nVideo state: SEEK %gs", m->value);
+			}
+		}
+		break;
+	
+	case CONTROL_LEVEL:
+		/* The encoder was set up with --level, scale relative to it */
+		if(vid_set_level(&s->vid, s->level > 0 ? m->value / s->level : m->value) != VID_OK)
+		{
+			fprintf(stderr, "\nUnable to change the output level");
+		}
+		break;
+	
+	case CONTROL_VOLUME:
+		/* And the source was opened with --volume */
+		vid_set_volume(&s->vid, s->volume > 0 ? m->value / s->volume : m->value);
+		break;
+	
+	case CONTROL_TELETEXT:
+		/* The pages were read by _control_prepare() */
+		if(vid_add_teletext_pages(&s->vid, m->data) != VID_OK)
+		{
+			fprintf(stderr, "\n%s: Teletext is not enabled", m->arg);
+		}
+		break;
+	
+	case CONTROL_ENABLE:
+	case CONTROL_DISABLE:
+		/* Done by _control_prepare() */
+		break;
+	}
+	
+	return(0);
+}
+
+static void _release_pages(void *data)
+{
+	tt_free_pages(data);
+}
+
+/* Prepare a command from the control socket, on the control thread */
+static const char *_control_prepare(void *user, control_msg_t *m)
+{
+	hacktv_t *s = user;
+	tt_service_t *pages;
+	char *arg;
+	
+	switch(m->command)
+	{
+	case CONTROL_TELETEXT:
+		/* Read the pages here, the render thread only adds them */
+		if(tt_read_pages(&pages, m->arg) != TT_OK)
+		{
+			return("Unable to load teletext pages");
+		}
+		
+		m->data = pages;
+		m->release = _release_pages;
+		break;
+	
+	case CONTROL_ENABLE:
+		/* The feature name may be followed by its argument */
+		arg = m->arg + strcspn(m->arg, " \t");
+		
+		if(*arg != '\0')
+		{
+			*arg++ = '\0';
+			arg += strspn(arg, " \t");
+		}
+		
+		if(vid_enable_feature(&s->vid, m->arg, *arg ? arg : NULL) != VID_OK)
+		{
+			return("Unable to enable the feature");
+		}
+		break;
+	
+	case CONTROL_DISABLE:
+		if(vid_disable_feature(&s->vid, m->arg) != VID_OK)
+		{
+			return("Feature is not enabled");
+		}
+		break;
+	
+	default:
+		break;
+	}
+	
+	return(NULL);
+}
+
+static int _prefetch_finish(_prefetch_t *p, hacktv_t *s)
+{
+	if(!p->started)
+	{
+		return(HACKTV_ERROR);
+	}
+	
+	pthread_join(p->thread, NULL);
+	s->vid.av.prefetch = 0;
+	
+	return(p->r);
+}
+
+static void _prefetch_commit(_prefetch_t *p, hacktv_t *s)
+{
+	/* The next input is now current, apply the
+	 * settings that were changed by opening it */
+	s->vid.conf.subtitles = p->conf.subtitles;
+	s->vid.conf.txsubtitles = p->conf.txsubtitles;
+	s->vid.conf.timestamp = p->conf.timestamp;
+	s->vid.conf.logo = p->conf.logo;
+}
+
 int main(int argc, char *argv[])
 {
 	int c;
@@ -562,9 +1023,27 @@ int main(int argc, char *argv[])
 		{ "raw-bb-blanking", required_argument, 0, _OPT_RAW_BB_BLANKING },
 		{ "raw-bb-white",   required_argument, 0, _OPT_RAW_BB_WHITE },
 		{ "secam-field-id", no_argument,       0, _OPT_SECAM_FIELD_ID },
+		{ "tbc",            required_argument, 0, _OPT_TBC },
+		{ "memstats",       no_argument,       0, _OPT_MEMSTATS },
+		{ "stats",          no_argument,       0, _OPT_STATS },
+		{ "hugepages",      no_argument,       0, _OPT_HUGEPAGES },
+		{ "degrade",        no_argument,       0, _OPT_DEGRADE },
+		{ "affinity",       required_argument, 0, _OPT_AFFINITY },
+		{ "sched",          required_argument, 0, _OPT_SCHED },
+		{ "nice",           required_argument, 0, _OPT_NICE },
+		{ "threads",        required_argument, 0, _OPT_THREADS },
+		{ "seed",           required_argument, 0, _OPT_SEED },
+		{ "fixed-time",     required_argument, 0, _OPT_FIXED_TIME },
 		{ "json",           no_argument,       0, _OPT_JSON },
+		{ "control",        required_argument, 0, _OPT_CONTROL },
+		{ "low-latency",    no_argument,       0, _OPT_LOW_LATENCY },
+		{ "latency",        required_argument, 0, _OPT_LATENCY },
+		{ "dwell",          required_argument, 0, _OPT_DWELL },
+		{ "crossfade",      required_argument, 0, _OPT_CROSSFADE },
 		{ "ffmt",           required_argument, 0, _OPT_FFMT },
 		{ "fopts",          required_argument, 0, _OPT_FOPTS },
+		{ "scale-slices",   required_argument, 0, _OPT_SCALE_SLICES },
+		{ "buffer-frames",  required_argument, 0, _OPT_BUFFER_FRAMES },
 		{ "frequency",      required_argument, 0, 'f' },
 		{ "amp",            no_argument,       0, 'a' },
 		{ "gain",           required_argument, 0, 'g' },
@@ -584,8 +1063,9 @@ int main(int argc, char *argv[])
 	const vid_configs_t *vid_confs;
 	vid_config_t vid_conf;
 	char *pre, *sub;
-	int l;
 	int r;
+	int n, opened, skip;
+	_prefetch_t prefetch;
 	
 	/* Disable console output buffer in Windows */
 	#ifdef WIN32
@@ -652,6 +1132,8 @@ int main(int argc, char *argv[])
 	s.subtitles = 0;
 	s.txsubtitles = 0;
 	s.volume = 1;
+	s.dwell = 10;
+	s.crossfade = 0;
 	s.downmix = 0;
 	s.ec_ppv = NULL;
 	s.nodate = 0;
@@ -1045,10 +1527,83 @@ int main(int argc, char *argv[])
 			s.secam_field_id = 1;
 			break;
 		
+		case _OPT_TBC: /* --tbc <file> */
+			s.tbc_file = optarg;
+			break;
+		
+		case _OPT_MEMSTATS: /* --memstats */
+			s.memstats = 1;
+			break;
+		
+		case _OPT_STATS: /* --stats */
+			s.stats = 1;
+			break;
+		
+		case _OPT_HUGEPAGES: /* --hugepages */
+			s.hugepages = 1;
+			break;
+		
+		case _OPT_DEGRADE: /* --degrade */
+			s.degrade = 1;
+			break;
+		
+		case _OPT_AFFINITY: /* --affinity <class>=<cpus> */
+			
+			if(affinity_set_cpus(optarg) != 0)
+			{
+				fprintf(stderr, "Invalid affinity '%s'\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_SCHED: /* --sched <class>=<policy>[:<priority>] */
+			
+			if(affinity_set_sched(optarg) != 0)
+			{
+				fprintf(stderr, "Invalid scheduling policy '%s'\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_NICE: /* --nice <class>=<value> */
+			
+			if(affinity_set_nice(optarg) != 0)
+			{
+				fprintf(stderr, "Invalid nice level '%s'\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_THREADS: /* --threads <value> */
+			
+			if(pool_set_threads(atoi(optarg)) != 0)
+			{
+				fprintf(stderr, "Invalid number of threads '%s'\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_SEED: /* --seed <value> */
+			s.seed = strtoul(optarg, NULL, 0);
+			break;
+		
+		case _OPT_FIXED_TIME: /* --fixed-time <value> */
+			s.fixed_time = strtoll(optarg, NULL, 0);
+			set_fixed_time(s.fixed_time);
+			break;
+		
 		case _OPT_JSON: /* --json */
 			s.json = 1;
 			break;
 		
+		case _OPT_CONTROL: /* --control <path> */
+			s.control = optarg;
+			break;
+		
 		case _OPT_FFMT: /* --ffmt <format> */
 			s.ffmt = optarg;
 			break;
@@ -1057,6 +1612,65 @@ int main(int argc, char *argv[])
 			s.fopts = optarg;
 			break;
 		
+		case _OPT_SCALE_SLICES: /* --scale-slices <value> */
+			s.scale_slices = atoi(optarg);
+			
+			if(s.scale_slices < 0)
+			{
+				fprintf(stderr, "Invalid number of slices '%s'\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_BUFFER_FRAMES: /* --buffer-frames <value> */
+			s.buffer_frames = atoi(optarg);
+			
+			if(s.buffer_frames < 2 || s.buffer_frames > 64)
+			{
+				fprintf(stderr, "Invalid number of frames '%s', must be 2 to 64\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_LOW_LATENCY: /* --low-latency */
+			s.low_latency = 1;
+			break;
+		
+		case _OPT_LATENCY: /* --latency <value> */
+			s.latency = atoi(optarg);
+			
+			if(s.latency <= 0)
+			{
+				fprintf(stderr, "Invalid latency '%s'\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_DWELL: /* --dwell <seconds> */
+			s.dwell = atof(optarg);
+			
+			if(s.dwell <= 0)
+			{
+				fprintf(stderr, "Invalid dwell time '%s'\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_CROSSFADE: /* --crossfade <seconds> */
+			s.crossfade = atof(optarg);
+			
+			if(s.crossfade < 0)
+			{
+				fprintf(stderr, "Invalid crossfade time '%s'\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
 		case 'f': /* -f, --frequency <value> */
 			s.frequency = (uint64_t) strtod(optarg, NULL);
 			break;
@@ -1242,7 +1856,7 @@ int main(int argc, char *argv[])
 
 	if(s.timestamp)
 	{
-		vid_conf.timestamp = time(0);
+		vid_conf.timestamp = wall_time();
 	}
 	
 	if(s.wss)
@@ -1517,6 +2131,15 @@ int main(int argc, char *argv[])
 		vid_conf.vfilter = 1;
 	}
 	
+	if(s.raw_bb_file)
+	{
+		if(vid_conf.type == VID_MAC)
+		{
+			fprintf(stderr, "Raw baseband input is not supported with D/D2-MAC modes.\n");
+			return(-1);
+		}
+	}
+	
 	vid_conf.swap_iq = s.swap_iq;
 	vid_conf.offset = s.offset;
 	vid_conf.passthru = s.passthru;
@@ -1525,6 +2148,22 @@ int main(int argc, char *argv[])
 	vid_conf.raw_bb_file = s.raw_bb_file;
 	vid_conf.raw_bb_blanking_level = s.raw_bb_blanking_level;
 	vid_conf.raw_bb_white_level = s.raw_bb_white_level;
+	vid_conf.tbc_file = s.tbc_file;
+	vid_conf.hugepages = s.hugepages;
+	vid_conf.stats = s.stats;
+	vid_conf.degrade = s.degrade;
+	vid_conf.scale_slices = s.scale_slices;
+	vid_conf.buffer_frames = s.buffer_frames;
+	vid_conf.low_latency = s.low_latency;
+	vid_conf.image_dwell = s.dwell;
+	vid_conf.image_crossfade = s.crossfade;
+	
+	if(s.latency == 0)
+	{
+		s.latency = s.low_latency ? 50 : 400;
+	}
+	vid_conf.seed = s.seed;
+	vid_conf.fixed_time = s.fixed_time;
 	vid_conf.secam_field_id = s.secam_field_id;
 	
 	/* Setup video encoder */
@@ -1537,10 +2176,15 @@ int main(int argc, char *argv[])
 	
 	vid_info(&s.vid);
 	
+	if(s.memstats)
+	{
+		vid_memstats(&s.vid);
+	}
+	
 	if(strcmp(s.output_type, "hackrf") == 0)
 	{
 #ifdef HAVE_HACKRF
-		if(rf_hackrf_open(&s.rf, s.output, s.vid.sample_rate, s.frequency, s.gain, s.amp) != RF_OK)
+		if(rf_hackrf_open(&s.rf, s.output, s.vid.sample_rate, s.frequency, s.gain, s.amp, s.latency) != RF_OK)
 		{
 			vid_free(&s.vid);
 			return(-1);
@@ -1591,105 +2235,135 @@ int main(int argc, char *argv[])
 	av_ffmpeg_init();
 	
 	/* Configure AV source settings */
-	s.vid.av = (av_t) {
-		.frame_rate = (rational_t) {
-			.num = s.vid.conf.frame_rate.num * (s.vid.conf.interlace ? 2 : 1),
-			.den = s.vid.conf.frame_rate.den,
-		},
-		.display_aspect_ratios = {
-			s.vid.conf.frame_aspects[0],
-			s.vid.conf.frame_aspects[1]
-		},
-		.fit_mode = s.fit_mode,
-		.min_display_aspect_ratio = s.min_aspect,
-		.max_display_aspect_ratio = s.max_aspect,
-		.width = s.vid.active_width,
-		.height = s.vid.conf.active_lines,
-		.sample_rate = (rational_t) {
-			.num = (s.vid.audio ? HACKTV_AUDIO_SAMPLE_RATE : 0),
-			1,
-		},
-	};
+	vid_av_init(&s.vid, s.fit_mode, s.min_aspect, s.max_aspect);
 	
-	if((s.vid.conf.frame_orientation & 3) == VID_ROTATE_90 ||
-	   (s.vid.conf.frame_orientation & 3) == VID_ROTATE_270)
+	if(s.stats)
 	{
-		/* Flip dimensions if the lines are scanned vertically */
-		s.vid.av.width = s.vid.conf.active_lines;
-		s.vid.av.height = s.vid.active_width;
+		s.stats_start = s.stats_last = monotonic_ns();
 	}
 	
-	do
+	/* Commands are read on another thread, from
+	 * the socket and the terminal if there is one */
+	if(s.control || isatty(STDIN_FILENO))
 	{
-		if(s.shuffle)
+		if(control_open(&s.ctl, s.control, isatty(STDIN_FILENO), _control_prepare, &s) == CONTROL_OK)
 		{
-			/* Shuffle the input source list */
-			/* Avoids moving the last entry to the start
-			 * to prevent it repeating immediately */
-			for(c = optind; c < argc - 1; c++)
-			{
-				l = c + (rand() % (argc - c - (c == optind ? 1 : 0)));
-				pre = argv[c];
-				argv[c] = argv[l];
-				argv[l] = pre;
-			}
+			s.ctl_open = 1;
+		}
+		else if(s.control)
+		{
+			rf_close(&s.rf);
+			vid_free(&s.vid);
+			return(-1);
+		}
+	}
+	
+	/* The main thread renders the video */
+	affinity_apply(AFFINITY_RENDER);
+	
+	if(s.shuffle)
+	{
+		_shuffle_inputs(argv, optind, argc);
+	}
+	
+	for(c = optind, opened = 0; c >= 0 && !_abort; c = n)
+	{
+		if(!opened && _open_input(&s, argv[c], &s.vid.conf) != HACKTV_OK)
+		{
+			/* Error opening this source. Move to the next */
+			n = _next_input(&s, argv, c, argc);
+			continue;
 		}
 		
-		for(c = optind; c < argc && !_abort; c++)
+		/* Open the next source in the background */
+		n = _next_input(&s, argv, c, argc);
+		
+		if(n >= 0)
 		{
-			/* Get a pointer to the output prefix and target */
-			pre = argv[c];
-			sub = strchr(pre, ':');
+			_prefetch_start(&prefetch, &s, argv[n]);
+		}
+		
+		skip = 0;
+		
+		while(!_abort)
+		{
+			size_t samples;
+			int16_t *data;
+			control_msg_t msg;
 			
-			if(sub != NULL)
-			{
-				l = sub - pre;
-				sub++;
-			}
-			else
+			if(s.ctl_open && control_next(&s.ctl, &msg))
 			{
-				l = strlen(pre);
+				skip = _control_apply(&s, &msg);
+				if(skip != 0) break;
 			}
 			
-			if(strncmp(pre, "test", l) == 0)
-			{
-				r = av_test_open(&s.vid.av, sub, &s.vid.conf);
-			}
-			else if(strncmp(pre, "ffmpeg", l) == 0)
+			data = vid_next_line(&s.vid, &samples);
+			
+			if(data == NULL) break;
+			
+			if(s.stats)
 			{
-				r = av_ffmpeg_open(&s.vid, &s.vid.conf, sub, s.ffmt, s.fopts);
+				if(_rf_write_timed(&s, data, samples) != RF_OK) break;
 			}
 			else
 			{
-				r = av_ffmpeg_open(&s.vid, &s.vid.conf, pre, s.ffmt, s.fopts);
-			}
-			
-			if(r != HACKTV_OK)
-			{
-				/* Error opening this source. Move to the next */
-				continue;
+				if(rf_write(&s.rf, data, samples) != RF_OK) break;
 			}
-			
-			while(!_abort)
+		}
+		
+		if(_signal)
+		{
+			fprintf(stderr, "Caught signal %d\n", _signal);
+			_signal = 0;
+		}
+		
+		opened = 0;
+		
+		if(skip < 0)
+		{
+			/* Go back, dropping the input opened ahead */
+			if(n >= 0 && _prefetch_finish(&prefetch, &s) == HACKTV_OK)
 			{
-				size_t samples;
-				int16_t *data = vid_next_line(&s.vid, &samples);
-				
-				if(data == NULL) break;
-				
-				if(rf_write(&s.rf, data, samples) != RF_OK) break;
+				av_close_next(&s.vid.av);
 			}
 			
-			if(_signal)
+			av_close(&s.vid.av);
+			n = _previous_input(&s, c, argc);
+			continue;
+		}
+		
+		if(n >= 0 && _prefetch_finish(&prefetch, &s) == HACKTV_OK)
+		{
+			if(!_abort)
 			{
-				fprintf(stderr, "Caught signal %d\n", _signal);
-				_signal = 0;
+				/* Switch straight over to the next source. The
+				 * encoder carries on from the same line */
+				av_next(&s.vid.av);
+				_prefetch_commit(&prefetch, &s);
+				opened = 1;
+				continue;
 			}
 			
-			av_close(&s.vid.av);
+			av_close_next(&s.vid.av);
 		}
+		
+		av_close(&s.vid.av);
+	}
+	
+	if(s.stats)
+	{
+		_print_stats(&s, s.json);
+	}
+	else if(s.low_latency)
+	{
+		fprintf(stderr, "\n");
+		_print_latency(&s);
+	}
+	
+	if(s.ctl_open)
+	{
+		control_close(&s.ctl);
 	}
-	while(s.repeat && !_abort);
 	
 	rf_close(&s.rf);
 	vid_free(&s.vid);
@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include "video.h"
 #include "rf.h"
+#include "control.h"
 
 /* Return codes */
 #define HACKTV_OK             0
@@ -103,11 +104,25 @@ typedef struct {
 	char *raw_bb_file;
 	int16_t raw_bb_blanking_level;
 	int16_t raw_bb_white_level;
+	char *tbc_file;
+	int memstats;
+	int hugepages;
+	int stats;
+	int degrade;
+	unsigned int seed;
+	time_t fixed_time;
 	int secam_field_id;
 	int list_modes;
 	int json;
 	char *ffmt;
 	char *fopts;
+	int scale_slices;
+	int buffer_frames;
+	int low_latency;
+	int latency;
+	float dwell;
+	float crossfade;
+	char *control;
 	
 	/* Video encoder state */
 	vid_t vid;
@@ -115,6 +130,15 @@ typedef struct {
 	/* RF sink interface */
 	rf_t rf;
 	
+	/* Control socket and terminal keys */
+	control_t ctl;
+	int ctl_open;
+	
+	/* Timing counters (--stats) */
+	vid_stat_t rf_stat;
+	uint64_t stats_start;
+	uint64_t stats_last;
+	
 } hacktv_t;
 
 #endif
@@ -0,0 +1,91 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* The functions declared in libhacktv.h which don't already live in
+ * video.c. These wrap what the hacktv frontend does for itself */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hacktv.h"
+#include "av_test.h"
+#include "av_image.h"
+#include "av_ffmpeg.h"
+#include "libhacktv.h"
+
+const vid_config_t *vid_find_config(const char *mode)
+{
+	const vid_configs_t *vc;
+	
+	for(vc = vid_configs; vc->id != NULL; vc++)
+	{
+		if(strcmp(mode, vc->id) == 0)
+		{
+			return(vc->conf);
+		}
+	}
+	
+	return(NULL);
+}
+
+vid_t *vid_alloc(void)
+{
+	return(calloc(1, sizeof(vid_t)));
+}
+
+int vid_attach_source(vid_t *s, char *input)
+{
+	static int ffmpeg_ready = 0;
+	char *sub;
+	int l;
+	
+	if(!ffmpeg_ready)
+	{
+		av_ffmpeg_init();
+		ffmpeg_ready = 1;
+	}
+	
+	vid_av_init(s, AV_FIT_STRETCH, (rational_t) { 0, 0 }, (rational_t) { 0, 0 });
+	
+	/* Split the input as _open_input() does in hacktv.c */
+	sub = strchr(input, ':');
+	
+	if(sub != NULL)
+	{
+		l = sub - input;
+		sub++;
+	}
+	else
+	{
+		l = strlen(input);
+	}
+	
+	if(strncmp(input, "test", l) == 0)
+	{
+		return(av_test_open(&s->av, sub, &s->conf));
+	}
+	else if(strncmp(input, "ffmpeg", l) == 0)
+	{
+		return(av_ffmpeg_open(s, &s->conf, sub, NULL, NULL));
+	}
+	else if(strncmp(input, "image", l) == 0)
+	{
+		return(av_image_open(&s->av, sub, &s->conf));
+	}
+	
+	return(av_ffmpeg_open(s, &s->conf, input, NULL, NULL));
+}
+
@@ -0,0 +1,65 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* The public interface of libhacktv. Opens an encoder for one of hacktv's
+ * modes, attaches a video source to it and renders the baseband signal
+ * into the caller's buffer as interleaved I/Q pairs. Everything else in
+ * the library is internal and may change between versions.
+ *
+ * A minimal program:
+ *
+ *   vid_t *s = vid_alloc();
+ *   vid_init(s, 20250000, 20250000, vid_find_config("i"));
+ *   vid_attach_source(s, "test");
+ *   for(;;) n = vid_render(s, iq, sizeof(iq) / sizeof(int16_t) / 2);
+ *   vid_free(s);
+ *   free(s);
+*/
+
+#ifndef _LIBHACKTV_H
+#define _LIBHACKTV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct vid_t vid_t;
+typedef struct vid_config_t vid_config_t;
+
+/* Returns the mode with the name given to hacktv's --mode option,
+ * or NULL if there isn't one */
+extern const vid_config_t *vid_find_config(const char *mode);
+
+/* Allocates an empty encoder for vid_init(). vid_free() releases
+ * what vid_init() set up, the encoder itself is then free()'d */
+extern vid_t *vid_alloc(void);
+
+/* Sets up the encoder for mode conf at sample_rate. A pixel_rate of 0
+ * renders at the sample rate. Returns 0 on success */
+extern int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t * const conf);
+extern void vid_free(vid_t *s);
+
+/* Attaches a source named as on hacktv's command line: "test",
+ * "test:<card>", "image:<path>", "ffmpeg:<url>" or a plain file name
+ * or URL for ffmpeg. Returns 0 on success */
+extern int vid_attach_source(vid_t *s, char *input);
+
+/* Renders samples I/Q pairs into iq and returns how many were written,
+ * which is only fewer than asked for once the source has ended */
+extern size_t vid_render(vid_t *s, int16_t *iq, size_t samples);
+
+#endif
+
@@ -55,25 +55,24 @@ typedef struct {
 	int lln2;
 	int fcp;
 	int lcp;
-	int links;
 } _rdf_t;
 
-static _rdf_t _rdf_d2[] = {
+static const _rdf_t _rdf_d2[] = {
 	/* CID, FL1, LL1,  FL2,  LL2, FCP,  LCP */
-	{ 0x01,   0, 622, 1023, 1023,   9,  205, 0 }, /* MPX 01 data burst (99 bits) */
-	{ 0x10,  22, 309,  334,  621, 235,  583, 0 }, /* CDIFF colour difference signal */
-	{ 0x11,  22, 309,  334,  621, 589, 1285, 0 }, /* LUM luminance signal */
-	{ 0x20,   0,  21,  312,  333, 229, 1292, 0 }, /* FF Fixed Format teletext */
+	{ 0x01,   0, 622, 1023, 1023,   9,  205 }, /* MPX 01 data burst (99 bits) */
+	{ 0x10,  22, 309,  334,  621, 235,  583 }, /* CDIFF colour difference signal */
+	{ 0x11,  22, 309,  334,  621, 589, 1285 }, /* LUM luminance signal */
+	{ 0x20,   0,  21,  312,  333, 229, 1292 }, /* FF Fixed Format teletext */
 	{ 0x00, }, /* End of sequence */
 };
 
-static _rdf_t _rdf_d[] = {
+static const _rdf_t _rdf_d[] = {
 	/* CID, FL1, LL1,  FL2,  LL2, FCP,  LCP */
-	{ 0x01,   0, 622, 1023, 1023,   6,  104, 0 }, /* MPX 01 data burst (99 bits) */
-	{ 0x02,   0, 622, 1023, 1023, 105,  203, 0 }, /* MPX 02 data burst (99 bits) */
-	{ 0x10,  22, 309,  334,  621, 235,  583, 0 }, /* CDIFF colour difference signal */
-	{ 0x11,  22, 309,  334,  621, 589, 1285, 0 }, /* LUM luminance signal */
-	{ 0x20,   0,  21,  312,  333, 229, 1292, 0 }, /* FF Fixed Format teletext */
+	{ 0x01,   0, 622, 1023, 1023,   6,  104 }, /* MPX 01 data burst (99 bits) */
+	{ 0x02,   0, 622, 1023, 1023, 105,  203 }, /* MPX 02 data burst (99 bits) */
+	{ 0x10,  22, 309,  334,  621, 235,  583 }, /* CDIFF colour difference signal */
+	{ 0x11,  22, 309,  334,  621, 589, 1285 }, /* LUM luminance signal */
+	{ 0x20,   0,  21,  312,  333, 229, 1292 }, /* FF Fixed Format teletext */
 	{ 0x00, }, /* End of sequence */
 };
 
@@ -155,7 +154,7 @@ static double _rrc(double x)
 	return(x == 0 ? 1 : sin(M_PI * x) / (M_PI * x));
 }
 
-static int16_t *_duobinary_lut(int mode, int width, double level)
+static int16_t *_duobinary_lut(arena_t *arena, int mode, int width, double level)
 {
 	double samples_per_symbol;
 	double offset;
@@ -170,7 +169,7 @@ static int16_t *_duobinary_lut(int mode, int width, double level)
 	ntaps = (int) (samples_per_symbol * 16) | 1;
 	htaps = ntaps / 2;
 	
-	lut = malloc(sizeof(int16_t) * ((ntaps + 1) * bits + 1));
+	lut = arena_alloc(arena, "mac", sizeof(int16_t) * ((ntaps + 1) * bits + 1));
 	if(!lut)
 	{
 		return(NULL);
@@ -522,20 +521,14 @@ static void _update_udt(uint8_t udt[25], time_t timestamp)
 	struct tm tm;
 	int i, mjd;
 	
-	/* Windows implements localtime differently, using localtime_s rather than localtime_r */
+	/* Get the timezone offset */
+	i = wall_gmtoff(timestamp) / 1800;
+	if(i < 0) i = -i | (1 << 5);
+	
+	/* Windows implements gmtime differently, using gmtime_s rather than gmtime_r */
 	#ifndef WIN32
-		/* Get the timezone offset */
-		localtime_r(&timestamp, &tm);
-		i = tm.tm_gmtoff / 1800;
-		if(i < 0) i = -i | (1 << 5);
-		
 		gmtime_r(&timestamp, &tm);
 	#else
-		/* Get the timezone offset */
-		localtime_s(&tm, &timestamp);
-		i = _timezone / 1800;
-		if(i < 0) i = -i | (1 << 5);
-		
 		gmtime_s(&tm, &timestamp);
 	#endif
 	
@@ -982,8 +975,9 @@ static int _create_si_dg9_packet(mac_t *s, uint8_t *pkt)
 
 	/* Parameter TIME */
 	char t[32];
-    time_t now = time(0);
-    strftime (t, 32, "%d/%m/%Y %H:%M:%S", localtime (&now));
+	struct tm tm;
+    time_t now = wall_time();
+    strftime (t, 32, "%d/%m/%Y %H:%M:%S", wall_tm(now, &tm));
 
 	pkt[x++] = 0x20;		/* PI Service Reference */
 	pkt[x++] = strlen(t);
@@ -1104,7 +1098,7 @@ int mac_init(vid_t *s)
 	mac->teletext = (s->conf.teletext ? 1 : 0);
 	mac->txsubtitles = (s->conf.txsubtitles ? 1 : 0);
 	
-	_update_udt(s->mac.udt, time(NULL));
+	_update_udt(s->mac.udt, wall_time());
 	
 	mac->rdf = 0;
 	
@@ -1125,7 +1119,7 @@ int mac_init(vid_t *s)
 	mac->subframes[1].pkt_bits = MAC_PACKET_BITS;
 	
 	mac->polarity = -1;
-	mac->lut = _duobinary_lut(s->conf.mac_mode, s->width, (s->white_level - s->black_level) * 0.4);
+	mac->lut = _duobinary_lut(&s->arena, s->conf.mac_mode, s->width, (s->white_level - s->black_level) * 0.4);
 	
 	/* Set the video properties */
 	s->active_width &= ~1;	/* Ensure the active width is an even number */
@@ -1151,7 +1145,6 @@ void mac_free(vid_t *s)
 {
 	mac_t *mac = &s->mac;
 	
-	free(mac->lut);
 	mac_audioenc_free(&mac->audio);
 }
 
@@ -1662,7 +1655,7 @@ static int _line_625(vid_t *s, int frame, int line, uint8_t *data, int x)
 	uint16_t b;
 	uint8_t df[16];
 	uint8_t il[69];
-	_rdf_t *rdf;
+	const _rdf_t *rdf;
 	int dx, ix;
 	int i;
 	
@@ -1711,7 +1704,8 @@ static int _line_625(vid_t *s, int frame, int line, uint8_t *data, int x)
 	dx = _bits(df, dx, rdf[s->mac.rdf].lln2, 10);		/* LLN2 (10 bits) */
 	dx = _bits(df, dx, rdf[s->mac.rdf].fcp, 11);		/* FCP (11 bits) */
 	dx = _bits(df, dx, rdf[s->mac.rdf].lcp, 11);		/* LCP (11 bits) */
-	dx = _bits(df, dx, rdf[s->mac.rdf].links ^= 1, 1);	/* LINKS (1 bit) */
+	s->mac.rdf_links ^= 1 << s->mac.rdf;
+	dx = _bits(df, dx, (s->mac.rdf_links >> s->mac.rdf) & 1, 1);	/* LINKS (1 bit) */
 	_bch_encode(df, 94, 80);
 	
 	s->mac.rdf++;
@@ -1887,7 +1881,7 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		/* Update the UDT date and time every 25 frames */
 		if(l->frame % 25 == 0)
 		{
-			_update_udt(s->mac.udt, time(NULL));
+			_update_udt(s->mac.udt, wall_time());
 		}
 	}
 	
@@ -190,8 +190,9 @@ typedef struct {
 	/* UDT (Unified Date and Time) sequence */
 	uint8_t udt[25];
 	
-	/* RDF sequence index */
+	/* RDF sequence index, and the LINKS bit of each entry */
 	int rdf;
+	int rdf_links;
 	
 	/* The data subframes */
 	mac_subframe_t subframes[2];
@@ -0,0 +1,523 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* A process wide work-stealing task pool.
+ *
+ * Each worker has its own deque of tasks. A worker takes new tasks from
+ * the bottom of its own deque and, when that is empty, steals from the
+ * top of the others. Tasks submitted from outside the pool are shared
+ * between the workers in turn.
+ *
+ * Every user of the pool shares the same workers, so several encoders
+ * in one process don't each start a thread per CPU. Threads waiting on
+ * a group of tasks run that group's queued tasks themselves while they
+ * wait, which also means a task can safely submit and wait on tasks of
+ * its own. They never pick up another group's tasks, so a wait is only
+ * as long as its own work and not whatever else happens to be queued.
+ *
+ * With one thread (the default on a single CPU system) no workers are
+ * started and tasks run immediately in the submitting thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+#include "affinity.h"
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#define _DEQUE_SIZE 256
+#define _MAX_THREADS 64
+#define _MAX_CHUNKS 256
+
+typedef struct {
+	pool_task_fn_t fn;
+	void *arg;
+	pool_group_t *group;
+} _task_t;
+
+typedef struct {
+	
+	pthread_t thread;
+	int id;
+	
+	/* The task deque. The owner pushes and pops at the bottom,
+	 * other threads steal from the top */
+	pthread_mutex_t mutex;
+	_task_t tasks[_DEQUE_SIZE];
+	unsigned int top;
+	unsigned int bottom;
+
+} _worker_t;
+
+typedef struct {
+	pool_range_fn_t fn;
+	void *arg;
+	int start;
+	int end;
+} _range_t;
+
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _done = PTHREAD_COND_INITIALIZER;
+
+/* The ffmpeg decoders and the video filters still run on threads of
+ * their own, so by default the pool's tasks run on the caller's thread
+ * rather than adding a worker per CPU on top of them */
+static int _threads = 1;
+static int _refs = 0;
+static int _nworkers = 0;
+static _worker_t *_workers = NULL;
+static int _queued = 0;
+static int _quit = 0;
+static unsigned int _next = 0;
+
+/* The index of the worker running on this thread, or -1 */
+static __thread int _self = -1;
+
+static int _cpus(void)
+{
+	int n;
+
+#ifdef WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	n = si.dwNumberOfProcessors;
+#else
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	
+	if(n < 1) n = 1;
+	if(n > _MAX_THREADS) n = _MAX_THREADS;
+	
+	return(n);
+}
+
+static int _push(_worker_t *w, const _task_t *t)
+{
+	pthread_mutex_lock(&w->mutex);
+	
+	if(w->bottom - w->top == _DEQUE_SIZE)
+	{
+		/* The deque is full */
+		pthread_mutex_unlock(&w->mutex);
+		return(-1);
+	}
+	
+	w->tasks[w->bottom++ % _DEQUE_SIZE] = *t;
+	
+	pthread_mutex_unlock(&w->mutex);
+	
+	return(0);
+}
+
+static int _pop(_worker_t *w, _task_t *t)
+{
+	int r = 0;
+	
+	pthread_mutex_lock(&w->mutex);
+	
+	if(w->bottom != w->top)
+	{
+		*t = w->tasks[--w->bottom % _DEQUE_SIZE];
+		r = 1;
+	}
+	
+	pthread_mutex_unlock(&w->mutex);
+	
+	return(r);
+}
+
+static int _steal(_worker_t *w, _task_t *t)
+{
+	int r = 0;
+	
+	pthread_mutex_lock(&w->mutex);
+	
+	if(w->bottom != w->top)
+	{
+		*t = w->tasks[w->top++ % _DEQUE_SIZE];
+		r = 1;
+	}
+	
+	pthread_mutex_unlock(&w->mutex);
+	
+	return(r);
+}
+
+static int _steal_group(_worker_t *w, pool_group_t *g, _task_t *t)
+{
+	unsigned int i;
+	int r = 0;
+	
+	pthread_mutex_lock(&w->mutex);
+	
+	for(i = w->top; i != w->bottom; i++)
+	{
+		if(w->tasks[i % _DEQUE_SIZE].group != g) continue;
+		
+		/* Swap the task to the top and take it from there */
+		*t = w->tasks[i % _DEQUE_SIZE];
+		w->tasks[i % _DEQUE_SIZE] = w->tasks[w->top % _DEQUE_SIZE];
+		w->top++;
+		r = 1;
+		break;
+	}
+	
+	pthread_mutex_unlock(&w->mutex);
+	
+	return(r);
+}
+
+static int _take_group(pool_group_t *g, _task_t *t)
+{
+	int i, r = 0;
+	
+	/* Find a queued task from group g, starting with our own deque */
+	for(i = 0; !r && i < _nworkers; i++)
+	{
+		r = _steal_group(&_workers[(_self + i + _nworkers) % _nworkers], g, t);
+	}
+	
+	if(r)
+	{
+		pthread_mutex_lock(&_mutex);
+		_queued--;
+		pthread_mutex_unlock(&_mutex);
+	}
+	
+	return(r);
+}
+
+static int _take(_task_t *t)
+{
+	int i, r = 0;
+	
+	if(_self >= 0)
+	{
+		r = _pop(&_workers[_self], t);
+	}
+	
+	/* Steal from the other workers, starting with the next one along */
+	for(i = 1; !r && i <= _nworkers; i++)
+	{
+		int w = (_self + i + _nworkers) % _nworkers;
+		
+		if(w != _self)
+		{
+			r = _steal(&_workers[w], t);
+		}
+	}
+	
+	if(r)
+	{
+		pthread_mutex_lock(&_mutex);
+		_queued--;
+		pthread_mutex_unlock(&_mutex);
+	}
+	
+	return(r);
+}
+
+static void _run(_task_t *t)
+{
+	t->fn(t->arg);
+	
+	pthread_mutex_lock(&_mutex);
+	
+	if(--t->group->pending == 0)
+	{
+		/* Wake any thread waiting on this group */
+		pthread_cond_broadcast(&_done);
+	}
+	
+	pthread_mutex_unlock(&_mutex);
+}
+
+static void *_worker_thread(void *arg)
+{
+	_worker_t *w = arg;
+	_task_t t;
+	int quit;
+	
+	_self = w->id;
+	
+	affinity_apply(AFFINITY_RENDER);
+	
+	for(;;)
+	{
+		if(_take(&t))
+		{
+			_run(&t);
+			continue;
+		}
+		
+		pthread_mutex_lock(&_mutex);
+		
+		while(_queued == 0 && !_quit)
+		{
+			pthread_cond_wait(&_cond, &_mutex);
+		}
+		
+		quit = _quit && _queued == 0;
+		
+		pthread_mutex_unlock(&_mutex);
+		
+		if(quit) break;
+	}
+	
+	return(NULL);
+}
+
+int pool_set_threads(int threads)
+{
+	/* 0 selects one thread per CPU */
+	if(threads < 0 || threads > _MAX_THREADS)
+	{
+		return(-1);
+	}
+	
+	_threads = threads;
+	
+	return(0);
+}
+
+int pool_threads(void)
+{
+	/* The number of threads running tasks, including the caller */
+	return(_nworkers + 1);
+}
+
+int pool_open(void)
+{
+	int i, n;
+	
+	pthread_mutex_lock(&_mutex);
+	
+	if(_refs++ > 0)
+	{
+		pthread_mutex_unlock(&_mutex);
+		return(0);
+	}
+	
+	/* The thread waiting on a group helps run its tasks,
+	 * so start one worker less than the number of threads */
+	n = (_threads > 0 ? _threads : _cpus()) - 1;
+	
+	if(n > 0)
+	{
+		_workers = calloc(n, sizeof(_worker_t));
+		if(_workers == NULL)
+		{
+			_refs--;
+			pthread_mutex_unlock(&_mutex);
+			return(-1);
+		}
+		
+		for(i = 0; i < n; i++)
+		{
+			_workers[i].id = i;
+			pthread_mutex_init(&_workers[i].mutex, NULL);
+		}
+		
+		/* Workers can steal from each other as soon as they start */
+		_nworkers = n;
+		
+		for(i = 0; i < n; i++)
+		{
+			if(pthread_create(&_workers[i].thread, NULL, &_worker_thread, &_workers[i]) != 0)
+			{
+				fprintf(stderr, "Warning: Unable to start task pool thread %d\n", i);
+				break;
+			}
+		}
+		
+		if(i < n)
+		{
+			/* Carry on with the workers that did start. The stopped
+			 * workers' deques are empty and nothing is queued yet */
+			_nworkers = i;
+			
+			for(; i < n; i++)
+			{
+				pthread_mutex_destroy(&_workers[i].mutex);
+			}
+		}
+		
+		if(_nworkers == 0)
+		{
+			free(_workers);
+			_workers = NULL;
+		}
+	}
+	
+	pthread_mutex_unlock(&_mutex);
+	
+	return(0);
+}
+
+void pool_close(void)
+{
+	int i, n;
+	
+	pthread_mutex_lock(&_mutex);
+	
+	if(_refs == 0 || --_refs > 0)
+	{
+		pthread_mutex_unlock(&_mutex);
+		return;
+	}
+	
+	_quit = 1;
+	pthread_cond_broadcast(&_cond);
+	
+	n = _nworkers;
+	
+	pthread_mutex_unlock(&_mutex);
+	
+	for(i = 0; i < n; i++)
+	{
+		pthread_join(_workers[i].thread, NULL);
+		pthread_mutex_destroy(&_workers[i].mutex);
+	}
+	
+	free(_workers);
+	_workers = NULL;
+	_nworkers = 0;
+	_quit = 0;
+}
+
+void pool_group_init(pool_group_t *g)
+{
+	g->pending = 0;
+}
+
+void pool_submit(pool_group_t *g, pool_task_fn_t fn, void *arg)
+{
+	_task_t t = { fn, arg, g };
+	int r;
+	
+	if(_nworkers == 0)
+	{
+		/* No workers, run the task now */
+		fn(arg);
+		return;
+	}
+	
+	pthread_mutex_lock(&_mutex);
+	
+	g->pending++;
+	
+	/* Workers push onto their own deque, anyone else
+	 * shares the tasks out between the workers */
+	r = _push(&_workers[_self >= 0 ? _self : _next++ % _nworkers], &t);
+	if(r == 0)
+	{
+		_queued++;
+		pthread_cond_signal(&_cond);
+	}
+	
+	pthread_mutex_unlock(&_mutex);
+	
+	if(r != 0)
+	{
+		/* The deque is full, run the task now */
+		_run(&t);
+	}
+}
+
+void pool_wait(pool_group_t *g)
+{
+	_task_t t;
+	
+	for(;;)
+	{
+		/* Help with this group's queued tasks */
+		if(_take_group(g, &t))
+		{
+			_run(&t);
+			continue;
+		}
+		
+		pthread_mutex_lock(&_mutex);
+		
+		if(g->pending == 0)
+		{
+			pthread_mutex_unlock(&_mutex);
+			break;
+		}
+		
+		/* The rest are running on the workers */
+		pthread_cond_wait(&_done, &_mutex);
+		
+		pthread_mutex_unlock(&_mutex);
+	}
+}
+
+static void _range_task(void *arg)
+{
+	_range_t *r = arg;
+	
+	r->fn(r->arg, r->start, r->end);
+}
+
+void pool_parallel_for(int n, int grain, pool_range_fn_t fn, void *arg)
+{
+	_range_t ranges[_MAX_CHUNKS];
+	pool_group_t g;
+	int i, chunks;
+	
+	if(n <= 0)
+	{
+		return;
+	}
+	
+	if(grain < 1) grain = 1;
+	
+	/* Split the range into a few chunks per thread, so threads
+	 * that finish early can steal the remaining ones */
+	chunks = (_nworkers + 1) * 4;
+	if(chunks > n / grain) chunks = n / grain;
+	if(chunks > _MAX_CHUNKS) chunks = _MAX_CHUNKS;
+	
+	if(_nworkers == 0 || chunks <= 1)
+	{
+		fn(arg, 0, n);
+		return;
+	}
+	
+	pool_group_init(&g);
+	
+	for(i = 0; i < chunks; i++)
+	{
+		ranges[i].fn = fn;
+		ranges[i].arg = arg;
+		ranges[i].start = (int64_t) n * i / chunks;
+		ranges[i].end = (int64_t) n * (i + 1) / chunks;
+		
+		pool_submit(&g, _range_task, &ranges[i]);
+	}
+	
+	pool_wait(&g);
+}
+
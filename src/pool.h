@@ -0,0 +1,41 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+typedef void (*pool_task_fn_t)(void *arg);
+typedef void (*pool_range_fn_t)(void *arg, int start, int end);
+
+/* A group of tasks that can be waited on together */
+typedef struct {
+	int pending;
+} pool_group_t;
+
+extern int pool_set_threads(int threads);
+extern int pool_threads(void);
+extern int pool_open(void);
+extern void pool_close(void);
+
+extern void pool_group_init(pool_group_t *g);
+extern void pool_submit(pool_group_t *g, pool_task_fn_t fn, void *arg);
+extern void pool_wait(pool_group_t *g);
+
+extern void pool_parallel_for(int n, int grain, pool_range_fn_t fn, void *arg);
+
+#endif
+
@@ -45,6 +45,10 @@ typedef struct {
 	rf_write_t write;
 	rf_close_t close;
 	
+	/* Time samples spend in the sink's own buffers
+	 * once they have filled, or 0 if not known */
+	uint64_t latency_ns;
+	
 } rf_t;
 
 extern int rf_write(rf_t *s, int16_t *iq_data, size_t samples);
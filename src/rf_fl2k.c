@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <osmo-fl2k.h>
 #include <pthread.h>
+#include "affinity.h"
 #include "rf.h"
 
 #define BUFFERS 4
@@ -36,6 +37,9 @@ typedef struct {
 	int in;
 	int out;
 	
+	/* Callback thread settings applied */
+	int affinity;
+	
 } fl2k_t;
 
 static void _callback(fl2k_data_info_t *data_info)
@@ -43,6 +47,12 @@ static void _callback(fl2k_data_info_t *data_info)
 	fl2k_t *rf = data_info->ctx;
 	int i;
 	
+	if(!rf->affinity)
+	{
+		affinity_apply(AFFINITY_SINK);
+		rf->affinity = 1;
+	}
+	
 	if(data_info->device_error)
 	{
 		rf->abort = 1;
@@ -190,6 +200,9 @@ int rf_fl2k_open(rf_t *s, const char *device, unsigned int sample_rate)
 	s->write = _rf_write;
 	s->close = _rf_close;
 	
+	/* The buffers are fixed, this is the most they hold */
+	s->latency_ns = (uint64_t) BUFFERS * FL2K_BUF_LEN * 1000000000ULL / sample_rate;
+	
 	return(RF_OK);
 }
 
@@ -21,6 +21,8 @@
 #include <libhackrf/hackrf.h>
 #include <pthread.h>
 #include <unistd.h>
+#include "common.h"
+#include "affinity.h"
 #include "rf.h"
 
 typedef enum {
@@ -68,6 +70,15 @@ typedef struct {
 	/* Buffers */
 	buffers_t buffers;
 	
+	/* Underruns since the first data was sent */
+	volatile int started;
+	volatile unsigned int underruns;
+	unsigned int reported;
+	uint64_t report_time;
+	
+	/* Callback thread settings applied */
+	int affinity;
+	
 } hackrf_t;
 
 static int _buffer_init(buffers_t *buffers, size_t count, size_t length)
@@ -215,6 +226,12 @@ static int _tx_callback(hackrf_transfer *transfer)
 	uint8_t *buf = transfer->buffer;
 	int r;
 	
+	if(!rf->affinity)
+	{
+		affinity_apply(AFFINITY_SINK);
+		rf->affinity = 1;
+	}
+	
 	while(l)
 	{
 		r = _buffer_read(&rf->buffers, (int8_t *) buf, l);
@@ -224,9 +241,15 @@ static int _tx_callback(hackrf_transfer *transfer)
 			/* Buffer underrun, fill with zero */
 			memset(buf, 0, l);
 			l = 0;
+			
+			if(rf->started)
+			{
+				rf->underruns++;
+			}
 		}
 		else
 		{
+			rf->started = 1;
 			l -= r;
 			buf += r;
 		}
@@ -240,6 +263,20 @@ static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 	hackrf_t *rf = private;
 	int8_t *iq8 = NULL;
 	int i, r;
+	uint64_t t;
+	
+	/* Report any underruns, at most once a second */
+	if(rf->underruns != rf->reported)
+	{
+		t = monotonic_ns();
+		
+		if(t - rf->report_time >= 1000000000ULL)
+		{
+			fprintf(stderr, "HackRF buffer underrun (%u total)\n", rf->underruns);
+			rf->reported = rf->underruns;
+			rf->report_time = t;
+		}
+	}
 	
 	samples *= 2;
 	
@@ -293,7 +330,7 @@ static int _rf_close(void *private)
 	return(RF_OK);
 }
 
-int rf_hackrf_open(rf_t *s, const char *serial, uint32_t sample_rate, uint64_t frequency_hz, unsigned int txvga_gain, unsigned char amp_enable)
+int rf_hackrf_open(rf_t *s, const char *serial, uint32_t sample_rate, uint64_t frequency_hz, unsigned int txvga_gain, unsigned char amp_enable, unsigned int latency_ms)
 {
 	hackrf_t *rf;
 	int r;
@@ -361,11 +398,15 @@ int rf_hackrf_open(rf_t *s, const char *serial, uint32_t sample_rate, uint64_t f
 		return(RF_ERROR);
 	}
 	
-	/* Allocate memory for the output buffers, enough for at least 400ms - minimum 4 */
-	r = sample_rate * 2 * 4 / 10 / hackrf_get_transfer_buffer_size(rf->d);
-	if(r < 4) r = 4;
+	/* Allocate memory for the output buffers, enough for at least
+	 * latency_ms. Minimum 4, or 2 if a short latency was asked for */
+	r = (uint64_t) sample_rate * 2 * latency_ms / 1000 / hackrf_get_transfer_buffer_size(rf->d);
+	if(r < (latency_ms < 400 ? 2 : 4)) r = latency_ms < 400 ? 2 : 4;
 	_buffer_init(&rf->buffers, r, hackrf_get_transfer_buffer_size(rf->d));
 	
+	/* Time the buffers hold once full */
+	s->latency_ns = (uint64_t) r * hackrf_get_transfer_buffer_size(rf->d) / 2 * 1000000000ULL / sample_rate;
+	
 	/* Begin transmitting */
 	r = hackrf_start_tx(rf->d, _tx_callback, rf);
 	if(r != HACKRF_SUCCESS)
@@ -125,6 +125,108 @@ static char *_get_subtitle_string(char *fmt)
 	return txt;
 }
 
+/* Add subtitle sindex to the index. Subtitles nearly always arrive in
+ * order, so this is usually an append */
+static int _index_add(av_subs_t *subs, int sindex)
+{
+	uint32_t start, end;
+	int i, n;
+	void *p;
+	
+	n = subs[0].number_of_subs;
+	
+	if(n == subs[0].order_size)
+	{
+		i = subs[0].order_size ? subs[0].order_size * 2 : 256;
+		
+		p = realloc(subs[0].order, sizeof(int) * i);
+		if(!p)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+		subs[0].order = p;
+		
+		p = realloc(subs[0].order_end, sizeof(uint32_t) * i);
+		if(!p)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+		subs[0].order_end = p;
+		
+		subs[0].order_size = i;
+	}
+	
+	start = subs[sindex].start_time;
+	
+	for(i = n; i > 0 && (uint32_t) subs[subs[0].order[i - 1]].start_time > start; i--)
+	{
+		subs[0].order[i] = subs[0].order[i - 1];
+	}
+	
+	subs[0].order[i] = sindex;
+	
+	/* Update the latest end times from the new position on */
+	for(; i <= n; i++)
+	{
+		end = subs[subs[0].order[i]].end_time;
+		
+		if(i > 0 && subs[0].order_end[i - 1] > end)
+		{
+			end = subs[0].order_end[i - 1];
+		}
+		
+		subs[0].order_end[i] = end;
+	}
+	
+	return(HACKTV_OK);
+}
+
+/* Find the most recently started subtitle showing at ts, or -1 */
+static int _index_find(av_subs_t *subs, uint32_t ts)
+{
+	const int *order = subs[0].order;
+	int lo, hi, mid, n, i;
+	
+	n = subs[0].number_of_subs;
+	i = subs[0].pos;
+	
+	/* The subtitle found for the last frame is usually still showing */
+	if(i < n &&
+	   (uint32_t) subs[order[i]].start_time <= ts &&
+	   (uint32_t) subs[order[i]].end_time >= ts &&
+	   (i + 1 == n || (uint32_t) subs[order[i + 1]].start_time > ts))
+	{
+		return(order[i]);
+	}
+	
+	/* Find the last subtitle to start at or before ts */
+	for(lo = 0, hi = n; lo < hi; )
+	{
+		mid = (lo + hi) / 2;
+		
+		if((uint32_t) subs[order[mid]].start_time <= ts)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	
+	/* And step back while any earlier one could still be showing */
+	for(i = lo - 1; i >= 0 && subs[0].order_end[i] >= ts; i--)
+	{
+		if((uint32_t) subs[order[i]].end_time >= ts)
+		{
+			subs[0].pos = i;
+			return(order[i]);
+		}
+	}
+	
+	return(-1);
+}
+
 void load_text_subtitle(av_subs_t *subs, uint32_t start_time, uint32_t duration, char *fmt)
 {
 	int sindex;
@@ -144,69 +246,269 @@ void load_text_subtitle(av_subs_t *subs, uint32_t start_time, uint32_t duration,
 	/* Copy subtitle text into subs struct */
 	memcpy(subs[sindex].text, s, 256);
 	
-	/* Update number of subtitles */
-	subs[0].number_of_subs++;
+	/* Index and count the subtitle */
+	pthread_mutex_lock(&subs[0].mutex);
+	if(_index_add(subs, sindex) == HACKTV_OK)
+	{
+		subs[0].number_of_subs++;
+	}
+	pthread_mutex_unlock(&subs[0].mutex);
 	
 	subs[0].type = SUB_TEXT;
 }
 
 
-void load_bitmap_subtitle(AVSubtitle *sub, av_subs_t *subs, int bitmap_width, int max_bitmap_width, int max_bitmap_height, uint32_t pts, int bitmap_scale)
+/* FNV-1a hash of an encoded subtitle bitmap */
+static uint64_t _bitmap_hash(const sub_bitmap_t *bitmap)
 {
-	uint32_t *bitmap;
-	int i, x, y, pixel, sindex;
+	uint64_t h = 0xCBF29CE484222325ULL;
+	int i;
 	
-	sindex = subs[0].number_of_subs;
-		
-	/* Load subs struct with data */
-	subs[sindex].index = sindex;
-	subs[sindex].start_time = pts + sub->start_display_time;
-	subs[sindex].end_time = pts + sub->start_display_time + sub->end_display_time;
-	subs[sindex].bitmap_height = max_bitmap_height;
-	subs[sindex].bitmap_width = bitmap_width;
-		
-	/* Convert subtitle to bitmap */
-	bitmap = malloc(max_bitmap_width * max_bitmap_height * sizeof(uint32_t));
+	for(i = 0; i < bitmap->rows[bitmap->height]; i++)
+	{
+		h = (h ^ bitmap->runs[i].length) * 0x100000001B3ULL;
+		h = (h ^ bitmap->runs[i].colour) * 0x100000001B3ULL;
+	}
+	
+	for(i = 0; i < bitmap->colours; i++)
+	{
+		h = (h ^ bitmap->palette[i]) * 0x100000001B3ULL;
+	}
+	
+	return(h);
+}
+
+static void _free_bitmap(sub_bitmap_t *bitmap)
+{
+	if(!bitmap) return;
+	free(bitmap->palette);
+	free(bitmap->rows);
+	free(bitmap->runs);
+	free(bitmap);
+}
+
+/* Find or add a colour in the palette, premultiplied with 255 - alpha
+ * in the top byte. All invisible colours share entry 0 */
+static int _bitmap_colour(sub_bitmap_t *bitmap, uint32_t c)
+{
+	uint32_t a, r, g, b;
+	int i;
+	
+	a = c >> 24;
+	r = (c >> 16) & 0xFF;
+	g = (c >> 8) & 0xFF;
+	b = (c >> 0) & 0xFF;
+	
+	if(a == 0)
+	{
+		return(0);
+	}
+	
+	c = (255 - a) << 24 | (r * a / 255) << 16 | (g * a / 255) << 8 | (b * a / 255);
+	
+	for(i = 1; i < bitmap->colours; i++)
+	{
+		if(bitmap->palette[i] == c) return(i);
+	}
+	
+	bitmap->palette[bitmap->colours] = c;
+	
+	return(bitmap->colours++);
+}
+
+/* Compose the subtitle rects into palette indices, then store each
+ * row as runs of one colour */
+static sub_bitmap_t *_encode_bitmap(AVSubtitle *sub, int width, int height, int scale)
+{
+	sub_bitmap_t *bitmap;
+	uint16_t *image, c;
+	int map[256];
+	int i, x, y, n;
+	void *p;
+	
+	bitmap = calloc(1, sizeof(sub_bitmap_t));
+	image = calloc(width * height, sizeof(uint16_t));
+	
+	if(!bitmap || !image)
+	{
+		free(bitmap);
+		free(image);
+		return(NULL);
+	}
 	
-	/* Set all pixels to black */
-	memset(bitmap, 0, max_bitmap_width * max_bitmap_height * sizeof(uint32_t));
+	bitmap->width = width;
+	bitmap->height = height;
+	bitmap->palette = malloc(sizeof(uint32_t) * (1 + 256 * sub->num_rects));
+	bitmap->rows = malloc(sizeof(int) * (height + 1));
 	
+	if(!bitmap->palette || !bitmap->rows)
+	{
+		free(image);
+		_free_bitmap(bitmap);
+		return(NULL);
+	}
+	
+	bitmap->palette[0] = 0xFF000000;
+	bitmap->colours = 1;
+	
+	/* The first rect is drawn last, on top */
 	for(i = sub->num_rects - 1; i >= 0; i--)
-	{	
-		for (x = 0; x < sub->rects[i]->w; x++)
+	{
+		AVSubtitleRect *rect = sub->rects[i];
+		
+		for(x = 0; x < 256; x++)
 		{
-			for (y = 0; y < sub->rects[i]->h; y++)
+			map[x] = -1;
+		}
+		
+		for(y = 0; y < rect->h; y++)
+		{
+			for(x = 0; x < rect->w; x++)
 			{
-				/* Colour index */
-				char c = sub->rects[i]->data[0][y * sub->rects[i]->w + x];
+				/* Colour index, 0 is transparent */
+				n = rect->data[0][y * rect->linesize[0] + x];
+				if(!n) continue;
 				
-				if(c)
+				/* The palette is native endian ARGB */
+				if(map[n] < 0)
 				{
-					/* Pixel position */
-					pixel = (y / bitmap_scale * max_bitmap_width + x / bitmap_scale);
-
-					char r = sub->rects[i]->data[1][c * 4 + 0];
-					char g = sub->rects[i]->data[1][c * 4 + 1];
-					char b = sub->rects[i]->data[1][c * 4 + 2];
-					char a = sub->rects[i]->data[1][c * 4 + 3];
-					
-					bitmap[pixel] = (a << 24 | r << 16 | g << 8 | b << 0);
+					map[n] = _bitmap_colour(bitmap, ((uint32_t *) rect->data[1])[n]);
 				}
+				
+				image[y / scale * width + x / scale] = map[n];
+			}
+		}
+	}
+	
+	/* Drop the unused palette entries */
+	p = realloc(bitmap->palette, sizeof(uint32_t) * bitmap->colours);
+	if(p) bitmap->palette = p;
+	
+	/* Count the runs, then store them */
+	for(y = n = 0; y < height; y++)
+	{
+		for(x = 0; x < width; n++)
+		{
+			for(c = image[y * width + x]; x < width && image[y * width + x] == c; x++);
+		}
+	}
+	
+	bitmap->runs = malloc(sizeof(sub_run_t) * n);
+	if(!bitmap->runs && n > 0)
+	{
+		free(image);
+		_free_bitmap(bitmap);
+		return(NULL);
+	}
+	
+	for(y = n = 0; y < height; y++)
+	{
+		bitmap->rows[y] = n;
+		
+		for(x = 0; x < width; n++)
+		{
+			bitmap->runs[n].colour = c = image[y * width + x];
+			bitmap->runs[n].length = 0;
+			
+			for(; x < width && image[y * width + x] == c; x++)
+			{
+				bitmap->runs[n].length++;
 			}
 		}
 	}
+	
+	bitmap->rows[height] = n;
+	
+	free(image);
+	
+	return(bitmap);
+}
 
-	/* Resize bitmap subtitle and load into subs struct */
-	subs[sindex].bitmap = malloc(bitmap_width * max_bitmap_height * sizeof(uint32_t));
-	resize_bitmap(bitmap, subs[sindex].bitmap, max_bitmap_width, max_bitmap_height, bitmap_width, max_bitmap_height);
+void load_bitmap_subtitle(AVSubtitle *sub, av_subs_t *subs, int bitmap_width, int max_bitmap_width, int max_bitmap_height, uint32_t pts, int bitmap_scale)
+{
+	sub_bitmap_t *bitmap;
+	int i, sindex;
+	
+	sindex = subs[0].number_of_subs;
+	
+	/* Keep the subtitle as runs of palette colours, as it arrives */
+	bitmap = _encode_bitmap(sub, max_bitmap_width, max_bitmap_height, bitmap_scale);
+	if(!bitmap)
+	{
+		return;
+	}
+	
+	/* Load subs struct with data */
+	subs[sindex].index = sindex;
+	subs[sindex].start_time = pts + sub->start_display_time;
+	subs[sindex].end_time = pts + sub->start_display_time + sub->end_display_time;
+	subs[sindex].bitmap_height = max_bitmap_height;
+	subs[sindex].bitmap_width = bitmap_width;
+	subs[sindex].hash = _bitmap_hash(bitmap);
+	subs[sindex].bitmap = bitmap;
+	
+	/* Broadcasters repeat the same subtitle page many
+	 * times, share the bitmap with a recent match */
+	for(i = sindex - 1; i >= 0 && i >= sindex - SUB_BITMAP_CACHE; i--)
+	{
+		if(subs[i].bitmap &&
+		   subs[i].hash == subs[sindex].hash &&
+		   subs[i].bitmap->width == bitmap->width &&
+		   subs[i].bitmap->height == bitmap->height &&
+		   subs[i].bitmap_width == bitmap_width)
+		{
+			subs[sindex].bitmap = subs[i].bitmap;
+			_free_bitmap(bitmap);
+			break;
+		}
+	}
 	
-	/* Update number of subtitles */
-	subs[0].number_of_subs++;
+	/* Index and count the subtitle */
+	pthread_mutex_lock(&subs[0].mutex);
+	if(_index_add(subs, sindex) == HACKTV_OK)
+	{
+		subs[0].number_of_subs++;
+	}
+	pthread_mutex_unlock(&subs[0].mutex);
 	
 	/* Set subtitle type */
 	subs[0].type = SUB_BITMAP;
+}
 
-	free(bitmap);
+/* Blend a bitmap subtitle onto the frame straight from its runs, scaled
+ * across to w pixels wide. Transparent runs are skipped */
+int display_bitmap_subtitle(av_font_t *font, uint32_t *vid, int w, int h, const sub_bitmap_t *bitmap)
+{
+	const sub_run_t *run;
+	int i, j, x, x0, x1, y, x_start, y_start;
+	
+	x_start = (font->video_width / 2) - (w / 2);
+	y_start = (font->video_height) * 0.8;
+	
+	for(y = 0; y < h && y < bitmap->height; y++)
+	{
+		i = y_start + y;
+		if(i < 0 || i >= font->video_height) continue;
+		
+		for(j = bitmap->rows[y], x = 0; j < bitmap->rows[y + 1]; j++)
+		{
+			run = &bitmap->runs[j];
+			
+			x0 = x_start + x * w / bitmap->width;
+			x += run->length;
+			x1 = x_start + x * w / bitmap->width;
+			
+			if(run->colour == 0) continue;
+			
+			if(x0 < 0) x0 = 0;
+			if(x1 > font->video_width) x1 = font->video_width;
+			if(x0 >= x1) continue;
+			
+			blend_fill(&vid[i * font->video_width + x0], bitmap->palette[run->colour], x1 - x0);
+		}
+	}
+	
+	return(0);
 }
 
 int subs_init_ffmpeg(av_subs_t **s)
@@ -225,6 +527,7 @@ int subs_init_ffmpeg(av_subs_t **s)
 	
 	subs[0].pos = 0;
 	subs[0].number_of_subs = 0;
+	pthread_mutex_init(&subs[0].mutex, NULL);
 
 	*s = subs;
 	
@@ -337,8 +640,21 @@ int subs_init_file(char *video_path, av_subs_t **s)
 	/* Close file */
 	fclose(fp);
 
+	/* Index the subtitles, the file may not be in order */
 	subs[0].pos = 0;
-	subs[0].number_of_subs = sindex;
+	subs[0].number_of_subs = 0;
+	pthread_mutex_init(&subs[0].mutex, NULL);
+	
+	for(n = 0; n < sindex; n++)
+	{
+		if(_index_add(subs, n) != HACKTV_OK)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+		
+		subs[0].number_of_subs++;
+	}
+	
 	subs[0].type = SUB_TEXT;
 	*s = subs;
 	return(HACKTV_OK);
@@ -349,16 +665,11 @@ char *get_text_subtitle(av_subs_t *subs, uint32_t ts)
 	char *fmt;
 	int x;
 	
-	fmt = "";
-	for(x = subs[0].pos; x < subs[0].number_of_subs; x++)
-	{
-		if(ts >= subs[x].start_time && ts <= subs[x].end_time)
-		{
-			fmt = subs[x].text;
-			subs[0].pos = x;
-			break;
-		}
-	}
+	pthread_mutex_lock(&subs[0].mutex);
+	x = _index_find(subs, ts);
+	pthread_mutex_unlock(&subs[0].mutex);
+	
+	fmt = x >= 0 ? subs[x].text : "";
 
 	return fmt;
 }
@@ -369,16 +680,16 @@ int get_bitmap_subtitle(av_subs_t *subs, uint32_t current_timestamp, int *w, int
 	
 	*w = 0;
 	
-	for(x = subs[0].pos; x < subs[0].number_of_subs; x++)
+	pthread_mutex_lock(&subs[0].mutex);
+	x = _index_find(subs, current_timestamp);
+	pthread_mutex_unlock(&subs[0].mutex);
+	
+	if(x >= 0)
 	{
-		if(current_timestamp >= subs[x].start_time && current_timestamp <= subs[x].end_time)
-		{
-			subs[0].pos = x;
-			*w = subs[x].bitmap_width;
-			*h = subs[x].bitmap_height;
-			break;
-		}
+		*w = subs[x].bitmap_width;
+		*h = subs[x].bitmap_height;
 	}
+	
 	return x;
 }
 
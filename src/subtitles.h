@@ -18,12 +18,34 @@
 #ifndef SUBTITLES_H_
 #define SUBTITLES_H_
 
+#include <pthread.h>
 #include <libavcodec/avcodec.h>
 #include "video.h"
 
 #define SUB_BITMAP 0
 #define SUB_TEXT 1
 
+/* Recent subtitles checked for an identical bitmap to share */
+#define SUB_BITMAP_CACHE 8
+
+/* A run of pixels of one palette colour, colour 0 is transparent */
+typedef struct {
+	uint16_t length;
+	uint16_t colour;
+} sub_run_t;
+
+/* A bitmap subtitle at its decoded size, stored as runs of colours.
+ * Row y is runs rows[y] to rows[y + 1] - 1. The palette colours are
+ * premultiplied, with 255 - alpha in the top byte */
+typedef struct {
+	int width;
+	int height;
+	int colours;
+	uint32_t *palette;
+	int *rows;
+	sub_run_t *runs;
+} sub_bitmap_t;
+
 typedef struct {
 	int pos;
 	int type;
@@ -32,10 +54,19 @@ typedef struct {
     int end_time;
     char text[256];
 	int number_of_subs;
-	uint32_t *bitmap;
+	sub_bitmap_t *bitmap;
 	int bitmap_width;
 	int bitmap_height;
+	uint64_t hash;
 	void *font;
+	
+	/* Held in subs[0] only. The subtitles sorted by start time, with
+	 * the latest end time of each and all sorted before it. pos is
+	 * the sorted position of the last subtitle found */
+	int *order;
+	uint32_t *order_end;
+	int order_size;
+	pthread_mutex_t mutex;
 } av_subs_t;
 
 extern void load_text_subtitle(av_subs_t *subs, uint32_t start_time, uint32_t duration, char *fmt);
@@ -45,4 +76,5 @@ extern char *get_text_subtitle(av_subs_t *subs, uint32_t ts);
 extern int get_bitmap_subtitle(av_subs_t *subs, uint32_t current_timestamp, int *w, int *h);
 extern void load_bitmap_subtitle(AVSubtitle *av_sub, av_subs_t *subs, int bitmap_width, int w, int h, uint32_t pts, int bitmap_scale);
 extern int get_subtitle_type(av_subs_t *subs);
+extern int display_bitmap_subtitle(av_font_t *font, uint32_t *vid, int w, int h, const sub_bitmap_t *bitmap);
 #endif
@@ -490,7 +490,7 @@ int _init_common(ng_t *s, vid_t *vid, char *mode, int ecm_type)
 	uint16_t d = _get_date(n->date);
 	
 	/* Premiere uses PPV dates in different locations */
-	if((n->id = "premiere-ca") || (n->id = "premiere-fa"))
+	if(strcmp(n->id, "premiere-ca") == 0 || strcmp(n->id, "premiere-fa") == 0)
 	{
 		n->data[6] = d & 0xFF;
 		n->data[7] = d >> 8;
@@ -521,10 +521,8 @@ int _init_common(ng_t *s, vid_t *vid, char *mode, int ecm_type)
 
 int ng_init(ng_t *s, vid_t *vid)
 {
-	time_t t;
 	int x;
 	
-	srand((unsigned) time(&t));
 	char *mode = vid->conf.syster ? vid->conf.syster : vid->conf.systercnr;
 	
 	if(vid->conf.syster && vid->conf.systercnr)
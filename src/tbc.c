@@ -0,0 +1,377 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Writes the baseband composite signal, before any resampling, filtering
+ * or modulation, as a 16-bit time base corrected (.tbc) file. Each field
+ * is written as a fixed number of lines of one pixel-rate line width, with
+ * the levels mapped to those used by ld-decode. A JSON metadata file is
+ * written alongside it when the output is closed.
+ *
+ * The line process only converts samples into a field buffer. Complete
+ * fields are handed to a writer thread, so a slow disk never stalls the
+ * RF output. If the writer falls behind whole fields are dropped.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "video.h"
+#include "tbc.h"
+#include "affinity.h"
+
+static void *_writer_thread(void *arg)
+{
+	tbc_t *s = arg;
+	tbc_field_t *f;
+	size_t n = (size_t) s->width * s->field_lines;
+	
+	affinity_apply(AFFINITY_INPUT);
+	
+	pthread_mutex_lock(&s->mutex);
+	
+	while(1)
+	{
+		while(s->ready == 0 && !s->abort)
+		{
+			pthread_cond_wait(&s->cond, &s->mutex);
+		}
+		
+		if(s->ready == 0)
+		{
+			/* Aborted and all fields have been written */
+			break;
+		}
+		
+		f = &s->fields[s->out];
+		pthread_mutex_unlock(&s->mutex);
+		
+		if(!s->error && fwrite(f->data, sizeof(uint16_t), n, s->f) != n)
+		{
+			perror("tbc");
+			s->error = 1;
+		}
+		
+		/* Record the field order for the metadata */
+		if(s->nwritten == s->written_len)
+		{
+			uint8_t *w = realloc(s->written, s->written_len + 4096);
+			
+			if(w)
+			{
+				s->written = w;
+				s->written_len += 4096;
+			}
+		}
+		
+		if(s->nwritten < s->written_len)
+		{
+			s->written[s->nwritten++] = f->first;
+		}
+		
+		pthread_mutex_lock(&s->mutex);
+		s->out = (s->out + 1) % TBC_FIELDS;
+		s->ready--;
+	}
+	
+	pthread_mutex_unlock(&s->mutex);
+	
+	return(NULL);
+}
+
+static tbc_field_t *_next_field(tbc_t *s)
+{
+	int avail;
+	
+	pthread_mutex_lock(&s->mutex);
+	avail = s->ready < TBC_FIELDS;
+	pthread_mutex_unlock(&s->mutex);
+	
+	return(avail ? &s->fields[s->in] : NULL);
+}
+
+static void _submit_field(tbc_t *s)
+{
+	pthread_mutex_lock(&s->mutex);
+	s->in = (s->in + 1) % TBC_FIELDS;
+	s->ready++;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->mutex);
+}
+
+static void _write_json(tbc_t *s)
+{
+	FILE *f;
+	size_t i;
+	
+	f = fopen(s->json, "w");
+	if(!f)
+	{
+		perror(s->json);
+		return;
+	}
+	
+	fprintf(f, "{\n");
+	fprintf(f, "\t\"videoParameters\": {\n");
+	fprintf(f, "\t\t\"system\": \"%s\",\n", s->system);
+	fprintf(f, "\t\t\"isSourcePal\": %s,\n", s->lines == 525 ? "false" : "true");
+	fprintf(f, "\t\t\"isSubcarrierLocked\": false,\n");
+	fprintf(f, "\t\t\"sampleRate\": %u,\n", s->sample_rate);
+	fprintf(f, "\t\t\"fieldWidth\": %d,\n", s->width);
+	fprintf(f, "\t\t\"fieldHeight\": %d,\n", s->field_lines);
+	fprintf(f, "\t\t\"numberOfSequentialFields\": %zu,\n", s->nwritten);
+	fprintf(f, "\t\t\"colourBurstStart\": %d,\n", s->burst_left);
+	fprintf(f, "\t\t\"colourBurstEnd\": %d,\n", s->burst_left + s->burst_width);
+	fprintf(f, "\t\t\"activeVideoStart\": %d,\n", s->active_left);
+	fprintf(f, "\t\t\"activeVideoEnd\": %d,\n", s->active_left + s->active_width);
+	fprintf(f, "\t\t\"black16bIre\": %d,\n", s->blanking16);
+	fprintf(f, "\t\t\"white16bIre\": %d\n", s->white16);
+	fprintf(f, "\t},\n");
+	fprintf(f, "\t\"fields\": [\n");
+	
+	for(i = 0; i < s->nwritten; i++)
+	{
+		fprintf(f, "\t\t{ \"seqNo\": %zu, \"isFirstField\": %s }%s\n",
+			i + 1,
+			s->written[i] ? "true" : "false",
+			i + 1 < s->nwritten ? "," : ""
+		);
+	}
+	
+	fprintf(f, "\t]\n");
+	fprintf(f, "}\n");
+	
+	fclose(f);
+}
+
+int tbc_init(tbc_t *s, vid_t *vid, const char *filename)
+{
+	double scale;
+	int i;
+	
+	memset(s, 0, sizeof(tbc_t));
+	
+	if(vid->conf.type == VID_MAC)
+	{
+		fprintf(stderr, "TBC output is not supported with D/D2-MAC modes.\n");
+		return(VID_ERROR);
+	}
+	
+	s->width = vid->width;
+	s->lines = vid->conf.lines;
+	s->field_lines = (vid->conf.lines + 1) / 2;
+	s->blanking_level = vid->blanking_level;
+	
+	if(vid->conf.lines == 525)
+	{
+		s->system = vid->conf.colour_mode == VID_PAL ? "PAL-M" : "NTSC";
+		s->blanking16 = TBC_525_BLANKING;
+		s->white16 = TBC_525_WHITE;
+	}
+	else
+	{
+		s->system = "PAL";
+		s->blanking16 = TBC_625_BLANKING;
+		s->white16 = TBC_625_WHITE;
+	}
+	
+	s->sample_rate = vid->pixel_rate;
+	s->active_left = vid->active_left;
+	s->active_width = vid->active_width;
+	s->burst_left = vid->burst_left;
+	s->burst_width = vid->burst_width;
+	
+	if(vid->white_level == vid->blanking_level)
+	{
+		fprintf(stderr, "TBC output requires a video signal.\n");
+		return(VID_ERROR);
+	}
+	
+	/* Map the mode's blanking and white levels to the 16-bit TBC
+	 * levels. As with the raw baseband input the gain is kept
+	 * within 14 bits so the 32-bit product cannot overflow */
+	scale = (double) (s->white16 - s->blanking16) / (vid->white_level - vid->blanking_level);
+	
+	for(s->shift = 14; s->shift > 0 && fabs(scale) * (1 << s->shift) > (1 << 14); s->shift--);
+	s->gain = lround(scale * (1 << s->shift));
+	
+	for(i = 0; i < TBC_FIELDS; i++)
+	{
+		s->fields[i].data = malloc(sizeof(uint16_t) * s->width * s->field_lines);
+		if(!s->fields[i].data)
+		{
+			tbc_free(s);
+			return(VID_OUT_OF_MEMORY);
+		}
+	}
+	
+	if(strcmp(filename, "-") == 0)
+	{
+		s->f = stdout;
+	}
+	else
+	{
+		s->f = fopen(filename, "wb");
+		
+		s->json = malloc(strlen(filename) + 6);
+		if(s->json)
+		{
+			sprintf(s->json, "%s.json", filename);
+		}
+	}
+	
+	if(!s->f)
+	{
+		perror(filename);
+		tbc_free(s);
+		return(VID_ERROR);
+	}
+	
+	setvbuf(s->f, NULL, _IOFBF, 4 * 1024 * 1024);
+	
+	pthread_mutex_init(&s->mutex, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	
+	if(pthread_create(&s->writer, NULL, &_writer_thread, (void *) s) != 0)
+	{
+		perror("pthread_create");
+		pthread_cond_destroy(&s->cond);
+		pthread_mutex_destroy(&s->mutex);
+		tbc_free(s);
+		return(VID_ERROR);
+	}
+	
+	s->thread = 1;
+	
+	return(VID_OK);
+}
+
+void tbc_free(tbc_t *s)
+{
+	int i;
+	
+	if(s->thread)
+	{
+		/* Wait for the writer to finish any buffered fields */
+		pthread_mutex_lock(&s->mutex);
+		s->abort = 1;
+		pthread_cond_signal(&s->cond);
+		pthread_mutex_unlock(&s->mutex);
+		
+		pthread_join(s->writer, NULL);
+		pthread_cond_destroy(&s->cond);
+		pthread_mutex_destroy(&s->mutex);
+		
+		if(s->dropped > 0)
+		{
+			fprintf(stderr, "TBC: %zu fields written, %u dropped\n", s->nwritten, s->dropped);
+		}
+		
+		if(s->json)
+		{
+			_write_json(s);
+		}
+	}
+	
+	if(s->f && s->f != stdout)
+	{
+		fclose(s->f);
+	}
+	
+	for(i = 0; i < TBC_FIELDS; i++)
+	{
+		free(s->fields[i].data);
+	}
+	
+	free(s->json);
+	free(s->written);
+	
+	memset(s, 0, sizeof(tbc_t));
+}
+
+int tbc_render_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	tbc_t *t = arg;
+	vid_line_t *l = lines[0];
+	const int16_t ib = t->blanking_level;
+	const int32_t ob = t->blanking16;
+	const int32_t gain = t->gain;
+	const int shift = t->shift;
+	uint16_t *dst;
+	int half = t->lines / 2;
+	int first, y, x, w;
+	
+	if(l->line < 1)
+	{
+		return(1);
+	}
+	
+	/* Line number within the field */
+	first = l->line <= half;
+	y = first ? l->line - 1 : l->line - 1 - half;
+	
+	if(y == 0)
+	{
+		t->field = _next_field(t);
+		
+		if(t->field)
+		{
+			t->field->first = first;
+		}
+		else
+		{
+			t->dropped++;
+		}
+	}
+	
+	if(!t->field)
+	{
+		return(1);
+	}
+	
+	dst = &t->field->data[y * t->width];
+	w = l->width < t->width ? l->width : t->width;
+	
+	for(x = 0; x < w; x++)
+	{
+		int32_t v = ob + ((((int32_t) l->output[x * 2] - ib) * gain) >> shift);
+		
+		dst[x] = v < 0 ? 0 : (v > UINT16_MAX ? UINT16_MAX : v);
+	}
+	
+	for(; x < t->width; x++)
+	{
+		dst[x] = ob;
+	}
+	
+	if(l->line == half || l->line == t->lines)
+	{
+		/* Pad a short field with blanking */
+		for(x = (y + 1) * t->width; x < t->width * t->field_lines; x++)
+		{
+			t->field->data[x] = ob;
+		}
+		
+		_submit_field(t);
+		t->field = NULL;
+	}
+	
+	return(1);
+}
+
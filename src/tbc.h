@@ -0,0 +1,95 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _TBC_H
+#define _TBC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "video.h"
+
+/* Number of fields buffered for the writer thread */
+#define TBC_FIELDS 32
+
+/* ld-decode style 16-bit levels */
+#define TBC_625_BLANKING 0x4000
+#define TBC_625_WHITE    0xD300
+#define TBC_525_BLANKING 0x3C00
+#define TBC_525_WHITE    0xC800
+
+typedef struct {
+	uint16_t *data;
+	int first;
+} tbc_field_t;
+
+typedef struct {
+	
+	/* Output file and metadata path */
+	FILE *f;
+	char *json;
+	
+	/* Field geometry */
+	int width;
+	int lines;
+	int field_lines;
+	
+	/* Level conversion */
+	int16_t blanking_level;
+	uint16_t blanking16;
+	uint16_t white16;
+	int32_t gain;
+	int shift;
+	
+	/* Field ring shared with the writer thread */
+	tbc_field_t fields[TBC_FIELDS];
+	int in;
+	int out;
+	int ready;
+	int abort;
+	int error;
+	int thread;
+	pthread_t writer;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	
+	/* The field being filled, NULL if it is being dropped */
+	tbc_field_t *field;
+	
+	/* Field order of each written field, for the metadata */
+	uint8_t *written;
+	size_t nwritten;
+	size_t written_len;
+	unsigned int dropped;
+	
+	/* Copied for the metadata */
+	const char *system;
+	unsigned int sample_rate;
+	int active_left;
+	int active_width;
+	int burst_left;
+	int burst_width;
+	
+} tbc_t;
+
+extern int tbc_init(tbc_t *s, vid_t *vid, const char *filename);
+extern void tbc_free(tbc_t *s);
+
+extern int tbc_render_line(vid_t *s, void *arg, int nlines, vid_line_t **lines);
+
+#endif
+
@@ -436,13 +436,13 @@ static void _line(uint8_t line[45], int magazine, int packet_number, const uint8
 static char *_mk_header(char *s, uint16_t page, time_t timestamp)
 {
 	char temp[33];
-	struct tm *tm;
+	struct tm tm;
 	
 	/* TODO: Make this customisable */
 	
-	tm = localtime(&timestamp);
+	wall_tm(timestamp, &tm);
 	snprintf(temp, 33, "hacktv   %03X %%a %%d %%b\x03" "%%H:%%M/%%S", page);
-	strftime(s, 33, temp, tm);
+	strftime(s, 33, temp, &tm);
 	
 	return(s);
 }
@@ -610,7 +610,7 @@ static int _next_packet(tt_service_t *s, uint8_t line[45], unsigned int timecode
 	time_t timestamp;
 	
 	/* Update the timestamp */
-	timestamp = time(NULL);
+	timestamp = wall_time();
 	
 	/* If the timestamp has changed, we need to insert an 8/30 packet */
 	if(s->timestamp != timestamp)
@@ -1282,6 +1282,83 @@ int tt_init(tt_t *s, vid_t *vid, char *path)
 	return(VID_OK);
 }
 
+int tt_read_pages(tt_service_t **pages, const char *filename)
+{
+	int r;
+	
+	/* Read the pages in a TTI file into a set of their own,
+	 * for tt_add_pages(). The carousel isn't touched, so
+	 * this can be done away from the render thread */
+	*pages = calloc(1, sizeof(tt_service_t));
+	if(*pages == NULL)
+	{
+		return(TT_OUT_OF_MEMORY);
+	}
+	
+	r = _load_tti(*pages, (char *) filename);
+	
+	if(r != TT_OK)
+	{
+		tt_free_pages(*pages);
+		*pages = NULL;
+	}
+	
+	return(r);
+}
+
+int tt_add_pages(tt_t *s, tt_service_t *pages)
+{
+	tt_page_t *page, *npage;
+	tt_page_t *subpage, *nsubpage, *first;
+	int i;
+	
+	/* Move the pages from tt_read_pages() into the carousel. Pages
+	 * already there are replaced with their update flag set */
+	if(s->raw)
+	{
+		tt_free_pages(pages);
+		return(TT_ERROR);
+	}
+	
+	for(i = 0; i < 8; i++)
+	{
+		page = pages->magazines[i].pages;
+		if(page == NULL) continue;
+		
+		/* _add_page() relinks each page it's given,
+		 * so the next ones are found before adding it */
+		do
+		{
+			npage = page->next;
+			first = page->subpages;
+			subpage = first;
+			
+			do
+			{
+				nsubpage = subpage->next_subpage;
+				_add_page(&s->service, subpage);
+				subpage = nsubpage;
+			}
+			while(subpage != first);
+			
+			page = npage;
+		}
+		while(page != pages->magazines[i].pages);
+	}
+	
+	free(pages);
+	
+	return(TT_OK);
+}
+
+void tt_free_pages(tt_service_t *pages)
+{
+	if(pages == NULL) return;
+	
+	_free_service(pages);
+	free(pages);
+}
+
 void tt_free(tt_t *s)
 {
 	if(s == NULL) return;
@@ -141,6 +141,9 @@ typedef struct {
 
 extern int tt_init(tt_t *s, vid_t *vid, char *path);
 extern void tt_free(tt_t *s);
+extern int tt_read_pages(tt_service_t **pages, const char *filename);
+extern int tt_add_pages(tt_t *s, tt_service_t *pages);
+extern void tt_free_pages(tt_service_t *pages);
 extern int tt_next_packet(tt_t *s, uint8_t vbi[45], int frame, int line);
 extern int tt_render_line(vid_t *s, void *arg, int nlines, vid_line_t **lines);
 extern int update_teletext_subtitle(char *fmt, tt_service_t *s);
@@ -0,0 +1,236 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Runtime line process changes
+ *
+ * Renders the test card once as a reference, then again while inserting
+ * two single line processes before the output and a two line process in
+ * front of them, and later removing all three. Every output line must
+ * match the reference, plus the sum of the values added by whichever
+ * processes were attached, with no lines lost or repeated.
+ *
+ * The reference is then rendered through vid_render() in blocks of
+ * varying size, some holding several whole lines and some splitting
+ * lines across calls. The samples must match the reference in order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../video.h"
+#include "../av_test.h"
+
+#define _SAMPLE_RATE 13500000
+#define _FRAMES      6
+
+static int _add(vid_t *s, int value, vid_line_t *l)
+{
+	int x;
+	
+	for(x = 0; x < l->width; x++)
+	{
+		l->output[x * 2] += value;
+	}
+	
+	return(1);
+}
+
+static int _add_one(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	return(_add(s, 1, lines[0]));
+}
+
+static int _add_two(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	return(_add(s, 2, lines[0]));
+}
+
+static int _add_four(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	/* A two line window, marking the line about to leave it */
+	return(_add(s, 4, lines[0]));
+}
+
+static int _open(vid_t *s)
+{
+	const vid_configs_t *vc;
+	vid_config_t conf;
+	
+	for(vc = vid_configs; vc->id != NULL && strcmp(vc->id, "i") != 0; vc++);
+	if(vc->id == NULL) return(-1);
+	
+	conf = *vc->conf;
+	conf.seed = 1;
+	conf.fixed_time = 946684800;
+	
+	if(vid_init(s, _SAMPLE_RATE, 0, &conf) != VID_OK)
+	{
+		return(-1);
+	}
+	
+	vid_av_init(s, AV_FIT_STRETCH, (rational_t) { 0, 0 }, (rational_t) { 0, 0 });
+	
+	if(av_test_open(&s->av, "colourbars", &s->conf) != AV_OK)
+	{
+		vid_free(s);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+int main(int argc, char *argv[])
+{
+	static vid_t s;
+	int16_t *ref, *data, *block;
+	size_t *width, n, c;
+	int lines, line, x, d, phase, i;
+	
+	if(_open(&s) != 0)
+	{
+		fprintf(stderr, "lineprocess: Unable to initialise the encoder\n");
+		return(1);
+	}
+	
+	lines = s.conf.lines * _FRAMES;
+	width = malloc(sizeof(size_t) * lines);
+	ref = malloc(sizeof(int16_t) * 2 * s.max_width * lines);
+	
+	if(!width || !ref)
+	{
+		fprintf(stderr, "lineprocess: Out of memory\n");
+		return(1);
+	}
+	
+	/* The reference output */
+	for(line = 0; line < lines; line++)
+	{
+		data = vid_next_line(&s, &width[line]);
+		if(data == NULL) return(1);
+		
+		memcpy(&ref[line * 2 * s.max_width], data, sizeof(int16_t) * 2 * width[line]);
+	}
+	
+	vid_free(&s);
+	
+	if(_open(&s) != 0)
+	{
+		return(1);
+	}
+	
+	/* The expected offset goes from 0 to 7 and back to 0 */
+	phase = 0;
+	
+	for(line = 0; line < lines; line++)
+	{
+		if(line == s.conf.lines * 2)
+		{
+			vid_insert_lineprocess(&s, "output", "addtwo", 1, NULL, _add_two, NULL);
+			vid_insert_lineprocess(&s, "addtwo", "addone", 1, NULL, _add_one, NULL);
+			vid_insert_lineprocess(&s, "addone", "addfour", 2, NULL, _add_four, NULL);
+		}
+		else if(line == s.conf.lines * 4)
+		{
+			vid_remove_lineprocess(&s, "addfour");
+			vid_remove_lineprocess(&s, "addone");
+			vid_remove_lineprocess(&s, "addtwo");
+		}
+		
+		data = vid_next_line(&s, &n);
+		
+		if(data == NULL || n != width[line])
+		{
+			fprintf(stderr, "lineprocess: Line %d has the wrong width\n", line);
+			return(1);
+		}
+		
+		d = data[0] - ref[line * 2 * s.max_width];
+		
+		if(phase == 0 && d == 7) phase = 1;
+		else if(phase == 1 && d == 0) phase = 2;
+		
+		if(d != (phase == 1 ? 7 : 0))
+		{
+			fprintf(stderr, "lineprocess: Line %d is offset by %d\n", line, d);
+			return(1);
+		}
+		
+		for(x = 0; x < n; x++)
+		{
+			if(data[x * 2] - ref[(line * s.max_width + x) * 2] != d ||
+			   data[x * 2 + 1] != ref[(line * s.max_width + x) * 2 + 1])
+			{
+				fprintf(stderr, "lineprocess: Line %d sample %d does not match\n", line, x);
+				return(1);
+			}
+		}
+	}
+	
+	vid_free(&s);
+	
+	if(phase != 2)
+	{
+		fprintf(stderr, "lineprocess: The processes were not %s\n", phase == 0 ? "inserted" : "removed");
+		return(1);
+	}
+	
+	if(_open(&s) != 0)
+	{
+		return(1);
+	}
+	
+	/* The same output in blocks, written directly or copied from the ring */
+	block = malloc(sizeof(int16_t) * 2 * s.max_width * 4);
+	if(!block)
+	{
+		fprintf(stderr, "lineprocess: Out of memory\n");
+		return(1);
+	}
+	
+	line = 0;
+	x = 0;
+	
+	for(i = 0; line < lines; i++)
+	{
+		n = vid_render(&s, block, i % 2 ? s.max_width * 4 - i % 97 : 100 + i % 1000);
+		
+		for(c = 0; c < n && line < lines; c++)
+		{
+			if(block[c * 2] != ref[(line * s.max_width + x) * 2] ||
+			   block[c * 2 + 1] != ref[(line * s.max_width + x) * 2 + 1])
+			{
+				fprintf(stderr, "lineprocess: vid_render() line %d sample %d does not match\n", line, x);
+				return(1);
+			}
+			
+			if(++x == width[line])
+			{
+				line++;
+				x = 0;
+			}
+		}
+	}
+	
+	vid_free(&s);
+	free(block);
+	free(ref);
+	free(width);
+	
+	printf("lineprocess: ok\n");
+	
+	return(0);
+}
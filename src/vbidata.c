@@ -183,6 +183,26 @@ vbidata_lut_t *vbidata_init_step(unsigned int nsymbols, unsigned int dwidth, int
 	return(lut);
 }
 
+size_t vbidata_lut_size(const vbidata_lut_t *lut)
+{
+	size_t l = 0;
+	
+	if(lut == NULL)
+	{
+		return(0);
+	}
+	
+	/* Walk the LUT up to the end marker */
+	for(; lut->length != -1; lut = (const vbidata_lut_t *) &lut->value[lut->length])
+	{
+		l += 2 + lut->length;
+	}
+	
+	l++;
+	
+	return(l * sizeof(int16_t));
+}
+
 void vbidata_render(const vbidata_lut_t *lut, const uint8_t *src, int offset, int length, int order, vid_line_t *line)
 {
 	int b = -offset;
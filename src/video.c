@@ -18,11 +18,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include "video.h"
 #include "nicam728.h"
 #include "dance.h"
 #include "hacktv.h"
+#include "pool.h"
 #include <sys/time.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 /* 
  * Video generation
@@ -46,10 +52,35 @@
 #define SECAM_CB_FREQ 4250000 /* 272 fH */
 #define SECAM_CR_FREQ 4406250 /* 282 fH */
 
+/* Real-time headroom monitor. Optional work is shed when the smoothed
+ * render time exceeds VID_DEGRADE_LOAD of the frame period, and restored
+ * when the load expected with the work restored falls below
+ * VID_RESTORE_LOAD. At least VID_DEGRADE_HOLD frames pass between each
+ * change */
+#define VID_HEADROOM_SMOOTHING 0.1
+#define VID_DEGRADE_LOAD 0.90
+#define VID_RESTORE_LOAD 0.60
+#define VID_DEGRADE_HOLD 50
+#define VID_DEGRADE_LEVELS 2
+
+/* Optional VBI features, for vid_enable_feature() */
+#define _FEATURE_VITS     (1 << 0)
+#define _FEATURE_WSS      (1 << 1)
+#define _FEATURE_ACP      (1 << 2)
+#define _FEATURE_VITC     (1 << 3)
+#define _FEATURE_TELETEXT (1 << 4)
+
+/* States of the Y'CbCr lookup table build */
+#define _YUV_LUT_IDLE     0
+#define _YUV_LUT_BUILDING 1
+#define _YUV_LUT_READY    2
+#define _YUV_LUT_ABORT    3
+#define _YUV_LUT_FAILED   4
+
 const vid_config_t vid_config_pal_i = {
 	
 	/* System I (PAL) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -104,7 +135,7 @@ const vid_config_t vid_config_pal_i = {
 const vid_config_t vid_config_pal_bg = {
 	
 	/* System B/G (PAL) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5000000, /* Hz */
@@ -159,7 +190,7 @@ const vid_config_t vid_config_pal_bg = {
 const vid_config_t vid_config_pal_dk = {
 	
 	/* System D/K (PAL) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -215,7 +246,7 @@ const vid_config_t vid_config_pal_dk = {
 const vid_config_t vid_config_pal_fm = {
 	
 	/* PAL FM (satellite) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_FM,
 	.fm_level       = 1.0,
@@ -277,7 +308,7 @@ const vid_config_t vid_config_pal_fm = {
 const vid_config_t vid_config_pal = {
 	
 	/* Composite PAL */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -320,7 +351,7 @@ const vid_config_t vid_config_pal = {
 const vid_config_t vid_config_pal_m = {
 	
 	/* System M (525 PAL) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 4200000, /* Hz */
@@ -371,7 +402,7 @@ const vid_config_t vid_config_pal_m = {
 const vid_config_t vid_config_pal_n = {
 	
 	/* System N (625 PAL) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 4200000, /* Hz */
@@ -421,7 +452,7 @@ const vid_config_t vid_config_pal_n = {
 const vid_config_t vid_config_525pal = {
 	
 	/* Composite 525PAL */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -464,7 +495,7 @@ const vid_config_t vid_config_525pal = {
 const vid_config_t vid_config_secam_l = {
 	
 	/* System L (SECAM) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 6000000, /* Hz */
@@ -515,7 +546,7 @@ const vid_config_t vid_config_secam_l = {
 const vid_config_t vid_config_secam_dk = {
 	
 	/* System D/K (SECAM) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -568,7 +599,7 @@ const vid_config_t vid_config_secam_dk = {
 const vid_config_t vid_config_secam_i = {
 	
 	/* System I (SECAM) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -621,7 +652,7 @@ const vid_config_t vid_config_secam_i = {
 const vid_config_t vid_config_secam_bg = {
 	
 	/* System B/G (SECAM) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5000000, /* Hz */
@@ -674,7 +705,7 @@ const vid_config_t vid_config_secam_bg = {
 const vid_config_t vid_config_secam_fm = {
 	
 	/* SECAM FM (satellite) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_FM,
 	.fm_level       = 1.0,
@@ -733,7 +764,7 @@ const vid_config_t vid_config_secam_fm = {
 const vid_config_t vid_config_secam = {
 	
 	/* Composite SECAM */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -774,7 +805,7 @@ const vid_config_t vid_config_secam = {
 const vid_config_t vid_config_ntsc_m = {
 	
 	/* System M (NTSC) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 4200000, /* Hz */
@@ -825,7 +856,7 @@ const vid_config_t vid_config_ntsc_m = {
 const vid_config_t vid_config_ntsc_i = {
 	
 	/* System I (NTSC) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -880,7 +911,7 @@ const vid_config_t vid_config_ntsc_i = {
 const vid_config_t vid_config_ntsc_bg = {
 	
 	/* System BG (NTSC) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -935,7 +966,7 @@ const vid_config_t vid_config_ntsc_bg = {
 const vid_config_t vid_config_ntsc_dk = {
 	
 	/* System DK (NTSC) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -990,7 +1021,7 @@ const vid_config_t vid_config_ntsc_dk = {
 const vid_config_t vid_config_ntsc443_bg = {
 	
 	/* System BG (NTSC_443) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -1045,7 +1076,7 @@ const vid_config_t vid_config_ntsc443_bg = {
 const vid_config_t vid_config_ntsc443_i = {
 	
 	/* System I (NTSC_443) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -1100,7 +1131,7 @@ const vid_config_t vid_config_ntsc443_i = {
 const vid_config_t vid_config_ntsc443_dk = {
 	
 	/* System DK (NTSC_443) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -1155,7 +1186,7 @@ const vid_config_t vid_config_ntsc443_dk = {
 const vid_config_t vid_config_ntsc_fm = {
 	
 	/* NTSC FM (satellite) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_FM,
 	.fm_level       = 1.0,
@@ -1216,7 +1247,7 @@ const vid_config_t vid_config_ntsc_fm = {
 const vid_config_t vid_config_ntsc_bs_fm = {
 	
 	/* Digital Subcarrier/NTSC FM (satellite) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_FM,
 	.fm_level       = 1.0,
@@ -1266,7 +1297,7 @@ const vid_config_t vid_config_ntsc_bs_fm = {
 const vid_config_t vid_config_ntsc = {
 	
 	/* Composite NTSC */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -1309,7 +1340,7 @@ const vid_config_t vid_config_ntsc = {
 const vid_config_t vid_config_pal60_i = {
 	
 	/* System I (525-line PAL) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -1364,7 +1395,7 @@ const vid_config_t vid_config_pal60_i = {
 const vid_config_t vid_config_pal60_bg = {
 	
 	/* System BG (525-line PAL) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -1419,7 +1450,7 @@ const vid_config_t vid_config_pal60_bg = {
 const vid_config_t vid_config_pal60_dk = {
 	
 	/* System DK (525-line PAL) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -1474,7 +1505,7 @@ const vid_config_t vid_config_pal60_dk = {
 const vid_config_t vid_config_pal60 = {
 	
 	/* Composite 525-line PAL */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -1516,7 +1547,7 @@ const vid_config_t vid_config_pal60 = {
 const vid_config_t vid_config_d2mac_am = {
 	
 	/* D2-MAC AM */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 8400000, /* Hz */
@@ -1552,7 +1583,7 @@ const vid_config_t vid_config_d2mac_am = {
 const vid_config_t vid_config_d2mac_fm = {
 	
 	/* D2-MAC FM (Satellite) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_FM,
 	.fm_level       = 1.0,
@@ -1588,7 +1619,7 @@ const vid_config_t vid_config_d2mac_fm = {
 const vid_config_t vid_config_d2mac = {
 	
 	/* D2-MAC */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.video_bw       = 6.0e6,
 	
@@ -1622,7 +1653,7 @@ const vid_config_t vid_config_d2mac = {
 const vid_config_t vid_config_dmac_am = {
 	
 	/* D-MAC AM */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_AM,
 	
@@ -1656,7 +1687,7 @@ const vid_config_t vid_config_dmac_am = {
 const vid_config_t vid_config_dmac_fm = {
 	
 	/* D2-MAC FM (Satellite) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_FM,
 	.fm_level       = 1.0,
@@ -1692,7 +1723,7 @@ const vid_config_t vid_config_dmac_fm = {
 const vid_config_t vid_config_dmac = {
 	
 	/* D-MAC */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.video_bw       = 8.4e6,
 	
@@ -1726,7 +1757,7 @@ const vid_config_t vid_config_dmac = {
 const vid_config_t vid_config_819_e = {
 	
 	/* System E (819 line monochrome, French variant) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   =  2000000, /* Hz */
@@ -1765,7 +1796,7 @@ const vid_config_t vid_config_819_e = {
 const vid_config_t vid_config_819 = {
 	
 	/* 819 line video, French variant */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.video_bw       = 10.4e6,
 	
@@ -1797,7 +1828,7 @@ const vid_config_t vid_config_819 = {
 const vid_config_t vid_config_405_a = {
 	
 	/* System A (405 line monochrome) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   =  750000, /* Hz */
@@ -1837,7 +1868,7 @@ const vid_config_t vid_config_405_a = {
 const vid_config_t vid_config_405_i = {
 	
 	/* System A (405 line monochrome) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 5500000, /* Hz */
@@ -1878,7 +1909,7 @@ const vid_config_t vid_config_405_i = {
 const vid_config_t vid_config_405 = {
 	
 	/* 405 line video */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -1911,7 +1942,7 @@ const vid_config_t vid_config_405 = {
 const vid_config_t vid_config_baird_240_am = {
 	
 	/* Baird 240 line, AM modulation */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_AM,
 	
@@ -1942,7 +1973,7 @@ const vid_config_t vid_config_baird_240_am = {
 const vid_config_t vid_config_baird_240 = {
 	
 	/* Baird 240 line */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -1971,7 +2002,7 @@ const vid_config_t vid_config_baird_240 = {
 const vid_config_t vid_config_baird_30_am = {
 	
 	/* Baird 30 line, AM modulation */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_AM,
 	
@@ -1999,7 +2030,7 @@ const vid_config_t vid_config_baird_30_am = {
 const vid_config_t vid_config_baird_30 = {
 	
 	/* Baird 30 line */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -2025,7 +2056,7 @@ const vid_config_t vid_config_baird_30 = {
 const vid_config_t vid_config_nbtv_32_am = {
 	
 	/* NBTV Club standard, AM modulation (negative) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_AM,
 	
@@ -2055,7 +2086,7 @@ const vid_config_t vid_config_nbtv_32_am = {
 const vid_config_t vid_config_nbtv_32 = {
 	
 	/* NBTV Club standard */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -2083,7 +2114,7 @@ const vid_config_t vid_config_nbtv_32 = {
 const vid_config_t vid_config_apollo_colour_fm = {
 	
 	/* Unified S-Band, Apollo Colour Lunar Television */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.level          = 1.000, /* Overall signal level */
 	.video_level    = 1.000, /* Power level of video */
@@ -2134,7 +2165,7 @@ const vid_config_t vid_config_apollo_colour_fm = {
 const vid_config_t vid_config_apollo_colour = {
 	
 	/* Apollo Colour Lunar Television */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -2171,7 +2202,7 @@ const vid_config_t vid_config_apollo_colour = {
 const vid_config_t vid_config_apollo_mono_fm = {
 	
 	/* Unified S-Band, Apollo Lunar Television 10 fps video (Mode 1) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.level          = 1.000, /* Overall signal level */
 	.video_level    = 1.000, /* Power level of video */
@@ -2219,7 +2250,7 @@ const vid_config_t vid_config_apollo_mono_fm = {
 const vid_config_t vid_config_apollo_mono = {
 	
 	/* Apollo Lunar Television 10 fps video (Mode 1) */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -2258,7 +2289,7 @@ const vid_config_t vid_config_apollo_mono = {
 const vid_config_t vid_config_cbs405_m = {
 	
 	/* System M (CBS 405-line Colour) */
-	.output_type    = HACKTV_INT16_COMPLEX,
+	.output_type    = RF_INT16_COMPLEX,
 	
 	.modulation     = VID_VSB,
 	.vsb_upper_bw   = 4200000, /* Hz */
@@ -2305,7 +2336,7 @@ const vid_config_t vid_config_cbs405_m = {
 const vid_config_t vid_config_cbs405 = {
 	
 	/* CBS 405-line Colour */
-	.output_type    = HACKTV_INT16_REAL,
+	.output_type    = RF_INT16_REAL,
 	
 	.level          = 1.0, /* Overall signal level */
 	.video_level    = 1.0, /* Power level of video */
@@ -2581,14 +2612,14 @@ static double _dlimit(double v, double min, double max)
 	return(v);
 }
 
-static int16_t *_burstwin(unsigned int sample_rate, double width, double rise, double level, int *len)
+static int16_t *_burstwin(arena_t *arena, unsigned int sample_rate, double width, double rise, double level, int *len)
 {
 	int16_t *win;
 	double t;
 	int i;
 	
 	*len = ceil(sample_rate * (width + rise));
-	win = malloc(*len * sizeof(int16_t));
+	win = arena_alloc(arena, "burst", *len * sizeof(int16_t));
 	if(!win)
 	{
 		return(NULL);
@@ -2605,7 +2636,7 @@ static int16_t *_burstwin(unsigned int sample_rate, double width, double rise, d
 
 /* FM modulator
  * deviation = peak deviation in Hz (+/-) from frequency */
-static int _init_fm_modulator(_mod_fm_t *fm, int sample_rate, double frequency, double deviation, double level)
+static int _init_fm_modulator(arena_t *arena, _mod_fm_t *fm, int sample_rate, double frequency, double deviation, double level)
 {
 	int r;
 	double d;
@@ -2614,7 +2645,7 @@ static int _init_fm_modulator(_mod_fm_t *fm, int sample_rate, double frequency,
 	fm->counter = INT16_MAX;
 	fm->phase.i = INT32_MAX;
 	fm->phase.q = 0;
-	fm->lut     = malloc(sizeof(cint32_t) * (UINT16_MAX + 1));
+	fm->lut     = arena_alloc(arena, "fm", sizeof(cint32_t) * (UINT16_MAX + 1));
 	
 	if(!fm->lut)
 	{
@@ -2724,11 +2755,6 @@ static void inline _fm_modulator(_mod_fm_t *fm, int16_t *dst, int16_t sample)
 	}
 }
 
-static void _free_fm_modulator(_mod_fm_t *fm)
-{
-	free(fm->lut);
-}
-
 /* AM modulator */
 static int _init_am_modulator(_mod_am_t *am, int sample_rate, double frequency, double level)
 {
@@ -2772,76 +2798,233 @@ static void _free_am_modulator(_mod_am_t *am)
 	/* Nothing */
 }
 
-/* AV source callback handlers */
-static uint32_t *_av_read_video(vid_t *s, float *ratio)
+int vid_av_close(vid_t *s)
 {
-	if(s->av_read_video)
-	{
-		return(s->av_read_video(s->av_private, ratio));
-	}
+	return(av_close(&s->av));
+}
+
+void _test_sample_rate(const vid_config_t *conf, unsigned int sample_rate)
+{
+	int m, r;
 	
-	return(NULL);
+	/* Test if the chosen sample rate results in an exact number of
+	 * samples per line. If not, display a warning and show the
+	 * previous and next valid sample rates. */
+	
+	/* Calculate lowest valid sample rate */
+	m = conf->lines * conf->frame_rate.num;
+	m /= r = gcd(m, conf->frame_rate.den);
+	
+	/* Is the chosen sample rate good? */
+	if(sample_rate % m == 0) return;
+	
+	/* Not really. Suggest some good sample rates */
+	r = sample_rate / m;
+	fprintf(stderr, "Warning: Pixel rate %u may not work well with this mode.\n", sample_rate);
+	fprintf(stderr, "Next valid pixel rates: %u, %u\n", m * r, m * (r + 1));
+}
+
+static inline const uint32_t *_vid_frame_line(vid_t *s, int vy)
+{
+	/* Return a pointer to active line vy of the current frame,
+	 * or NULL if the line falls outside of the frame */
+	if(vy < 0 || s->vframe.framebuffer == NULL) return(NULL);
+	
+	vy -= s->vframe_y;
+	if(vy < 0 || vy >= s->vframe.height) return(NULL);
+	
+	return(&s->vframe.framebuffer[vy * s->vframe.line_stride]);
+}
+
+static inline uint32_t _vid_frame_pixel(vid_t *s, const uint32_t *px, int x)
+{
+	/* Return the RGB value for sample x, black outside of the frame */
+	if(px == NULL) return(0x000000);
+	
+	x -= s->active_left + s->vframe_x;
+	if(x < 0 || x >= s->vframe.width) return(0x000000);
+	
+	return(px[x * s->vframe.pixel_stride] & 0xFFFFFF);
+}
+
+static inline int _vid_clip8(int v)
+{
+	return(v < 0 ? 0 : (v > 0xFF ? 0xFF : v));
+}
+
+static inline uint32_t _vid_yuv_rgb(const vid_t *s, int y, int cb, int cr)
+{
+	const int *k = s->yuv_coeffs;
+	int r, g, b;
+	
+	/* Y'CbCr to 8-bit R'G'B' with the 16.16 fixed point
+	 * coefficients from _vid_yuv_coeffs() */
+	y = (y - k[0]) * k[1] + 0x8000;
+	cb -= 128;
+	cr -= 128;
+	
+	r = (y + k[2] * cr) >> 16;
+	g = (y - k[3] * cb - k[4] * cr) >> 16;
+	b = (y + k[5] * cb) >> 16;
+	
+	return(_vid_clip8(r) << 16 | _vid_clip8(g) << 8 | _vid_clip8(b));
 }
 
-static int16_t *_av_read_audio(vid_t *s, size_t *samples)
+static void _vid_frame_levels(vid_t *s, int vy, _yiq16_t *lv)
 {
-	if(s->av_read_audio)
+	const _yiq16_t *black = &s->yiq_level_lookup[0x000000];
+	const uint32_t *prgb;
+	const uint8_t *py, *pcb, *pcr;
+	int x, x0, x1, fx, fy;
+	
+	/* Look up the signal levels for active line vy of the frame */
+	
+	if(s->vframe.format != AV_FRAME_YUV)
 	{
-		return(s->av_read_audio(s->av_private, samples));
+		prgb = _vid_frame_line(s, vy);
+		
+		for(x = 0; x < s->active_width; x++)
+		{
+			lv[x] = s->yiq_level_lookup[_vid_frame_pixel(s, prgb, s->active_left + x)];
+		}
+		
+		return;
 	}
 	
-	return(NULL);
+	fy = vy - s->vframe_y;
+	x0 = x1 = 0;
+	
+	if(vy >= 0 && fy >= 0 && fy < s->vframe.height && s->vframe.planes[0] != NULL)
+	{
+		/* The part of the line covered by the frame */
+		x0 = s->vframe_x < 0 ? 0 : s->vframe_x;
+		x1 = s->vframe_x + s->vframe.width;
+		if(x1 > s->active_width) x1 = s->active_width;
+	}
+	
+	for(x = 0; x < x0; x++)
+	{
+		lv[x] = *black;
+	}
+	
+	if(x1 > x0)
+	{
+		py  = s->vframe.planes[0] + fy * s->vframe.plane_line_stride[0];
+		pcb = s->vframe.planes[1] + (fy >> s->vframe.chroma_shift_y) * s->vframe.plane_line_stride[1];
+		pcr = s->vframe.planes[2] + (fy >> s->vframe.chroma_shift_y) * s->vframe.plane_line_stride[2];
+		
+		if(s->yuv_lut_ok)
+		{
+			for(; x < x1; x++)
+			{
+				fx = x - s->vframe_x;
+				
+				lv[x] = s->yuv_level_lookup[
+					py[fx * s->vframe.plane_pixel_stride[0]] << 16 |
+					pcb[(fx >> s->vframe.chroma_shift_x) * s->vframe.plane_pixel_stride[1]] << 8 |
+					pcr[(fx >> s->vframe.chroma_shift_x) * s->vframe.plane_pixel_stride[2]]
+				];
+			}
+		}
+		else
+		{
+			/* No table for this matrix and range yet,
+			 * convert to R'G'B' and use the RGB one */
+			for(; x < x1; x++)
+			{
+				fx = x - s->vframe_x;
+				
+				lv[x] = s->yiq_level_lookup[_vid_yuv_rgb(s,
+					py[fx * s->vframe.plane_pixel_stride[0]],
+					pcb[(fx >> s->vframe.chroma_shift_x) * s->vframe.plane_pixel_stride[1]],
+					pcr[(fx >> s->vframe.chroma_shift_x) * s->vframe.plane_pixel_stride[2]]
+				)];
+			}
+		}
+	}
+	
+	for(; x < s->active_width; x++)
+	{
+		lv[x] = *black;
+	}
 }
 
-static int _av_eof(vid_t *s)
+static void _vid_levels_task(void *arg, int start, int end)
 {
-	if(s->av_eof)
+	vid_t *s = arg;
+	int r, vy;
+	
+	for(r = start; r < end; r++)
 	{
-		return(s->av_eof(s->av_private));
+		vy = s->vlevels_first + r * s->vlevels_step;
+		_vid_frame_levels(s, vy, &s->vlevels[vy * s->active_width]);
 	}
-	
-	return(0);
 }
 
-int vid_av_close(vid_t *s)
+static void _vid_prepare_levels(vid_t *s, int first, int step)
 {
-	int r;
+	/* Look up the signal levels for each active line of this field,
+	 * shared between the pool threads. The lookup table is too large
+	 * to cache well, so this is most of the raster's work */
+	int mask = step == 1 ? 3 : 1 << first;
 	
-	r = s->av_close ? s->av_close(s->av_private) : VID_ERROR;
+	s->vlevels_first = first;
+	s->vlevels_step = step;
 	
-	s->av_private = NULL;
-	s->av_read_video = NULL;
-	s->av_read_audio = NULL;
-	s->av_eof = NULL;
-	s->av_close = NULL;
+	/* Nothing to do if the frame is unchanged since these lines were looked up */
+	if((s->vlevels_valid & mask) == mask)
+	{
+		return;
+	}
 	
-	return(r);
+	pool_parallel_for((s->conf.active_lines - first + step - 1) / step, 8, _vid_levels_task, s);
+	
+	s->vlevels_valid |= mask;
 }
 
-void _test_sample_rate(const vid_config_t *conf, unsigned int sample_rate)
+static const _yiq16_t *_vid_line_levels(vid_t *s, int vy)
 {
-	int m, r;
+	/* Return the levels for active line vy, indexed by sample
+	 * number, or NULL if the raster should look up the RGB pixels */
+	if(s->vlevels != NULL && vy >= 0 &&
+	   (vy - s->vlevels_first) % s->vlevels_step == 0)
+	{
+		return(&s->vlevels[vy * s->active_width - s->active_left]);
+	}
 	
-	/* Test if the chosen sample rate results in an exact number of
-	 * samples per line. If not, display a warning and show the
-	 * previous and next valid sample rates. */
+	if(s->vframe.format != AV_FRAME_YUV)
+	{
+		return(NULL);
+	}
 	
-	/* Calculate lowest valid sample rate */
-	m = conf->lines * conf->frame_rate.num;
-	m /= r = gcd(m, conf->frame_rate.den);
+	_vid_frame_levels(s, vy, s->vline);
 	
-	/* Is the chosen sample rate good? */
-	if(sample_rate % m == 0) return;
+	return(s->vline - s->active_left);
+}
+
+static void _vid_fir_line(fir_int16_t *fir, int16_t *p, int samples, int avail)
+{
+	/* Zeros fed to the 51 tap SECAM filters */
+	static const int16_t pad[2 * 32] = { 0 };
+	int n = avail - fir->ataps / 2;
+	
+	/* Filter part of a line in place. The filter looks ahead by half
+	 * its length, anything past the end of the line is fed in as
+	 * zeros rather than read from whatever follows the line */
+	if(n >= samples)
+	{
+		fir_int16_process_block(fir, p, p, samples, 2);
+		return;
+	}
 	
-	/* Not really. Suggest some good sample rates */
-	r = sample_rate / m;
-	fprintf(stderr, "Warning: Pixel rate %u may not work well with this mode.\n", sample_rate);
-	fprintf(stderr, "Next valid pixel rates: %u, %u\n", m * r, m * (r + 1));
+	fir_int16_process_block(fir, p, p, n, 2);
+	fir_int16_process(fir, p + n * 2, pad, samples - n, 2);
 }
 
 static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
 	const char *seq;
+	const _yiq16_t *lv = NULL;
 	int x;
 	int vy;
 	int pal = 0;
@@ -3311,7 +3494,8 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 	if(seq[2] == 'a' || seq[3] == 'a')
 	{
 		uint32_t rgb;
-		uint32_t *prgb;
+		const uint32_t *prgb;
+		const _yiq16_t *yiq;
 		int16_t *o;
 		
 		/* Calculate active video portion of this line */
@@ -3319,29 +3503,35 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		int ar = (seq[3] == 'a' ? s->active_left + s->active_width : (seq[2] == 'a' ? s->half_width : -1));
 		
 		/* Render the active video */
-		prgb = (s->framebuffer != NULL && vy != -1 ? &s->framebuffer[vy * s->active_width + al - s->active_left] : NULL);
-		rgb = 0x000000;
+		prgb = _vid_frame_line(s, vy);
+		lv = _vid_line_levels(s, vy);
 		
 		for(x = al, o = &l->output[al * 2]; x < ar; x++, o += 2)
 		{
-			if(prgb)
+			if(lv)
 			{
-				rgb = *(prgb++) & 0xFFFFFF;
+				yiq = &lv[x];
 			}
-			
-			if(s->conf.colour_mode == VID_APOLLO_FSC ||
-			   s->conf.colour_mode == VID_CBS_FSC)
+			else
 			{
-				rgb  = (rgb >> (8 * fsc)) & 0xFF;
-				rgb |= (rgb << 8) | (rgb << 16);
+				rgb = _vid_frame_pixel(s, prgb, x);
+				
+				if(s->conf.colour_mode == VID_APOLLO_FSC ||
+				   s->conf.colour_mode == VID_CBS_FSC)
+				{
+					rgb  = (rgb >> (8 * fsc)) & 0xFF;
+					rgb |= (rgb << 8) | (rgb << 16);
+				}
+				
+				yiq = &s->yiq_level_lookup[rgb];
 			}
 			
-			*o = s->yiq_level_lookup[rgb].y;
+			*o = yiq->y;
 			
 			if(pal)
 			{
-				*o += (s->yiq_level_lookup[rgb].i * l->lut[x].q +
-				       s->yiq_level_lookup[rgb].q * l->lut[x].i * pal) >> 15;
+				*o += (yiq->i * l->lut[x].q +
+				       yiq->q * l->lut[x].i * pal) >> 15;
 			}
 		}
 	}
@@ -3425,24 +3615,24 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		else if(seq[2] == 'a' || seq[3] == 'a')
 		{
-			uint32_t rgb;
+			const _yiq16_t *yiq;
 			
 			for(x = 0; x < s->width; x++)
 			{
-				rgb = 0x000000;
+				yiq = &s->yiq_level_lookup[0x000000];
 				
 				if(x >= s->active_left && x < s->active_left + s->active_width)
 				{
-					rgb = s->framebuffer != NULL && vy >= 0 ? s->framebuffer[vy * s->active_width + x - s->active_left] & 0xFFFFFF : 0x000000;
+					yiq = lv ? &lv[x] : &s->yiq_level_lookup[_vid_frame_pixel(s, _vid_frame_line(s, vy), x)];
 				}
 				
 				if(((l->frame * s->conf.lines) + l->line) & 1)
 				{
-					l->output[x * 2 + 1] = s->yiq_level_lookup[rgb].q; // D'r
+					l->output[x * 2 + 1] = yiq->q; // D'r
 				}
 				else
 				{
-					l->output[x * 2 + 1] = s->yiq_level_lookup[rgb].i; // D'b
+					l->output[x * 2 + 1] = yiq->i; // D'b
 				}
 			}
 			
@@ -3452,8 +3642,8 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		
 		if(sr > sl)
 		{
-			fir_int16_process_block(&s->secam_l_fir, l->output + s->active_left * 2, l->output + s->active_left * 2, s->active_width, 2);
-			fir_int16_process_block(&s->fm_secam_fir, l->output + 1, l->output + 1, s->width, 2);
+			_vid_fir_line(&s->secam_l_fir, l->output + s->active_left * 2, s->active_width, s->width - s->active_left);
+			_vid_fir_line(&s->fm_secam_fir, l->output + 1, s->width, s->width);
 			iir_int16_process(&s->fm_secam_iir, l->output + 1, l->output + 1, s->width, 2);
 			
 			/* Reset the SECAM FM phase every line, alternating every third line */
@@ -3487,6 +3677,164 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 	return(1);
 }
 
+static void _vid_rawbb_scale(vid_t *s, int16_t *dst, const int16_t *src, int samples)
+{
+	const int16_t ib = s->conf.raw_bb_blanking_level;
+	const int16_t ob = s->blanking_level;
+	const int32_t gain = s->raw_bb_gain;
+	const int shift = s->raw_bb_shift;
+	int x;
+	
+	/* Rescale the raw levels to the output signal levels. Kept as
+	 * simple 32-bit integer arithmetic so the compiler can vectorise it */
+	for(x = 0; x < samples; x++)
+	{
+		int32_t v = ob + ((((int32_t) src[x] - ib) * gain) >> shift);
+		
+		dst[x * 2 + 0] = v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : v);
+		dst[x * 2 + 1] = 0;
+	}
+}
+
+static int _vid_next_line_rawbb(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	vid_line_t *l = lines[0];
+	const int16_t *src;
+	int x, n;
+	
+	l->width    = s->width;
+	l->frame    = s->bframe;
+	l->line     = s->bline;
+	l->vbialloc = 0;
+	l->lut      = NULL;
+	
+	if(s->raw_bb_map)
+	{
+		/* Loop back to the start when less than a full line remains */
+		if(s->raw_bb_pos + s->width > s->raw_bb_map_len)
+		{
+			s->raw_bb_pos = 0;
+		}
+		
+		src = &s->raw_bb_map[s->raw_bb_pos];
+		s->raw_bb_pos += s->width;
+		n = s->width;
+	}
+	else
+	{
+		n = fread(s->raw_bb_line, sizeof(int16_t), s->width, s->raw_bb_file);
+		
+		if(n < s->width && fseek(s->raw_bb_file, 0, SEEK_SET) == 0)
+		{
+			/* Loop back to the start of the file */
+			n = fread(s->raw_bb_line, sizeof(int16_t), s->width, s->raw_bb_file);
+		}
+		
+		src = s->raw_bb_line;
+	}
+	
+	_vid_rawbb_scale(s, l->output, src, n);
+	
+	/* Blank anything missing from the end of the line */
+	for(x = n; x < s->width; x++)
+	{
+		l->output[x * 2 + 0] = s->blanking_level;
+		l->output[x * 2 + 1] = 0;
+	}
+	
+	/* Clear the Q channel */
+	for(; x < s->max_width; x++)
+	{
+		l->output[x * 2 + 1] = 0;
+	}
+	
+	return(1);
+}
+
+static int _init_rawbb(vid_t *s)
+{
+	double scale;
+	
+	if(s->conf.raw_bb_white_level == s->conf.raw_bb_blanking_level)
+	{
+		fprintf(stderr, "Raw baseband white and blanking levels must differ.\n");
+		return(VID_ERROR);
+	}
+	
+	/* Scale the input so the raw blanking and white levels
+	 * match the levels of the current mode. The difference
+	 * term can be 17 bits wide, so the gain is kept within
+	 * 14 bits to avoid overflowing the 32-bit product */
+	scale = (double) (s->white_level - s->blanking_level) / (s->conf.raw_bb_white_level - s->conf.raw_bb_blanking_level);
+	
+	for(s->raw_bb_shift = 14; s->raw_bb_shift > 0 && fabs(scale) * (1 << s->raw_bb_shift) > (1 << 14); s->raw_bb_shift--);
+	s->raw_bb_gain = lround(scale * (1 << s->raw_bb_shift));
+	
+	if(strcmp(s->conf.raw_bb_file, "-") == 0)
+	{
+		s->raw_bb_file = stdin;
+	}
+	else
+	{
+		s->raw_bb_file = fopen(s->conf.raw_bb_file, "rb");
+	}
+	
+	if(!s->raw_bb_file)
+	{
+		perror(s->conf.raw_bb_file);
+		return(VID_ERROR);
+	}
+	
+#ifndef WIN32
+	struct stat st;
+	
+	/* Map regular files directly into memory */
+	if(fstat(fileno(s->raw_bb_file), &st) == 0 &&
+	   S_ISREG(st.st_mode) &&
+	   st.st_size >= s->width * sizeof(int16_t))
+	{
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(s->raw_bb_file), 0);
+		
+		if(map != MAP_FAILED)
+		{
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			
+			s->raw_bb_map = map;
+			s->raw_bb_map_len = st.st_size / sizeof(int16_t);
+			s->raw_bb_pos = 0;
+			
+			return(VID_OK);
+		}
+	}
+#endif
+	
+	/* Pipes and other streams are read with a large buffer */
+	setvbuf(s->raw_bb_file, NULL, _IOFBF, 4 * 1024 * 1024);
+	
+	s->raw_bb_line = arena_alloc(&s->arena, "rawbb", sizeof(int16_t) * s->width);
+	if(!s->raw_bb_line)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	return(VID_OK);
+}
+
+static void _free_rawbb(vid_t *s)
+{
+#ifndef WIN32
+	if(s->raw_bb_map)
+	{
+		munmap((void *) s->raw_bb_map, s->raw_bb_map_len * sizeof(int16_t));
+	}
+#endif
+	
+	if(s->raw_bb_file && s->raw_bb_file != stdin)
+	{
+		fclose(s->raw_bb_file);
+	}
+}
+
 static int _vid_filter_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
 	_vid_filter_process_t *p = arg;
@@ -3524,7 +3872,17 @@ static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **line
 			
 			if(s->audiobuffer_samples == 0)
 			{
-				s->audiobuffer = _av_read_audio(s, &s->audiobuffer_samples);
+				uint64_t t = s->conf.stats || s->conf.degrade ? monotonic_ns() : 0;
+				
+				s->audiobuffer = av_read_audio(&s->av, &s->audiobuffer_samples);
+				
+				if(s->conf.stats || s->conf.degrade)
+				{
+					t = monotonic_ns() - t;
+					s->av_audio_stat.ns += t;
+					s->av_audio_stat.calls++;
+					s->source_ns += t;
+				}
 				
 				if(s->conf.systeraudio == 1)
 				{
@@ -3539,6 +3897,17 @@ static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **line
 				audio[1] = s->audiobuffer[1];
 				s->audiobuffer += 2;
 				s->audiobuffer_samples--;
+				
+				if(s->audio_gain != 4096)
+				{
+					int32_t a;
+					
+					a = (audio[0] * s->audio_gain) >> 12;
+					audio[0] = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+					
+					a = (audio[1] * s->audio_gain) >> 12;
+					audio[1] = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+				}
 			}
 			else
 			{
@@ -3685,6 +4054,21 @@ static int _vid_fmmod_process(vid_t *s, void *arg, int nlines, vid_line_t **line
 	return(1);
 }
 
+static int _vid_gain_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	vid_line_t *l = lines[0];
+	int32_t v;
+	int x;
+	
+	for(x = 0; x < l->width * 2; x++)
+	{
+		v = (l->output[x] * s->output_gain) >> 12;
+		l->output[x] = v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : v);
+	}
+	
+	return(1);
+}
+
 static int _vid_offset_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
 	vid_line_t *l = lines[0];
@@ -3740,6 +4124,45 @@ static int _vid_passthru_process(vid_t *s, void *arg, int nlines, vid_line_t **l
 	return(1);
 }
 
+static void _vid_feature_released(vid_t *s, int feature)
+{
+	/* The feature's state is free to be initialised again */
+	pthread_mutex_lock(&s->changes_mutex);
+	s->features &= ~feature;
+	s->features_releasing &= ~feature;
+	pthread_mutex_unlock(&s->changes_mutex);
+}
+
+static void _vid_release_vits(vid_t *s, void *arg)
+{
+	vits_free(&s->vits);
+	_vid_feature_released(s, _FEATURE_VITS);
+}
+
+static void _vid_release_wss(vid_t *s, void *arg)
+{
+	wss_free(&s->wss);
+	_vid_feature_released(s, _FEATURE_WSS);
+}
+
+static void _vid_release_acp(vid_t *s, void *arg)
+{
+	acp_free(&s->acp);
+	_vid_feature_released(s, _FEATURE_ACP);
+}
+
+static void _vid_release_vitc(vid_t *s, void *arg)
+{
+	vitc_free(&s->vitc);
+	_vid_feature_released(s, _FEATURE_VITC);
+}
+
+static void _vid_release_teletext(vid_t *s, void *arg)
+{
+	tt_free(&s->tt);
+	_vid_feature_released(s, _FEATURE_TELETEXT);
+}
+
 static int _add_lineprocess(vid_t *s, const char *name, int nlines, void *arg, vid_lineprocess_process_t pprocess, vid_lineprocess_free_t pfree)
 {
 	_lineprocess_t *p;
@@ -3753,6 +4176,7 @@ static int _add_lineprocess(vid_t *s, const char *name, int nlines, void *arg, v
 	s->processes = p;
 	p = &s->processes[s->nprocesses++];
 	
+	memset(p, 0, sizeof(_lineprocess_t));
 	strncpy(p->name, name, 15);
 	p->vid = s;
 	p->nlines = nlines;
@@ -3942,7 +4366,7 @@ vbidata_lut_t *_render_sync_pulses(vid_t *s, const double syncs[][4], int num)
 	l += 1;
 	
 	/* Allocate memory and render the sync pulses */
-	lut = malloc(l * sizeof(int16_t));
+	lut = arena_alloc(&s->arena, "syncs", l * sizeof(int16_t));
 	if(!lut)
 	{
 		return(NULL);
@@ -3966,28 +4390,248 @@ vbidata_lut_t *_render_sync_pulses(vid_t *s, const double syncs[][4], int num)
 	return(lut);
 }
 
-int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t * const conf)
+static void _vid_rgb_levels(vid_t *s, _yiq16_t *o, double r, double g, double b)
 {
-	int r, x;
-	int64_t c;
-	double d;
-	double glut[0x100];
-	double width;
-	double level, slevel;
-	vid_line_t *l;
+	double y, u, v;
+	double i, q;
 	
-	/* Seed the system's PRNG, used by some of the video scramblers */
-	srand(time(NULL));
-	
-	memset(s, 0, sizeof(vid_t));
-	memcpy(&s->conf, conf, sizeof(vid_config_t));
+	/* Calculate Y, Cb and Cr values */
+	y = r * s->conf.rw_co
+	  + g * s->conf.gw_co
+	  + b * s->conf.bw_co;
+	u = (b - y);
+	v = (r - y);
 	
-	s->sample_rate = sample_rate;
-	s->pixel_rate = pixel_rate ? pixel_rate : sample_rate;
+	i = s->conf.eu_co * u;
+	q = s->conf.ev_co * v;
 	
-	_test_sample_rate(&s->conf, s->pixel_rate);
+	/* Adjust values to correct signal level */
+	y = (s->conf.black_level + (y * (s->conf.white_level - s->conf.black_level))) * s->level;
 	
-	/* Calculate the number of samples per line */
+	if(s->conf.colour_mode != VID_SECAM)
+	{
+		i *= (s->conf.white_level - s->conf.black_level) * s->level;
+		q *= (s->conf.white_level - s->conf.black_level) * s->level;
+	}
+	else
+	{
+		i = (i + SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
+		q = (q + SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
+	}
+	
+	/* Convert to INT16 range */
+	o->y = round(_dlimit(y, -1, 1) * INT16_MAX);
+	o->i = round(_dlimit(i, -1, 1) * INT16_MAX);
+	o->q = round(_dlimit(q, -1, 1) * INT16_MAX);
+}
+
+static void _yiq_lut_task(void *arg, int start, int end)
+{
+	vid_t *s = arg;
+	int c;
+	
+	for(c = start; c < end; c++)
+	{
+		/* Calculate RGB 0..1 values */
+		_vid_rgb_levels(s, &s->yiq_level_lookup[c],
+			s->glut[(c & 0xFF0000) >> 16],
+			s->glut[(c & 0x00FF00) >> 8],
+			s->glut[(c & 0x0000FF) >> 0]
+		);
+	}
+}
+
+static void _vid_matrix_coeffs(av_matrix_t matrix, double *kr, double *kb)
+{
+	switch(matrix)
+	{
+	case AV_MATRIX_BT709:  *kr = 0.2126; *kb = 0.0722; break;
+	case AV_MATRIX_BT2020: *kr = 0.2627; *kb = 0.0593; break;
+	default:               *kr = 0.299;  *kb = 0.114;  break;
+	}
+}
+
+static void *_yuv_lut_thread(void *arg)
+{
+	vid_t *s = arg;
+	double kr, kb, y, pb, pr;
+	double r, g, b;
+	int c;
+	
+	_vid_matrix_coeffs(s->yuv_next_matrix, &kr, &kb);
+	
+	for(c = 0; c < 0x1000000; c++)
+	{
+		if((c & 0xFFFF) == 0 &&
+		   __atomic_load_n(&s->yuv_lut_state, __ATOMIC_RELAXED) == _YUV_LUT_ABORT)
+		{
+			return(NULL);
+		}
+		
+		/* Calculate Y' 0..1 and Cb, Cr -0.5..0.5 values */
+		if(s->yuv_next_full_range)
+		{
+			y  = (double) ((c >> 16) & 0xFF) / 255;
+			pb = (double) (((c >> 8) & 0xFF) - 128) / 255;
+			pr = (double) (((c >> 0) & 0xFF) - 128) / 255;
+		}
+		else
+		{
+			y  = (double) (((c >> 16) & 0xFF) - 16) / 219;
+			pb = (double) (((c >> 8) & 0xFF) - 128) / 224;
+			pr = (double) (((c >> 0) & 0xFF) - 128) / 224;
+		}
+		
+		/* Convert to R'G'B' with the source's matrix. Colours
+		 * outside of the RGB cube are clipped as they would
+		 * be when converting to an RGB frame */
+		r = y + 2 * (1 - kr) * pr;
+		b = y + 2 * (1 - kb) * pb;
+		g = (y - kr * r - kb * b) / (1 - kr - kb);
+		
+		r = _dlimit(r, 0, 1);
+		g = _dlimit(g, 0, 1);
+		b = _dlimit(b, 0, 1);
+		
+		if(s->conf.gamma != 1.0)
+		{
+			r = pow(r, 1 / s->conf.gamma);
+			g = pow(g, 1 / s->conf.gamma);
+			b = pow(b, 1 / s->conf.gamma);
+		}
+		
+		_vid_rgb_levels(s, &s->yuv_lut_next[c], r, g, b);
+	}
+	
+	__atomic_store_n(&s->yuv_lut_state, _YUV_LUT_READY, __ATOMIC_RELEASE);
+	
+	return(NULL);
+}
+
+static void _vid_yuv_coeffs(vid_t *s, av_matrix_t matrix, int full_range)
+{
+	double kr, kb, kg, ys, cs;
+	
+	/* 16.16 fixed point Y'CbCr to 8-bit R'G'B' coefficients */
+	_vid_matrix_coeffs(matrix, &kr, &kb);
+	kg = 1 - kr - kb;
+	
+	ys = full_range ? 1.0 : 255.0 / 219;
+	cs = full_range ? 1.0 : 255.0 / 224;
+	
+	s->yuv_coeffs[0] = full_range ? 0 : 16;
+	s->yuv_coeffs[1] = lround(ys * 65536);
+	s->yuv_coeffs[2] = lround(cs * 2 * (1 - kr) * 65536);
+	s->yuv_coeffs[3] = lround(cs * 2 * kb * (1 - kb) / kg * 65536);
+	s->yuv_coeffs[4] = lround(cs * 2 * kr * (1 - kr) / kg * 65536);
+	s->yuv_coeffs[5] = lround(cs * 2 * (1 - kb) * 65536);
+}
+
+static void _vid_stop_yuv_lut(vid_t *s)
+{
+	if(s->yuv_lut_state == _YUV_LUT_BUILDING ||
+	   s->yuv_lut_state == _YUV_LUT_READY)
+	{
+		__atomic_store_n(&s->yuv_lut_state, _YUV_LUT_ABORT, __ATOMIC_RELAXED);
+		pthread_join(s->yuv_lut_thread, NULL);
+		s->yuv_lut_state = _YUV_LUT_IDLE;
+	}
+}
+
+static void _vid_update_yuv_lut(vid_t *s)
+{
+	_yiq16_t *t;
+	
+	/* Swap in a table finished by the build thread */
+	if(__atomic_load_n(&s->yuv_lut_state, __ATOMIC_ACQUIRE) == _YUV_LUT_READY)
+	{
+		pthread_join(s->yuv_lut_thread, NULL);
+		s->yuv_lut_state = _YUV_LUT_IDLE;
+		
+		t = s->yuv_level_lookup;
+		s->yuv_level_lookup = s->yuv_lut_next;
+		s->yuv_lut_next = t;
+		s->yuv_matrix = s->yuv_next_matrix;
+		s->yuv_full_range = s->yuv_next_full_range;
+		s->vlevels_valid = 0;
+	}
+	
+	s->yuv_lut_ok = s->yuv_level_lookup != NULL &&
+		s->yuv_matrix == s->vframe.matrix &&
+		s->yuv_full_range == s->vframe.full_range;
+	
+	if(s->yuv_lut_ok)
+	{
+		return;
+	}
+	
+	/* Building the table takes too long to do between lines,
+	 * so it's done in the background. Frames are converted
+	 * through the RGB table until it's ready */
+	_vid_yuv_coeffs(s, s->vframe.matrix, s->vframe.full_range);
+	
+	if(s->yuv_lut_state != _YUV_LUT_IDLE)
+	{
+		return;
+	}
+	
+	if(s->yuv_lut_next == NULL)
+	{
+		s->yuv_lut_next = arena_alloc(&s->arena, "yuv", 0x1000000 * sizeof(_yiq16_t));
+		if(s->yuv_lut_next == NULL)
+		{
+			fprintf(stderr, "Out of memory for the Y'CbCr lookup table\n");
+			s->yuv_lut_state = _YUV_LUT_FAILED;
+			return;
+		}
+	}
+	
+	s->yuv_next_matrix = s->vframe.matrix;
+	s->yuv_next_full_range = s->vframe.full_range;
+	s->yuv_lut_state = _YUV_LUT_BUILDING;
+	
+	if(pthread_create(&s->yuv_lut_thread, NULL, _yuv_lut_thread, s) != 0)
+	{
+		fprintf(stderr, "Unable to start the Y'CbCr lookup table thread\n");
+		s->yuv_lut_state = _YUV_LUT_FAILED;
+	}
+}
+
+int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t * const conf)
+{
+	int r, x;
+	int64_t c;
+	double d;
+	double width;
+	double level, slevel;
+	vid_line_t *l;
+	
+	/* Seed the system's PRNG, used by some of the video scramblers */
+	set_fixed_time(conf->fixed_time);
+	srand(conf->seed ? conf->seed : wall_time());
+	
+	memset(s, 0, sizeof(vid_t));
+	memcpy(&s->conf, conf, sizeof(vid_config_t));
+	
+	s->output_gain = 4096;
+	s->audio_gain = 4096;
+	
+	arena_init(&s->arena, s->conf.hugepages);
+	pthread_mutex_init(&s->changes_mutex, NULL);
+	
+	if(pool_open() != 0)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	s->pool = 1;
+	
+	s->sample_rate = sample_rate;
+	s->pixel_rate = pixel_rate ? pixel_rate : sample_rate;
+	
+	_test_sample_rate(&s->conf, s->pixel_rate);
+	
+	/* Calculate the number of samples per line */
 	width = (double) s->conf.frame_rate.den / s->conf.frame_rate.num / s->conf.lines;
 	
 	s->width = round((double) s->pixel_rate * width);
@@ -3997,7 +4641,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	/* Calculate the active video width and offset */
 	s->active_left = round(s->pixel_rate * s->conf.active_left);
 	s->active_width = ceil(s->pixel_rate * s->conf.active_width);
-	if(s->active_width > s->width) s->active_width = s->width;
+	if(s->active_left + s->active_width > s->width) s->active_width = s->width - s->active_left;
 	
 	/* Calculate signal levels */
 	/* slevel is the the sub-carrier level. When FM modulating
@@ -4042,7 +4686,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	}
 	
 	/* Allocate memory for YUV lookup tables */
-	s->yiq_level_lookup = malloc(0x1000000 * sizeof(_yiq16_t));
+	s->yiq_level_lookup = arena_alloc(&s->arena, "yiq", 0x1000000 * sizeof(_yiq16_t));
 	if(s->yiq_level_lookup == NULL)
 	{
 		vid_free(s);
@@ -4057,50 +4701,12 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	
 	for(c = 0; c < 0x100; c++)
 	{
-		glut[c] = pow((double) c / 255, 1 / s->conf.gamma);
+		s->glut[c] = pow((double) c / 255, 1 / s->conf.gamma);
 	}
 	
 	/* Generate the RGB > signal level lookup tables */
-	for(c = 0x000000; c <= 0xFFFFFF; c++)
-	{
-		double r, g, b;
-		double y, u, v;
-		double i, q;
-		
-		/* Calculate RGB 0..1 values */
-		r = glut[(c & 0xFF0000) >> 16];
-		g = glut[(c & 0x00FF00) >> 8];
-		b = glut[(c & 0x0000FF) >> 0];
-		
-		/* Calculate Y, Cb and Cr values */
-		y = r * s->conf.rw_co
-		  + g * s->conf.gw_co
-		  + b * s->conf.bw_co;
-		u = (b - y);
-		v = (r - y);
-		
-		i = s->conf.eu_co * u;
-		q = s->conf.ev_co * v;
-		
-		/* Adjust values to correct signal level */
-		y = (s->conf.black_level + (y * (s->conf.white_level - s->conf.black_level))) * level;
-		
-		if(s->conf.colour_mode != VID_SECAM)
-		{
-			i *= (s->conf.white_level - s->conf.black_level) * level;
-			q *= (s->conf.white_level - s->conf.black_level) * level;
-		}
-		else
-		{
-			i = (i + SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
-			q = (q + SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
-		}
-		
-		/* Convert to INT16 range and store in tables */
-		s->yiq_level_lookup[c].y = round(_dlimit(y, -1, 1) * INT16_MAX);
-		s->yiq_level_lookup[c].i = round(_dlimit(i, -1, 1) * INT16_MAX);
-		s->yiq_level_lookup[c].q = round(_dlimit(q, -1, 1) * INT16_MAX);
-	}
+	s->level = level;
+	pool_parallel_for(0x1000000, 0x10000, _yiq_lut_task, s);
 	
 	if(s->conf.colour_mode == VID_PAL ||
 	   s->conf.colour_mode == VID_NTSC)
@@ -4113,7 +4719,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		d = 2.0 * M_PI * ((double) s->conf.colour_carrier.num / s->conf.colour_carrier.den) / s->pixel_rate;
 		
 		/*  To make overflow easier to handle the length of the table is extended by one line */
-		s->colour_lookup = malloc((s->colour_lookup_width + s->width) * sizeof(cint16_t));
+		s->colour_lookup = arena_alloc(&s->arena, "colour", (s->colour_lookup_width + s->width) * sizeof(cint16_t));
 		if(!s->colour_lookup)
 		{
 			vid_free(s);
@@ -4136,6 +4742,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		/* Generate the colour burst envelope */
 		s->burst_left  = round(s->pixel_rate * (s->conf.burst_left - s->conf.burst_rise / 2));
 		s->burst_win   = _burstwin(
+			&s->arena,
 			s->pixel_rate,
 			s->conf.burst_width,
 			s->conf.burst_rise,
@@ -4194,7 +4801,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		double secam_level = (s->conf.white_level - s->conf.blanking_level) * level;
 		double taps[51];
 		
-		r = _init_fm_modulator(&s->fm_secam, s->pixel_rate, SECAM_FM_FREQ, SECAM_FM_DEV, secam_level);
+		r = _init_fm_modulator(&s->arena, &s->fm_secam, s->pixel_rate, SECAM_FM_FREQ, SECAM_FM_DEV, secam_level);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4223,7 +4830,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->fm_secam_dmin[1] = lround((SECAM_CR_FREQ - SECAM_FM_FREQ - 506e3) / SECAM_FM_DEV * INT16_MAX);
 		s->fm_secam_dmax[1] = lround((SECAM_CR_FREQ - SECAM_FM_FREQ + 350e3) / SECAM_FM_DEV * INT16_MAX);
 		
-		s->fm_secam_bell = malloc(sizeof(cint16_t) * UINT16_MAX);
+		s->fm_secam_bell = arena_alloc(&s->arena, "secam", sizeof(cint16_t) * UINT16_MAX);
 		if(!s->fm_secam_bell)
 		{
 			vid_free(s);
@@ -4244,6 +4851,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		/* Generate the colour subcarrier envelope */
 		s->burst_left  = round(s->pixel_rate * (s->conf.burst_left - s->conf.burst_rise / 2));
 		s->burst_win   = _burstwin(
+			&s->arena,
 			s->pixel_rate,
 			s->conf.burst_width,
 			s->conf.burst_rise,
@@ -4262,7 +4870,6 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	s->bline  = 1;
 	s->bframe = 1;
 	
-	s->framebuffer = NULL;
 	s->olines = 1;
 	s->audio = 0;
 	
@@ -4278,9 +4885,47 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		
 		_add_lineprocess(s, "macraster", 3, NULL, mac_next_line, NULL);
 	}
+	else if(s->conf.raw_bb_file)
+	{
+		/* Pre-rendered baseband lines replace the raster */
+		r = _init_rawbb(s);
+		
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+		
+		_add_lineprocess(s, "rawbb", 1, NULL, _vid_next_line_rawbb, NULL);
+	}
 	else
 	{
 		_add_lineprocess(s, "raster", 3, NULL, _vid_next_line_raster, NULL);
+		
+		/* Field sequential colour selects the colour per line,
+		 * so it always looks up the RGB pixels directly */
+		if(s->conf.colour_mode != VID_APOLLO_FSC &&
+		   s->conf.colour_mode != VID_CBS_FSC)
+		{
+			s->vline = arena_alloc(&s->arena, "line levels", s->active_width * sizeof(_yiq16_t));
+			if(s->vline == NULL)
+			{
+				vid_free(s);
+				return(VID_OUT_OF_MEMORY);
+			}
+			
+			/* Look up the active video levels in parallel
+			 * if there is more than one thread */
+			if(pool_threads() > 1)
+			{
+				s->vlevels = arena_alloc(&s->arena, "field levels", s->conf.active_lines * s->active_width * sizeof(_yiq16_t));
+				if(s->vlevels == NULL)
+				{
+					vid_free(s);
+					return(VID_OUT_OF_MEMORY);
+				}
+			}
+		}
 	}
 	
 	/* Initialise VITS inserter */
@@ -4298,7 +4943,8 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			return(r);
 		}
 		
-		_add_lineprocess(s, "vits", 1, &s->vits, vits_render, NULL);
+		_add_lineprocess(s, "vits", 1, &s->vits, vits_render, _vid_release_vits);
+		s->features |= _FEATURE_VITS;
 	}
 	
 	/* Initialise the WSS system */
@@ -4310,7 +4956,12 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			return(r);
 		}
 		
-		_add_lineprocess(s, "wss", 1, &s->wss, wss_render, NULL);
+		/* The WSS mode sets the aspect ratios of the frame */
+		s->conf.frame_aspects[0] = s->wss.aspect[0];
+		s->conf.frame_aspects[1] = s->wss.aspect[1];
+		
+		_add_lineprocess(s, "wss", 1, &s->wss, wss_render, _vid_release_wss);
+		s->features |= _FEATURE_WSS;
 	}
 	
 	/* Initialise videocrypt I/II encoder */
@@ -4370,7 +5021,8 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			return(r);
 		}
 		
-		_add_lineprocess(s, "acp", 1, &s->acp, acp_render_line, NULL);
+		_add_lineprocess(s, "acp", 1, &s->acp, acp_render_line, _vid_release_acp);
+		s->features |= _FEATURE_ACP;
 	}
 	
 	/* Initialise VITC timestamp */
@@ -4382,7 +5034,8 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			return(r);
 		}
 		
-		_add_lineprocess(s, "vitc", 1, &s->vitc, vitc_render, NULL);
+		_add_lineprocess(s, "vitc", 1, &s->vitc, vitc_render, _vid_release_vitc);
+		s->features |= _FEATURE_VITC;
 	}
 	
 	/* Initalise the teletext system */
@@ -4397,10 +5050,23 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		/* Start the teletext renderer thread for non-MAC modes */
 		if(s->conf.type != VID_MAC)
 		{
-			_add_lineprocess(s, "teletext", 1, &s->tt, tt_render_line, NULL);
+			_add_lineprocess(s, "teletext", 1, &s->tt, tt_render_line, _vid_release_teletext);
+			s->features |= _FEATURE_TELETEXT;
 		}
 	}
 	
+	/* Tap the baseband signal before resampling or filtering */
+	if(s->conf.tbc_file)
+	{
+		if((r = tbc_init(&s->tbc, s, s->conf.tbc_file)) != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+		
+		_add_lineprocess(s, "tbc", 1, &s->tbc, tbc_render_line, NULL);
+	}
+	
 	if(s->pixel_rate != s->sample_rate)
 	{
 		_init_vresampler(s);
@@ -4441,7 +5107,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	/* FM audio */
 	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_mono, s->sample_rate, s->conf.fm_mono_carrier, s->conf.fm_mono_deviation, s->conf.fm_mono_level * slevel);
+		r = _init_fm_modulator(&s->arena, &s->fm_mono, s->sample_rate, s->conf.fm_mono_carrier, s->conf.fm_mono_deviation, s->conf.fm_mono_level * slevel);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4482,7 +5148,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	
 	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_left, s->sample_rate, s->conf.fm_left_carrier, s->conf.fm_left_deviation, s->conf.fm_left_level * slevel);
+		r = _init_fm_modulator(&s->arena, &s->fm_left, s->sample_rate, s->conf.fm_left_carrier, s->conf.fm_left_deviation, s->conf.fm_left_level * slevel);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4523,7 +5189,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	
 	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_right, s->sample_rate, s->conf.fm_right_carrier, s->conf.fm_right_deviation, s->conf.fm_right_level * slevel);
+		r = _init_fm_modulator(&s->arena, &s->fm_right, s->sample_rate, s->conf.fm_right_carrier, s->conf.fm_right_deviation, s->conf.fm_right_level * slevel);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4614,7 +5280,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	/* FM video */
 	if(s->conf.modulation == VID_FM)
 	{
-		r = _init_fm_modulator(&s->fm_video, s->sample_rate, 0, s->conf.fm_deviation, s->conf.fm_level * s->conf.level);
+		r = _init_fm_modulator(&s->arena, &s->fm_video, s->sample_rate, 0, s->conf.fm_deviation, s->conf.fm_level * s->conf.level);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4670,7 +5336,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		}
 		
 		/* Allocate memory for the temporary passthru buffer */
-		s->passline = calloc(sizeof(int16_t) * 2, s->max_width);
+		s->passline = arena_alloc(&s->arena, "passthru", sizeof(int16_t) * 2 * s->max_width);
 		if(!s->passline)
 		{
 			vid_free(s);
@@ -4685,7 +5351,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	s->output_process = &s->processes[s->nprocesses - 1];
 	
 	/* Output line buffer(s) */
-	s->oline = calloc(sizeof(vid_line_t), s->olines);
+	s->oline = arena_alloc(&s->arena, "lines", sizeof(vid_line_t) * s->olines);
 	if(!s->oline)
 	{
 		vid_free(s);
@@ -4694,7 +5360,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	
 	for(r = 0; r < s->olines; r++)
 	{
-		s->oline[r].output = malloc(sizeof(int16_t) * 2 * s->max_width);
+		s->oline[r].output = arena_alloc(&s->arena, "lines", sizeof(int16_t) * 2 * s->max_width);
 		if(!s->oline[r].output)
 		{
 			vid_free(s);
@@ -4730,6 +5396,9 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		}
 	}
 	
+	/* Duration of a frame, for the headroom monitor */
+	s->frame_ns = 1000000000ULL * s->conf.frame_rate.den / s->conf.frame_rate.num;
+	
 	return(VID_OK);
 }
 
@@ -4754,27 +5423,23 @@ void vid_free(vid_t *s)
 	if(s->conf.passthru)
 	{
 		fclose(s->passthru);
-		free(s->passline);
-	}
-	
-	if(s->conf.teletext)
-	{
-		tt_free(&s->tt);
 	}
 	
-	if(s->conf.vitc)
+	if(s->conf.raw_bb_file)
 	{
-		vitc_free(&s->vitc);
+		_free_rawbb(s);
 	}
 	
-	if(s->conf.vits)
+	/* VITS, WSS, ACP, VITC and non-MAC teletext are freed by their
+	 * line processes above. MAC teletext has no line process */
+	if(s->conf.type == VID_MAC && (s->conf.teletext || s->conf.txsubtitles))
 	{
-		vits_free(&s->vits);
+		tt_free(&s->tt);
 	}
 	
-	if(s->conf.acp)
+	if(s->conf.tbc_file)
 	{
-		acp_free(&s->acp);
+		tbc_free(&s->tbc);
 	}
 	
 	if(s->conf.syster || s->conf.d11 || s->conf.systercnr)
@@ -4792,27 +5457,15 @@ void vid_free(vid_t *s)
 		vcs_free(&s->vcs);
 	}
 	
-	if(s->conf.wss)
-	{
-		wss_free(&s->wss);
-	}
-	
 	if(s->conf.type == VID_MAC)
 	{
 		mac_free(s);
 	}
 	
 	/* Free allocated memory */
-	free(s->yiq_level_lookup);
-	free(s->colour_lookup);
 	fir_int16_free(&s->secam_l_fir);
 	fir_int16_free(&s->fm_secam_fir);
 	iir_int16_free(&s->fm_secam_iir);
-	_free_fm_modulator(&s->fm_secam);
-	_free_fm_modulator(&s->fm_video);
-	_free_fm_modulator(&s->fm_mono);
-	_free_fm_modulator(&s->fm_left);
-	_free_fm_modulator(&s->fm_right);
 	_free_am_modulator(&s->a2stereo_pilot);
 	_free_am_modulator(&s->a2stereo_signal);
 	limiter_free(&s->fm_mono.limiter);
@@ -4822,22 +5475,70 @@ void vid_free(vid_t *s)
 	nicam_mod_free(&s->nicam);
 	_free_am_modulator(&s->am_mono);
 	
-	if(s->oline)
+	for(i = 0; i < s->nxlines; i++)
+	{
+		free(s->xlines[i]->output);
+		free(s->xlines[i]);
+	}
+	free(s->xlines);
+	
+	/* Release anything waiting to be inserted */
+	for(i = 0; i < s->nchanges; i++)
 	{
-		for(i = 0; i < s->olines; i++)
+		if(s->changes[i].insert && s->changes[i].free)
 		{
-			free(s->oline[i].output);
+			s->changes[i].free(s, s->changes[i].arg);
 		}
-		free(s->oline);
 	}
+	free(s->changes);
+	pthread_mutex_destroy(&s->changes_mutex);
 	
-	free(s->burst_win);
-	free(s->syncs);
-	free(s->fsc_syncs);
+	_vid_stop_yuv_lut(s);
+	
+	/* Release all tables allocated from the arena */
+	arena_free(&s->arena);
+	
+	if(s->pool)
+	{
+		pool_close();
+	}
 	
 	memset(s, 0, sizeof(vid_t));
 }
 
+void vid_av_init(vid_t *s, av_fit_mode_t fit_mode, rational_t min_aspect, rational_t max_aspect)
+{
+	/* Configure the AV source settings to match this mode */
+	s->av = (av_t) {
+		.frame_rate = (rational_t) {
+			.num = s->conf.frame_rate.num * (s->conf.interlace ? 2 : 1),
+			.den = s->conf.frame_rate.den,
+		},
+		.display_aspect_ratios = {
+			s->conf.frame_aspects[0],
+			s->conf.frame_aspects[1]
+		},
+		.fit_mode = fit_mode,
+		.min_display_aspect_ratio = min_aspect,
+		.max_display_aspect_ratio = max_aspect,
+		.width = s->active_width,
+		.height = s->conf.active_lines,
+		.yuv = s->vline != NULL,
+		.sample_rate = (rational_t) {
+			.num = (s->audio ? HACKTV_AUDIO_SAMPLE_RATE : 0),
+			1,
+		},
+	};
+	
+	if((s->conf.frame_orientation & 3) == VID_ROTATE_90 ||
+	   (s->conf.frame_orientation & 3) == VID_ROTATE_270)
+	{
+		/* Flip dimensions if the lines are scanned vertically */
+		s->av.width = s->conf.active_lines;
+		s->av.height = s->active_width;
+	}
+}
+
 void vid_info(vid_t *s)
 {
 	fprintf(stderr, "Video: %dx%d %.2f fps (full frame %dx%d)\n",
@@ -4854,73 +5555,1020 @@ void vid_info(vid_t *s)
 	fprintf(stderr, "Sample rate: %d\n", s->sample_rate);
 }
 
+void vid_memstats(vid_t *s)
+{
+	arena_t a = s->arena;
+	int features;
+	
+	pthread_mutex_lock(&s->changes_mutex);
+	features = s->features;
+	pthread_mutex_unlock(&s->changes_mutex);
+	
+	/* Add the data tables owned by the VBI and scrambler modules */
+	if((features & _FEATURE_TELETEXT) ||
+	   (s->conf.type == VID_MAC && (s->conf.teletext || s->conf.txsubtitles)))
+	{
+		arena_account(&a, "teletext", vbidata_lut_size(s->tt.lut));
+	}
+	
+	if(features & _FEATURE_WSS)
+	{
+		arena_account(&a, "wss", vbidata_lut_size(s->wss.lut));
+	}
+	
+	if(features & _FEATURE_VITC)
+	{
+		arena_account(&a, "vitc", vbidata_lut_size(s->vitc.lut));
+	}
+	
+	if(s->conf.videocrypt || s->conf.videocrypt2)
+	{
+		arena_account(&a, "videocrypt", vbidata_lut_size(s->vc.lut));
+	}
+	
+	if(s->conf.videocrypts)
+	{
+		arena_account(&a, "videocrypts", vbidata_lut_size(s->vcs.lut));
+	}
+	
+	if(s->conf.syster || s->conf.systercnr)
+	{
+		arena_account(&a, "syster", vbidata_lut_size(s->ng.lut));
+	}
+	
+	arena_print_stats(&a, stderr);
+}
+
 size_t vid_get_framebuffer_length(vid_t *s)
 {
 	return(sizeof(uint32_t) * s->active_width * s->conf.active_lines);
 }
 
-static vid_line_t *_vid_next_line(vid_t *s, size_t *samples)
+/* The order processes are added in by vid_init(). Processes inserted at
+ * runtime without an explicit position are placed using this list */
+static const char *_process_order[] = {
+	"vits", "wss", "videocrypt", "videocrypts", "syster", "discret11",
+	"acp", "vitc", "teletext", "tbc", "vresampler", "vfilter", "audio",
+	"fmmod", "offset", "gain", "passthru", "output", NULL
+};
+
+static int _vid_find_process(vid_t *s, const char *name)
 {
-	vid_line_t *l = s->output_process->lines[0];
-	int i, j;
+	int i;
 	
-	/* Load the next frame */
-	if(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline))
+	for(i = 0; i < s->nprocesses; i++)
 	{
-		/* Have we reached the end of the video? */
-		if(_av_eof(s))
+		if(strcmp(s->processes[i].name, name) == 0)
 		{
-			return(NULL);
+			return(i);
 		}
-		s->framebuffer = _av_read_video(s, &s->ratio);
 	}
 	
-	for(i = 0; i < s->nprocesses; i++)
+	return(-1);
+}
+
+static vid_line_t *_vid_new_line(vid_t *s)
+{
+	vid_line_t *l;
+	int x;
+	
+	l = calloc(1, sizeof(vid_line_t));
+	if(!l)
 	{
-		_lineprocess_t *p = &s->processes[i];
-		
-		if(p->process)
-		{
-			p->process(p->vid, p->arg, p->nlines, p->lines);
-		}
-		
-		for(j = 0; j < p->nlines; j++)
-		{
-			p->lines[j] = p->lines[j]->next;
-		}
+		return(NULL);
 	}
 	
-	/* Advance the next line/frame counter */
-	if(s->bline++ == s->conf.lines)
+	l->output = malloc(sizeof(int16_t) * 2 * s->max_width);
+	if(!l->output)
 	{
-		s->bline = 1;
-		s->bframe++;
+		free(l);
+		return(NULL);
 	}
 	
-	/* Return a pointer to the output buffer */
-	if(samples)
+	/* A blank delay line, dropped before output */
+	for(x = 0; x < s->width; x++)
 	{
-		*samples = l->width;
+		l->output[x * 2] = s->blanking_level;
 	}
 	
+	l->frame = 1;
+	l->line = 0;
+	
 	return(l);
 }
 
-int16_t *vid_next_line(vid_t *s, size_t *samples)
+static int _vid_attach_process(vid_t *s, _lineprocess_change_t *c)
 {
-	vid_line_t *l;
+	_lineprocess_t *p, *b;
+	vid_line_t **lines, **xl, *x;
+	int i, j;
 	
-	/* Drop any delay lines introduced by scramblers / filters */
-	do
+	/* Reuse a detached stage with the same name and window size */
+	i = _vid_find_process(s, c->name);
+	if(i >= 0)
 	{
-		l = _vid_next_line(s, samples);
-		if(l == NULL) return(NULL);
+		p = &s->processes[i];
+		
+		if(p->process != NULL || p->nlines != c->nlines)
+		{
+			fprintf(stderr, "Line process '%s' is already present.\n", c->name);
+			return(VID_ERROR);
+		}
+		
+		p->arg = c->arg;
+		p->process = c->process;
+		p->free = c->free;
+		
+		return(VID_OK);
 	}
-	while(l->line < 1);
 	
-	s->frame = l->frame;
-	s->line  = l->line;
+	/* Find the process to insert before. Nothing can be
+	 * placed before the first (source) process and the
+	 * output process is always the last */
+	i = -1;
+	
+	if(c->before[0] != '\0')
+	{
+		i = _vid_find_process(s, c->before);
+	}
+	else
+	{
+		for(j = 0; _process_order[j] && strcmp(_process_order[j], c->name) != 0; j++);
+		for(; _process_order[j] && i < 0; j++)
+		{
+			i = _vid_find_process(s, _process_order[j]);
+		}
+	}
+	
+	if(i < 1)
+	{
+		i = s->nprocesses - 1;
+	}
+	
+	/* Allocate the new window and any extra delay lines first */
+	lines = calloc(sizeof(vid_line_t *), c->nlines);
+	if(!lines)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	/* One spare entry, a single line process needs none and
+	 * realloc() of zero bytes may free the list */
+	xl = realloc(s->xlines, sizeof(vid_line_t *) * (s->nxlines + c->nlines));
+	if(!xl)
+	{
+		free(lines);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	s->xlines = xl;
+	xl = &s->xlines[s->nxlines];
+	
+	for(j = 0; j < c->nlines - 1; j++)
+	{
+		xl[j] = _vid_new_line(s);
+		if(!xl[j])
+		{
+			while(j--)
+			{
+				free(xl[j]->output);
+				free(xl[j]);
+			}
+			
+			free(lines);
+			return(VID_OUT_OF_MEMORY);
+		}
+	}
+	
+	p = realloc(s->processes, sizeof(_lineprocess_t) * (s->nprocesses + 1));
+	if(!p)
+	{
+		for(j = 0; j < c->nlines - 1; j++)
+		{
+			free(xl[j]->output);
+			free(xl[j]);
+		}
+		
+		free(lines);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	s->processes = p;
+	memmove(&p[i + 1], &p[i], sizeof(_lineprocess_t) * (s->nprocesses - i));
+	s->nprocesses++;
+	s->output_process = &s->processes[s->nprocesses - 1];
+	
+	b = &p[i + 1];
+	p = &p[i];
+	
+	memset(p, 0, sizeof(_lineprocess_t));
+	strncpy(p->name, c->name, 15);
+	p->vid = s;
+	p->nlines = c->nlines;
+	p->lines = lines;
+	p->arg = c->arg;
+	p->process = c->process;
+	p->free = c->free;
+	
+	/* The new window ends on the line the next process
+	 * was due to read. Any extra lines needed for the
+	 * window are spliced into the ring just behind it,
+	 * which delays everything downstream without losing
+	 * any of the lines already in flight */
+	x = b->lines[b->nlines - 1];
+	p->lines[c->nlines - 1] = x;
+	
+	for(j = c->nlines - 2; j >= 0; j--)
+	{
+		xl[j]->next = x;
+		xl[j]->previous = x->previous;
+		x->previous->next = xl[j];
+		x->previous = xl[j];
+		
+		p->lines[j] = x = xl[j];
+	}
+	
+	s->nxlines += c->nlines - 1;
+	s->olines += c->nlines - 1;
+	
+	/* Everything downstream that was reading the same line, the
+	 * next process and any single line processes and the output
+	 * process after it, now reads the end of the new window */
+	for(j = i + 1; j < s->nprocesses; j++)
+	{
+		b = &s->processes[j];
+		
+		if(b->lines[b->nlines - 1] == p->lines[c->nlines - 1])
+		{
+			b->lines[b->nlines - 1] = p->lines[0];
+		}
+	}
+	
+	return(VID_OK);
+}
+
+static void _vid_detach_process(vid_t *s, _lineprocess_change_t *c)
+{
+	_lineprocess_t *p;
+	int i;
+	
+	i = _vid_find_process(s, c->name);
+	
+	/* The source and output processes can't be removed */
+	if(i < 1 || i == s->nprocesses - 1 || s->processes[i].process == NULL)
+	{
+		return;
+	}
+	
+	p = &s->processes[i];
+	
+	if(p->free)
+	{
+		p->free(s, p->arg);
+	}
+	
+	if(c->free)
+	{
+		c->free(s, p->arg);
+	}
+	
+	if(p->nlines > 1)
+	{
+		/* Lines still inside the window are on their way to the
+		 * output, so the stage is kept as a plain delay */
+		p->arg = NULL;
+		p->process = NULL;
+		p->free = NULL;
+		return;
+	}
+	
+	free(p->lines);
+	memmove(p, p + 1, sizeof(_lineprocess_t) * (s->nprocesses - i - 1));
+	s->nprocesses--;
+	s->output_process = &s->processes[s->nprocesses - 1];
+}
+
+static void _vid_apply_changes(vid_t *s)
+{
+	_lineprocess_change_t *c;
+	int i, n;
+	
+	pthread_mutex_lock(&s->changes_mutex);
+	c = s->changes;
+	n = s->nchanges;
+	s->changes = NULL;
+	__atomic_store_n(&s->nchanges, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&s->changes_mutex);
+	
+	for(i = 0; i < n; i++)
+	{
+		if(c[i].insert)
+		{
+			/* The free function is still responsible
+			 * for the argument if it wasn't inserted */
+			if(_vid_attach_process(s, &c[i]) != VID_OK && c[i].free)
+			{
+				c[i].free(s, c[i].arg);
+			}
+		}
+		else
+		{
+			_vid_detach_process(s, &c[i]);
+		}
+	}
+	
+	free(c);
+}
+
+static int _vid_queue_change(vid_t *s, int insert, const char *before, const char *name, int nlines, void *arg, vid_lineprocess_process_t pprocess, vid_lineprocess_free_t pfree)
+{
+	_lineprocess_change_t *c;
+	
+	if(strlen(name) > 15 || (before && strlen(before) > 15) || nlines < 1)
+	{
+		return(VID_ERROR);
+	}
+	
+	pthread_mutex_lock(&s->changes_mutex);
+	
+	c = realloc(s->changes, sizeof(_lineprocess_change_t) * (s->nchanges + 1));
+	if(!c)
+	{
+		pthread_mutex_unlock(&s->changes_mutex);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	s->changes = c;
+	c = &s->changes[s->nchanges];
+	
+	memset(c, 0, sizeof(_lineprocess_change_t));
+	c->insert = insert;
+	strcpy(c->name, name);
+	if(before) strcpy(c->before, before);
+	c->nlines = nlines;
+	c->arg = arg;
+	c->process = pprocess;
+	c->free = pfree;
+	
+	/* The render thread checks for changes without the lock */
+	__atomic_store_n(&s->nchanges, s->nchanges + 1, __ATOMIC_RELEASE);
+	
+	pthread_mutex_unlock(&s->changes_mutex);
+	
+	return(VID_OK);
+}
+
+int vid_insert_lineprocess(vid_t *s, const char *before, const char *name, int nlines, void *arg, vid_lineprocess_process_t pprocess, vid_lineprocess_free_t pfree)
+{
+	/* Queue a new line process to be added at the start of the next
+	 * frame. It is placed before the process named 'before', or in
+	 * the default position for its name if that is NULL. If it can't
+	 * be inserted then, pfree is called to release arg. */
+	return(_vid_queue_change(s, 1, before, name, nlines, arg, pprocess, pfree));
+}
+
+int vid_remove_lineprocess(vid_t *s, const char *name)
+{
+	/* Queue a line process for removal at the start of the next frame */
+	return(_vid_queue_change(s, 0, NULL, name, 1, NULL, NULL, NULL));
+}
+
+int vid_set_level(vid_t *s, double level)
+{
+	int gain;
+	int r = VID_OK;
+	
+	/* Scale the output by level, relative to the level it was
+	 * initialised with. Only called from the render thread */
+	gain = lround(level * 4096);
+	if(gain < 0) gain = 0;
+	if(gain > 4096 * 8) gain = 4096 * 8;
+	
+	if(gain != 4096 && !s->output_gain_process)
+	{
+		r = vid_insert_lineprocess(s, NULL, "gain", 1, NULL, _vid_gain_process, NULL);
+		s->output_gain_process = (r == VID_OK);
+	}
+	else if(gain == 4096 && s->output_gain_process)
+	{
+		r = vid_remove_lineprocess(s, "gain");
+		s->output_gain_process = (r != VID_OK);
+	}
+	
+	if(r == VID_OK)
+	{
+		s->output_gain = gain;
+	}
+	
+	return(r);
+}
+
+void vid_set_volume(vid_t *s, double volume)
+{
+	int gain;
+	
+	/* Scale the audio by volume, relative to the
+	 * volume the source was opened with */
+	gain = lround(volume * 4096);
+	s->audio_gain = gain < 0 ? 0 : (gain > 4096 * 8 ? 4096 * 8 : gain);
+}
+
+static int _vid_claim_feature(vid_t *s, int feature, int releasing)
+{
+	int r = VID_ERROR;
+	
+	/* Features are enabled and disabled from other threads. A feature
+	 * can't be enabled again until the render thread has released it */
+	pthread_mutex_lock(&s->changes_mutex);
+	
+	if(!releasing && (s->features & feature) == 0)
+	{
+		s->features |= feature;
+		r = VID_OK;
+	}
+	else if(releasing && (s->features & feature) != 0 && (s->features_releasing & feature) == 0)
+	{
+		s->features_releasing |= feature;
+		r = VID_OK;
+	}
+	
+	pthread_mutex_unlock(&s->changes_mutex);
+	
+	return(r);
+}
+
+int vid_enable_feature(vid_t *s, const char *name, const char *arg)
+{
+	vid_lineprocess_process_t process;
+	vid_lineprocess_free_t release;
+	void *state;
+	int feature;
+	int r;
+	
+	/* Initialise one of the optional VBI features and queue its line
+	 * process for the next frame. The initialisation is done here, on
+	 * the caller's thread, and the render thread only sees the feature
+	 * once its process is attached. Nothing in s->conf is changed. */
+	if(s->conf.type != VID_RASTER_625 &&
+	   s->conf.type != VID_RASTER_525)
+	{
+		fprintf(stderr, "Features can only be changed in 625 and 525 line raster modes.\n");
+		return(VID_ERROR);
+	}
+	
+	if(strcmp(name, "vits") == 0)
+	{
+		feature = _FEATURE_VITS;
+		state = &s->vits;
+		process = vits_render;
+		release = _vid_release_vits;
+	}
+	else if(strcmp(name, "wss") == 0 && s->conf.lines == 625)
+	{
+		feature = _FEATURE_WSS;
+		state = &s->wss;
+		process = wss_render;
+		release = _vid_release_wss;
+	}
+	else if(strcmp(name, "acp") == 0)
+	{
+		if(s->conf.videocrypt || s->conf.videocrypt2 || s->conf.videocrypts || s->conf.syster)
+		{
+			fprintf(stderr, "Analogue Copy Protection cannot be used with video scrambling enabled.\n");
+			return(VID_ERROR);
+		}
+		
+		feature = _FEATURE_ACP;
+		state = &s->acp;
+		process = acp_render_line;
+		release = _vid_release_acp;
+	}
+	else if(strcmp(name, "vitc") == 0)
+	{
+		feature = _FEATURE_VITC;
+		state = &s->vitc;
+		process = vitc_render;
+		release = _vid_release_vitc;
+	}
+	else if(strcmp(name, "teletext") == 0 && arg && s->conf.lines == 625 && !s->conf.txsubtitles)
+	{
+		feature = _FEATURE_TELETEXT;
+		state = &s->tt;
+		process = tt_render_line;
+		release = _vid_release_teletext;
+	}
+	else
+	{
+		fprintf(stderr, "Feature '%s' can't be enabled in this mode.\n", name);
+		return(VID_ERROR);
+	}
+	
+	if(_vid_claim_feature(s, feature, 0) != VID_OK)
+	{
+		fprintf(stderr, "Feature '%s' is already enabled.\n", name);
+		return(VID_ERROR);
+	}
+	
+	switch(feature)
+	{
+	case _FEATURE_VITS:
+		r = vits_init(
+			&s->vits, s->pixel_rate, s->width, s->conf.lines,
+			s->conf.colour_mode == VID_PAL,
+			s->white_level - s->blanking_level
+		);
+		break;
+	
+	case _FEATURE_WSS: r = wss_init(&s->wss, s, (char *) (arg ? arg : "auto")); break;
+	case _FEATURE_ACP: r = acp_init(&s->acp, s); break;
+	case _FEATURE_VITC: r = vitc_init(&s->vitc, s); break;
+	default: r = tt_init(&s->tt, s, (char *) arg); break;
+	}
+	
+	if(r != VID_OK)
+	{
+		_vid_feature_released(s, feature);
+		return(r);
+	}
+	
+	/* From here the release function owns the state. It is
+	 * called when the process is removed, or if it can't be
+	 * inserted */
+	r = vid_insert_lineprocess(s, NULL, name, 1, state, process, release);
+	
+	if(r != VID_OK)
+	{
+		release(s, state);
+	}
+	
+	return(r);
+}
+
+int vid_add_teletext_pages(vid_t *s, tt_service_t *pages)
+{
+	/* Add pages from tt_read_pages() to the teletext service, if
+	 * it's running. Only call from the render thread between lines */
+	if(_vid_find_process(s, "teletext") < 0 &&
+	   !(s->conf.type == VID_MAC && s->conf.teletext))
+	{
+		tt_free_pages(pages);
+		return(VID_ERROR);
+	}
+	
+	return(tt_add_pages(&s->tt, pages) == TT_OK ? VID_OK : VID_ERROR);
+}
+
+int vid_disable_feature(vid_t *s, const char *name)
+{
+	int feature;
+	int r;
+	
+	/* Queue the feature's line process for removal. Its state is
+	 * released by the render thread once it has been detached. */
+	if(strcmp(name, "vits") == 0) feature = _FEATURE_VITS;
+	else if(strcmp(name, "wss") == 0) feature = _FEATURE_WSS;
+	else if(strcmp(name, "acp") == 0) feature = _FEATURE_ACP;
+	else if(strcmp(name, "vitc") == 0) feature = _FEATURE_VITC;
+	else if(strcmp(name, "teletext") == 0 && !s->conf.txsubtitles) feature = _FEATURE_TELETEXT;
+	else return(VID_ERROR);
+	
+	if(_vid_claim_feature(s, feature, 1) != VID_OK)
+	{
+		return(VID_ERROR);
+	}
+	
+	r = vid_remove_lineprocess(s, name);
+	
+	if(r != VID_OK)
+	{
+		pthread_mutex_lock(&s->changes_mutex);
+		s->features_releasing &= ~feature;
+		pthread_mutex_unlock(&s->changes_mutex);
+	}
+	
+	return(r);
+}
+
+static int _vid_degrade_step(vid_t *s, int level, int enable)
+{
+	int i;
+	
+	switch(level)
+	{
+	case 1: /* Bypass the video filter */
+		i = _vid_find_process(s, "vfilter");
+		if(i < 0) return(0);
+		s->processes[i].bypass = enable;
+		return(1);
+	
+	case 2: /* Stop burning in overlays */
+		__atomic_store_n(&s->av.skip_overlays, enable, __ATOMIC_RELAXED);
+		return(1);
+	}
+	
+	return(0);
+}
+
+static void _vid_update_headroom(vid_t *s)
+{
+	static const char *steps[] = { NULL, "video filter", "overlays and subtitles" };
+	double load;
+	int level;
+	
+	/* Fraction of the frame period spent rendering the last frame.
+	 * Time spent waiting for the source is left out, a slow decoder
+	 * isn't helped by shedding work in the encoder */
+	load = (double) (s->render_ns - s->source_ns) / s->frame_ns;
+	s->render_ns = 0;
+	s->source_ns = 0;
+	
+	s->load = s->load * (1.0 - VID_HEADROOM_SMOOTHING) + load * VID_HEADROOM_SMOOTHING;
+	
+	/* The AV source may have been reopened */
+	__atomic_store_n(&s->av.skip_overlays, s->degrade_level >= 2, __ATOMIC_RELAXED);
+	
+	if(s->degrade_hold > 0)
+	{
+		s->degrade_hold--;
+		return;
+	}
+	
+	if(s->degrade_measure)
+	{
+		/* The load has settled since the last step was shed. Keep
+		 * the fraction of the load that remained, this is unaffected
+		 * by any other processes competing for the CPU */
+		level = s->degrade_level;
+		s->degrade_ratio[level] = s->load / s->degrade_ratio[level];
+		if(s->degrade_ratio[level] > 1.0) s->degrade_ratio[level] = 1.0;
+		if(s->degrade_ratio[level] < 0.05) s->degrade_ratio[level] = 0.05;
+		s->degrade_measure = 0;
+	}
+	
+	if(s->load > VID_DEGRADE_LOAD)
+	{
+		/* Shed the next available step */
+		for(level = s->degrade_level + 1; level <= VID_DEGRADE_LEVELS; level++)
+		{
+			if(_vid_degrade_step(s, level, 1))
+			{
+				fprintf(stderr, "Headroom %.0f%%: disabling %s\n", (1.0 - s->load) * 100, steps[level]);
+				s->degrade_level = level;
+				s->degrade_hold = VID_DEGRADE_HOLD;
+				s->degrade_ratio[level] = s->load;
+				s->degrade_measure = 1;
+				break;
+			}
+		}
+	}
+	else if(s->degrade_level > 0 && s->load / s->degrade_ratio[s->degrade_level] < VID_RESTORE_LOAD)
+	{
+		/* Restore the last step taken */
+		level = s->degrade_level;
+		_vid_degrade_step(s, level, 0);
+		s->degrade_ratio[level] = 0;
+		
+		fprintf(stderr, "Headroom %.0f%%: restoring %s\n", (1.0 - s->load) * 100, steps[level]);
+		
+		/* Steps that didn't apply were never taken */
+		for(level--; level > 0 && s->degrade_ratio[level] == 0; level--);
+		
+		s->degrade_level = level;
+		s->degrade_hold = VID_DEGRADE_HOLD;
+	}
+}
+
+static void _vid_point_line(vid_t *s, vid_line_t *l, int16_t *output, int copy)
+{
+	/* Move a line into vid_render()'s buffer */
+	if(l->output == output)
+	{
+		return;
+	}
+	
+	if(copy)
+	{
+		memcpy(output, l->output, sizeof(int16_t) * 2 * s->max_width);
+	}
+	
+	if(l->ring == NULL)
+	{
+		l->ring = l->output;
+	}
+	
+	l->output = output;
+}
+
+static void _vid_unpoint_line(vid_t *s, vid_line_t *l, int copy)
+{
+	/* Return a line to its own buffer */
+	if(l->ring == NULL)
+	{
+		return;
+	}
+	
+	if(copy)
+	{
+		memcpy(l->ring, l->output, sizeof(int16_t) * 2 * s->max_width);
+	}
+	
+	l->output = l->ring;
+	l->ring = NULL;
+}
+
+static void _vid_unpoint_lines(vid_t *s)
+{
+	vid_line_t *l, *start;
+	
+	/* Return every line still in flight to the ring */
+	l = start = s->output_process->lines[0];
+	
+	do
+	{
+		_vid_unpoint_line(s, l, 1);
+		l = l->next;
+	}
+	while(l != start);
+}
+
+static void _vid_point_lines(vid_t *s)
+{
+	_lineprocess_t *p = &s->processes[0];
+	vid_line_t *l, *newest;
+	size_t x, w;
+	
+	/* Without a resampler every line is the same width, so each line
+	 * in flight can be placed where it will be output in the caller's
+	 * buffer and the line processes write it there directly */
+	if(s->pixel_rate != s->sample_rate ||
+	   (p->process != _vid_next_line_raster && p->process != _vid_next_line_rawbb))
+	{
+		return;
+	}
+	
+	w = s->width;
+	newest = p->lines[p->nlines - 1];
+	l = s->output_process->lines[0];
+	
+	for(x = 0; x + w <= s->direct_room; x += w)
+	{
+		/* Delay lines are dropped before output, leaving a gap */
+		if(l->line < 1)
+		{
+			return;
+		}
+		
+		/* The newest line is overwritten by the source process,
+		 * the others bring their samples with them */
+		_vid_point_line(s, l, s->direct + x * 2, l != newest);
+		
+		if(l == newest)
+		{
+			break;
+		}
+		
+		l = l->next;
+	}
+}
+
+static vid_line_t *_vid_next_line(vid_t *s, size_t *samples)
+{
+	vid_line_t *l = s->output_process->lines[0];
+	uint64_t start = 0;
+	int i, j;
+	
+	if(s->conf.degrade)
+	{
+		if(s->bline == 1)
+		{
+			_vid_update_headroom(s);
+		}
+		
+		start = monotonic_ns();
+	}
+	
+	/* Apply any line process changes at the start of a frame */
+	if(s->bline == 1 && __atomic_load_n(&s->nchanges, __ATOMIC_ACQUIRE) > 0)
+	{
+		_vid_unpoint_lines(s);
+		_vid_apply_changes(s);
+		l = s->output_process->lines[0];
+	}
+	
+	/* Load the next frame */
+	if(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline))
+	{
+		/* Have we reached the end of the video? */
+		if(av_eof(&s->av))
+		{
+			return(NULL);
+		}
+		
+		if(s->conf.stats || s->conf.degrade)
+		{
+			uint64_t t = monotonic_ns();
+			
+			av_read_video(&s->av, &s->vframe);
+			
+			t = monotonic_ns() - t;
+			s->av_video_stat.ns += t;
+			s->av_video_stat.calls++;
+			s->source_ns += t;
+		}
+		else
+		{
+			av_read_video(&s->av, &s->vframe);
+		}
+		
+		if(!s->vframe.unchanged)
+		{
+			s->vlevels_valid = 0;
+		}
+		
+		if(s->vframe.format == AV_FRAME_YUV)
+		{
+			_vid_update_yuv_lut(s);
+		}
+		
+		if(s->conf.frame_orientation & VID_VFLIP) av_vflip_frame(&s->vframe);
+		if(s->conf.frame_orientation & VID_HFLIP) av_hflip_frame(&s->vframe);
+		av_rotate_frame(&s->vframe, s->conf.frame_orientation & 3);
+		
+		/* Calculate the frame offsets */
+		s->vframe_x = (s->active_width - s->vframe.width) / 2;
+		s->vframe_y = (s->conf.active_lines - s->vframe.height) / 2;
+		
+		if(s->vlevels)
+		{
+			uint64_t t = s->conf.stats ? monotonic_ns() : 0;
+			
+			/* An interlaced mode loads a new frame for each field */
+			if(s->conf.interlace)
+			{
+				_vid_prepare_levels(s, s->bline == 1 ? 0 : 1, 2);
+			}
+			else
+			{
+				_vid_prepare_levels(s, 0, 1);
+			}
+			
+			if(s->conf.stats)
+			{
+				/* Counted as part of the raster's time */
+				s->processes[_vid_find_process(s, "raster")].stat.ns += monotonic_ns() - t;
+			}
+		}
+	}
+	
+	if(s->direct)
+	{
+		_vid_point_lines(s);
+	}
+	
+	if(s->conf.stats)
+	{
+		/* The same loop, timing each process */
+		for(i = 0; i < s->nprocesses; i++)
+		{
+			_lineprocess_t *p = &s->processes[i];
+			
+			if(p->process && !p->bypass)
+			{
+				uint64_t t = monotonic_ns();
+				
+				p->process(p->vid, p->arg, p->nlines, p->lines);
+				
+				p->stat.ns += monotonic_ns() - t;
+				p->stat.calls++;
+			}
+			
+			for(j = 0; j < p->nlines; j++)
+			{
+				p->lines[j] = p->lines[j]->next;
+			}
+		}
+	}
+	else
+	{
+		for(i = 0; i < s->nprocesses; i++)
+		{
+			_lineprocess_t *p = &s->processes[i];
+			
+			if(p->process && !p->bypass)
+			{
+				p->process(p->vid, p->arg, p->nlines, p->lines);
+			}
+			
+			for(j = 0; j < p->nlines; j++)
+			{
+				p->lines[j] = p->lines[j]->next;
+			}
+		}
+	}
+	
+	/* The output line is finished. If it was written into the
+	 * caller's buffer in the right place it needn't be copied */
+	s->direct_written = (s->direct && l->output == s->direct);
+	_vid_unpoint_line(s, l, !s->direct_written);
+	
+	/* Advance the next line/frame counter */
+	if(s->bline++ == s->conf.lines)
+	{
+		s->bline = 1;
+		s->bframe++;
+	}
+	
+	/* Return a pointer to the output buffer */
+	if(samples)
+	{
+		*samples = l->width;
+	}
+	
+	if(s->conf.degrade)
+	{
+		s->render_ns += monotonic_ns() - start;
+	}
+	
+	return(l);
+}
+
+static vid_line_t *_vid_next_output_line(vid_t *s, size_t *samples)
+{
+	vid_line_t *l;
+	
+	/* Drop any delay lines introduced by scramblers / filters */
+	do
+	{
+		l = _vid_next_line(s, samples);
+		if(l == NULL) return(NULL);
+	}
+	while(l->line < 1);
+	
+	s->frame = l->frame;
+	s->line  = l->line;
+	
+	return(l);
+}
+
+int16_t *vid_next_line(vid_t *s, size_t *samples)
+{
+	vid_line_t *l;
+	
+	/* Discard any line partially returned by vid_render() */
+	s->rline = NULL;
+	s->direct = NULL;
+	
+	l = _vid_next_output_line(s, samples);
+	
+	return(l ? l->output : NULL);
+}
+
+size_t vid_render(vid_t *s, int16_t *iq, size_t samples)
+{
+	size_t n, c;
+	
+	/* Render up to 'samples' complex samples into the caller's buffer.
+	 * Where whole lines fit the line processes write them there
+	 * directly. A line which doesn't fit is rendered into the line
+	 * ring, copied out from there and continued on the next call.
+	 * Returns the number of samples written, which is only less
+	 * than requested at the end of the source. */
+	for(n = 0; n < samples; n += c)
+	{
+		if(s->rline == NULL)
+		{
+			s->direct = &iq[n * 2];
+			s->direct_room = samples - n;
+			s->rline = _vid_next_output_line(s, NULL);
+			s->rline_offset = 0;
+			
+			if(s->rline == NULL) break;
+			
+			if(s->direct_written)
+			{
+				c = s->rline->width;
+				s->rline = NULL;
+				continue;
+			}
+		}
+		
+		c = s->rline->width - s->rline_offset;
+		if(c > samples - n) c = samples - n;
+		
+		memcpy(&iq[n * 2], &s->rline->output[s->rline_offset * 2], sizeof(int16_t) * 2 * c);
+		
+		s->rline_offset += c;
+		
+		if(s->rline_offset == s->rline->width)
+		{
+			s->rline = NULL;
+		}
+	}
+	
+	/* Lines placed ahead in the buffer go back into the ring */
+	s->direct = NULL;
+	_vid_unpoint_lines(s);
 	
-	return(l->output);
+	return(n);
 }
 
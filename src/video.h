@@ -20,8 +20,10 @@
 
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "av.h"
+#include "arena.h"
 #include "nicam728.h"
 #include "dance.h"
 #include "fir.h"
@@ -47,9 +49,11 @@ typedef struct vid_t vid_t;
 #include "vits.h"
 #include "graphics.h"
 #include "vitc.h"
+#include "tbc.h"
 #include "vbidata.h"
 
 #include "av_test.h"
+#include "av_image.h"
 #include "av_ffmpeg.h"
 
 /* Return codes */
@@ -133,7 +137,7 @@ typedef struct {
 
 
 
-typedef struct {
+typedef struct vid_config_t {
 	
 	/* Output type */
 	int output_type;
@@ -164,6 +168,9 @@ typedef struct {
 	int16_t raw_bb_blanking_level;
 	int16_t raw_bb_white_level;
 	
+	/* Baseband TBC output */
+	char *tbc_file;
+	
 	/* Signal offset and passthru */
 	int64_t offset;
 	char *passthru;
@@ -209,6 +216,10 @@ typedef struct {
 	char *logo;
 	time_t timestamp;
 	int position;
+	
+	/* A non-zero seed or time makes the output repeatable */
+	unsigned int seed;
+	time_t fixed_time;
 	char *mode;
 	
 	char *wss;
@@ -304,6 +315,29 @@ typedef struct {
 	/* Video filter enable flag */
 	int vfilter;
 	
+	/* Back large tables with huge pages */
+	int hugepages;
+	
+	/* Collect timing counters */
+	int stats;
+	
+	/* Shed optional work when close to missing real-time */
+	int degrade;
+	
+	/* Number of slices ffmpeg video is scaled in, 0 for one per thread */
+	int scale_slices;
+	
+	/* Frames buffered between the ffmpeg threads, 0 for the default */
+	int buffer_frames;
+	
+	/* Keep buffering to a minimum, for live inputs */
+	int low_latency;
+	
+	/* Seconds each still image is shown for, and spent
+	 * crossfading into the next at the end of it */
+	float image_dwell;
+	float image_crossfade;
+	
 } vid_config_t;
 
 typedef struct {
@@ -324,6 +358,10 @@ struct vid_line_t {
 	int16_t *output;
 	int width;
 	
+	/* The line's own buffer, while output points into
+	 * the buffer passed to vid_render() */
+	int16_t *ring;
+	
 	/* Frame and line number */
 	int frame;
 	int line;
@@ -339,6 +377,12 @@ struct vid_line_t {
 	vid_line_t *next;
 };
 
+/* Timing counters, updated when stats are enabled */
+typedef struct {
+	uint64_t calls;
+	uint64_t ns;
+} vid_stat_t;
+
 /* Line process function prototypes */
 typedef int (*vid_lineprocess_process_t)(vid_t *s, void *arg, int nlines, vid_line_t **lines);
 typedef void (*vid_lineprocess_free_t)(vid_t *s, void *arg);
@@ -360,14 +404,39 @@ struct _lineprocess_t {
 	/* Callback parameters */
 	vid_t *vid;
 	void *arg;
+	
+	/* Time spent in the process callback */
+	vid_stat_t stat;
+	
+	/* Skip the callback, leaving the lines unmodified */
+	int bypass;
 };
 
+/* A line process change waiting for the next frame boundary */
+typedef struct {
+	
+	/* Non-zero to insert the process, zero to remove it */
+	int insert;
+	
+	char name[16];
+	char before[16];
+	int nlines;
+	
+	void *arg;
+	vid_lineprocess_process_t process;
+	vid_lineprocess_free_t free;
+	
+} _lineprocess_change_t;
+
 struct vid_t {
 	/* AV source */
 	av_t av;
 	
 	/* Signal configuration */
 	vid_config_t conf;
+	
+	/* Allocator for tables kept for the life of the encoder */
+	arena_t arena;
 	int sample_rate;
 	
 	/* Video setup */
@@ -387,6 +456,43 @@ struct vid_t {
 	
 	_yiq16_t *yiq_level_lookup;
 	
+	/* Y'CbCr > signal level lookup, built for the matrix
+	 * and range of the current AV_FRAME_YUV frames. The
+	 * table for a new matrix or range is built into
+	 * yuv_lut_next by yuv_lut_thread, and swapped in by
+	 * the render thread once yuv_lut_state is ready */
+	_yiq16_t *yuv_level_lookup;
+	av_matrix_t yuv_matrix;
+	int yuv_full_range;
+	int yuv_lut_ok;
+	
+	_yiq16_t *yuv_lut_next;
+	av_matrix_t yuv_next_matrix;
+	int yuv_next_full_range;
+	pthread_t yuv_lut_thread;
+	int yuv_lut_state;
+	
+	/* Y'CbCr > R'G'B' coefficients used until the table is ready */
+	int yuv_coeffs[6];
+	
+	/* The video level and gamma table used to build the lookups */
+	double level;
+	double glut[0x100];
+	
+	/* Signal levels of one active line, for frames with no
+	 * prepared levels */
+	_yiq16_t *vline;
+	
+	/* Signal levels of the active video for the current field,
+	 * looked up by the task pool when the frame is loaded */
+	_yiq16_t *vlevels;
+	int vlevels_first;
+	int vlevels_step;
+	
+	/* The fields of vlevels still valid while the source
+	 * returns unchanged frames, bit 0 from line 0, bit 1 from 1 */
+	int vlevels_valid;
+	
 	unsigned int colour_lookup_width;
 	unsigned int colour_lookup_offset;
 	cint16_t *colour_lookup;
@@ -422,6 +528,12 @@ struct vid_t {
 	
 	/* Raw baseband video file */
 	FILE *raw_bb_file;
+	const int16_t *raw_bb_map;
+	size_t raw_bb_map_len;
+	size_t raw_bb_pos;
+	int16_t *raw_bb_line;
+	int32_t raw_bb_gain;
+	int raw_bb_shift;
 	
 	/* Teletext state */
 	tt_t tt;
@@ -444,6 +556,9 @@ struct vid_t {
 	
 	/* VITC state */
 	vitc_t vitc;
+	
+	/* Baseband TBC output state */
+	tbc_t tbc;
 
 	/* Font state */
 	av_font_t *av_font;
@@ -454,6 +569,9 @@ struct vid_t {
 	size_t audiobuffer_samples;
 	int interp;
 	
+	/* Volume set at runtime, 4096 for unity */
+	int audio_gain;
+	
 	/* FM Mono/Stereo audio state */
 	_mod_fm_t fm_mono;
 	_mod_fm_t fm_left;
@@ -483,6 +601,11 @@ struct vid_t {
 	/* Offset signal */
 	_mod_offset_t offset;
 	
+	/* Output level set at runtime, 4096 for unity. The gain
+	 * process is only in the pipeline while it isn't unity */
+	int output_gain;
+	int output_gain_process;
+	
 	/* Passthru source */
 	FILE *passthru;
 	int16_t *passline;
@@ -490,15 +613,56 @@ struct vid_t {
 	/* D/D2-MAC specific data */
 	mac_t mac;
 	
+	/* Line partially returned by vid_render() */
+	vid_line_t *rline;
+	int rline_offset;
+	
+	/* Where vid_render() wants the next line and the space
+	 * left there, and if the line was written there */
+	int16_t *direct;
+	size_t direct_room;
+	int direct_written;
+	
 	/* Output line(s) buffer */
 	int olines;
 	vid_line_t *oline;
 	int max_width;
 	
+	/* Lines added to the ring after vid_init() */
+	int nxlines;
+	vid_line_t **xlines;
+	
 	/* Line processes */
 	int nprocesses;
 	_lineprocess_t *processes;
 	_lineprocess_t *output_process;
+	
+	/* Time spent reading from the AV source */
+	vid_stat_t av_video_stat;
+	vid_stat_t av_audio_stat;
+	
+	/* Line process changes waiting for the next frame */
+	pthread_mutex_t changes_mutex;
+	int nchanges;
+	_lineprocess_change_t *changes;
+	
+	/* Optional features in use, and those waiting to be released.
+	 * Both are protected by changes_mutex */
+	int features;
+	int features_releasing;
+	
+	/* Holding a reference to the task pool */
+	int pool;
+	
+	/* Real-time headroom monitor */
+	uint64_t frame_ns;
+	uint64_t render_ns;
+	uint64_t source_ns;
+	double load;
+	int degrade_level;
+	int degrade_hold;
+	int degrade_measure;
+	double degrade_ratio[3];
 };
 
 extern const vid_configs_t vid_configs[];
@@ -507,8 +671,18 @@ extern int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate,
 extern void vid_free(vid_t *s);
 extern int vid_av_close(vid_t *s);
 extern void vid_info(vid_t *s);
+extern void vid_memstats(vid_t *s);
+extern void vid_av_init(vid_t *s, av_fit_mode_t fit_mode, rational_t min_aspect, rational_t max_aspect);
 extern size_t vid_get_framebuffer_length(vid_t *s);
 extern int16_t *vid_next_line(vid_t *s, size_t *samples);
+extern size_t vid_render(vid_t *s, int16_t *iq, size_t samples);
+extern int vid_insert_lineprocess(vid_t *s, const char *before, const char *name, int nlines, void *arg, vid_lineprocess_process_t pprocess, vid_lineprocess_free_t pfree);
+extern int vid_remove_lineprocess(vid_t *s, const char *name);
+extern int vid_enable_feature(vid_t *s, const char *name, const char *arg);
+extern int vid_disable_feature(vid_t *s, const char *name);
+extern int vid_add_teletext_pages(vid_t *s, tt_service_t *pages);
+extern int vid_set_level(vid_t *s, double level);
+extern void vid_set_volume(vid_t *s, double volume);
 
 #endif
 
@@ -213,8 +213,6 @@ int vc_init(vc_t *s, vid_t *vid, const char *mode, const char *mode2)
 {
 	double f, l;
 	int i, x;
-	time_t t;
-	srand((unsigned) time(&t));
 	
 	memset(s, 0, sizeof(vc_t));
 	
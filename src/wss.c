@@ -75,8 +75,8 @@ int wss_init(wss_t *s, vid_t *vid, char *mode)
 		if(strcasecmp(mode, _wss_modes[o].id) == 0)
 		{
 			s->code = _wss_modes[o].code;
-			vid->conf.frame_aspects[0] = _wss_modes[o].aspect[0];
-			vid->conf.frame_aspects[1] = _wss_modes[o].aspect[1];
+			s->aspect[0] = _wss_modes[o].aspect[0];
+			s->aspect[1] = _wss_modes[o].aspect[1];
 			break;
 		}
 	}
@@ -25,6 +25,7 @@
 typedef struct {
 	vid_t *vid;
 	rational_t auto_threshold;
+	rational_t aspect[2];
 	uint8_t code;
 	vbidata_lut_t *lut;
 	uint8_t vbi[18];